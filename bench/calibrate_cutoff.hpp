@@ -0,0 +1,177 @@
+#ifndef CALIBRATE_CUTOFF_H_
+#define CALIBRATE_CUTOFF_H_
+
+#include <assert.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "surf.hpp"
+
+namespace bench {
+
+// ns per lookupKey of keys, the best of a few timed runs
+static double timeLookups(const surf::SuRF& filter, const std::vector<std::string>& keys) {
+    static const unsigned kNumRuns = 5;
+    static const uint64_t kNumLookupsPerRun = 1 << 18;
+    std::mt19937_64 rng(2018);
+    std::vector<const std::string*> probes;
+    for (uint64_t i = 0; i < kNumLookupsPerRun; i++)
+	probes.push_back(&keys[rng() % keys.size()]);
+    double best_ns = 0;
+    uint64_t num_found = 0;
+    for (unsigned r = 0; r < kNumRuns; r++) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < kNumLookupsPerRun; i++)
+	    num_found += filter.lookupKey(*probes[i]);
+	std::chrono::duration<double, std::nano> elapsed
+	    = std::chrono::steady_clock::now() - start;
+	double ns = elapsed.count() / kNumLookupsPerRun;
+	if ((r == 0) || (ns < best_ns))
+	    best_ns = ns;
+    }
+    assert(num_found == kNumRuns * kNumLookupsPerRun);
+    (void)num_found;
+    return best_ns;
+}
+
+// Measures the per-level costs of surf::CutoffCostModel on this
+// machine from stored-key lookups: the in-cache costs in small filters
+// over keys of two fan-outs, each built with all levels dense and with
+// all but the root sparse, then the miss costs in two layouts of a
+// filter over 3M random ints. Takes a few seconds; memory_budget is
+// left at 0.
+surf::CutoffCostModel calibrateCutoffCosts() {
+    static const unsigned kNumKeySets = 2;
+    static const unsigned kFanouts[kNumKeySets] = {4, 64};
+    static const surf::level_t kKeyLens[kNumKeySets] = {8, 3};
+    static const uint64_t kNumSmallKeys = 4096;
+    static const uint64_t kNumLargeKeys = 3 << 20;
+    static const surf::level_t kLargeDenseLevels = 3;
+
+    surf::CutoffCostModel model;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    long cache_bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (cache_bytes > 0)
+	model.cache_bytes = cache_bytes;
+#endif
+    // Under a model with a single cost of 1, modeledLookupCost gives
+    // the coefficient of that cost; a model that makes one layout free
+    // builds it on every level it may.
+    surf::CutoffCostModel zero = model;
+    zero.dense_level_ns = 0;
+    zero.sparse_level_ns = 0;
+    zero.sparse_label_ns = 0;
+    zero.dense_miss_ns = 0;
+    zero.sparse_miss_ns = 0;
+    surf::CutoffCostModel free_dense = zero; // all levels dense
+    free_dense.sparse_level_ns = 1;
+    surf::CutoffCostModel free_sparse = zero; // all levels but the root sparse
+    free_sparse.dense_level_ns = 1;
+
+    // In cache: small filters over keys of two fan-outs. A lookup takes
+    // overhead + c_dense * dense_level_ns if all levels are dense and
+    // overhead + dense_level_ns + c_sparse * sparse_level_ns
+    // + c_label * sparse_label_ns if all but the root are sparse.
+    std::mt19937_64 rng(2018);
+    double dense_time[kNumKeySets], sparse_time[kNumKeySets];
+    double c_dense[kNumKeySets], c_sparse[kNumKeySets], c_label[kNumKeySets];
+    for (unsigned k = 0; k < kNumKeySets; k++) {
+	std::vector<std::string> keys;
+	for (uint64_t i = 0; i < kNumSmallKeys; i++) {
+	    std::string key;
+	    for (surf::level_t j = 0; j < kKeyLens[k]; j++)
+		key.push_back((char)('A' + rng() % kFanouts[k]));
+	    keys.push_back(key);
+	}
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+	surf::SuRFBuilder dense_builder(true, surf::kSparseDenseRatio, surf::kNone, 0, 0);
+	dense_builder.setCutoffCostModel(free_dense);
+	dense_builder.build(keys);
+	c_dense[k] = dense_builder.modeledLookupCost(dense_builder.getSparseStartLevel(),
+						     free_sparse);
+	surf::SuRF dense_filter(&dense_builder);
+	dense_time[k] = timeLookups(dense_filter, keys);
+	dense_filter.destroy();
+
+	surf::SuRFBuilder sparse_builder(true, surf::kSparseDenseRatio, surf::kNone, 0, 0);
+	sparse_builder.setCutoffCostModel(free_sparse);
+	sparse_builder.build(keys);
+	c_sparse[k] = sparse_builder.modeledLookupCost(1, free_dense);
+	surf::CutoffCostModel label = zero;
+	label.sparse_label_ns = 1;
+	c_label[k] = sparse_builder.modeledLookupCost(1, label);
+	surf::SuRF sparse_filter(&sparse_builder);
+	sparse_time[k] = timeLookups(sparse_filter, keys);
+	sparse_filter.destroy();
+    }
+    if (c_dense[0] == c_dense[1])
+	return model;
+    double dense_level_ns = (dense_time[0] - dense_time[1]) / (c_dense[0] - c_dense[1]);
+    double overhead = dense_time[0] - c_dense[0] * dense_level_ns;
+    double rhs[2];
+    for (unsigned k = 0; k < kNumKeySets; k++)
+	rhs[k] = sparse_time[k] - overhead - dense_level_ns;
+    double det = c_sparse[0] * c_label[1] - c_sparse[1] * c_label[0];
+    if (det == 0)
+	return model;
+    model.dense_level_ns = std::max(0.0, dense_level_ns);
+    model.sparse_level_ns = std::max(0.0, (rhs[0] * c_label[1] - rhs[1] * c_label[0]) / det);
+    model.sparse_label_ns = std::max(0.0, (c_sparse[0] * rhs[1] - c_sparse[1] * rhs[0]) / det);
+
+    // Out of cache: random 8-byte keys, far more than fit, with only
+    // the root dense and with kLargeDenseLevels dense levels. What the
+    // in-cache costs leave of the lookup time is put down to misses.
+    std::vector<uint64_t> int_keys;
+    for (uint64_t i = 0; i < kNumLargeKeys; i++)
+	int_keys.push_back(rng());
+    std::sort(int_keys.begin(), int_keys.end());
+    int_keys.erase(std::unique(int_keys.begin(), int_keys.end()), int_keys.end());
+    std::vector<std::string> keys;
+    for (uint64_t i = 0; i < int_keys.size(); i++)
+	keys.push_back(surf::uint64ToString(int_keys[i]));
+    std::vector<uint64_t>().swap(int_keys);
+
+    surf::CutoffCostModel in_cache = model;
+    in_cache.dense_miss_ns = 0;
+    in_cache.sparse_miss_ns = 0;
+    surf::CutoffCostModel dense_miss = zero;
+    dense_miss.dense_miss_ns = 1;
+    surf::CutoffCostModel sparse_miss = zero;
+    sparse_miss.sparse_miss_ns = 1;
+    double c_dense_miss[2], c_sparse_miss[2];
+    uint64_t budget = 0;
+    for (int i = 0; i < 2; i++) {
+	// free dense levels under a budget: as many as fit in it
+	surf::CutoffCostModel layout = (i == 0) ? free_sparse : free_dense;
+	layout.memory_budget = budget;
+	surf::SuRFBuilder builder(true, surf::kSparseDenseRatio, surf::kNone, 0, 0);
+	builder.setCutoffCostModel(layout);
+	builder.build(keys);
+	surf::level_t start_level = builder.getSparseStartLevel();
+	if (i == 0)
+	    budget = builder.modeledMemory(kLargeDenseLevels);
+	c_dense_miss[i] = builder.modeledLookupCost(start_level, dense_miss);
+	c_sparse_miss[i] = builder.modeledLookupCost(start_level, sparse_miss);
+	double in_cache_time = overhead + builder.modeledLookupCost(start_level, in_cache);
+	surf::SuRF filter(&builder);
+	rhs[i] = timeLookups(filter, keys) - in_cache_time;
+	filter.destroy();
+    }
+    det = c_dense_miss[0] * c_sparse_miss[1] - c_dense_miss[1] * c_sparse_miss[0];
+    if (det == 0)
+	return model;
+    model.dense_miss_ns = std::max(0.0, (rhs[0] * c_sparse_miss[1] - rhs[1] * c_sparse_miss[0]) / det);
+    model.sparse_miss_ns = std::max(0.0, (c_dense_miss[0] * rhs[1] - c_dense_miss[1] * rhs[0]) / det);
+    return model;
+}
+
+} // namespace bench
+
+#endif // CALIBRATE_CUTOFF_H_
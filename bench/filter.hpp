@@ -9,6 +9,10 @@ namespace bench {
 class Filter {
 public:
     virtual bool lookup(const std::string& key) = 0;
+    virtual void lookupBatch(const std::string* keys, const size_t n, bool* out) {
+	for (size_t i = 0; i < n; i++)
+	    out[i] = lookup(keys[i]);
+    }
     virtual bool lookupRange(const std::string& left_key, const std::string& right_key) = 0;
     virtual uint64_t getMemoryUsage() = 0;
 };
@@ -9,9 +9,12 @@ namespace bench {
 
 class FilterFactory {
 public:
+    // SuRFAuto takes suffix_len as its bits-per-key budget and tunes
+    // its suffixes for point_fraction point queries
     static Filter* createFilter(const std::string& filter_type,
 				const uint32_t suffix_len,
-				const std::vector<std::string>& keys) {
+				const std::vector<std::string>& keys,
+				const double point_fraction = 1.0) {
 	if (filter_type.compare(std::string("SuRF")) == 0)
 	    return new FilterSuRF(keys, surf::kNone, 0, 0);
 	else if (filter_type.compare(std::string("SuRFHash")) == 0)
@@ -20,7 +23,12 @@ public:
 	    return new FilterSuRF(keys, surf::kReal, 0, suffix_len);
         else if (filter_type.compare(std::string("SuRFMixed")) == 0)
 	    return new FilterSuRF(keys, surf::kMixed, suffix_len, suffix_len);
-	else if (filter_type.compare(std::string("Bloom")) == 0)
+	else if (filter_type.compare(std::string("SuRFAuto")) == 0) {
+	    surf::SuffixBudget budget;
+	    budget.bits_per_key = suffix_len;
+	    budget.point_fraction = point_fraction;
+	    return new FilterSuRF(keys, budget);
+	} else if (filter_type.compare(std::string("Bloom")) == 0)
 	    return new FilterBloom(keys);
 	else
 	    return new FilterSuRF(keys, surf::kReal, 0, suffix_len); // default
@@ -19,6 +19,12 @@ public:
 				 suffix_type, hash_suffix_len, real_suffix_len);
     }
 
+    // Suffixes picked by surf::SuRF::chooseSuffixes within budget
+    FilterSuRF(const std::vector<std::string>& keys, const surf::SuffixBudget& budget) {
+	filter_ = new surf::SuRF();
+	filter_->create(keys, surf::SuRF::chooseSuffixes(keys, budget));
+    }
+
     ~FilterSuRF() {
 	filter_->destroy();
 	delete filter_;
@@ -28,6 +34,10 @@ public:
 	return filter_->lookupKey(key);
     }
 
+    void lookupBatch(const std::string* keys, const size_t n, bool* out) {
+	filter_->lookupKeys(keys, n, out);
+    }
+
     bool lookupRange(const std::string& left_key, const std::string& right_key) {
 	//return filter_->lookupRange(left_key, false, right_key, false);
 	return filter_->lookupRange(left_key, true, right_key, true);
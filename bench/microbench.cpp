@@ -0,0 +1,621 @@
+#include "bench.hpp"
+#include "calibrate_cutoff.hpp"
+
+#include "surf.hpp"
+#include "surf_int64.hpp"
+
+// Micro benchmarks of the succinct building blocks and of SuRF lookups
+// built on top of them. Random int keys are generated in memory, so no
+// workload files are needed.
+
+static const uint64_t kNumProbes = 10000000;
+
+static void printResult(const std::string& name, const double seconds,
+			const uint64_t num_ops, const uint64_t checksum) {
+    std::cout << bench::kGreen << name << " = " << bench::kNoColor
+	      << (seconds * 1000000000.0 / num_ops) << " ns/op"
+	      << " (checksum " << checksum << ")\n";
+}
+
+// A single level of num_bits random bits
+static void genBits(const uint64_t num_bits, std::mt19937_64& rng, surf::LevelBits& bits) {
+    bits.addLevel();
+    for (uint64_t i = 0; i < num_bits / surf::kWordSize; i++)
+	bits.append(0, rng(), surf::kWordSize);
+    bits.append(0, rng(), num_bits % surf::kWordSize);
+}
+
+static void benchRank(const uint64_t num_bits) {
+    std::mt19937_64 rng(2018);
+    surf::LevelBits bits;
+    genBits(num_bits, rng, bits);
+
+    std::vector<surf::position_t> probes;
+    for (uint64_t i = 0; i < kNumProbes; i++)
+	probes.push_back(rng() % num_bits);
+
+    const surf::RankType types[] = {surf::kRankBasic, surf::kRankTwoLevel};
+    const char* names[] = {"rank basic (512-bit blocks)", "rank two-level"};
+    for (int t = 0; t < 2; t++) {
+	surf::BitvectorRank bv(512, bits, 0, 1, types[t]);
+	uint64_t checksum = 0;
+	double start = bench::getNow();
+	for (uint64_t i = 0; i < kNumProbes; i++)
+	    checksum += bv.rank(probes[i]);
+	double end = bench::getNow();
+	printResult(std::string(names[t]) + ", lut " + std::to_string(bv.rankLutSize()) + "B",
+		    end - start, kNumProbes, checksum);
+	bv.destroy();
+    }
+}
+
+static void benchSelect(const uint64_t num_bits) {
+    // LOUDS bits: one 1 bit per node, about half of the bits are set
+    std::mt19937_64 rng(2018);
+    surf::LevelBits bits;
+    genBits(num_bits, rng, bits);
+    bits.setBit(0, 0);
+
+    const surf::position_t intervals[] = {64, 32, 16};
+    for (int t = 0; t < 3; t++) {
+	surf::BitvectorSelect bv(intervals[t], bits, 0, 1);
+	std::vector<surf::position_t> probes;
+	for (uint64_t i = 0; i < kNumProbes; i++)
+	    probes.push_back(rng() % bv.numOnes() + 1);
+	uint64_t checksum = 0;
+	double start = bench::getNow();
+	for (uint64_t i = 0; i < kNumProbes; i++)
+	    checksum += bv.select(probes[i]);
+	double end = bench::getNow();
+	printResult("select, sample interval " + std::to_string(intervals[t])
+		    + ", lut " + std::to_string(bv.selectLutSize()) + "B",
+		    end - start, kNumProbes, checksum);
+	bv.destroy();
+    }
+}
+
+typedef bool (surf::LabelVector::*LabelSearchFn)(const surf::label_t, surf::position_t&,
+						 const surf::position_t) const;
+
+// Nodes of node_size sorted distinct labels; probes are random
+// labels, so larger nodes hit more often.
+static void benchLabelSearch(const uint64_t num_labels, const surf::position_t node_size) {
+    std::mt19937_64 rng(2018);
+    surf::LevelLabels labels;
+    labels.addLevel();
+    std::vector<surf::label_t> all_labels;
+    for (int i = 0; i < 256; i++)
+	all_labels.push_back((surf::label_t)i);
+    uint64_t num_nodes = num_labels / node_size + 1;
+    for (uint64_t i = 0; i < num_nodes; i++) {
+	std::shuffle(all_labels.begin(), all_labels.end(), rng);
+	std::vector<surf::label_t> node(all_labels.begin(), all_labels.begin() + node_size);
+	std::sort(node.begin(), node.end());
+	for (surf::position_t j = 0; j < node_size; j++)
+	    labels.push(0, node[j]);
+    }
+    surf::LabelVector lv(labels, 0, 1);
+
+    std::vector<std::pair<surf::position_t, surf::label_t> > probes;
+    for (uint64_t i = 0; i < kNumProbes; i++)
+	probes.push_back(std::make_pair((surf::position_t)(rng() % num_nodes) * node_size,
+					(surf::label_t)rng()));
+
+    // the kernels are called directly, so each can be timed on every
+    // node size; the dispatch thresholds in LabelVector come from here
+    const char* names[] = {"linear", "sse2", "avx2", "avx512"};
+    const surf::LabelVector::SimdLevel levels[] = {surf::LabelVector::kSimdSse2,
+						   surf::LabelVector::kSimdSse2,
+						   surf::LabelVector::kSimdAvx2,
+						   surf::LabelVector::kSimdAvx512};
+    const LabelSearchFn search_fns[] = {&surf::LabelVector::linearSearch,
+					&surf::LabelVector::sse2Search,
+					&surf::LabelVector::avx2Search,
+					&surf::LabelVector::avx512Search};
+    const LabelSearchFn greater_fns[] = {&surf::LabelVector::linearSearchGreaterThan,
+					 &surf::LabelVector::sse2SearchGreaterThan,
+					 &surf::LabelVector::avx2SearchGreaterThan,
+					 &surf::LabelVector::avx512SearchGreaterThan};
+    for (int k = 0; k < 4; k++) {
+	if (levels[k] > surf::LabelVector::detectSimdLevel())
+	    continue;
+	for (int greater = 0; greater < 2; greater++) {
+	    LabelSearchFn fn = greater ? greater_fns[k] : search_fns[k];
+	    uint64_t checksum = 0;
+	    double start = bench::getNow();
+	    for (uint64_t i = 0; i < kNumProbes; i++) {
+		surf::position_t pos = probes[i].first;
+		if ((lv.*fn)(probes[i].second, pos, node_size))
+		    checksum += pos;
+	    }
+	    double end = bench::getNow();
+	    printResult(std::string(greater ? "searchGreaterThan " : "search ") + names[k]
+			+ ", node size " + std::to_string(node_size),
+			end - start, kNumProbes, checksum);
+	}
+    }
+    lv.destroy();
+}
+
+static void benchLabelSearch(const uint64_t num_labels) {
+    const surf::position_t node_sizes[] = {1, 2, 3, 4, 6, 8, 12, 16, 17, 24, 31, 32, 48, 64,
+					   96, 128, 160, 192, 256};
+    for (int i = 0; i < 19; i++)
+	benchLabelSearch(num_labels, node_sizes[i]);
+}
+
+// Key lengths vary in [key_len / 2, key_len * 3 / 2]; the keys fit in
+// cache, so this measures hashing rather than key fetches.
+static void benchSuffixHash(const uint64_t key_len) {
+    std::mt19937_64 rng(2018);
+    std::vector<std::string> keys;
+    for (uint64_t i = 0; i < 4096; i++) {
+	std::string key;
+	uint64_t len = key_len / 2 + rng() % (key_len + 1);
+	for (uint64_t j = 0; j < len; j++)
+	    key.push_back((char)('a' + rng() % 26));
+	keys.push_back(key);
+    }
+    std::vector<surf::Slice> key_slices(keys.begin(), keys.end());
+    surf::word_t hashes[surf::kLookupBatchSize];
+    uint64_t num_rounds = kNumProbes / keys.size();
+    uint64_t checksum = 0;
+    double start = bench::getNow();
+    for (uint64_t r = 0; r < num_rounds; r++)
+	for (uint64_t i = 0; i < keys.size(); i++)
+	    checksum += surf::suffixHash(keys[i]);
+    double end = bench::getNow();
+    printResult("suffixHash, key length " + std::to_string(key_len),
+		end - start, num_rounds * keys.size(), checksum);
+
+    checksum = 0;
+    start = bench::getNow();
+    for (uint64_t r = 0; r < num_rounds; r++) {
+	for (uint64_t i = 0; i < keys.size(); i += surf::kLookupBatchSize) {
+	    surf::suffixHashes(key_slices.data() + i, surf::kLookupBatchSize,
+			       surf::kSuffixHashLevelDB, hashes);
+	    for (uint64_t j = 0; j < surf::kLookupBatchSize; j++)
+		checksum += hashes[j];
+	}
+    }
+    end = bench::getNow();
+    printResult("suffixHashes, key length " + std::to_string(key_len),
+		end - start, num_rounds * keys.size(), checksum);
+
+    checksum = 0;
+    start = bench::getNow();
+    for (uint64_t r = 0; r < num_rounds; r++)
+	for (uint64_t i = 0; i < keys.size(); i++)
+	    checksum += surf::suffixHash(keys[i], surf::kSuffixHash64);
+    end = bench::getNow();
+    printResult("suffixHash 64-bit, key length " + std::to_string(key_len),
+		end - start, num_rounds * keys.size(), checksum);
+}
+
+// Sorted random int keys; half of the probes are stored keys
+static void genSuRFKeys(const uint64_t num_keys, std::vector<std::string>& keys,
+			std::vector<std::string>& probes) {
+    std::mt19937_64 rng(2018);
+    std::vector<uint64_t> int_keys;
+    for (uint64_t i = 0; i < num_keys; i++)
+	int_keys.push_back(rng());
+    std::sort(int_keys.begin(), int_keys.end());
+    int_keys.erase(std::unique(int_keys.begin(), int_keys.end()), int_keys.end());
+    for (uint64_t i = 0; i < int_keys.size(); i++)
+	keys.push_back(bench::uint64ToString(int_keys[i]));
+
+    for (uint64_t i = 0; i < kNumProbes; i++) {
+	if (i % 2 == 0)
+	    probes.push_back(keys[rng() % keys.size()]);
+	else
+	    probes.push_back(bench::uint64ToString(rng()));
+    }
+}
+
+static void benchSuRFLookup(const std::string& name, const std::vector<std::string>& keys,
+			    const std::vector<std::string>& probes,
+			    const surf::RankType rank_type,
+			    const surf::position_t select_sample_interval) {
+    surf::SuRF filter(keys, surf::kIncludeDense, surf::kSparseDenseRatio,
+		      surf::kReal, 0, 8, 1, rank_type, select_sample_interval);
+    uint64_t checksum = 0;
+    double start = bench::getNow();
+    for (uint64_t i = 0; i < probes.size(); i++)
+	checksum += filter.lookupKey(probes[i]);
+    double end = bench::getNow();
+    printResult("SuRF lookupKey, " + name + ", " + std::to_string(filter.getMemoryUsage()) + "B",
+		end - start, probes.size(), checksum);
+    filter.destroy();
+}
+
+static void benchSuRFRank(const uint64_t num_keys) {
+    std::vector<std::string> keys;
+    std::vector<std::string> probes;
+    genSuRFKeys(num_keys, keys, probes);
+    benchSuRFLookup("rank basic", keys, probes, surf::kRankBasic, surf::kSelectSampleInterval);
+    benchSuRFLookup("rank two-level", keys, probes, surf::kRankTwoLevel,
+		    surf::kSelectSampleInterval);
+}
+
+static void benchSuRFSelect(const uint64_t num_keys) {
+    std::vector<std::string> keys;
+    std::vector<std::string> probes;
+    genSuRFKeys(num_keys, keys, probes);
+    const surf::position_t intervals[] = {64, 32, 16};
+    for (int t = 0; t < 3; t++)
+	benchSuRFLookup("select sample interval " + std::to_string(intervals[t]),
+			keys, probes, surf::kRankBasic, intervals[t]);
+}
+
+// lookupRange vs. positioning an iterator at the left bound and comparing
+// its key to the right bound, for ranges of random width below 2^64 / width_div
+static void benchSuRFRange(const uint64_t num_keys) {
+    std::vector<std::string> keys;
+    std::vector<std::string> probes;
+    genSuRFKeys(num_keys, keys, probes);
+    surf::SuRF filter(keys, surf::kIncludeDense, surf::kSparseDenseRatio, surf::kReal, 0, 8);
+    std::mt19937_64 rng(2018);
+    const uint64_t width_divs[] = {num_keys / 16, num_keys * 4};
+    for (int w = 0; w < 2; w++) {
+	uint64_t max_width = ~0ULL / width_divs[w];
+	std::vector<std::string> left_keys;
+	std::vector<std::string> right_keys;
+	for (uint64_t i = 0; i < kNumProbes / 4; i++) {
+	    uint64_t left = rng();
+	    uint64_t width = rng() % max_width;
+	    uint64_t right = (left > ~0ULL - width) ? ~0ULL : left + width;
+	    left_keys.push_back(bench::uint64ToString(left));
+	    right_keys.push_back(bench::uint64ToString(right));
+	}
+	std::string name = "width < 2^64/" + std::to_string(width_divs[w]);
+
+	uint64_t checksum = 0;
+	surf::SuRF::Iter iter(&filter);
+	double start = bench::getNow();
+	for (uint64_t i = 0; i < left_keys.size(); i++) {
+	    iter = filter.moveToKeyGreaterThan(left_keys[i], true);
+	    if (iter.isValid()) {
+		int compare = iter.compare(right_keys[i]);
+		checksum += (compare == surf::kCouldBePositive) || (compare < 0);
+	    }
+	}
+	double end = bench::getNow();
+	printResult("SuRF iterator seek + compare, " + name, end - start, left_keys.size(), checksum);
+
+	checksum = 0;
+	start = bench::getNow();
+	for (uint64_t i = 0; i < left_keys.size(); i++)
+	    checksum += filter.lookupRange(left_keys[i], true, right_keys[i], false, iter);
+	end = bench::getNow();
+	printResult("SuRF lookupRange, " + name, end - start, left_keys.size(), checksum);
+    }
+    filter.destroy();
+}
+
+// lookupPrefix vs. lookupRange up to the prefix's successor (the
+// smallest string greater than every key with the prefix)
+static void benchSuRFPrefix(const uint64_t num_keys) {
+    std::vector<std::string> keys;
+    std::vector<std::string> probes;
+    genSuRFKeys(num_keys, keys, probes);
+    surf::SuRF filter(keys, surf::kIncludeDense, surf::kSparseDenseRatio, surf::kReal, 0, 8);
+    const size_t prefix_lens[] = {3, 5};
+    for (int l = 0; l < 2; l++) {
+	std::vector<std::string> prefixes;
+	std::vector<std::string> upper_bounds;
+	for (uint64_t i = 0; i < probes.size(); i++) {
+	    std::string prefix = probes[i].substr(0, prefix_lens[l]);
+	    std::string upper_bound = prefix;
+	    while (!upper_bound.empty() && ((uint8_t)upper_bound.back() == 0xFF))
+		upper_bound.pop_back();
+	    if (upper_bound.empty())
+		continue;
+	    upper_bound.back()++;
+	    prefixes.push_back(prefix);
+	    upper_bounds.push_back(upper_bound);
+	}
+	std::string name = "prefix length " + std::to_string(prefix_lens[l]);
+
+	uint64_t checksum = 0;
+	surf::SuRF::Iter iter(&filter);
+	double start = bench::getNow();
+	for (uint64_t i = 0; i < prefixes.size(); i++)
+	    checksum += filter.lookupRange(prefixes[i], true, upper_bounds[i], false, iter);
+	double end = bench::getNow();
+	printResult("SuRF lookupRange to successor, " + name, end - start, prefixes.size(), checksum);
+
+	checksum = 0;
+	start = bench::getNow();
+	for (uint64_t i = 0; i < prefixes.size(); i++)
+	    checksum += filter.lookupPrefix(prefixes[i]);
+	end = bench::getNow();
+	printResult("SuRF lookupPrefix, " + name, end - start, prefixes.size(), checksum);
+    }
+    filter.destroy();
+}
+
+// Sorted email-like keys: a name over a skewed alphabet at one of a few
+// domains, so that long shared prefixes are common
+static void genEmailKeys(const uint64_t num_keys, std::vector<std::string>& keys,
+			 std::vector<std::string>& probes) {
+    static const char* kDomains[] = {"gmail.com", "yahoo.com", "hotmail.com", "example.org"};
+    std::mt19937_64 rng(2018);
+    std::vector<std::string> emails;
+    for (uint64_t i = 0; i < num_keys + kNumProbes / 2; i++) {
+	std::string email = kDomains[rng() % 4];
+	email += "@";
+	uint64_t len = 4 + rng() % 12;
+	for (uint64_t j = 0; j < len; j++)
+	    email.push_back('a' + (rng() % 26) * (rng() % 26) / 26);
+	emails.push_back(email);
+    }
+    keys.assign(emails.begin(), emails.begin() + num_keys);
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    for (uint64_t i = 0; i < kNumProbes; i++) {
+	if (i % 2 == 0)
+	    probes.push_back(keys[rng() % keys.size()]);
+	else
+	    probes.push_back(emails[num_keys + i / 2]);
+    }
+}
+
+static void benchSuRFCutoff(const std::string& name, const std::vector<std::string>& keys,
+			    const std::vector<std::string>& probes,
+			    const surf::CutoffCostModel* model) {
+    surf::SuRFBuilder builder(surf::kIncludeDense, surf::kSparseDenseRatio, surf::kReal, 0, 8);
+    if (model != nullptr)
+	builder.setCutoffCostModel(*model);
+    builder.build(keys);
+    surf::SuRF filter(&builder);
+    // the layouts differ by little; the best of a few runs
+    uint64_t checksum = 0;
+    double best = 0;
+    for (int r = 0; r < 3; r++) {
+	checksum = 0;
+	double start = bench::getNow();
+	for (uint64_t i = 0; i < probes.size(); i++)
+	    checksum += filter.lookupKey(probes[i]);
+	double end = bench::getNow();
+	if ((r == 0) || (end - start < best))
+	    best = end - start;
+    }
+    printResult("SuRF lookupKey, " + name + ", sparse from level "
+		+ std::to_string(builder.getSparseStartLevel()) + " of "
+		+ std::to_string(builder.getTreeHeight()) + ", "
+		+ std::to_string(filter.getMemoryUsage()) + "B",
+		best, probes.size(), checksum);
+    filter.destroy();
+}
+
+// LOUDS-Sparse start level from the size ratio vs. from the calibrated
+// cost model, within once and twice the ratio's size and without a budget
+static void benchSuRFCutoff(const uint64_t num_keys) {
+    surf::CutoffCostModel model = bench::calibrateCutoffCosts();
+    std::cout << "calibrated: dense level " << model.dense_level_ns
+	      << " ns, sparse level " << model.sparse_level_ns
+	      << " ns, sparse label " << model.sparse_label_ns
+	      << " ns, dense miss " << model.dense_miss_ns
+	      << " ns, sparse miss " << model.sparse_miss_ns
+	      << " ns, cache " << model.cache_bytes << "B\n";
+    for (int k = 0; k < 2; k++) {
+	std::vector<std::string> keys;
+	std::vector<std::string> probes;
+	if (k == 0)
+	    genSuRFKeys(num_keys, keys, probes);
+	else
+	    genEmailKeys(num_keys, keys, probes);
+	std::string name = (k == 0) ? "ints" : "emails";
+	benchSuRFCutoff(name + ", size ratio", keys, probes, nullptr);
+	surf::SuRFBuilder ratio_builder(surf::kIncludeDense, surf::kSparseDenseRatio,
+					surf::kReal, 0, 8);
+	ratio_builder.build(keys);
+	uint64_t ratio_mem = ratio_builder.modeledMemory(ratio_builder.getSparseStartLevel());
+	for (int budget = 1; budget <= 2; budget++) {
+	    model.memory_budget = budget * ratio_mem;
+	    benchSuRFCutoff(name + ", cost model within " + std::to_string(budget)
+			    + "x the ratio's size", keys, probes, &model);
+	}
+	model.memory_budget = 0;
+	benchSuRFCutoff(name + ", cost model", keys, probes, &model);
+    }
+}
+
+// Suffixes picked by SuRF::chooseSuffixes for budgets a few bits per
+// key above the trie size and for three query mixes, with the predicted
+// false positive rate next to the measured one. The prediction counts
+// only negatives that reach a suffix check, so it bounds the measured
+// rate from above.
+static void benchSuRFBudget(const uint64_t num_keys) {
+    static const uint64_t kNumNegatives = 1000000;
+    static const int kNumExtraBits = 3;
+    static const double kExtraBits[kNumExtraBits] = {2, 6, 10};
+    static const int kNumMixes = 3;
+    static const double kPointFractions[kNumMixes] = {1.0, 0.5, 0.0};
+    for (int k = 0; k < 2; k++) {
+	std::vector<std::string> keys;
+	std::vector<std::string> probes;
+	if (k == 0)
+	    genSuRFKeys(num_keys, keys, probes);
+	else
+	    genEmailKeys(num_keys, keys, probes);
+	std::string name = (k == 0) ? "ints" : "emails";
+
+	// point negatives, and ranges [probe, probe with its last byte
+	// incremented) that hold no stored key
+	std::vector<std::string> negatives;
+	std::vector<std::string> right_keys;
+	for (uint64_t i = 1; (i < probes.size()) && (negatives.size() < kNumNegatives); i += 2) {
+	    std::string right_key = probes[i];
+	    if ((uint8_t)right_key.back() == 0xFF)
+		continue;
+	    right_key.back()++;
+	    std::vector<std::string>::const_iterator it
+		= std::lower_bound(keys.begin(), keys.end(), probes[i]);
+	    if ((it != keys.end()) && (*it < right_key))
+		continue;
+	    negatives.push_back(probes[i]);
+	    right_keys.push_back(right_key);
+	}
+
+	surf::SuffixBudget trie_budget;
+	trie_budget.bits_per_key = 0;
+	uint64_t trie_bytes = surf::SuRF::chooseSuffixes(keys, trie_budget).predicted_bytes;
+	std::cout << name << ": " << keys.size() << " keys, trie "
+		  << (trie_bytes * 8.0 / keys.size()) << " bits/key\n";
+	for (int b = 0; b < kNumExtraBits; b++) {
+	    for (int m = 0; m < kNumMixes; m++) {
+		surf::SuffixBudget budget;
+		// each LOUDS part pads its suffixes to whole words
+		budget.max_bytes = trie_bytes + (uint64_t)(kExtraBits[b] * keys.size() / 8) + 16;
+		budget.point_fraction = kPointFractions[m];
+		double start = bench::getNow();
+		surf::SuffixChoice choice = surf::SuRF::chooseSuffixes(keys, budget);
+		double end = bench::getNow();
+		surf::SuRF filter;
+		filter.create(keys, choice);
+		uint64_t num_point_fps = 0;
+		uint64_t num_range_fps = 0;
+		for (uint64_t i = 0; i < negatives.size(); i++) {
+		    num_point_fps += filter.lookupKey(negatives[i]);
+		    num_range_fps += filter.lookupRange(negatives[i], true, right_keys[i], false);
+		}
+		double fpr = budget.point_fraction * num_point_fps / negatives.size()
+		    + (1 - budget.point_fraction) * num_range_fps / negatives.size();
+		std::cout << bench::kGreen << name << ", trie + " << kExtraBits[b]
+			  << " bits/key, point fraction " << budget.point_fraction
+			  << " = " << bench::kNoColor
+			  << "hash " << choice.hash_suffix_len
+			  << " real " << choice.real_suffix_len
+			  << ", " << (filter.serializedSize() * 8.0 / keys.size()) << " bits/key"
+			  << ", fpr predicted " << choice.predicted_fpr
+			  << " measured " << fpr
+			  << " (chosen in " << (end - start) << " s)\n";
+		filter.destroy();
+	    }
+	}
+    }
+}
+
+static double timeSuRFLookups(const surf::SuRF& filter, const std::vector<std::string>& probes,
+			      uint64_t& checksum) {
+    double best = 0;
+    for (int r = 0; r < 3; r++) {
+	checksum = 0;
+	double start = bench::getNow();
+	for (uint64_t i = 0; i < probes.size(); i++)
+	    checksum += filter.lookupKey(probes[i]);
+	double end = bench::getNow();
+	if ((r == 0) || (end - start < best))
+	    best = end - start;
+    }
+    return best;
+}
+
+// lookupKey on the filter's heap arrays vs. after moveToHugePages,
+// which needs many keys to show: the filter must outgrow the TLB reach
+// of 4KB pages by far
+static void benchSuRFHugePages(const uint64_t num_keys) {
+    std::vector<std::string> keys;
+    std::vector<std::string> probes;
+    genSuRFKeys(num_keys, keys, probes);
+    surf::SuRF filter(keys, surf::kIncludeDense, surf::kSparseDenseRatio, surf::kReal, 0, 8);
+    std::string size = std::to_string(filter.serializedSize()) + "B";
+    uint64_t checksum = 0;
+    double seconds = timeSuRFLookups(filter, probes, checksum);
+    printResult("SuRF lookupKey, heap, " + size, seconds, probes.size(), checksum);
+
+    surf::HugePageOptions options;
+    options.use_hugetlb = true;
+    if (!filter.moveToHugePages(options)) {
+	std::cout << bench::kRed << "mmap failed\n" << bench::kNoColor;
+	filter.destroy();
+	return;
+    }
+    seconds = timeSuRFLookups(filter, probes, checksum);
+    printResult(std::string("SuRF lookupKey, ")
+		+ (filter.getHugePageRegion().isHugeTlb() ? "hugetlb" : "transparent huge pages")
+		+ ", " + size, seconds, probes.size(), checksum);
+    filter.destroy();
+}
+
+// SuRF over 8-byte big-endian strings vs. SuRFInt64 over the same ints
+static void benchSuRFInt64(const uint64_t num_keys) {
+    std::mt19937_64 rng(2018);
+    std::vector<uint64_t> keys;
+    for (uint64_t i = 0; i < num_keys; i++)
+	keys.push_back(rng());
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::vector<std::string> str_keys;
+    for (uint64_t i = 0; i < keys.size(); i++)
+	str_keys.push_back(bench::uint64ToString(keys[i]));
+    std::vector<uint64_t> probes;
+    for (uint64_t i = 0; i < kNumProbes; i++)
+	probes.push_back((i % 2 == 0) ? keys[rng() % keys.size()] : rng());
+
+    surf::SuRF filter(str_keys, surf::kIncludeDense, surf::kSparseDenseRatio, surf::kReal, 0, 8);
+    uint64_t checksum = 0;
+    double start = bench::getNow();
+    for (uint64_t i = 0; i < probes.size(); i++)
+	checksum += filter.lookupKey(bench::uint64ToString(probes[i]));
+    double end = bench::getNow();
+    printResult("SuRF lookupKey(uint64ToString)", end - start, probes.size(), checksum);
+    filter.destroy();
+
+    surf::SuRFInt64 filter_int(keys, surf::kReal, 0, 8);
+    checksum = 0;
+    start = bench::getNow();
+    for (uint64_t i = 0; i < probes.size(); i++)
+	checksum += filter_int.lookupKey(probes[i]);
+    end = bench::getNow();
+    printResult("SuRFInt64 lookupKey", end - start, probes.size(), checksum);
+    filter_int.destroy();
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+	std::cout << "Usage:\n";
+	std::cout << "1. benchmark: rank, select, label_search, suffix_hash, surf_rank, surf_select, surf_int64, surf_range, surf_prefix, surf_cutoff, surf_budget, surf_huge_pages\n";
+	std::cout << "2. size: number of bits (rank, select), labels (label_search), "
+		  << "key length (suffix_hash) or keys (surf_*)\n";
+	return -1;
+    }
+
+    std::string benchmark = argv[1];
+    uint64_t size = strtoull(argv[2], nullptr, 10);
+    if (size == 0 || size >= (1ULL << 32)) {
+	std::cout << bench::kRed << "WRONG size\n" << bench::kNoColor;
+	return -1;
+    }
+
+    if (benchmark.compare(std::string("rank")) == 0)
+	benchRank(size);
+    else if (benchmark.compare(std::string("select")) == 0)
+	benchSelect(size);
+    else if (benchmark.compare(std::string("label_search")) == 0)
+	benchLabelSearch(size);
+    else if (benchmark.compare(std::string("suffix_hash")) == 0)
+	benchSuffixHash(size);
+    else if (benchmark.compare(std::string("surf_rank")) == 0)
+	benchSuRFRank(size);
+    else if (benchmark.compare(std::string("surf_select")) == 0)
+	benchSuRFSelect(size);
+    else if (benchmark.compare(std::string("surf_int64")) == 0)
+	benchSuRFInt64(size);
+    else if (benchmark.compare(std::string("surf_range")) == 0)
+	benchSuRFRange(size);
+    else if (benchmark.compare(std::string("surf_prefix")) == 0)
+	benchSuRFPrefix(size);
+    else if (benchmark.compare(std::string("surf_cutoff")) == 0)
+	benchSuRFCutoff(size);
+    else if (benchmark.compare(std::string("surf_budget")) == 0)
+	benchSuRFBudget(size);
+    else if (benchmark.compare(std::string("surf_huge_pages")) == 0)
+	benchSuRFHugePages(size);
+    else {
+	std::cout << bench::kRed << "WRONG benchmark\n" << bench::kNoColor;
+	return -1;
+    }
+    return 0;
+}
@@ -4,13 +4,14 @@
 int main(int argc, char *argv[]) {
     if (argc != 9) {
 	std::cout << "Usage:\n";
-	std::cout << "1. filter type: SuRF, SuRFHash, SuRFReal, SuRFMixed, Bloom\n";
-	std::cout << "2. suffix length: 0 < len <= 64 (for SuRFHash and SuRFReal only)\n";
+	std::cout << "1. filter type: SuRF, SuRFHash, SuRFReal, SuRFMixed, SuRFAuto, Bloom\n";
+	std::cout << "2. suffix length: 0 < len <= 64 (for SuRFHash and SuRFReal only); "
+		  << "bits per key (for SuRFAuto)\n";
 	std::cout << "3. workload type: mixed, alterByte (only for email key)\n";
 	std::cout << "4. percentage of keys inserted: 0 < num <= 100\n";
 	std::cout << "5. byte position (conting from last, only for alterByte): num\n";
 	std::cout << "6. key type: randint, email\n";
-	std::cout << "7. query type: point, range, mix\n";
+	std::cout << "7. query type: point, range, mix, batch (batched point)\n";
 	std::cout << "8. distribution: uniform, zipfian, latest\n";
 	return -1;
     }
@@ -29,6 +30,7 @@ int main(int argc, char *argv[]) {
 	&& filter_type.compare(std::string("SuRFHash")) != 0
 	&& filter_type.compare(std::string("SuRFReal")) != 0
 	&& filter_type.compare(std::string("SuRFMixed")) != 0
+	&& filter_type.compare(std::string("SuRFAuto")) != 0
 	&& filter_type.compare(std::string("Bloom")) != 0
 	&& filter_type.compare(std::string("ARF")) != 0) {
 	std::cout << bench::kRed << "WRONG filter type\n" << bench::kNoColor;
@@ -60,7 +62,8 @@ int main(int argc, char *argv[]) {
 
     if (query_type.compare(std::string("point")) != 0
 	&& query_type.compare(std::string("range")) != 0
-	&& query_type.compare(std::string("mix")) != 0) {
+	&& query_type.compare(std::string("mix")) != 0
+	&& query_type.compare(std::string("batch")) != 0) {
 	std::cout << bench::kRed << "WRONG query type\n" << bench::kNoColor;
 	return -1;
     }
@@ -108,7 +111,13 @@ int main(int argc, char *argv[]) {
 
     // create filter ==============================================
     double time1 = bench::getNow();
-    bench::Filter* filter = bench::FilterFactory::createFilter(filter_type, suffix_len, insert_keys);
+    double point_fraction = 1.0;
+    if (query_type.compare(std::string("range")) == 0)
+	point_fraction = 0.0;
+    else if (query_type.compare(std::string("mix")) == 0)
+	point_fraction = 0.5;
+    bench::Filter* filter = bench::FilterFactory::createFilter(filter_type, suffix_len, insert_keys,
+							       point_fraction);
     double time2 = bench::getNow();
     std::cout << "Build time = " << (time2 - time1) << std::endl;
 
@@ -119,6 +128,15 @@ int main(int argc, char *argv[]) {
     if (query_type.compare(std::string("point")) == 0) {
 	for (int i = 0; i < (int)txn_keys.size(); i++)
 	    positives += (int)filter->lookup(txn_keys[i]);
+    } else if (query_type.compare(std::string("batch")) == 0) {
+	static const size_t kBatchSize = 128;
+	bool results[kBatchSize];
+	for (size_t i = 0; i < txn_keys.size(); i += kBatchSize) {
+	    size_t batch_size = std::min(kBatchSize, txn_keys.size() - i);
+	    filter->lookupBatch(txn_keys.data() + i, batch_size, results);
+	    for (size_t j = 0; j < batch_size; j++)
+		positives += (int)results[j];
+	}
     } else if (query_type.compare(std::string("range")) == 0) {
 	for (int i = 0; i < (int)txn_keys.size(); i++)
 	    if (key_type.compare(std::string("email")) == 0) {
@@ -153,7 +171,8 @@ int main(int argc, char *argv[]) {
 
     int64_t true_positives = 0;
     std::map<std::string, bool>::iterator ht_iter;
-    if (query_type.compare(std::string("point")) == 0) {
+    if ((query_type.compare(std::string("point")) == 0)
+	|| (query_type.compare(std::string("batch")) == 0)) {
 	for (int i = 0; i < (int)txn_keys.size(); i++) {
 	    ht_iter = ht.find(txn_keys[i]);
 	    true_positives += (ht_iter != ht.end());
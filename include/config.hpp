@@ -26,6 +26,21 @@ static const int kHashShift = 7;
 
 static const int kCouldBePositive = 2018; // used in suffix comparison
 
+// Outcome of walking the common prefix of a range's bounds
+// (see SuRF::probeRange)
+enum RangeProbe {
+    kRangeEmpty = 0, // no stored key has the common prefix
+    kRangeNonEmpty = 1, // a subtrie lies strictly between the bounds
+    kRangeUnknown = 2, // the full iterator search must decide
+    kRangeContinue = 3 // the walk goes on in louds-sparse
+};
+
+// Default number of 1 bits between two samples of a BitvectorSelect
+static const position_t kSelectSampleInterval = 64;
+
+// Number of keys whose trie walks are interleaved in a batched lookup
+static const position_t kLookupBatchSize = 32;
+
 enum SuffixType {
     kNone = 0,
     kHash = 1,
@@ -33,10 +48,36 @@ enum SuffixType {
     kMixed = 3
 };
 
+// Hash function behind kHash and kMixed suffixes (see hash.hpp)
+enum SuffixHashType {
+    kSuffixHashLevelDB = 0, // 32 bits, 4 key bytes per step
+    kSuffixHash64 = 1 // 64 bits, 16 key bytes per step
+};
+
+// Layout of the rank look-up table of a BitvectorRank (see rank.hpp)
+enum RankType {
+    kRankBasic = 0, // one count per basic block
+    kRankTwoLevel = 1 // rank9-style: block and sub-block counts in one table word
+};
+
 void align(char*& ptr) {
     ptr = (char*)(((uint64_t)ptr + 7) & ~((uint64_t)7));
 }
 
+void align(const char*& ptr) {
+    ptr = (const char*)(((uint64_t)ptr + 7) & ~((uint64_t)7));
+}
+
+bool isAligned(const char* ptr) {
+    return (((uint64_t)ptr & (uint64_t)7) == 0);
+}
+
+// Returns true if size bytes starting at src end no later than end.
+// A null end means that the buffer length is unknown (not checked).
+bool fitsInBuffer(const char* src, const char* end, const uint64_t size) {
+    return (end == nullptr) || ((src <= end) && (size <= (uint64_t)(end - src)));
+}
+
 void sizeAlign(position_t& size) {
     size = (size + 7) & ~((position_t)7);
 }
@@ -56,6 +97,39 @@ uint64_t stringToUint64(const std::string& str_word) {
     return __builtin_bswap64(int_word);
 }
 
+// CPU features that kernels dispatch on at run time
+struct CpuFeatures {
+    bool has_avx2;
+    bool has_avx512bw;
+    // BMI2, except where PDEP is microcoded (slow): AMD before Zen 3
+    bool has_fast_pdep;
+};
+
+CpuFeatures detectCpuFeatures() {
+    __builtin_cpu_init();
+    CpuFeatures features;
+    features.has_avx2 = __builtin_cpu_supports("avx2");
+    features.has_avx512bw = __builtin_cpu_supports("avx512bw");
+    features.has_fast_pdep = (__builtin_cpu_supports("bmi2")
+			      && !__builtin_cpu_is("bdver4")
+			      && !__builtin_cpu_is("znver1")
+			      && !__builtin_cpu_is("znver2"));
+    return features;
+}
+
+// CPUID is queried once per process
+inline const CpuFeatures& cpuFeatures() {
+    static const CpuFeatures features = detectCpuFeatures();
+    return features;
+}
+
+static const level_t kUint64KeyLen = 8;
+
+// Byte level of uint64ToString(word), read from the integer directly
+label_t uint64KeyByte(const uint64_t word, const level_t level) {
+    return (label_t)(word >> (56 - 8 * level));
+}
+
 } // namespace surf
 
 #endif // CONFIG_H_
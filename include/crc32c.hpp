@@ -0,0 +1,66 @@
+#ifndef CRC32C_H_
+#define CRC32C_H_
+
+#include <stdint.h>
+#include <string.h>
+
+namespace surf {
+
+//******************************************************
+// CRC32C (Castagnoli), slicing-by-8, same polynomial as
+// the one used by LevelDB and SSE4.2 crc32 instructions
+//******************************************************
+class Crc32cTable {
+public:
+    Crc32cTable() {
+	static const uint32_t kPoly = 0x82f63b78; // reflected
+	for (uint32_t i = 0; i < 256; i++) {
+	    uint32_t crc = i;
+	    for (int j = 0; j < 8; j++)
+		crc = (crc >> 1) ^ ((crc & 1) ? kPoly : 0);
+	    table_[0][i] = crc;
+	}
+	for (uint32_t i = 0; i < 256; i++)
+	    for (int k = 1; k < 8; k++)
+		table_[k][i] = (table_[k - 1][i] >> 8) ^ table_[0][table_[k - 1][i] & 0xff];
+    }
+
+    uint32_t table_[8][256];
+};
+
+inline const Crc32cTable& crc32cTable() {
+    static const Crc32cTable table;
+    return table;
+}
+
+// Extends crc with data[0..n); crc32c(data, n) == crc32cExtend(0, data, n)
+inline uint32_t crc32cExtend(uint32_t crc, const char* data, uint64_t n) {
+    const uint32_t (*t)[256] = crc32cTable().table_;
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    crc = ~crc;
+    while (n >= 8) {
+	uint64_t word;
+	memcpy(&word, p, sizeof(word));
+	word ^= crc;
+	crc = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff]
+	    ^ t[5][(word >> 16) & 0xff] ^ t[4][(word >> 24) & 0xff]
+	    ^ t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff]
+	    ^ t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+	p += 8;
+	n -= 8;
+    }
+    while (n > 0) {
+	crc = t[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+	p++;
+	n--;
+    }
+    return ~crc;
+}
+
+inline uint32_t crc32c(const char* data, uint64_t n) {
+    return crc32cExtend(0, data, n);
+}
+
+} // namespace surf
+
+#endif // CRC32C_H_
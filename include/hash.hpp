@@ -1,8 +1,14 @@
 #ifndef HASH_H_
 #define HASH_H_
 
+#include <immintrin.h>
+#include <string.h>
+
 #include <string>
 
+#include "config.hpp"
+#include "slice.hpp"
+
 namespace surf {
 
 //******************************************************
@@ -45,12 +51,161 @@ inline uint32_t Hash(const char* data, size_t n, uint32_t seed) {
     return h;
 }
 
-inline uint32_t suffixHash(const std::string &key) {
-    return Hash(key.c_str(), key.size(), 0xbc9f1d34);
+//******************************************************
+// 64-BIT HASH: 16 bytes per step, each folded in with a
+// 64x64->128-bit multiply whose halves are xored
+//******************************************************
+inline uint64_t DecodeFixed64(const char* ptr) {
+    uint64_t result;
+    memcpy(&result, ptr, sizeof(result));
+    return result;
+}
+
+inline uint64_t mix64(const uint64_t a, const uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+inline uint64_t Hash64(const char* data, size_t n, uint64_t seed) {
+    const uint64_t k0 = 0xa0761d6478bd642fULL;
+    const uint64_t k1 = 0xe7037ed1a0b428dbULL;
+    const uint64_t len = n;
+    uint64_t h = mix64(seed ^ k0, len ^ k1);
+    while (n > 16) {
+	h = mix64(DecodeFixed64(data) ^ k1, DecodeFixed64(data + 8) ^ h);
+	data += 16;
+	n -= 16;
+    }
+
+    // Last 1 to 16 bytes, read as two possibly overlapping halves
+    uint64_t a = 0;
+    uint64_t b = 0;
+    if (n >= 8) {
+	a = DecodeFixed64(data);
+	b = DecodeFixed64(data + n - 8);
+    } else if (n >= 4) {
+	a = DecodeFixed32(data);
+	b = DecodeFixed32(data + n - 4);
+    } else if (n > 0) {
+	a = ((uint64_t)(unsigned char)data[0] << 16)
+	    | ((uint64_t)(unsigned char)data[n >> 1] << 8)
+	    | (uint64_t)(unsigned char)data[n - 1];
+    }
+    return mix64(len ^ k1, mix64(a ^ k1, b ^ h));
+}
+
+static const uint32_t kSuffixHashSeed = 0xbc9f1d34;
+
+inline uint32_t suffixHash(const Slice& key) {
+    return Hash(key.data(), key.size(), kSuffixHashSeed);
 }
 
 inline uint32_t suffixHash(const char* key, const int keylen) {
-    return Hash(key, keylen, 0xbc9f1d34);
+    return Hash(key, keylen, kSuffixHashSeed);
+}
+
+inline word_t suffixHash(const Slice& key, const SuffixHashType hash_type) {
+    if (hash_type == kSuffixHash64)
+	return Hash64(key.data(), key.size(), kSuffixHashSeed);
+    return Hash(key.data(), key.size(), kSuffixHashSeed);
+}
+
+// Hash of the 8-byte key uint64ToString(key)
+inline word_t suffixHash(const uint64_t key, const SuffixHashType hash_type) {
+    uint64_t big_endian_key = __builtin_bswap64(key);
+    const char* data = reinterpret_cast<const char*>(&big_endian_key);
+    if (hash_type == kSuffixHash64)
+	return Hash64(data, 8, kSuffixHashSeed);
+    return Hash(data, 8, kSuffixHashSeed);
+}
+
+// The last step of Hash(), for the num_bytes_left < 4 bytes at data
+inline uint32_t hashTail(const char* data, const size_t num_bytes_left, uint32_t h) {
+    const uint32_t m = 0xc6a4a793;
+    const uint32_t r = 24;
+    uint32_t w = 0;
+    switch (num_bytes_left) {
+    case 3:
+	w += static_cast<unsigned char>(data[2]) << 16;
+    case 2:
+	w += static_cast<unsigned char>(data[1]) << 8;
+    case 1:
+	w += static_cast<unsigned char>(data[0]);
+	h += w;
+	h *= m;
+	h ^= (h >> r);
+	break;
+    }
+    return h;
+}
+
+// Hash() of 8 keys at once, one key per 32-bit lane. Lanes load their
+// next 4 bytes with a masked gather, so keys of different lengths
+// share the loop and finished lanes stop reading.
+__attribute__((target("avx2")))
+inline void suffixHashesAvx2(const Slice* keys, uint32_t* out) {
+    const uint32_t m = 0xc6a4a793;
+    uint64_t addrs[8];
+    uint32_t seeds[8];
+    uint32_t num_words[8];
+    uint32_t max_num_words = 0;
+    for (int i = 0; i < 8; i++) {
+	addrs[i] = reinterpret_cast<uint64_t>(keys[i].data());
+	seeds[i] = kSuffixHashSeed ^ (keys[i].size() * m);
+	num_words[i] = keys[i].size() / 4;
+	if (num_words[i] > max_num_words)
+	    max_num_words = num_words[i];
+    }
+    __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(seeds));
+    __m256i words_left = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(num_words));
+    __m256i addrs_lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(addrs));
+    __m256i addrs_hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(addrs + 4));
+    for (uint32_t w = 0; w < max_num_words; w++) {
+	__m256i active = _mm256_cmpgt_epi32(words_left, _mm256_set1_epi32(w));
+	__m128i words_lo = _mm256_mask_i64gather_epi32(_mm_setzero_si128(), nullptr, addrs_lo,
+						       _mm256_castsi256_si128(active), 1);
+	__m128i words_hi = _mm256_mask_i64gather_epi32(_mm_setzero_si128(), nullptr, addrs_hi,
+						       _mm256_extracti128_si256(active, 1), 1);
+	__m256i next_h = _mm256_add_epi32(h, _mm256_set_m128i(words_hi, words_lo));
+	next_h = _mm256_mullo_epi32(next_h, _mm256_set1_epi32(m));
+	next_h = _mm256_xor_si256(next_h, _mm256_srli_epi32(next_h, 16));
+	h = _mm256_blendv_epi8(h, next_h, active);
+	addrs_lo = _mm256_add_epi64(addrs_lo, _mm256_set1_epi64x(4));
+	addrs_hi = _mm256_add_epi64(addrs_hi, _mm256_set1_epi64x(4));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), h);
+    for (int i = 0; i < 8; i++)
+	out[i] = hashTail(keys[i].data() + num_words[i] * 4, keys[i].size() & 3, out[i]);
+}
+
+// out[i] = suffixHash(keys[i], hash_type) for n keys. For the LevelDB
+// hash, the gathers only pay off for long keys ("microbench
+// suffix_hash"): groups of 8 averaging fewer than
+// kMinVectorHashKeyLen bytes are hashed one by one. The 64-bit hash
+// is cheap enough per key to need no batching.
+static const size_t kMinVectorHashKeyLen = 32;
+
+inline void suffixHashes(const Slice* keys, const size_t n,
+			 const SuffixHashType hash_type, word_t* out) {
+    size_t i = 0;
+    if (cpuFeatures().has_avx2 && (hash_type == kSuffixHashLevelDB)) {
+	for (; i + 8 <= n; i += 8) {
+	    size_t total_len = 0;
+	    for (size_t j = i; j < i + 8; j++)
+		total_len += keys[j].size();
+	    if (total_len >= 8 * kMinVectorHashKeyLen) {
+		uint32_t hashes[8];
+		suffixHashesAvx2(keys + i, hashes);
+		for (size_t j = 0; j < 8; j++)
+		    out[i + j] = hashes[j];
+	    } else {
+		for (size_t j = i; j < i + 8; j++)
+		    out[j] = suffixHash(keys[j]);
+	    }
+	}
+    }
+    for (; i < n; i++)
+	out[i] = suffixHash(keys[i], hash_type);
 }
 
 } // namespace surf
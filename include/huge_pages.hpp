@@ -0,0 +1,149 @@
+#ifndef HUGEPAGES_H_
+#define HUGEPAGES_H_
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "config.hpp"
+
+namespace surf {
+
+//******************************************************
+// One mapping, in 2MB pages where the system allows, that
+// holds a whole filter image (see SuRF::moveToHugePages).
+// Reserved huge pages (MAP_HUGETLB) are used if asked for
+// and available; otherwise the mapping is 2MB aligned and
+// madvise'd for transparent huge pages. The NUMA policy
+// is set before any page is touched.
+//******************************************************
+struct HugePageOptions {
+    HugePageOptions() : use_hugetlb(false), numa_node(-1), interleave(false) {};
+
+    bool use_hugetlb; // try reserved huge pages first
+    int numa_node; // bind the pages to this node; -1: no binding
+    bool interleave; // interleave the pages over all nodes; overrides numa_node
+};
+
+// Shallow copies share the mapping; release() unmaps it.
+class HugePageRegion {
+public:
+    static const uint64_t kHugePageSize = 2 << 20;
+
+    HugePageRegion() : data_(nullptr), size_(0), mapped_size_(0),
+		       is_hugetlb_(false), is_numa_placed_(false) {};
+
+    // Maps size bytes, rounded up to whole huge pages. Returns false
+    // only if no memory could be mapped; failing to apply the NUMA
+    // policy is reported by isNumaPlaced().
+    bool allocate(const uint64_t size, const HugePageOptions& options);
+    void release();
+
+    char* data() const {
+	return data_;
+    }
+
+    uint64_t size() const {
+	return size_;
+    }
+
+    // true if backed by reserved huge pages; transparent huge pages
+    // are up to the kernel (AnonHugePages in /proc/meminfo)
+    bool isHugeTlb() const {
+	return is_hugetlb_;
+    }
+
+    bool isNumaPlaced() const {
+	return is_numa_placed_;
+    }
+
+private:
+    // mbind(2) modes; called through syscall() so that libnuma is not needed
+    static const int kMpolBind = 2;
+    static const int kMpolInterleave = 3;
+    static const unsigned kMaxNumaNodes = 64;
+
+    bool setNumaPolicy(const HugePageOptions& options);
+
+    char* data_;
+    uint64_t size_;
+    uint64_t mapped_size_;
+    bool is_hugetlb_;
+    bool is_numa_placed_;
+};
+
+bool HugePageRegion::allocate(const uint64_t size, const HugePageOptions& options) {
+    release();
+    uint64_t mapped_size = (size + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+    if (mapped_size == 0)
+	mapped_size = kHugePageSize;
+    void* addr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (options.use_hugetlb) {
+	addr = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	is_hugetlb_ = (addr != MAP_FAILED);
+    }
+#endif
+    if (addr == MAP_FAILED) {
+	// over-map by a huge page and trim both ends to a 2MB boundary
+	void* raw = mmap(nullptr, mapped_size + kHugePageSize, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED)
+	    return false;
+	uintptr_t start = (uintptr_t)raw;
+	uintptr_t aligned = (start + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+	if (aligned > start)
+	    munmap(raw, aligned - start);
+	uintptr_t tail = aligned + mapped_size;
+	uintptr_t raw_end = start + mapped_size + kHugePageSize;
+	if (raw_end > tail)
+	    munmap((void*)tail, raw_end - tail);
+	addr = (void*)aligned;
+#ifdef MADV_HUGEPAGE
+	madvise(addr, mapped_size, MADV_HUGEPAGE);
+#endif
+    }
+    data_ = (char*)addr;
+    size_ = size;
+    mapped_size_ = mapped_size;
+    if (options.interleave || (options.numa_node >= 0))
+	is_numa_placed_ = setNumaPolicy(options);
+    return true;
+}
+
+bool HugePageRegion::setNumaPolicy(const HugePageOptions& options) {
+#ifdef SYS_mbind
+    unsigned long node_mask = 0;
+    int mode = kMpolBind;
+    if (options.interleave) {
+	// the kernel narrows the mask down to the nodes with memory
+	node_mask = ~0UL;
+	mode = kMpolInterleave;
+    } else {
+	if ((unsigned)options.numa_node >= kMaxNumaNodes)
+	    return false;
+	node_mask = 1UL << options.numa_node;
+    }
+    return (syscall(SYS_mbind, data_, mapped_size_, mode, &node_mask,
+		    (unsigned long)kMaxNumaNodes + 1, 0) == 0);
+#else
+    (void)options;
+    return false;
+#endif
+}
+
+void HugePageRegion::release() {
+    if (data_ != nullptr)
+	munmap(data_, mapped_size_);
+    data_ = nullptr;
+    size_ = 0;
+    mapped_size_ = 0;
+    is_hugetlb_ = false;
+    is_numa_placed_ = false;
+}
+
+} // namespace surf
+
+#endif // HUGEPAGES_H_
@@ -0,0 +1,62 @@
+#ifndef INLINEVECTOR_H_
+#define INLINEVECTOR_H_
+
+#include <assert.h>
+#include <string.h>
+
+#include <vector>
+
+namespace surf {
+
+//******************************************************
+// Array of n elements that lives inside its owner while
+// n <= kInlineSize and falls back to a heap vector only
+// beyond that. Trie iterators keep their path in it, so
+// creating, copying and advancing an iterator over a
+// trie of at most kInlineSize levels does not allocate.
+//******************************************************
+template <typename T>
+class InlineVector {
+public:
+    static const size_t kInlineSize = 32;
+
+    InlineVector() : size_(0) {
+	memset(inline_, 0, sizeof(inline_));
+    }
+
+    // Sets the size to n zeroed elements
+    void resize(const size_t n) {
+	size_ = n;
+	if (n > kInlineSize) {
+	    heap_.assign(n, T());
+	} else {
+	    heap_.clear();
+	    memset(inline_, 0, sizeof(inline_));
+	}
+    }
+
+    size_t size() const { return size_; };
+    bool isInline() const { return (size_ <= kInlineSize); };
+
+    T* data() { return isInline() ? inline_ : heap_.data(); };
+    const T* data() const { return isInline() ? inline_ : heap_.data(); };
+
+    T& operator[](const size_t i) {
+	assert(i < size_);
+	return data()[i];
+    }
+
+    const T& operator[](const size_t i) const {
+	assert(i < size_);
+	return data()[i];
+    }
+
+private:
+    size_t size_;
+    T inline_[kInlineSize];
+    std::vector<T> heap_;
+};
+
+} // namespace surf
+
+#endif // INLINEVECTOR_H_
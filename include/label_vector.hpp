@@ -1,39 +1,38 @@
 #ifndef LABELVECTOR_H_
 #define LABELVECTOR_H_
 
-#include <emmintrin.h>
+#include <immintrin.h>
 
 #include <vector>
 
 #include "config.hpp"
+#include "level_vector.hpp"
+#include "stats.hpp"
 
 namespace surf {
 
 class LabelVector {
 public:
-    LabelVector() : num_bytes_(0), labels_(nullptr) {};
-
-    LabelVector(const std::vector<std::vector<label_t> >& labels_per_level,
-		const level_t start_level = 0,
-		level_t end_level = 0/* non-inclusive */) {
-	if (end_level == 0)
-	    end_level = labels_per_level.size();
-
-	num_bytes_ = 1;
-	for (level_t level = start_level; level < end_level; level++)
-	    num_bytes_ += labels_per_level[level].size();
-
-	labels_ = new label_t[num_bytes_];
-
-	position_t pos = 0;
-	for (level_t level = start_level; level < end_level; level++) {
-	    for (position_t idx = 0; idx < labels_per_level[level].size(); idx++) {
-		labels_[pos] = labels_per_level[level][idx];
-		pos++;
-	    }
-	}
+    // Widest label search kernel the CPU supports
+    enum SimdLevel { kSimdSse2 = 0, kSimdAvx2 = 1, kSimdAvx512 = 2 };
+
+    LabelVector() : num_bytes_(0), labels_(nullptr), simd_level_(detectSimdLevel()) {};
+
+    // Concatenates levels [start_level, end_level) of labels
+    LabelVector(const LevelLabels& labels,
+		const level_t start_level,
+		const level_t end_level/* non-inclusive */)
+	: simd_level_(detectSimdLevel()) {
+	position_t num_labels;
+	labels_ = labels.copy(start_level, end_level, num_labels);
+	num_bytes_ = num_labels + 1;
     }
 
+    // Takes over labels, allocated with new[] and holding num_labels
+    // labels and a spare 0 byte (see LevelLabels)
+    LabelVector(label_t* labels, const position_t num_labels)
+	: num_bytes_(num_labels + 1), labels_(labels), simd_level_(detectSimdLevel()) {};
+
     ~LabelVector() {}
 
     position_t getNumBytes() const {
@@ -58,16 +57,45 @@ public:
 	return labels_[pos];
     }
 
+    void prefetch(const position_t pos) const {
+	__builtin_prefetch(labels_ + pos);
+    }
+
+    SimdLevel getSimdLevel() const {
+	return simd_level_;
+    }
+
+    // Kernels above the detected level are never dispatched to;
+    // tests and benchmarks use this to compare levels.
+    void setSimdLevel(const SimdLevel level) {
+	simd_level_ = (level < detectSimdLevel()) ? level : detectSimdLevel();
+    }
+
+    static SimdLevel detectSimdLevel() {
+	if (cpuFeatures().has_avx512bw)
+	    return kSimdAvx512;
+	if (cpuFeatures().has_avx2)
+	    return kSimdAvx2;
+	return kSimdSse2;
+    }
+
     bool search(const label_t target, position_t& pos, const position_t search_len) const;
     bool searchGreaterThan(const label_t target, position_t& pos, const position_t search_len) const;
 
-    bool binarySearch(const label_t target, position_t& pos, const position_t search_len) const;
     bool simdSearch(const label_t target, position_t& pos, const position_t search_len) const;
     bool linearSearch(const label_t target, position_t& pos, const position_t search_len) const;
 
-    bool binarySearchGreaterThan(const label_t target, position_t& pos, const position_t search_len) const;
+    bool simdSearchGreaterThan(const label_t target, position_t& pos, const position_t search_len) const;
     bool linearSearchGreaterThan(const label_t target, position_t& pos, const position_t search_len) const;
 
+    // Fixed-width kernels; callers must check the CPU supports them
+    bool sse2Search(const label_t target, position_t& pos, const position_t search_len) const;
+    bool avx2Search(const label_t target, position_t& pos, const position_t search_len) const;
+    bool avx512Search(const label_t target, position_t& pos, const position_t search_len) const;
+    bool sse2SearchGreaterThan(const label_t target, position_t& pos, const position_t search_len) const;
+    bool avx2SearchGreaterThan(const label_t target, position_t& pos, const position_t search_len) const;
+    bool avx512SearchGreaterThan(const label_t target, position_t& pos, const position_t search_len) const;
+
     void serialize(char*& dst) const {
 	memcpy(dst, &num_bytes_, sizeof(num_bytes_));
 	dst += sizeof(num_bytes_);
@@ -78,69 +106,94 @@ public:
     
     static LabelVector* deSerialize(char*& src) {
 	LabelVector* lv = new LabelVector();
-	memcpy(&(lv->num_bytes_), src, sizeof(lv->num_bytes_));
-	src += sizeof(lv->num_bytes_);
-	lv->labels_ = const_cast<label_t*>(reinterpret_cast<const label_t*>(src));
-	src += lv->num_bytes_;
-	align(src);
+	const char* cur = src;
+	lv->loadView(cur, nullptr);
+	src = const_cast<char*>(cur);
 	return lv;
     }
 
+    // Points the label array at a serialized image without copying.
+    // Returns false if the image does not fit before end.
+    bool loadView(const char*& src, const char* end) {
+	if (!fitsInBuffer(src, end, sizeof(num_bytes_)))
+	    return false;
+	memcpy(&num_bytes_, src, sizeof(num_bytes_));
+	if (!fitsInBuffer(src, end, serializedSize()))
+	    return false;
+	src += sizeof(num_bytes_);
+	labels_ = const_cast<label_t*>(reinterpret_cast<const label_t*>(src));
+	src += num_bytes_;
+	align(src);
+	return true;
+    }
+
     void destroy() {
 	delete[] labels_;	
     }
 
 private:
+    // Smallest node each kernel is dispatched for, per operation,
+    // tuned with "microbench label_search". A single label is the only
+    // size the scalar loop wins. AVX2 needs a full 32-byte load inside
+    // the node. AVX-512 masks its loads; searchGreaterThan gains from
+    // that once a node spans more than one SSE2 register, while search
+    // stays faster on AVX2 until a node is full.
+    static const position_t kLinearSearchThreshold = 2;
+    static const position_t kLinearSearchGreaterThanThreshold = 2;
+    static const position_t kAvx2SearchThreshold = 32;
+    static const position_t kAvx2SearchGreaterThanThreshold = 32;
+    static const position_t kAvx512SearchThreshold = 256;
+    static const position_t kAvx512SearchGreaterThanThreshold = 17;
+
+    // Start of the 16-byte tail load for the labels from pos on. Near
+    // the end of the array the load is pulled back so it stays inside
+    // num_bytes_; a zero-copy image can end right at a mapped page.
+    position_t tailLoadPos(const position_t pos) const {
+	return (pos + 16 <= num_bytes_) ? pos : num_bytes_ - 16;
+    }
+
     position_t num_bytes_;
     label_t* labels_;
+    SimdLevel simd_level_;
 };
 
 bool LabelVector::search(const label_t target, position_t& pos, position_t search_len) const {
+    SURF_STAT(lookupStats().label_searches++);
     //skip terminator label
     if ((search_len > 1) && (labels_[pos] == kTerminator)) {
 	pos++;
 	search_len--;
     }
 
-    if (search_len < 3)
+    if (search_len < kLinearSearchThreshold)
 	return linearSearch(target, pos, search_len);
-    if (search_len < 12)
-	return binarySearch(target, pos, search_len);
-    else
-	return simdSearch(target, pos, search_len);
+    return simdSearch(target, pos, search_len);
 }
 
 bool LabelVector::searchGreaterThan(const label_t target, position_t& pos, position_t search_len) const {
+    SURF_STAT(lookupStats().label_searches++);
     //skip terminator label
     if ((search_len > 1) && (labels_[pos] == kTerminator)) {
 	pos++;
 	search_len--;
     }
 
-    if (search_len < 3)
+    if (search_len < kLinearSearchGreaterThanThreshold)
 	return linearSearchGreaterThan(target, pos, search_len);
-    else
-	return binarySearchGreaterThan(target, pos, search_len);
+    return simdSearchGreaterThan(target, pos, search_len);
 }
 
-bool LabelVector::binarySearch(const label_t target, position_t& pos, const position_t search_len) const {
-    position_t l = pos;
-    position_t r = pos + search_len;
-    while (l < r) {
-	position_t m = (l + r) >> 1;
-	if (target < labels_[m]) {
-	    r = m;
-	} else if (target == labels_[m]) {
-	    pos = m;
-	    return true;
-	} else {
-	    l = m + 1;
-	}
-    }
-    return false;
+bool LabelVector::simdSearch(const label_t target, position_t& pos, const position_t search_len) const {
+    if ((simd_level_ == kSimdAvx512) && (search_len >= kAvx512SearchThreshold))
+	return avx512Search(target, pos, search_len);
+    if ((simd_level_ >= kSimdAvx2) && (search_len >= kAvx2SearchThreshold))
+	return avx2Search(target, pos, search_len);
+    return sse2Search(target, pos, search_len);
 }
 
-bool LabelVector::simdSearch(const label_t target, position_t& pos, const position_t search_len) const {
+bool LabelVector::sse2Search(const label_t target, position_t& pos, const position_t search_len) const {
+    if (num_bytes_ < 16)
+	return linearSearch(target, pos, search_len);
     position_t num_labels_searched = 0;
     position_t num_labels_left = search_len;
     while ((num_labels_left >> 4) > 0) {
@@ -157,11 +210,12 @@ bool LabelVector::simdSearch(const label_t target, position_t& pos, const positi
     }
 
     if (num_labels_left > 0) {
-	label_t* start_ptr = labels_ + pos + num_labels_searched;
+	position_t start_pos = pos + num_labels_searched;
+	position_t load_pos = tailLoadPos(start_pos);
 	__m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8(target), 
-				     _mm_loadu_si128(reinterpret_cast<__m128i*>(start_ptr)));
+				     _mm_loadu_si128(reinterpret_cast<__m128i*>(labels_ + load_pos)));
 	unsigned leftover_bits_mask = (1 << num_labels_left) - 1;
-	unsigned check_bits = _mm_movemask_epi8(cmp) & leftover_bits_mask;
+	unsigned check_bits = (_mm_movemask_epi8(cmp) >> (start_pos - load_pos)) & leftover_bits_mask;
 	if (check_bits) {
 	    pos += (num_labels_searched + __builtin_ctz(check_bits));
 	    return true;
@@ -171,6 +225,48 @@ bool LabelVector::simdSearch(const label_t target, position_t& pos, const positi
     return false;
 }
 
+// The last load overlaps labels already searched instead of
+// running past the node. simdSearch only calls it from
+// kAvx2SearchThreshold labels up; shorter nodes fall back to SSE2.
+__attribute__((target("avx2")))
+bool LabelVector::avx2Search(const label_t target, position_t& pos, const position_t search_len) const {
+    if (search_len < 32)
+	return sse2Search(target, pos, search_len);
+    __m256i key = _mm256_set1_epi8(target);
+    position_t num_labels_searched = 0;
+    while (true) {
+	if (num_labels_searched + 32 > search_len)
+	    num_labels_searched = search_len - 32;
+	label_t* start_ptr = labels_ + pos + num_labels_searched;
+	__m256i cmp = _mm256_cmpeq_epi8(key, _mm256_loadu_si256(reinterpret_cast<__m256i*>(start_ptr)));
+	unsigned check_bits = _mm256_movemask_epi8(cmp);
+	if (check_bits) {
+	    pos += (num_labels_searched + __builtin_ctz(check_bits));
+	    return true;
+	}
+	num_labels_searched += 32;
+	if (num_labels_searched >= search_len)
+	    return false;
+    }
+}
+
+__attribute__((target("avx512bw")))
+bool LabelVector::avx512Search(const label_t target, position_t& pos, const position_t search_len) const {
+    __m512i key = _mm512_set1_epi8(target);
+    for (position_t num_labels_searched = 0; num_labels_searched < search_len;
+	 num_labels_searched += 64) {
+	position_t num_labels_left = search_len - num_labels_searched;
+	__mmask64 load_mask = (num_labels_left >= 64) ? ~0ULL : ((1ULL << num_labels_left) - 1);
+	__m512i labels = _mm512_maskz_loadu_epi8(load_mask, labels_ + pos + num_labels_searched);
+	__mmask64 check_bits = _mm512_mask_cmpeq_epi8_mask(load_mask, labels, key);
+	if (check_bits) {
+	    pos += (num_labels_searched + __builtin_ctzll(check_bits));
+	    return true;
+	}
+    }
+    return false;
+}
+
 bool LabelVector::linearSearch(const label_t target, position_t&  pos, const position_t search_len) const {
     for (position_t i = 0; i < search_len; i++) {
 	if (target == labels_[pos + i]) {
@@ -181,27 +277,91 @@ bool LabelVector::linearSearch(const label_t target, position_t&  pos, const pos
     return false;
 }
 
-bool LabelVector::binarySearchGreaterThan(const label_t target, position_t& pos, const position_t search_len) const {
-    position_t l = pos;
-    position_t r = pos + search_len;
-    while (l < r) {
-	position_t m = (l + r) >> 1;
-	if (target < labels_[m]) {
-	    r = m;
-	} else if (target == labels_[m]) {
-	    if (m < pos + search_len - 1) {
-		pos = m + 1;
-		return true;
-	    }
-	    return false;
-	} else {
-	    l = m + 1;
+// Labels in a node are sorted, so the first label above target
+// is the answer. There is no unsigned byte compare below
+// AVX-512; x > target is tested as max(x, target + 1) == x.
+bool LabelVector::simdSearchGreaterThan(const label_t target, position_t& pos, const position_t search_len) const {
+    if ((simd_level_ == kSimdAvx512) && (search_len >= kAvx512SearchGreaterThanThreshold))
+	return avx512SearchGreaterThan(target, pos, search_len);
+    if ((simd_level_ >= kSimdAvx2) && (search_len >= kAvx2SearchGreaterThanThreshold))
+	return avx2SearchGreaterThan(target, pos, search_len);
+    return sse2SearchGreaterThan(target, pos, search_len);
+}
+
+bool LabelVector::sse2SearchGreaterThan(const label_t target, position_t& pos, const position_t search_len) const {
+    if (num_bytes_ < 16)
+	return linearSearchGreaterThan(target, pos, search_len);
+    if (target == 0xFF)
+	return false;
+    __m128i bound = _mm_set1_epi8(target + 1);
+    position_t num_labels_searched = 0;
+    position_t num_labels_left = search_len;
+    while ((num_labels_left >> 4) > 0) {
+	label_t* start_ptr = labels_ + pos + num_labels_searched;
+	__m128i labels = _mm_loadu_si128(reinterpret_cast<__m128i*>(start_ptr));
+	__m128i cmp = _mm_cmpeq_epi8(_mm_max_epu8(labels, bound), labels);
+	unsigned check_bits = _mm_movemask_epi8(cmp);
+	if (check_bits) {
+	    pos += (num_labels_searched + __builtin_ctz(check_bits));
+	    return true;
 	}
+	num_labels_searched += 16;
+	num_labels_left -= 16;
     }
 
-    if (l < pos + search_len) {
-	pos = l;
-	return true;
+    if (num_labels_left > 0) {
+	position_t start_pos = pos + num_labels_searched;
+	position_t load_pos = tailLoadPos(start_pos);
+	__m128i labels = _mm_loadu_si128(reinterpret_cast<__m128i*>(labels_ + load_pos));
+	__m128i cmp = _mm_cmpeq_epi8(_mm_max_epu8(labels, bound), labels);
+	unsigned leftover_bits_mask = (1 << num_labels_left) - 1;
+	unsigned check_bits = (_mm_movemask_epi8(cmp) >> (start_pos - load_pos)) & leftover_bits_mask;
+	if (check_bits) {
+	    pos += (num_labels_searched + __builtin_ctz(check_bits));
+	    return true;
+	}
+    }
+    return false;
+}
+
+__attribute__((target("avx2")))
+bool LabelVector::avx2SearchGreaterThan(const label_t target, position_t& pos, const position_t search_len) const {
+    if (search_len < 32)
+	return sse2SearchGreaterThan(target, pos, search_len);
+    if (target == 0xFF)
+	return false;
+    __m256i bound = _mm256_set1_epi8(target + 1);
+    position_t num_labels_searched = 0;
+    while (true) {
+	if (num_labels_searched + 32 > search_len)
+	    num_labels_searched = search_len - 32;
+	label_t* start_ptr = labels_ + pos + num_labels_searched;
+	__m256i labels = _mm256_loadu_si256(reinterpret_cast<__m256i*>(start_ptr));
+	__m256i cmp = _mm256_cmpeq_epi8(_mm256_max_epu8(labels, bound), labels);
+	unsigned check_bits = _mm256_movemask_epi8(cmp);
+	if (check_bits) {
+	    pos += (num_labels_searched + __builtin_ctz(check_bits));
+	    return true;
+	}
+	num_labels_searched += 32;
+	if (num_labels_searched >= search_len)
+	    return false;
+    }
+}
+
+__attribute__((target("avx512bw")))
+bool LabelVector::avx512SearchGreaterThan(const label_t target, position_t& pos, const position_t search_len) const {
+    __m512i key = _mm512_set1_epi8(target);
+    for (position_t num_labels_searched = 0; num_labels_searched < search_len;
+	 num_labels_searched += 64) {
+	position_t num_labels_left = search_len - num_labels_searched;
+	__mmask64 load_mask = (num_labels_left >= 64) ? ~0ULL : ((1ULL << num_labels_left) - 1);
+	__m512i labels = _mm512_maskz_loadu_epi8(load_mask, labels_ + pos + num_labels_searched);
+	__mmask64 check_bits = _mm512_mask_cmpgt_epu8_mask(load_mask, labels, key);
+	if (check_bits) {
+	    pos += (num_labels_searched + __builtin_ctzll(check_bits));
+	    return true;
+	}
     }
     return false;
 }
@@ -0,0 +1,546 @@
+#ifndef LEVELVECTOR_H_
+#define LEVELVECTOR_H_
+
+#include <assert.h>
+#include <string.h>
+
+#include <utility>
+#include <vector>
+
+#include "config.hpp"
+
+namespace surf {
+
+//******************************************************
+// Bits of one trie component (e.g., the LOUDS bits) as
+// SuRFBuilder appends them level by level, MSB first.
+// After reserveExact, the levels from a start level on
+// lie back to back in one array at their final offsets,
+// and release hands that array over to a bitvector
+// instead of concatenating the levels into a new one.
+// Every other level grows in a vector of its own.
+//******************************************************
+class LevelBits {
+public:
+    LevelBits() : bits_(nullptr), num_words_(0), exact_start_(0), is_exact_(false) {};
+    LevelBits(const LevelBits& other);
+    LevelBits(LevelBits&& other) : LevelBits() {
+	swap(other);
+    }
+    LevelBits& operator=(LevelBits other) {
+	swap(other);
+	return *this;
+    }
+    ~LevelBits() {
+	delete[] bits_;
+    }
+
+    // Lays out each level l >= start_level with exactly level_sizes[l]
+    // bits, all 0, in one array; levels added beyond level_sizes stay
+    // empty, levels below start_level grow in vectors.
+    // REQUIRED: no level has been added yet.
+    void reserveExact(const std::vector<position_t>& level_sizes,
+		      const level_t start_level = 0);
+    // Capacity hint for a level that grows in a vector of its own
+    void reserve(const level_t level, const position_t num_bits) {
+	if (!inArray(level))
+	    levels_[level].reserve(numWordsFor(num_bits));
+    }
+    bool isExact() const {
+	return is_exact_;
+    }
+    // Whether every level of an exact layout holds its reserved size,
+    // i.e., release can hand the array over
+    bool isFull() const;
+
+    // Adds a level of num_bits 0 bits
+    void addLevel(const position_t num_bits = 0);
+
+    level_t numLevels() const {
+	return num_bits_.size();
+    }
+    position_t size(const level_t level) const {
+	return num_bits_[level];
+    }
+
+    bool readBit(const level_t level, const position_t pos) const {
+	assert(pos < num_bits_[level]);
+	position_t bit = levelOffset(level) + pos;
+	return (levelWords(level)[bit / kWordSize] & (kMsbMask >> (bit % kWordSize)));
+    }
+    void setBit(const level_t level, const position_t pos) {
+	assert(pos < num_bits_[level]);
+	position_t bit = levelOffset(level) + pos;
+	levelWords(level)[bit / kWordSize] |= (kMsbMask >> (bit % kWordSize));
+    }
+
+    void push(const level_t level, const bool bit) {
+	position_t pos = num_bits_[level];
+	grow(level, 1);
+	if (bit)
+	    setBit(level, pos);
+    }
+    // Appends the len (at most kWordSize) low bits of value
+    void append(const level_t level, const word_t value, const level_t len);
+    // Appends bits [begin, end) of src_level of src
+    void append(const level_t level, const LevelBits& src, const level_t src_level,
+		const position_t begin, const position_t end);
+
+    // Levels [start_level, end_level) back to back in a new[] array of
+    // their own that is 0 past num_bits
+    word_t* copy(const level_t start_level, const level_t end_level,
+		 position_t& num_bits) const;
+    // Same as copy, but a full exact layout hands its own array over
+    // when asked for all of its levels. Frees all levels; this is
+    // empty afterwards.
+    word_t* release(const level_t start_level, const level_t end_level,
+		    position_t& num_bits);
+    // Frees the bits of levels [start_level, end_level) that grow in
+    // vectors; the array is freed by release only
+    void releaseLevels(const level_t start_level, const level_t end_level);
+    void clear();
+
+    bool operator==(const LevelBits& other) const;
+
+private:
+    static position_t numWordsFor(const position_t num_bits) {
+	return (num_bits + kWordSize - 1) / kWordSize;
+    }
+
+    // the len (at most kWordSize) bits at pos, aligned to the MSB
+    static word_t readBits(const word_t* words, const position_t pos, const position_t len);
+    // ORs the len MSB-aligned bits into words at pos
+    static void orBits(word_t* words, const position_t pos, const word_t bits,
+		       const position_t len);
+    // ORs len bits of src at src_pos into dst at dst_pos
+    static void copyBits(word_t* dst, const position_t dst_pos,
+			 const word_t* src, const position_t src_pos, const position_t len);
+
+    bool inArray(const level_t level) const {
+	return is_exact_ && (level >= exact_start_);
+    }
+    word_t* levelWords(const level_t level) {
+	return inArray(level) ? bits_ : levels_[level].data();
+    }
+    const word_t* levelWords(const level_t level) const {
+	return inArray(level) ? bits_ : levels_[level].data();
+    }
+    // the first bit of level within levelWords(level)
+    position_t levelOffset(const level_t level) const {
+	if (!inArray(level))
+	    return 0;
+	level_t i = level - exact_start_;
+	return (i < offsets_.size()) ? offsets_[i] : offsets_.back();
+    }
+    position_t capacity(const level_t level) const {
+	return levelOffset(level + 1) - levelOffset(level);
+    }
+
+    void grow(const level_t level, const position_t num_bits) {
+	num_bits_[level] += num_bits;
+	assert(!inArray(level) || (num_bits_[level] <= capacity(level)));
+	if (!inArray(level) && (levels_[level].size() < numWordsFor(num_bits_[level])))
+	    levels_[level].resize(numWordsFor(num_bits_[level]), 0);
+    }
+
+    void swap(LevelBits& other);
+
+    std::vector<position_t> num_bits_; // per level
+    // exact layout of levels [exact_start_, ...)
+    word_t* bits_;
+    position_t num_words_;
+    std::vector<position_t> offsets_; // of the reserved levels, and the total
+    level_t exact_start_;
+    bool is_exact_;
+    // the other levels
+    std::vector<std::vector<word_t> > levels_;
+};
+
+//******************************************************
+// The labels of LOUDS-Sparse as SuRFBuilder appends
+// them level by level. Laid out like LevelBits; the
+// arrays handed over keep a spare last byte for
+// LabelVector.
+//******************************************************
+class LevelLabels {
+public:
+    LevelLabels() : labels_(nullptr), exact_start_(0), is_exact_(false) {};
+    LevelLabels(const LevelLabels& other);
+    LevelLabels(LevelLabels&& other) : LevelLabels() {
+	swap(other);
+    }
+    LevelLabels& operator=(LevelLabels other) {
+	swap(other);
+	return *this;
+    }
+    ~LevelLabels() {
+	delete[] labels_;
+    }
+
+    // see LevelBits
+    void reserveExact(const std::vector<position_t>& level_sizes,
+		      const level_t start_level = 0);
+    void reserve(const level_t level, const position_t num_labels) {
+	if (!inArray(level))
+	    levels_[level].reserve(num_labels);
+    }
+    bool isExact() const {
+	return is_exact_;
+    }
+    bool isFull() const;
+
+    void addLevel();
+
+    level_t numLevels() const {
+	return num_labels_.size();
+    }
+    position_t size(const level_t level) const {
+	return num_labels_[level];
+    }
+
+    label_t read(const level_t level, const position_t pos) const {
+	assert(pos < num_labels_[level]);
+	return levelLabels(level)[pos];
+    }
+    label_t back(const level_t level) const {
+	return read(level, num_labels_[level] - 1);
+    }
+
+    void push(const level_t level, const label_t label) {
+	if (inArray(level)) {
+	    assert(num_labels_[level] < capacity(level));
+	    labels_[levelOffset(level) + num_labels_[level]] = label;
+	} else {
+	    levels_[level].push_back(label);
+	}
+	num_labels_[level]++;
+    }
+    // Appends labels [begin, end) of src_level of src
+    void append(const level_t level, const LevelLabels& src, const level_t src_level,
+		const position_t begin, const position_t end);
+
+    // see LevelBits; the arrays hold num_labels + 1 bytes, the last one 0
+    label_t* copy(const level_t start_level, const level_t end_level,
+		  position_t& num_labels) const;
+    label_t* release(const level_t start_level, const level_t end_level,
+		     position_t& num_labels);
+    void releaseLevels(const level_t start_level, const level_t end_level);
+    void clear();
+
+    bool operator==(const LevelLabels& other) const;
+
+private:
+    bool inArray(const level_t level) const {
+	return is_exact_ && (level >= exact_start_);
+    }
+    label_t* levelLabels(const level_t level) {
+	return inArray(level) ? (labels_ + levelOffset(level)) : levels_[level].data();
+    }
+    const label_t* levelLabels(const level_t level) const {
+	return inArray(level) ? (labels_ + levelOffset(level)) : levels_[level].data();
+    }
+    position_t levelOffset(const level_t level) const {
+	if (!inArray(level))
+	    return 0;
+	level_t i = level - exact_start_;
+	return (i < offsets_.size()) ? offsets_[i] : offsets_.back();
+    }
+    position_t capacity(const level_t level) const {
+	return levelOffset(level + 1) - levelOffset(level);
+    }
+
+    void swap(LevelLabels& other);
+
+    std::vector<position_t> num_labels_; // per level
+    // exact layout of levels [exact_start_, ...)
+    label_t* labels_;
+    std::vector<position_t> offsets_;
+    level_t exact_start_;
+    bool is_exact_;
+    // the other levels
+    std::vector<std::vector<label_t> > levels_;
+};
+
+LevelBits::LevelBits(const LevelBits& other)
+    : num_bits_(other.num_bits_), bits_(nullptr), num_words_(other.num_words_),
+      offsets_(other.offsets_), exact_start_(other.exact_start_), is_exact_(other.is_exact_),
+      levels_(other.levels_) {
+    if (other.bits_ != nullptr) {
+	bits_ = new word_t[num_words_];
+	memcpy(bits_, other.bits_, num_words_ * sizeof(word_t));
+    }
+}
+
+void LevelBits::swap(LevelBits& other) {
+    num_bits_.swap(other.num_bits_);
+    std::swap(bits_, other.bits_);
+    std::swap(num_words_, other.num_words_);
+    offsets_.swap(other.offsets_);
+    std::swap(exact_start_, other.exact_start_);
+    std::swap(is_exact_, other.is_exact_);
+    levels_.swap(other.levels_);
+}
+
+void LevelBits::reserveExact(const std::vector<position_t>& level_sizes,
+			     const level_t start_level) {
+    assert(numLevels() == 0);
+    clear();
+    offsets_.push_back(0);
+    for (level_t level = start_level; level < level_sizes.size(); level++)
+	offsets_.push_back(offsets_.back() + level_sizes[level]);
+    // one spare word, so that an empty layout has an array too
+    num_words_ = offsets_.back() / kWordSize + 1;
+    bits_ = new word_t[num_words_];
+    memset(bits_, 0, num_words_ * sizeof(word_t));
+    exact_start_ = start_level;
+    is_exact_ = true;
+}
+
+bool LevelBits::isFull() const {
+    if (!is_exact_)
+	return false;
+    for (level_t level = exact_start_; level < numLevels(); level++) {
+	if (num_bits_[level] != capacity(level))
+	    return false;
+    }
+    return (numLevels() + 1 >= exact_start_ + offsets_.size());
+}
+
+void LevelBits::addLevel(const position_t num_bits) {
+    num_bits_.push_back(0);
+    levels_.push_back(std::vector<word_t>());
+    grow(numLevels() - 1, num_bits);
+}
+
+void LevelBits::append(const level_t level, const word_t value, const level_t len) {
+    assert(len <= kWordSize);
+    if (len == 0)
+	return;
+    position_t pos = num_bits_[level];
+    grow(level, len);
+    orBits(levelWords(level), levelOffset(level) + pos, value << (kWordSize - len), len);
+}
+
+void LevelBits::append(const level_t level, const LevelBits& src, const level_t src_level,
+		       const position_t begin, const position_t end) {
+    if (end <= begin)
+	return;
+    position_t pos = num_bits_[level];
+    grow(level, end - begin);
+    copyBits(levelWords(level), levelOffset(level) + pos,
+	     src.levelWords(src_level), src.levelOffset(src_level) + begin, end - begin);
+}
+
+word_t* LevelBits::copy(const level_t start_level, const level_t end_level,
+			position_t& num_bits) const {
+    num_bits = 0;
+    for (level_t level = start_level; level < end_level; level++)
+	num_bits += num_bits_[level];
+    position_t num_words = num_bits / kWordSize + 1;
+    word_t* bits = new word_t[num_words];
+    memset(bits, 0, num_words * sizeof(word_t));
+    position_t pos = 0;
+    for (level_t level = start_level; level < end_level; level++) {
+	copyBits(bits, pos, levelWords(level), levelOffset(level), num_bits_[level]);
+	pos += num_bits_[level];
+    }
+    return bits;
+}
+
+word_t* LevelBits::release(const level_t start_level, const level_t end_level,
+			   position_t& num_bits) {
+    if (!isFull() || (start_level != exact_start_) || (end_level != numLevels())) {
+	word_t* bits = copy(start_level, end_level, num_bits);
+	clear();
+	return bits;
+    }
+    // the array is 0 past the reserved bits already
+    num_bits = offsets_.back();
+    word_t* bits = bits_;
+    bits_ = nullptr;
+    clear();
+    return bits;
+}
+
+void LevelBits::releaseLevels(const level_t start_level, const level_t end_level) {
+    for (level_t level = start_level; (level < end_level) && (level < numLevels()); level++)
+	std::vector<word_t>().swap(levels_[level]);
+}
+
+void LevelBits::clear() {
+    std::vector<position_t>().swap(num_bits_);
+    delete[] bits_;
+    bits_ = nullptr;
+    num_words_ = 0;
+    std::vector<position_t>().swap(offsets_);
+    exact_start_ = 0;
+    is_exact_ = false;
+    std::vector<std::vector<word_t> >().swap(levels_);
+}
+
+bool LevelBits::operator==(const LevelBits& other) const {
+    if (num_bits_ != other.num_bits_)
+	return false;
+    for (level_t level = 0; level < numLevels(); level++) {
+	for (position_t pos = 0; pos < num_bits_[level]; pos += kWordSize) {
+	    position_t len = num_bits_[level] - pos;
+	    if (len > kWordSize)
+		len = kWordSize;
+	    if (readBits(levelWords(level), levelOffset(level) + pos, len)
+		!= readBits(other.levelWords(level), other.levelOffset(level) + pos, len))
+		return false;
+	}
+    }
+    return true;
+}
+
+word_t LevelBits::readBits(const word_t* words, const position_t pos, const position_t len) {
+    position_t word_id = pos / kWordSize;
+    position_t offset = pos % kWordSize;
+    word_t bits = words[word_id] << offset;
+    if ((offset > 0) && (offset + len > kWordSize))
+	bits |= (words[word_id + 1] >> (kWordSize - offset));
+    if (len < kWordSize)
+	bits &= ~(kOneMask >> len);
+    return bits;
+}
+
+void LevelBits::orBits(word_t* words, const position_t pos, const word_t bits,
+		       const position_t len) {
+    position_t word_id = pos / kWordSize;
+    position_t offset = pos % kWordSize;
+    words[word_id] |= (bits >> offset);
+    if ((offset > 0) && (offset + len > kWordSize))
+	words[word_id + 1] |= (bits << (kWordSize - offset));
+}
+
+void LevelBits::copyBits(word_t* dst, const position_t dst_pos,
+			 const word_t* src, const position_t src_pos, const position_t len) {
+    for (position_t done = 0; done < len; done += kWordSize) {
+	position_t chunk = len - done;
+	if (chunk > kWordSize)
+	    chunk = kWordSize;
+	orBits(dst, dst_pos + done, readBits(src, src_pos + done, chunk), chunk);
+    }
+}
+
+LevelLabels::LevelLabels(const LevelLabels& other)
+    : num_labels_(other.num_labels_), labels_(nullptr), offsets_(other.offsets_),
+      exact_start_(other.exact_start_), is_exact_(other.is_exact_), levels_(other.levels_) {
+    if (other.labels_ != nullptr) {
+	labels_ = new label_t[offsets_.back() + 1];
+	memcpy(labels_, other.labels_, offsets_.back() + 1);
+    }
+}
+
+void LevelLabels::swap(LevelLabels& other) {
+    num_labels_.swap(other.num_labels_);
+    std::swap(labels_, other.labels_);
+    offsets_.swap(other.offsets_);
+    std::swap(exact_start_, other.exact_start_);
+    std::swap(is_exact_, other.is_exact_);
+    levels_.swap(other.levels_);
+}
+
+void LevelLabels::reserveExact(const std::vector<position_t>& level_sizes,
+			       const level_t start_level) {
+    assert(numLevels() == 0);
+    clear();
+    offsets_.push_back(0);
+    for (level_t level = start_level; level < level_sizes.size(); level++)
+	offsets_.push_back(offsets_.back() + level_sizes[level]);
+    labels_ = new label_t[offsets_.back() + 1]; // the spare last byte
+    memset(labels_, 0, offsets_.back() + 1);
+    exact_start_ = start_level;
+    is_exact_ = true;
+}
+
+bool LevelLabels::isFull() const {
+    if (!is_exact_)
+	return false;
+    for (level_t level = exact_start_; level < numLevels(); level++) {
+	if (num_labels_[level] != capacity(level))
+	    return false;
+    }
+    return (numLevels() + 1 >= exact_start_ + offsets_.size());
+}
+
+void LevelLabels::addLevel() {
+    num_labels_.push_back(0);
+    levels_.push_back(std::vector<label_t>());
+}
+
+void LevelLabels::append(const level_t level, const LevelLabels& src, const level_t src_level,
+			 const position_t begin, const position_t end) {
+    if (end <= begin)
+	return;
+    if (inArray(level)) {
+	assert(num_labels_[level] + (end - begin) <= capacity(level));
+	memcpy(levelLabels(level) + num_labels_[level], src.levelLabels(src_level) + begin,
+	       end - begin);
+    } else {
+	levels_[level].insert(levels_[level].end(), src.levelLabels(src_level) + begin,
+			      src.levelLabels(src_level) + end);
+    }
+    num_labels_[level] += (end - begin);
+}
+
+label_t* LevelLabels::copy(const level_t start_level, const level_t end_level,
+			   position_t& num_labels) const {
+    num_labels = 0;
+    for (level_t level = start_level; level < end_level; level++)
+	num_labels += num_labels_[level];
+    label_t* labels = new label_t[num_labels + 1];
+    position_t pos = 0;
+    for (level_t level = start_level; level < end_level; level++) {
+	if (num_labels_[level] == 0) continue;
+	memcpy(labels + pos, levelLabels(level), num_labels_[level]);
+	pos += num_labels_[level];
+    }
+    labels[pos] = 0; // the spare last byte; keeps images deterministic
+    return labels;
+}
+
+label_t* LevelLabels::release(const level_t start_level, const level_t end_level,
+			      position_t& num_labels) {
+    if (!isFull() || (start_level != exact_start_) || (end_level != numLevels())) {
+	label_t* labels = copy(start_level, end_level, num_labels);
+	clear();
+	return labels;
+    }
+    num_labels = offsets_.back();
+    label_t* labels = labels_;
+    labels_ = nullptr;
+    clear();
+    return labels;
+}
+
+void LevelLabels::releaseLevels(const level_t start_level, const level_t end_level) {
+    for (level_t level = start_level; (level < end_level) && (level < numLevels()); level++)
+	std::vector<label_t>().swap(levels_[level]);
+}
+
+void LevelLabels::clear() {
+    std::vector<position_t>().swap(num_labels_);
+    delete[] labels_;
+    labels_ = nullptr;
+    std::vector<position_t>().swap(offsets_);
+    exact_start_ = 0;
+    is_exact_ = false;
+    std::vector<std::vector<label_t> >().swap(levels_);
+}
+
+bool LevelLabels::operator==(const LevelLabels& other) const {
+    if (num_labels_ != other.num_labels_)
+	return false;
+    for (level_t level = 0; level < numLevels(); level++) {
+	if (num_labels_[level] == 0) continue;
+	if (memcmp(levelLabels(level), other.levelLabels(level), num_labels_[level]) != 0)
+	    return false;
+    }
+    return true;
+}
+
+} // namespace surf
+
+#endif // LEVELVECTOR_H_
@@ -2,9 +2,14 @@
 #define LOUDSDENSE_H_
 
 #include <string>
+#include <vector>
 
 #include "config.hpp"
+#include "inline_vector.hpp"
 #include "rank.hpp"
+#include "serial_format.hpp"
+#include "slice.hpp"
+#include "stats.hpp"
 #include "suffix.hpp"
 #include "surf_builder.hpp"
 
@@ -15,16 +20,14 @@ public:
     class Iter {
     public:
 	Iter() : is_valid_(false) {};
-	Iter(LoudsDense* trie) : is_valid_(false), is_search_complete_(false),
+	Iter(const LoudsDense* trie) : is_valid_(false), is_search_complete_(false),
 				 is_move_left_complete_(false),
 				 is_move_right_complete_(false),
 				 trie_(trie),
 				 send_out_node_num_(0), key_len_(0),
 				 is_at_prefix_key_(false) {
-	    for (level_t level = 0; level < trie_->getHeight(); level++) {
-		key_.push_back(0);
-		pos_in_trie_.push_back(0);
-	    }
+	    key_.resize(trie_->getHeight());
+	    pos_in_trie_.resize(trie_->getHeight());
 	}
 
 	void clear();
@@ -37,8 +40,11 @@ public:
 		    (is_move_left_complete_ && is_move_right_complete_));
 	}
 
-	int compare(const std::string& key) const;
+	// Compares the key bytes in place; nothing is copied
+	int compare(const Slice& key) const;
 	std::string getKey() const;
+	// The bytes of getKey(), valid until the iterator moves
+	Slice getKeySlice() const;
 	int getSuffix(word_t* suffix) const;
 	std::string getKeyWithSuffix(unsigned* bitlen) const;
 	position_t getSendOutNodeNum() const { return send_out_node_num_; };
@@ -68,31 +74,71 @@ public:
 	bool is_move_left_complete_;
 	// If false, call moveToRightMostKey in LoudsSparse to complete
 	bool is_move_right_complete_; 
-	LoudsDense* trie_;
+	const LoudsDense* trie_;
 	position_t send_out_node_num_;
 	level_t key_len_; // Does NOT include suffix
 
-	std::vector<label_t> key_;
-	std::vector<position_t> pos_in_trie_;
+	InlineVector<label_t> key_;
+	InlineVector<position_t> pos_in_trie_;
 	bool is_at_prefix_key_;
 
 	friend class LoudsDense;
     };
 
 public:
-    LoudsDense() {};
+    LoudsDense() : height_(0), is_view_(false) {};
     LoudsDense(const SuRFBuilder* builder);
+    // Same as above, but if release_builder is set, the bitmaps take
+    // the builder's arrays over instead of copying them
+    LoudsDense(SuRFBuilder* builder, const bool release_builder);
 
     ~LoudsDense() {}
 
     // Returns whether key exists in the trie so far
     // out_node_num == 0 means search terminates in louds-dense.
-    bool lookupKey(const std::string& key, position_t& out_node_num) const;
+    bool lookupKey(const Slice& key, position_t& out_node_num) const;
+    // lookupKey for a trie of 8-byte keys (see SuRFInt64): key bytes come
+    // from the integer, and there are no prefix keys to check.
+    bool lookupKey(const uint64_t key, position_t& out_node_num) const;
+    // Returns false if no stored key starts with prefix. Like lookupKey,
+    // sets out_node_num if the walk must continue in LoudsSparse;
+    // requires at least one dense level.
+    bool lookupPrefix(const Slice& prefix, position_t& out_node_num) const;
+    // Batched version of lookupKey for n <= kLookupBatchSize keys.
+    // The walks are interleaved level by level: the bitmap words of all
+    // keys are prefetched before any of them is examined.
+    // key_hashes[i] = suffixHash(keys[i], getSuffixHashType()), read for
+    // hash suffixes only.
+    void lookupKeys(const Slice* keys, const word_t* key_hashes, const position_t n,
+		    bool* out, position_t* out_node_nums) const;
     // return value indicates potential false positive
-    bool moveToKeyGreaterThan(const std::string& key, 
+    bool moveToKeyGreaterThan(const Slice& key, 
 			      const bool inclusive, LoudsDense::Iter& iter) const;
+    // Same as moveToKeyGreaterThan, but keeps the longest part of iter's
+    // current path that is a prefix of key and descends only below it.
+    // Probing keys in sorted order through one iter skips shared prefixes.
+    bool resumeMoveToKeyGreaterThan(const Slice& key,
+				    const bool inclusive, LoudsDense::Iter& iter) const;
+    // Walks the first prefix_len bytes of left_key (its common prefix
+    // with right_key) and checks at level prefix_len for a label that
+    // lies strictly between the bounds. Returns kRangeContinue and the
+    // node to go on from if the walk leaves the dense levels.
+    RangeProbe probeRange(const Slice& left_key, const Slice& right_key,
+			  const level_t prefix_len, position_t& out_node_num) const;
+    // Returns the number of keys in the dense levels between the
+    // positions of iter_left and iter_right (nullptr: past the last key).
+    // Each position cuts every level into the items before and after
+    // it; the keys between two cuts are counted with rank differences.
+    // out_node_num is the first node below the cut at the sparse start
+    // level, or 0 if the cut follows the iterator into LOUDS-Sparse.
+    int64_t approxCount(const LoudsDense::Iter* iter_left,
+			const LoudsDense::Iter* iter_right,
+			position_t& out_node_num_left,
+			position_t& out_node_num_right) const;
 
     uint64_t getHeight() const { return height_; };
+    SuffixType getSuffixType() const { return suffixes_.getType(); };
+    SuffixHashType getSuffixHashType() const { return suffixes_.getHashType(); };
     uint64_t serializedSize() const;
     uint64_t getMemoryUsage() const;
 
@@ -100,31 +146,77 @@ public:
 	memcpy(dst, &height_, sizeof(height_));
 	dst += sizeof(height_);
 	align(dst);
-	label_bitmaps_->serialize(dst);
-	child_indicator_bitmaps_->serialize(dst);
-	prefixkey_indicator_bits_->serialize(dst);
-	suffixes_->serialize(dst);
+	label_bitmaps_.serialize(dst);
+	child_indicator_bitmaps_.serialize(dst);
+	prefixkey_indicator_bits_.serialize(dst);
+	suffixes_.serialize(dst);
 	align(dst);
     }
 
+    // Writes one section per component (see serial_format.hpp)
+    void serialize(SectionWriter& writer) const {
+	writeMeta(writer, height_);
+	writeSection(writer, kSectionDenseLabelBitmaps, label_bitmaps_);
+	writeSection(writer, kSectionDenseChildIndicatorBitmaps, child_indicator_bitmaps_);
+	writeSection(writer, kSectionDensePrefixkeyIndicatorBits, prefixkey_indicator_bits_);
+	writeSection(writer, kSectionDenseSuffixes, suffixes_);
+    }
+
+    // Writes the same sections as LoudsDense(builder).serialize(writer),
+    // but builds each component only when its section is due and frees
+    // it right after; the whole LoudsDense is never in memory.
+    static void serialize(const SuRFBuilder* builder, SectionWriter& writer);
+
     static LoudsDense* deSerialize(char*& src) {
 	LoudsDense* louds_dense = new LoudsDense();
-	memcpy(&(louds_dense->height_), src, sizeof(louds_dense->height_));
-	src += sizeof(louds_dense->height_);
-	align(src);
-	louds_dense->label_bitmaps_ = BitvectorRank::deSerialize(src);
-	louds_dense->child_indicator_bitmaps_ = BitvectorRank::deSerialize(src);
-	louds_dense->prefixkey_indicator_bits_ = BitvectorRank::deSerialize(src);
-	louds_dense->suffixes_ = BitvectorSuffix::deSerialize(src);
-	align(src);
+	const char* cur = src;
+	louds_dense->loadView(cur, nullptr);
+	src = const_cast<char*>(cur);
 	return louds_dense;
     }
 
+    // Points all components at a serialized image without copying.
+    // Returns false if the image is malformed or does not fit before end.
+    // Once loaded, destroy() leaves the image untouched.
+    bool loadView(const char*& src, const char* end) {
+	is_view_ = true;
+	if (!isAligned(src) || !fitsInBuffer(src, end, sizeof(height_)))
+	    return false;
+	memcpy(&height_, src, sizeof(height_));
+	src += sizeof(height_);
+	align(src);
+	return (label_bitmaps_.loadView(src, end)
+		&& child_indicator_bitmaps_.loadView(src, end)
+		&& prefixkey_indicator_bits_.loadView(src, end)
+		&& suffixes_.loadView(src, end));
+    }
+
+    // Same as above, but each component is bounded by its own section.
+    bool loadView(const SectionTable& table) {
+	is_view_ = true;
+	const char* src;
+	const char* end;
+	if (!table.find(kSectionDenseMeta, src, end)
+	    || !fitsInBuffer(src, end, sizeof(height_)))
+	    return false;
+	memcpy(&height_, src, sizeof(height_));
+	return (table.find(kSectionDenseLabelBitmaps, src, end)
+		&& label_bitmaps_.loadView(src, end)
+		&& table.find(kSectionDenseChildIndicatorBitmaps, src, end)
+		&& child_indicator_bitmaps_.loadView(src, end)
+		&& table.find(kSectionDensePrefixkeyIndicatorBits, src, end)
+		&& prefixkey_indicator_bits_.loadView(src, end)
+		&& table.find(kSectionDenseSuffixes, src, end)
+		&& suffixes_.loadView(src, end));
+    }
+
     void destroy() {
-	label_bitmaps_->destroy();
-	child_indicator_bitmaps_->destroy();
-	prefixkey_indicator_bits_->destroy();
-	suffixes_->destroy();
+	if (is_view_)
+	    return;
+	label_bitmaps_.destroy();
+	child_indicator_bitmaps_.destroy();
+	prefixkey_indicator_bits_.destroy();
+	suffixes_.destroy();
     }
 
 private:
@@ -133,9 +225,20 @@ private:
     position_t getNextPos(const position_t pos) const;
     position_t getPrevPos(const position_t pos, bool* is_out_of_bound) const;
 
-    bool compareSuffixGreaterThan(const position_t pos, const std::string& key, 
+    bool compareSuffixGreaterThan(const position_t pos, const Slice& key, 
 				  const level_t level, const bool inclusive, 
 				  LoudsDense::Iter& iter) const;
+    // Descends from node_num at start_level; iter holds the path above it
+    bool moveToKeyGreaterThanFrom(const Slice& key, const bool inclusive,
+				  const level_t start_level, position_t node_num,
+				  LoudsDense::Iter& iter) const;
+
+    // Shared by the constructors; takes the bitmaps of spent_builder
+    // (builder itself, or nullptr) over instead of copying them
+    void init(const SuRFBuilder* builder, SuRFBuilder* spent_builder);
+
+    static void writeMeta(SectionWriter& writer, const level_t height);
+    static BitvectorSuffix buildSuffixes(const SuRFBuilder* builder);
 
 private:
     static const position_t kNodeFanout = 256;
@@ -143,87 +246,294 @@ private:
 
     level_t height_;
 
-    BitvectorRank* label_bitmaps_;
-    BitvectorRank* child_indicator_bitmaps_;
-    BitvectorRank* prefixkey_indicator_bits_; //1 bit per internal node
-    BitvectorSuffix* suffixes_;
+    BitvectorRank label_bitmaps_;
+    BitvectorRank child_indicator_bitmaps_;
+    BitvectorRank prefixkey_indicator_bits_; //1 bit per internal node
+    BitvectorSuffix suffixes_;
+    bool is_view_; // true if the bits live in a caller-owned buffer
 };
 
 
-LoudsDense::LoudsDense(const SuRFBuilder* builder) {
-    height_ = builder->getSparseStartLevel();
-    std::vector<position_t> num_bits_per_level;
-    for (level_t level = 0; level < height_; level++)
-	num_bits_per_level.push_back(builder->getBitmapLabels()[level].size() * kWordSize);
+LoudsDense::LoudsDense(const SuRFBuilder* builder) : is_view_(false) {
+    init(builder, nullptr);
+}
+
+LoudsDense::LoudsDense(SuRFBuilder* builder, const bool release_builder) : is_view_(false) {
+    init(builder, release_builder ? builder : nullptr);
+}
 
-    label_bitmaps_ = new BitvectorRank(kRankBasicBlockSize, builder->getBitmapLabels(),
-				       num_bits_per_level, 0, height_);
-    child_indicator_bitmaps_ = new BitvectorRank(kRankBasicBlockSize,
+void LoudsDense::init(const SuRFBuilder* builder, SuRFBuilder* spent_builder) {
+    height_ = builder->getSparseStartLevel();
+    RankType rank_type = builder->getRankType();
+    if (spent_builder == nullptr) {
+	label_bitmaps_ = BitvectorRank(kRankBasicBlockSize, builder->getBitmapLabels(),
+				       0, height_, rank_type);
+	child_indicator_bitmaps_ = BitvectorRank(kRankBasicBlockSize,
 						 builder->getBitmapChildIndicatorBits(),
-						 num_bits_per_level, 0, height_);
-    prefixkey_indicator_bits_ = new BitvectorRank(kRankBasicBlockSize,
+						 0, height_, rank_type);
+	prefixkey_indicator_bits_ = BitvectorRank(kRankBasicBlockSize,
 						  builder->getPrefixkeyIndicatorBits(),
-						  builder->getNodeCounts(), 0, height_);
-
-    if (builder->getSuffixType() == kNone) {
-	suffixes_ = new BitvectorSuffix();
+						  0, height_, rank_type);
     } else {
-	level_t hash_suffix_len = builder->getHashSuffixLen();
-        level_t real_suffix_len = builder->getRealSuffixLen();
-        level_t suffix_len = hash_suffix_len + real_suffix_len;
-	std::vector<position_t> num_suffix_bits_per_level;
-	for (level_t level = 0; level < height_; level++)
-	    num_suffix_bits_per_level.push_back(builder->getSuffixCounts()[level] * suffix_len);
-	suffixes_ = new BitvectorSuffix(builder->getSuffixType(), 
-					hash_suffix_len, real_suffix_len,
-                                        builder->getSuffixes(),
-					num_suffix_bits_per_level, 0, height_);
+	position_t num_bits;
+	word_t* bits = spent_builder->bitmap_labels_.release(0, height_, num_bits);
+	label_bitmaps_ = BitvectorRank(kRankBasicBlockSize, bits, num_bits, rank_type);
+	bits = spent_builder->bitmap_child_indicator_bits_.release(0, height_, num_bits);
+	child_indicator_bitmaps_ = BitvectorRank(kRankBasicBlockSize, bits, num_bits, rank_type);
+	bits = spent_builder->prefixkey_indicator_bits_.release(0, height_, num_bits);
+	prefixkey_indicator_bits_ = BitvectorRank(kRankBasicBlockSize, bits, num_bits, rank_type);
     }
+    // the dense suffix levels lie in vectors of their own; they are
+    // concatenated, and freed by SuRFBuilder::releaseDenseLevels
+    suffixes_ = buildSuffixes(builder);
+}
+
+void LoudsDense::serialize(const SuRFBuilder* builder, SectionWriter& writer) {
+    level_t height = builder->getSparseStartLevel();
+    writeMeta(writer, height);
+    RankType rank_type = builder->getRankType();
+
+    BitvectorRank bitmaps(kRankBasicBlockSize, builder->getBitmapLabels(),
+			  0, height, rank_type);
+    writeSection(writer, kSectionDenseLabelBitmaps, bitmaps);
+    bitmaps.destroy();
+    bitmaps = BitvectorRank(kRankBasicBlockSize, builder->getBitmapChildIndicatorBits(),
+			    0, height, rank_type);
+    writeSection(writer, kSectionDenseChildIndicatorBitmaps, bitmaps);
+    bitmaps.destroy();
+    bitmaps = BitvectorRank(kRankBasicBlockSize, builder->getPrefixkeyIndicatorBits(),
+			    0, height, rank_type);
+    writeSection(writer, kSectionDensePrefixkeyIndicatorBits, bitmaps);
+    bitmaps.destroy();
+
+    BitvectorSuffix suffixes = buildSuffixes(builder);
+    writeSection(writer, kSectionDenseSuffixes, suffixes);
+    suffixes.destroy();
+}
+
+void LoudsDense::writeMeta(SectionWriter& writer, const level_t height) {
+    uint64_t size = sizeof(height);
+    sizeAlign(size);
+    char* dst = writer.beginSection(kSectionDenseMeta, size);
+    memcpy(dst, &height, sizeof(height));
+    dst += sizeof(height);
+    align(dst);
+    writer.endSection(dst);
 }
 
-bool LoudsDense::lookupKey(const std::string& key, position_t& out_node_num) const {
+BitvectorSuffix LoudsDense::buildSuffixes(const SuRFBuilder* builder) {
+    if (builder->getSuffixType() == kNone)
+	return BitvectorSuffix();
+    return BitvectorSuffix(builder->getSuffixType(),
+			   builder->getHashSuffixLen(), builder->getRealSuffixLen(),
+			   builder->getSuffixes(), 0, builder->getSparseStartLevel(),
+			   builder->getSuffixHashType());
+}
+
+bool LoudsDense::lookupKey(const Slice& key, position_t& out_node_num) const {
+    SURF_STAT(lookupStats().dense_lookups++);
     position_t node_num = 0;
     position_t pos = 0;
     for (level_t level = 0; level < height_; level++) {
+	SURF_STAT(lookupStats().dense_levels++);
 	pos = (node_num * kNodeFanout);
 	if (level >= key.length()) { //if run out of searchKey bytes
-	    if (prefixkey_indicator_bits_->readBit(node_num)) //if the prefix is also a key
-		return suffixes_->checkEquality(getSuffixPos(pos, true), key, level + 1);
-	    else
-		return false;
+	    if (prefixkey_indicator_bits_.readBit(node_num)) { //if the prefix is also a key
+		SURF_STAT(lookupStats().recordExit(false, kExitPrefixKey, level + 1));
+		return suffixes_.checkEquality(getSuffixPos(pos, true), key, level + 1);
+	    }
+	    SURF_STAT(lookupStats().recordExit(false, kExitKeyEnd, level + 1));
+	    return false;
 	}
 	pos += (label_t)key[level];
 
-	//child_indicator_bitmaps_->prefetch(pos);
+	//child_indicator_bitmaps_.prefetch(pos);
 
-	if (!label_bitmaps_->readBit(pos)) //if key byte does not exist
+	if (!label_bitmaps_.readBit(pos)) { //if key byte does not exist
+	    SURF_STAT(lookupStats().recordExit(false, kExitNoLabel, level + 1));
 	    return false;
+	}
 
-	if (!child_indicator_bitmaps_->readBit(pos)) //if trie branch terminates
-	    return suffixes_->checkEquality(getSuffixPos(pos, false), key, level + 1);
+	if (!child_indicator_bitmaps_.readBit(pos)) { //if trie branch terminates
+	    SURF_STAT(lookupStats().recordExit(false, kExitLeaf, level + 1));
+	    return suffixes_.checkEquality(getSuffixPos(pos, false), key, level + 1);
+	}
 
 	node_num = getChildNodeNum(pos);
     }
     //search will continue in LoudsSparse
+    SURF_STAT(lookupStats().recordExit(false, kExitToSparse, height_));
     out_node_num = node_num;
     return true;
 }
 
-bool LoudsDense::moveToKeyGreaterThan(const std::string& key, 
+bool LoudsDense::lookupKey(const uint64_t key, position_t& out_node_num) const {
+    SURF_STAT(lookupStats().dense_lookups++);
+    position_t node_num = 0;
+    for (level_t level = 0; (level < height_) && (level < kUint64KeyLen); level++) {
+	SURF_STAT(lookupStats().dense_levels++);
+	position_t pos = (node_num * kNodeFanout) + uint64KeyByte(key, level);
+	if (!label_bitmaps_.readBit(pos)) { //if key byte does not exist
+	    SURF_STAT(lookupStats().recordExit(false, kExitNoLabel, level + 1));
+	    return false;
+	}
+	if (!child_indicator_bitmaps_.readBit(pos)) { //if trie branch terminates
+	    SURF_STAT(lookupStats().recordExit(false, kExitLeaf, level + 1));
+	    // getSuffixPos without the (all zero) prefix key bits
+	    position_t suffix_pos = label_bitmaps_.rank(pos) - child_indicator_bitmaps_.rank(pos) - 1;
+	    return suffixes_.checkEquality(suffix_pos, key, level + 1);
+	}
+	node_num = getChildNodeNum(pos);
+    }
+    //search will continue in LoudsSparse
+    SURF_STAT(lookupStats().recordExit(false, kExitToSparse, height_));
+    out_node_num = node_num;
+    return true;
+}
+
+bool LoudsDense::lookupPrefix(const Slice& prefix, position_t& out_node_num) const {
+    position_t node_num = 0;
+    for (level_t level = 0; level < height_; level++) {
+	if (level >= prefix.length()) // every key below this node has the prefix
+	    return true;
+	position_t pos = (node_num * kNodeFanout) + (label_t)prefix[level];
+	if (!label_bitmaps_.readBit(pos)) //if prefix byte does not exist
+	    return false;
+	if (!child_indicator_bitmaps_.readBit(pos)) //if trie branch terminates
+	    return suffixes_.checkPrefix(getSuffixPos(pos, false), prefix, level + 1);
+	node_num = getChildNodeNum(pos);
+    }
+    //search will continue in LoudsSparse
+    out_node_num = node_num;
+    return true;
+}
+
+void LoudsDense::lookupKeys(const Slice* keys, const word_t* key_hashes,
+			    const position_t n,
+			    bool* out, position_t* out_node_nums) const {
+    assert(n <= kLookupBatchSize);
+    position_t node_nums[kLookupBatchSize];
+    position_t positions[kLookupBatchSize];
+    position_t active[kLookupBatchSize]; // keys whose walk is not finished
+    position_t num_active = 0;
+    for (position_t i = 0; i < n; i++) {
+	node_nums[i] = 0;
+	out_node_nums[i] = 0;
+	active[num_active++] = i;
+    }
+
+    for (level_t level = 0; (level < height_) && (num_active > 0); level++) {
+	for (position_t j = 0; j < num_active; j++) {
+	    position_t i = active[j];
+	    positions[i] = node_nums[i] * kNodeFanout;
+	    if (level < keys[i].length()) {
+		positions[i] += (label_t)keys[i][level];
+		label_bitmaps_.prefetch(positions[i]);
+		child_indicator_bitmaps_.prefetch(positions[i]);
+	    }
+	}
+
+	position_t num_next_active = 0;
+	for (position_t j = 0; j < num_active; j++) {
+	    position_t i = active[j];
+	    position_t pos = positions[i];
+	    if (level >= keys[i].length()) { //if run out of searchKey bytes
+		if (prefixkey_indicator_bits_.readBit(node_nums[i])) //if the prefix is also a key
+		    out[i] = suffixes_.checkEquality(getSuffixPos(pos, true), keys[i], level + 1,
+						     key_hashes[i]);
+		else
+		    out[i] = false;
+	    } else if (!label_bitmaps_.readBit(pos)) { //if key byte does not exist
+		out[i] = false;
+	    } else if (!child_indicator_bitmaps_.readBit(pos)) { //if trie branch terminates
+		out[i] = suffixes_.checkEquality(getSuffixPos(pos, false), keys[i], level + 1,
+						 key_hashes[i]);
+	    } else {
+		node_nums[i] = getChildNodeNum(pos);
+		active[num_next_active++] = i;
+	    }
+	}
+	num_active = num_next_active;
+    }
+
+    //search will continue in LoudsSparse
+    for (position_t j = 0; j < num_active; j++) {
+	position_t i = active[j];
+	out[i] = true;
+	out_node_nums[i] = node_nums[i];
+    }
+}
+
+RangeProbe LoudsDense::probeRange(const Slice& left_key, const Slice& right_key,
+				  const level_t prefix_len, position_t& out_node_num) const {
+    position_t node_num = 0;
+    for (level_t level = 0; level < height_; level++) {
+	position_t pos = node_num * kNodeFanout;
+	if (level == prefix_len) {
+	    if (level >= right_key.length())
+		return kRangeUnknown;
+	    // labels in [lo, hi) lead only to keys between the bounds
+	    position_t lo = 0;
+	    if (level < left_key.length())
+		lo = (position_t)(label_t)left_key[level] + 1;
+	    position_t hi = (label_t)right_key[level];
+	    if ((lo < hi)
+		&& (label_bitmaps_.rankBefore(pos + hi) > label_bitmaps_.rankBefore(pos + lo)))
+		return kRangeNonEmpty;
+	    return kRangeUnknown;
+	}
+	pos += (label_t)left_key[level];
+	if (!label_bitmaps_.readBit(pos))
+	    return kRangeEmpty;
+	if (!child_indicator_bitmaps_.readBit(pos)) // a stored key ends on the prefix
+	    return kRangeUnknown;
+	node_num = getChildNodeNum(pos);
+    }
+    out_node_num = node_num;
+    return kRangeContinue;
+}
+
+bool LoudsDense::moveToKeyGreaterThan(const Slice& key, 
 				      const bool inclusive, LoudsDense::Iter& iter) const {
+    return moveToKeyGreaterThanFrom(key, inclusive, 0, 0, iter);
+}
+
+bool LoudsDense::resumeMoveToKeyGreaterThan(const Slice& key,
+					    const bool inclusive, LoudsDense::Iter& iter) const {
+    level_t level = 0;
     position_t node_num = 0;
+    if (iter.isValid() && (iter.key_len_ > 0)) {
+	// every position above the last one on the path has a child;
+	// the last one may be a leaf (or the label after a prefix key)
+	level_t max_level = iter.key_len_ - 1;
+	while ((level < max_level) && (level < key.length())
+	       && (iter.key_[level] == (label_t)key[level]))
+	    level++;
+	if (level > 0)
+	    node_num = getChildNodeNum(iter.pos_in_trie_[level - 1]);
+    }
+    iter.clear();
+    iter.key_len_ = level;
+    return moveToKeyGreaterThanFrom(key, inclusive, level, node_num, iter);
+}
+
+bool LoudsDense::moveToKeyGreaterThanFrom(const Slice& key, const bool inclusive,
+					  const level_t start_level, position_t node_num,
+					  LoudsDense::Iter& iter) const {
     position_t pos = 0;
-    for (level_t level = 0; level < height_; level++) {
+    for (level_t level = start_level; level < height_; level++) {
 	// if is_at_prefix_key_, pos is at the next valid position in the child node
 	pos = node_num * kNodeFanout;
 	if (level >= key.length()) { // if run out of searchKey bytes
 	    iter.append(getNextPos(pos - 1));
-	    if (prefixkey_indicator_bits_->readBit(node_num)) //if the prefix is also a key
+	    if (prefixkey_indicator_bits_.readBit(node_num)) { //if the prefix is also a key
 		iter.is_at_prefix_key_ = true;
-	    else
+		// valid, search complete, moveLeft complete, moveRight complete
+		iter.setFlags(true, true, true, true);
+	    } else {
+		// may leave the rest of the descent to LoudsSparse
 		iter.moveToLeftMostKey();
-	    // valid, search complete, moveLeft complete, moveRight complete
-	    iter.setFlags(true, true, true, true); 
+	    }
 	    return true;
 	}
 
@@ -231,12 +541,12 @@ bool LoudsDense::moveToKeyGreaterThan(const std::string& key,
 	iter.append(pos);
 
 	// if no exact match
-	if (!label_bitmaps_->readBit(pos)) {
+	if (!label_bitmaps_.readBit(pos)) {
 	    iter++;
 	    return false;
 	}
 	//if trie branch terminates
-	if (!child_indicator_bitmaps_->readBit(pos))
+	if (!child_indicator_bitmaps_.readBit(pos))
 	    return compareSuffixGreaterThan(pos, key, level+1, inclusive, iter);
 	node_num = getChildNodeNum(pos);
     }
@@ -250,43 +560,103 @@ bool LoudsDense::moveToKeyGreaterThan(const std::string& key,
 
 uint64_t LoudsDense::serializedSize() const {
     uint64_t size = sizeof(height_)
-	+ label_bitmaps_->serializedSize()
-	+ child_indicator_bitmaps_->serializedSize()
-	+ prefixkey_indicator_bits_->serializedSize()
-	+ suffixes_->serializedSize();
+	+ label_bitmaps_.serializedSize()
+	+ child_indicator_bitmaps_.serializedSize()
+	+ prefixkey_indicator_bits_.serializedSize()
+	+ suffixes_.serializedSize();
     sizeAlign(size);
     return size;
 }
 
 uint64_t LoudsDense::getMemoryUsage() const {
     return (sizeof(LoudsDense)
-	    + label_bitmaps_->size()
-	    + child_indicator_bitmaps_->size()
-	    + prefixkey_indicator_bits_->size()
-	    + suffixes_->size());
+	    + label_bitmaps_.size()
+	    + child_indicator_bitmaps_.size()
+	    + prefixkey_indicator_bits_.size()
+	    + suffixes_.size());
+}
+
+int64_t LoudsDense::approxCount(const LoudsDense::Iter* iter_left,
+				const LoudsDense::Iter* iter_right,
+				position_t& out_node_num_left,
+				position_t& out_node_num_right) const {
+    const LoudsDense::Iter* iters[2] = {iter_left, iter_right};
+    // A non-zero node_num means that the cut has left the iterator's
+    // path and starts at that node on the current level. The cut past
+    // the last key starts at node 1, i.e., right after the root.
+    position_t node_nums[2];
+    for (int i = 0; i < 2; i++)
+	node_nums[i] = (iters[i] == nullptr) ? 1 : 0;
+
+    position_t num_bits = label_bitmaps_.numBits();
+    position_t num_nodes = prefixkey_indicator_bits_.numBits();
+    int64_t count = 0;
+    for (level_t level = 0; level < height_; level++) {
+	position_t cuts[2]; // label positions before the cut
+	position_t node_cuts[2]; // nodes whose prefix key is before the cut
+	bool is_path_end[2];
+	for (int i = 0; i < 2; i++) {
+	    is_path_end[i] = false;
+	    if (node_nums[i] > 0) {
+		if (node_nums[i] >= num_nodes) {
+		    cuts[i] = num_bits;
+		    node_cuts[i] = num_nodes;
+		} else {
+		    cuts[i] = node_nums[i] * kNodeFanout;
+		    node_cuts[i] = node_nums[i];
+		}
+		continue;
+	    }
+	    const LoudsDense::Iter* iter = iters[i];
+	    position_t pos = iter->pos_in_trie_[level];
+	    is_path_end[i] = iter->isComplete() && (level + 1 == iter->key_len_);
+	    if (is_path_end[i] && iter->is_at_prefix_key_) {
+		node_cuts[i] = pos / kNodeFanout;
+		cuts[i] = node_cuts[i] * kNodeFanout;
+	    } else {
+		node_cuts[i] = pos / kNodeFanout + 1;
+		cuts[i] = pos;
+	    }
+	}
+
+	count += ((int64_t)label_bitmaps_.rankBefore(cuts[1])
+		  - (int64_t)label_bitmaps_.rankBefore(cuts[0]));
+	count -= ((int64_t)child_indicator_bitmaps_.rankBefore(cuts[1])
+		  - (int64_t)child_indicator_bitmaps_.rankBefore(cuts[0]));
+	count += ((int64_t)prefixkey_indicator_bits_.rankBefore(node_cuts[1])
+		  - (int64_t)prefixkey_indicator_bits_.rankBefore(node_cuts[0]));
+
+	for (int i = 0; i < 2; i++) {
+	    if ((node_nums[i] > 0) || is_path_end[i])
+		node_nums[i] = child_indicator_bitmaps_.rankBefore(cuts[i]) + 1;
+	}
+    }
+    out_node_num_left = node_nums[0];
+    out_node_num_right = node_nums[1];
+    return count;
 }
 
 position_t LoudsDense::getChildNodeNum(const position_t pos) const {
-    return child_indicator_bitmaps_->rank(pos);
+    return child_indicator_bitmaps_.rank(pos);
 }
 
 position_t LoudsDense::getSuffixPos(const position_t pos, const bool is_prefix_key) const {
     position_t node_num = pos / kNodeFanout;
-    position_t suffix_pos = (label_bitmaps_->rank(pos)
-			     - child_indicator_bitmaps_->rank(pos)
-			     + prefixkey_indicator_bits_->rank(node_num)
+    position_t suffix_pos = (label_bitmaps_.rank(pos)
+			     - child_indicator_bitmaps_.rank(pos)
+			     + prefixkey_indicator_bits_.rank(node_num)
 			     - 1);
-    if (is_prefix_key && label_bitmaps_->readBit(pos) && !child_indicator_bitmaps_->readBit(pos))
+    if (is_prefix_key && label_bitmaps_.readBit(pos) && !child_indicator_bitmaps_.readBit(pos))
 	suffix_pos--;
     return suffix_pos;
 }
 
 position_t LoudsDense::getNextPos(const position_t pos) const {
-    return pos + label_bitmaps_->distanceToNextSetBit(pos);
+    return pos + label_bitmaps_.distanceToNextSetBit(pos);
 }
 
 position_t LoudsDense::getPrevPos(const position_t pos, bool* is_out_of_bound) const {
-    position_t distance = label_bitmaps_->distanceToPrevSetBit(pos);
+    position_t distance = label_bitmaps_.distanceToPrevSetBit(pos);
     if (pos <= distance) {
 	*is_out_of_bound = true;
 	return 0;
@@ -295,11 +665,11 @@ position_t LoudsDense::getPrevPos(const position_t pos, bool* is_out_of_bound) c
     return (pos - distance);
 }
 
-bool LoudsDense::compareSuffixGreaterThan(const position_t pos, const std::string& key, 
+bool LoudsDense::compareSuffixGreaterThan(const position_t pos, const Slice& key, 
 					  const level_t level, const bool inclusive, 
 					  LoudsDense::Iter& iter) const {
     position_t suffix_pos = getSuffixPos(pos, false);
-    int compare = suffixes_->compare(suffix_pos, key, level);
+    int compare = suffixes_.compare(suffix_pos, key, level);
     if ((compare != kCouldBePositive) && (compare < 0)) {
 	iter++;
 	return false;
@@ -317,35 +687,38 @@ void LoudsDense::Iter::clear() {
     is_at_prefix_key_ = false;
 }
 
-int LoudsDense::Iter::compare(const std::string& key) const {
+int LoudsDense::Iter::compare(const Slice& key) const {
     if (is_at_prefix_key_ && (key_len_ - 1) < key.length())
 	return -1;
-    std::string iter_key = getKey();
-    std::string key_dense = key.substr(0, iter_key.length());
-    int compare = iter_key.compare(key_dense);
+    Slice iter_key = getKeySlice();
+    int compare = iter_key.compare(key.substr(0, iter_key.length()));
     if (compare != 0) return compare;
     if (isComplete()) {
 	position_t suffix_pos = trie_->getSuffixPos(pos_in_trie_[key_len_ - 1], is_at_prefix_key_);
-	return trie_->suffixes_->compare(suffix_pos, key, key_len_);
+	return trie_->suffixes_.compare(suffix_pos, key, key_len_);
     }
     return compare;
 }
 
 std::string LoudsDense::Iter::getKey() const {
+    return getKeySlice().toString();
+}
+
+Slice LoudsDense::Iter::getKeySlice() const {
     if (!is_valid_)
-	return std::string();
+	return Slice();
     level_t len = key_len_;
     if (is_at_prefix_key_)
 	len--;
-    return std::string((const char*)key_.data(), (size_t)len);
+    return Slice((const char*)key_.data(), (size_t)len);
 }
 
 int LoudsDense::Iter::getSuffix(word_t* suffix) const {
     if (isComplete()
-        && ((trie_->suffixes_->getType() == kReal) || (trie_->suffixes_->getType() == kMixed))) {
+        && ((trie_->suffixes_.getType() == kReal) || (trie_->suffixes_.getType() == kMixed))) {
 	position_t suffix_pos = trie_->getSuffixPos(pos_in_trie_[key_len_ - 1], is_at_prefix_key_);
-	*suffix = trie_->suffixes_->readReal(suffix_pos);
-	return trie_->suffixes_->getRealSuffixLen();
+	*suffix = trie_->suffixes_.readReal(suffix_pos);
+	return trie_->suffixes_.getRealSuffixLen();
     }
     *suffix = 0;
     return 0;
@@ -354,11 +727,11 @@ int LoudsDense::Iter::getSuffix(word_t* suffix) const {
 std::string LoudsDense::Iter::getKeyWithSuffix(unsigned* bitlen) const {
     std::string iter_key = getKey();
     if (isComplete()
-        && ((trie_->suffixes_->getType() == kReal) || (trie_->suffixes_->getType() == kMixed))) {
+        && ((trie_->suffixes_.getType() == kReal) || (trie_->suffixes_.getType() == kMixed))) {
 	position_t suffix_pos = trie_->getSuffixPos(pos_in_trie_[key_len_ - 1], is_at_prefix_key_);
-	word_t suffix = trie_->suffixes_->readReal(suffix_pos);
+	word_t suffix = trie_->suffixes_.readReal(suffix_pos);
 	if (suffix > 0) {
-	    level_t suffix_len = trie_->suffixes_->getRealSuffixLen();
+	    level_t suffix_len = trie_->suffixes_.getRealSuffixLen();
 	    *bitlen = suffix_len % 8;
 	    suffix <<= (64 - suffix_len);
 	    char* suffix_str = reinterpret_cast<char*>(&suffix);
@@ -398,7 +771,9 @@ void LoudsDense::Iter::setFlags(const bool is_valid,
 }
 
 void LoudsDense::Iter::setToFirstLabelInRoot() {
-    if (trie_->label_bitmaps_->readBit(0)) {
+    if (trie_->getHeight() == 0)
+	return;
+    if (trie_->label_bitmaps_.readBit(0)) {
 	pos_in_trie_[0] = 0;
 	key_[0] = (label_t)0;
     } else {
@@ -409,6 +784,8 @@ void LoudsDense::Iter::setToFirstLabelInRoot() {
 }
 
 void LoudsDense::Iter::setToLastLabelInRoot() {
+    if (trie_->getHeight() == 0)
+	return;
     bool is_out_of_bound;
     pos_in_trie_[0] = trie_->getPrevPos(kNodeFanout, &is_out_of_bound);
     key_[0] = (label_t)pos_in_trie_[0];
@@ -416,17 +793,21 @@ void LoudsDense::Iter::setToLastLabelInRoot() {
 }
 
 void LoudsDense::Iter::moveToLeftMostKey() {
-    assert(key_len_ > 0);
+    if (key_len_ == 0) { // zero-height trie: the walk starts in LoudsSparse
+	send_out_node_num_ = 0;
+	// valid, search complete, moveLeft INCOMPLETE, moveRight complete
+	return setFlags(true, true, false, true);
+    }
     level_t level = key_len_ - 1;
     position_t pos = pos_in_trie_[level];
-    if (!trie_->child_indicator_bitmaps_->readBit(pos))
+    if (!trie_->child_indicator_bitmaps_.readBit(pos))
 	// valid, search complete, moveLeft complete, moveRight complete
 	return setFlags(true, true, true, true);
 
     while (level < trie_->getHeight() - 1) {
 	position_t node_num = trie_->getChildNodeNum(pos);
 	//if the current prefix is also a key
-	if (trie_->prefixkey_indicator_bits_->readBit(node_num)) {
+	if (trie_->prefixkey_indicator_bits_.readBit(node_num)) {
 	    append(trie_->getNextPos(node_num * kNodeFanout - 1));
 	    is_at_prefix_key_ = true;
 	    // valid, search complete, moveLeft complete, moveRight complete
@@ -437,7 +818,7 @@ void LoudsDense::Iter::moveToLeftMostKey() {
 	append(pos);
 
 	// if trie branch terminates
-	if (!trie_->child_indicator_bitmaps_->readBit(pos))
+	if (!trie_->child_indicator_bitmaps_.readBit(pos))
 	    // valid, search complete, moveLeft complete, moveRight complete
 	    return setFlags(true, true, true, true);
 
@@ -449,10 +830,14 @@ void LoudsDense::Iter::moveToLeftMostKey() {
 }
 
 void LoudsDense::Iter::moveToRightMostKey() {
-    assert(key_len_ > 0);
+    if (key_len_ == 0) { // zero-height trie: the walk starts in LoudsSparse
+	send_out_node_num_ = 0;
+	// valid, search complete, moveleft complete, moveRight INCOMPLETE
+	return setFlags(true, true, true, false);
+    }
     level_t level = key_len_ - 1;
     position_t pos = pos_in_trie_[level];
-    if (!trie_->child_indicator_bitmaps_->readBit(pos))
+    if (!trie_->child_indicator_bitmaps_.readBit(pos))
 	// valid, search complete, moveLeft complete, moveRight complete
 	return setFlags(true, true, true, true);
 
@@ -467,7 +852,7 @@ void LoudsDense::Iter::moveToRightMostKey() {
 	append(pos);
 
 	// if trie branch terminates
-	if (!trie_->child_indicator_bitmaps_->readBit(pos))
+	if (!trie_->child_indicator_bitmaps_.readBit(pos))
 	    // valid, search complete, moveLeft complete, moveRight complete
 	    return setFlags(true, true, true, true);
 
@@ -479,7 +864,10 @@ void LoudsDense::Iter::moveToRightMostKey() {
 }
 
 void LoudsDense::Iter::operator ++(int) {
-    assert(key_len_ > 0);
+    if (key_len_ == 0) { // zero-height trie: the empty path is the only one
+	is_valid_ = false;
+	return;
+    }
     if (is_at_prefix_key_) {
 	is_at_prefix_key_ = false;
 	return moveToLeftMostKey();
@@ -501,7 +889,10 @@ void LoudsDense::Iter::operator ++(int) {
 }
 
 void LoudsDense::Iter::operator --(int) {
-    assert(key_len_ > 0);
+    if (key_len_ == 0) { // zero-height trie: the empty path is the only one
+	is_valid_ = false;
+	return;
+    }
     if (is_at_prefix_key_) {
 	is_at_prefix_key_ = false;
 	key_len_--;
@@ -518,7 +909,7 @@ void LoudsDense::Iter::operator --(int) {
     while ((prev_pos / kNodeFanout) < (pos / kNodeFanout)) {
 	//if the current prefix is also a key
 	position_t node_num = pos / kNodeFanout;
-	if (trie_->prefixkey_indicator_bits_->readBit(node_num)) {
+	if (trie_->prefixkey_indicator_bits_.readBit(node_num)) {
 	    is_at_prefix_key_ = true;
 	    // valid, search complete, moveLeft complete, moveRight complete
 	    return setFlags(true, true, true, true);
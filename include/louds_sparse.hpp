@@ -2,11 +2,16 @@
 #define LOUDSSPARSE_H_
 
 #include <string>
+#include <vector>
 
 #include "config.hpp"
+#include "inline_vector.hpp"
 #include "label_vector.hpp"
 #include "rank.hpp"
 #include "select.hpp"
+#include "serial_format.hpp"
+#include "slice.hpp"
+#include "stats.hpp"
 #include "suffix.hpp"
 #include "surf_builder.hpp"
 
@@ -17,19 +22,20 @@ public:
     class Iter {
     public:
 	Iter() : is_valid_(false) {};
-	Iter(LoudsSparse* trie) : is_valid_(false), trie_(trie), start_node_num_(0), 
+	Iter(const LoudsSparse* trie) : is_valid_(false), trie_(trie), start_node_num_(0), 
 				  key_len_(0), is_at_terminator_(false) {
 	    start_level_ = trie_->getStartLevel();
-	    for (level_t level = start_level_; level < trie_->getHeight(); level++) {
-		key_.push_back(0);
-		pos_in_trie_.push_back(0);
-	    }
+	    key_.resize(trie_->getHeight() - start_level_);
+	    pos_in_trie_.resize(trie_->getHeight() - start_level_);
 	}
 
 	void clear();
 	bool isValid() const { return is_valid_; };
-	int compare(const std::string& key) const;
+	// Compares the key bytes in place; nothing is copied
+	int compare(const Slice& key) const;
 	std::string getKey() const;
+	// The bytes of getKey(), valid until the iterator moves
+	Slice getKeySlice() const;
         int getSuffix(word_t* suffix) const;
 	std::string getKeyWithSuffix(unsigned* bitlen) const;
 
@@ -50,33 +56,72 @@ public:
 
     private:
 	bool is_valid_; // True means the iter currently points to a valid key
-	LoudsSparse* trie_;
+	const LoudsSparse* trie_;
 	level_t start_level_;
 	position_t start_node_num_; // Passed in by the dense iterator; default = 0
 	level_t key_len_; // Start counting from start_level_; does NOT include suffix
 
-	std::vector<label_t> key_;
-	std::vector<position_t> pos_in_trie_;
+	InlineVector<label_t> key_;
+	InlineVector<position_t> pos_in_trie_;
 	bool is_at_terminator_;
 
 	friend class LoudsSparse;
     };
 
 public:
-    LoudsSparse() {};
+    LoudsSparse() : height_(0), start_level_(0), node_count_dense_(0),
+		    child_count_dense_(0), is_view_(false) {};
     LoudsSparse(const SuRFBuilder* builder);
+    // Same as above, but if release_builder is set, each component
+    // takes the builder's array over instead of copying it; after
+    // SuRFBuilder::build(keys), every array is already of its final
+    // size (see LevelBits::release). The builder is spent afterwards.
+    LoudsSparse(SuRFBuilder* builder, const bool release_builder);
 
     ~LoudsSparse() {}
 
     // point query: trie walk starts at node "in_node_num" instead of root
     // in_node_num is provided by louds-dense's lookupKey function
-    bool lookupKey(const std::string& key, const position_t in_node_num) const;
+    bool lookupKey(const Slice& key, const position_t in_node_num) const;
+    // lookupKey for a trie of 8-byte keys (see SuRFInt64): key bytes come
+    // from the integer, and no node has a terminator.
+    bool lookupKey(const uint64_t key, const position_t in_node_num) const;
+    // Returns false if no stored key starts with prefix; the walk
+    // starts at in_node_num, provided by LoudsDense::lookupPrefix.
+    bool lookupPrefix(const Slice& prefix, const position_t in_node_num) const;
+    // Batched version of lookupKey for n <= kLookupBatchSize keys.
+    // Only keys handed over by louds-dense (out[i] == true and
+    // in_node_nums[i] != 0) are searched; their out entries are overwritten.
+    // Without dense levels node 0 is the root, and every key with
+    // out[i] == true is searched.
+    // The walks are interleaved level by level so that the memory accesses
+    // of all keys at one level are in flight at the same time.
+    // key_hashes[i] = suffixHash(keys[i], getSuffixHashType()), read for
+    // hash suffixes only.
+    void lookupKeys(const Slice* keys, const word_t* key_hashes, const position_t n,
+		    const position_t* in_node_nums, bool* out) const;
     // return value indicates potential false positive
-    bool moveToKeyGreaterThan(const std::string& key, 
+    bool moveToKeyGreaterThan(const Slice& key, 
 			      const bool inclusive, LoudsSparse::Iter& iter) const;
+    // Same as moveToKeyGreaterThan, but keeps the longest part of iter's
+    // current path that is a prefix of key (see LoudsDense).
+    // iter must still start at the node that key reaches in louds-dense.
+    bool resumeMoveToKeyGreaterThan(const Slice& key,
+				    const bool inclusive, LoudsSparse::Iter& iter) const;
+    // probeRange of LoudsDense for the sparse levels, starting at
+    // in_node_num (0 if there are no dense levels)
+    RangeProbe probeRange(const Slice& left_key, const Slice& right_key,
+			  const level_t prefix_len, const position_t in_node_num) const;
+    // Returns the number of keys in the sparse levels between two cuts
+    // (see LoudsDense::approxCount). A cut starts at node node_num if it
+    // is non-zero and follows the iterator's path otherwise.
+    int64_t approxCount(const LoudsSparse::Iter* iter_left, const position_t node_num_left,
+			const LoudsSparse::Iter* iter_right, const position_t node_num_right) const;
 
     level_t getHeight() const { return height_; };
     level_t getStartLevel() const { return start_level_; };
+    SuffixType getSuffixType() const { return suffixes_.getType(); };
+    SuffixHashType getSuffixHashType() const { return suffixes_.getHashType(); };
     uint64_t serializedSize() const;
     uint64_t getMemoryUsage() const;
 
@@ -90,37 +135,99 @@ public:
 	memcpy(dst, &child_count_dense_, sizeof(child_count_dense_));
 	dst += sizeof(child_count_dense_);
 	align(dst);
-	labels_->serialize(dst);
-	child_indicator_bits_->serialize(dst);
-	louds_bits_->serialize(dst);
-	suffixes_->serialize(dst);
+	labels_.serialize(dst);
+	child_indicator_bits_.serialize(dst);
+	louds_bits_.serialize(dst);
+	suffixes_.serialize(dst);
 	align(dst);
     }
 
+    // Writes one section per component (see serial_format.hpp)
+    void serialize(SectionWriter& writer) const {
+	writeMeta(writer, height_, start_level_, node_count_dense_, child_count_dense_);
+	writeSection(writer, kSectionSparseLabels, labels_);
+	writeSection(writer, kSectionSparseChildIndicatorBits, child_indicator_bits_);
+	writeSection(writer, kSectionSparseLoudsBits, louds_bits_);
+	writeSection(writer, kSectionSparseSuffixes, suffixes_);
+    }
+
+    // Writes the same sections as LoudsSparse(builder).serialize(writer),
+    // from the arrays taken over from builder, which is spent afterwards.
+    static void serialize(SuRFBuilder* builder, SectionWriter& writer);
+
     static LoudsSparse* deSerialize(char*& src) {
 	LoudsSparse* louds_sparse = new LoudsSparse();
-	memcpy(&(louds_sparse->height_), src, sizeof(louds_sparse->height_));
-	src += sizeof(louds_sparse->height_);
-	memcpy(&(louds_sparse->start_level_), src, sizeof(louds_sparse->start_level_));
-	src += sizeof(louds_sparse->start_level_);
-	memcpy(&(louds_sparse->node_count_dense_), src, sizeof(louds_sparse->node_count_dense_));
-	src += sizeof(louds_sparse->node_count_dense_);
-	memcpy(&(louds_sparse->child_count_dense_), src, sizeof(louds_sparse->child_count_dense_));
-	src += sizeof(louds_sparse->child_count_dense_);
-	align(src);
-	louds_sparse->labels_ = LabelVector::deSerialize(src);
-	louds_sparse->child_indicator_bits_ = BitvectorRank::deSerialize(src);
-	louds_sparse->louds_bits_ = BitvectorSelect::deSerialize(src);
-	louds_sparse->suffixes_ = BitvectorSuffix::deSerialize(src);
-	align(src);
+	const char* cur = src;
+	louds_sparse->loadView(cur, nullptr);
+	src = const_cast<char*>(cur);
 	return louds_sparse;
     }
 
+    // Points all components at a serialized image without copying,
+    // except for the louds bits of an image from before the versioned
+    // format (see BitvectorSelect::loadView).
+    // Returns false if the image is malformed or does not fit before end.
+    // Once loaded, destroy() leaves the image untouched.
+    bool loadView(const char*& src, const char* end) {
+	is_view_ = true;
+	position_t header_size = sizeof(height_) + sizeof(start_level_)
+	    + sizeof(node_count_dense_) + sizeof(child_count_dense_);
+	if (!isAligned(src) || !fitsInBuffer(src, end, header_size))
+	    return false;
+	memcpy(&height_, src, sizeof(height_));
+	src += sizeof(height_);
+	memcpy(&start_level_, src, sizeof(start_level_));
+	src += sizeof(start_level_);
+	memcpy(&node_count_dense_, src, sizeof(node_count_dense_));
+	src += sizeof(node_count_dense_);
+	memcpy(&child_count_dense_, src, sizeof(child_count_dense_));
+	src += sizeof(child_count_dense_);
+	align(src);
+	if (start_level_ > height_)
+	    return false;
+	return (labels_.loadView(src, end)
+		&& child_indicator_bits_.loadView(src, end)
+		&& louds_bits_.loadView(src, end)
+		&& suffixes_.loadView(src, end));
+    }
+
+    // Same as above, but each component is bounded by its own section.
+    bool loadView(const SectionTable& table) {
+	is_view_ = true;
+	const char* src;
+	const char* end;
+	if (!table.find(kSectionSparseMeta, src, end)
+	    || !fitsInBuffer(src, end, sizeof(height_) + sizeof(start_level_)
+			     + sizeof(node_count_dense_) + sizeof(child_count_dense_)))
+	    return false;
+	memcpy(&height_, src, sizeof(height_));
+	src += sizeof(height_);
+	memcpy(&start_level_, src, sizeof(start_level_));
+	src += sizeof(start_level_);
+	memcpy(&node_count_dense_, src, sizeof(node_count_dense_));
+	src += sizeof(node_count_dense_);
+	memcpy(&child_count_dense_, src, sizeof(child_count_dense_));
+	if (start_level_ > height_)
+	    return false;
+	return (table.find(kSectionSparseLabels, src, end)
+		&& labels_.loadView(src, end)
+		&& table.find(kSectionSparseChildIndicatorBits, src, end)
+		&& child_indicator_bits_.loadView(src, end)
+		&& table.find(kSectionSparseLoudsBits, src, end)
+		&& louds_bits_.loadView(src, end)
+		&& table.find(kSectionSparseSuffixes, src, end)
+		&& suffixes_.loadView(src, end));
+    }
+
     void destroy() {
-	labels_->destroy();
-	child_indicator_bits_->destroy();
-	louds_bits_->destroy();
-	suffixes_->destroy();
+	if (is_view_) {
+	    louds_bits_.destroyCopy();
+	    return;
+	}
+	labels_.destroy();
+	child_indicator_bits_.destroy();
+	louds_bits_.destroy();
+	suffixes_.destroy();
     }
 
 private:
@@ -134,13 +241,27 @@ private:
     void moveToLeftInNextSubtrie(position_t pos, const position_t node_size, 
 				 const label_t label, LoudsSparse::Iter& iter) const;
     // return value indicates potential false positive
-    bool compareSuffixGreaterThan(const position_t pos, const std::string& key, 
+    bool compareSuffixGreaterThan(const position_t pos, const Slice& key, 
 				  const level_t level, const bool inclusive, 
 				  LoudsSparse::Iter& iter) const;
+    // Descends from node_num at start_level; iter holds the path above it
+    bool moveToKeyGreaterThanFrom(const Slice& key, const bool inclusive,
+				  const level_t start_level, position_t node_num,
+				  LoudsSparse::Iter& iter) const;
+
+    // Shared by the constructors; takes the arrays of spent_builder
+    // (builder itself, or nullptr) over instead of copying them
+    void init(const SuRFBuilder* builder, SuRFBuilder* spent_builder);
+
+    static void writeMeta(SectionWriter& writer, const level_t height, const level_t start_level,
+			  const position_t node_count_dense, const position_t child_count_dense);
+    static void countDenseNodes(const SuRFBuilder* builder, position_t& node_count_dense,
+				position_t& child_count_dense);
+    static BitvectorSuffix buildSuffixes(const SuRFBuilder* builder,
+					 SuRFBuilder* spent_builder);
 
 private:
     static const position_t kRankBasicBlockSize = 512;
-    static const position_t kSelectSampleInterval = 64;
 
     level_t height_; // trie height
     level_t start_level_; // louds-sparse encoding starts at this level
@@ -149,93 +270,301 @@ private:
     // number of children(1's in child indicator bitmap) in louds-dense encoding
     position_t child_count_dense_;
 
-    LabelVector* labels_;
-    BitvectorRank* child_indicator_bits_;
-    BitvectorSelect* louds_bits_;
-    BitvectorSuffix* suffixes_;
+    LabelVector labels_;
+    BitvectorRank child_indicator_bits_;
+    BitvectorSelect louds_bits_;
+    BitvectorSuffix suffixes_;
+    bool is_view_; // true if the bits live in a caller-owned buffer
 };
 
 
-LoudsSparse::LoudsSparse(const SuRFBuilder* builder) {
-    height_ = builder->getLabels().size();
-    start_level_ = builder->getSparseStartLevel();
+LoudsSparse::LoudsSparse(const SuRFBuilder* builder) : is_view_(false) {
+    init(builder, nullptr);
+}
 
-    node_count_dense_ = 0;
-    for (level_t level = 0; level < start_level_; level++)
-	node_count_dense_ += builder->getNodeCounts()[level];
+LoudsSparse::LoudsSparse(SuRFBuilder* builder, const bool release_builder) : is_view_(false) {
+    init(builder, release_builder ? builder : nullptr);
+}
 
-    if (start_level_ == 0)
-	child_count_dense_ = 0;
-    else
-	child_count_dense_ = node_count_dense_ + builder->getNodeCounts()[start_level_] - 1;
+void LoudsSparse::init(const SuRFBuilder* builder, SuRFBuilder* spent_builder) {
+    height_ = builder->getTreeHeight();
+    start_level_ = builder->getSparseStartLevel();
+    countDenseNodes(builder, node_count_dense_, child_count_dense_);
+
+    if (spent_builder == nullptr) {
+	labels_ = LabelVector(builder->getLabels(), start_level_, height_);
+	child_indicator_bits_ = BitvectorRank(kRankBasicBlockSize,
+					      builder->getChildIndicatorBits(),
+					      start_level_, height_, builder->getRankType());
+	louds_bits_ = BitvectorSelect(builder->getSelectSampleInterval(),
+				      builder->getLoudsBits(), start_level_, height_);
+    } else {
+	position_t num_items;
+	label_t* labels = spent_builder->labels_.release(start_level_, height_, num_items);
+	labels_ = LabelVector(labels, num_items);
+	word_t* bits = spent_builder->child_indicator_bits_.release(start_level_, height_,
+								    num_items);
+	child_indicator_bits_ = BitvectorRank(kRankBasicBlockSize, bits, num_items,
+					      builder->getRankType());
+	bits = spent_builder->louds_bits_.release(start_level_, height_, num_items);
+	louds_bits_ = BitvectorSelect(builder->getSelectSampleInterval(), bits, num_items);
+    }
+    suffixes_ = buildSuffixes(builder, spent_builder);
+}
 
-    labels_ = new LabelVector(builder->getLabels(), start_level_, height_);
+void LoudsSparse::serialize(SuRFBuilder* builder, SectionWriter& writer) {
+    LoudsSparse louds_sparse(builder, true);
+    louds_sparse.serialize(writer);
+    louds_sparse.destroy();
+}
 
-    std::vector<position_t> num_items_per_level;
-    for (level_t level = 0; level < height_; level++)
-	num_items_per_level.push_back(builder->getLabels()[level].size());
+void LoudsSparse::writeMeta(SectionWriter& writer, const level_t height, const level_t start_level,
+			    const position_t node_count_dense, const position_t child_count_dense) {
+    uint64_t size = sizeof(height) + sizeof(start_level)
+	+ sizeof(node_count_dense) + sizeof(child_count_dense);
+    sizeAlign(size);
+    char* dst = writer.beginSection(kSectionSparseMeta, size);
+    memcpy(dst, &height, sizeof(height));
+    dst += sizeof(height);
+    memcpy(dst, &start_level, sizeof(start_level));
+    dst += sizeof(start_level);
+    memcpy(dst, &node_count_dense, sizeof(node_count_dense));
+    dst += sizeof(node_count_dense);
+    memcpy(dst, &child_count_dense, sizeof(child_count_dense));
+    dst += sizeof(child_count_dense);
+    align(dst);
+    writer.endSection(dst);
+}
 
-    child_indicator_bits_ = new BitvectorRank(kRankBasicBlockSize, builder->getChildIndicatorBits(), 
-					      num_items_per_level, start_level_, height_);
-    louds_bits_ = new BitvectorSelect(kSelectSampleInterval, builder->getLoudsBits(), 
-				      num_items_per_level, start_level_, height_);
+void LoudsSparse::countDenseNodes(const SuRFBuilder* builder, position_t& node_count_dense,
+				  position_t& child_count_dense) {
+    level_t start_level = builder->getSparseStartLevel();
+    node_count_dense = 0;
+    for (level_t level = 0; level < start_level; level++)
+	node_count_dense += builder->getNodeCounts()[level];
 
-    if (builder->getSuffixType() == kNone) {
-	suffixes_ = new BitvectorSuffix();
-    } else {
-	level_t hash_suffix_len = builder->getHashSuffixLen();
-        level_t real_suffix_len = builder->getRealSuffixLen();
-        level_t suffix_len = hash_suffix_len + real_suffix_len;
-	std::vector<position_t> num_suffix_bits_per_level;
-	for (level_t level = 0; level < height_; level++)
-	    num_suffix_bits_per_level.push_back(builder->getSuffixCounts()[level] * suffix_len);
+    if (start_level == 0)
+	child_count_dense = 0;
+    else
+	child_count_dense = node_count_dense + builder->getNodeCounts()[start_level] - 1;
+}
 
-	suffixes_ = new BitvectorSuffix(builder->getSuffixType(), hash_suffix_len, real_suffix_len,
-                                        builder->getSuffixes(),
-					num_suffix_bits_per_level, start_level_, height_);
-    }
+BitvectorSuffix LoudsSparse::buildSuffixes(const SuRFBuilder* builder,
+					   SuRFBuilder* spent_builder) {
+    if (builder->getSuffixType() == kNone)
+	return BitvectorSuffix();
+    // the labels may have been taken over already
+    level_t height = builder->getSuffixes().numLevels();
+    level_t start_level = builder->getSparseStartLevel();
+    if (spent_builder == nullptr)
+	return BitvectorSuffix(builder->getSuffixType(), builder->getHashSuffixLen(),
+			       builder->getRealSuffixLen(), builder->getSuffixes(),
+			       start_level, height, builder->getSuffixHashType());
+    position_t num_bits;
+    word_t* bits = spent_builder->suffixes_.release(start_level, height, num_bits);
+    return BitvectorSuffix(builder->getSuffixType(), builder->getHashSuffixLen(),
+			   builder->getRealSuffixLen(), bits, num_bits,
+			   builder->getSuffixHashType());
 }
 
-bool LoudsSparse::lookupKey(const std::string& key, const position_t in_node_num) const {
+bool LoudsSparse::lookupKey(const Slice& key, const position_t in_node_num) const {
+    SURF_STAT(lookupStats().sparse_lookups++);
     position_t node_num = in_node_num;
     position_t pos = getFirstLabelPos(node_num);
     level_t level = 0;
     for (level = start_level_; level < key.length(); level++) {
-	//child_indicator_bits_->prefetch(pos);
-	if (!labels_->search((label_t)key[level], pos, nodeSize(pos)))
+	SURF_STAT(lookupStats().sparse_levels++);
+	//child_indicator_bits_.prefetch(pos);
+	if (!labels_.search((label_t)key[level], pos, nodeSize(pos))) {
+	    SURF_STAT(lookupStats().recordExit(true, kExitNoLabel, level + 1));
+	    return false;
+	}
+
+	// if trie branch terminates
+	if (!child_indicator_bits_.readBit(pos)) {
+	    SURF_STAT(lookupStats().recordExit(true, kExitLeaf, level + 1));
+	    return suffixes_.checkEquality(getSuffixPos(pos), key, level + 1);
+	}
+
+	// move to child
+	node_num = getChildNodeNum(pos);
+	pos = getFirstLabelPos(node_num);
+    }
+    SURF_STAT(lookupStats().sparse_levels++);
+    if ((labels_.read(pos) == kTerminator) && (!child_indicator_bits_.readBit(pos))) {
+	SURF_STAT(lookupStats().recordExit(true, kExitPrefixKey, level + 1));
+	return suffixes_.checkEquality(getSuffixPos(pos), key, level + 1);
+    }
+    SURF_STAT(lookupStats().recordExit(true, kExitKeyEnd, level + 1));
+    return false;
+}
+
+bool LoudsSparse::lookupKey(const uint64_t key, const position_t in_node_num) const {
+    SURF_STAT(lookupStats().sparse_lookups++);
+    position_t node_num = in_node_num;
+    position_t pos = getFirstLabelPos(node_num);
+    for (level_t level = start_level_; level < kUint64KeyLen; level++) {
+	SURF_STAT(lookupStats().sparse_levels++);
+	if (!labels_.search(uint64KeyByte(key, level), pos, nodeSize(pos))) {
+	    SURF_STAT(lookupStats().recordExit(true, kExitNoLabel, level + 1));
 	    return false;
+	}
 
 	// if trie branch terminates
-	if (!child_indicator_bits_->readBit(pos))
-	    return suffixes_->checkEquality(getSuffixPos(pos), key, level + 1);
+	if (!child_indicator_bits_.readBit(pos)) {
+	    SURF_STAT(lookupStats().recordExit(true, kExitLeaf, level + 1));
+	    return suffixes_.checkEquality(getSuffixPos(pos), key, level + 1);
+	}
 
 	// move to child
 	node_num = getChildNodeNum(pos);
 	pos = getFirstLabelPos(node_num);
     }
-    if ((labels_->read(pos) == kTerminator) && (!child_indicator_bits_->readBit(pos)))
-	return suffixes_->checkEquality(getSuffixPos(pos), key, level + 1);
     return false;
 }
 
-bool LoudsSparse::moveToKeyGreaterThan(const std::string& key, 
+bool LoudsSparse::lookupPrefix(const Slice& prefix, const position_t in_node_num) const {
+    position_t pos = getFirstLabelPos(in_node_num);
+    for (level_t level = start_level_; level < prefix.length(); level++) {
+	if (!labels_.search((label_t)prefix[level], pos, nodeSize(pos)))
+	    return false;
+
+	// if trie branch terminates
+	if (!child_indicator_bits_.readBit(pos))
+	    return suffixes_.checkPrefix(getSuffixPos(pos), prefix, level + 1);
+
+	// move to child
+	pos = getFirstLabelPos(getChildNodeNum(pos));
+    }
+    // every key below this node has the prefix
+    return true;
+}
+
+void LoudsSparse::lookupKeys(const Slice* keys, const word_t* key_hashes,
+			     const position_t n,
+			     const position_t* in_node_nums, bool* out) const {
+    assert(n <= kLookupBatchSize);
+    position_t node_nums[kLookupBatchSize];
+    position_t positions[kLookupBatchSize];
+    position_t active[kLookupBatchSize]; // keys whose walk is not finished
+    position_t num_active = 0;
+    for (position_t i = 0; i < n; i++) {
+	if (out[i] && ((in_node_nums[i] != 0) || (start_level_ == 0))) {
+	    node_nums[i] = in_node_nums[i];
+	    louds_bits_.prefetch(node_nums[i] + 1 - node_count_dense_);
+	    active[num_active++] = i;
+	}
+    }
+
+    level_t level = start_level_;
+    while (num_active > 0) {
+	// move to child: locate the first label of every node
+	for (position_t j = 0; j < num_active; j++) {
+	    position_t i = active[j];
+	    positions[i] = getFirstLabelPos(node_nums[i]);
+	    labels_.prefetch(positions[i]);
+	    child_indicator_bits_.prefetch(positions[i]);
+	}
+
+	position_t num_next_active = 0;
+	for (position_t j = 0; j < num_active; j++) {
+	    position_t i = active[j];
+	    position_t pos = positions[i];
+	    if (level >= keys[i].length()) {
+		if ((labels_.read(pos) == kTerminator) && (!child_indicator_bits_.readBit(pos)))
+		    out[i] = suffixes_.checkEquality(getSuffixPos(pos), keys[i], level + 1,
+						     key_hashes[i]);
+		else
+		    out[i] = false;
+	    } else if (!labels_.search((label_t)keys[i][level], pos, nodeSize(pos))) {
+		out[i] = false;
+	    } else if (!child_indicator_bits_.readBit(pos)) { // if trie branch terminates
+		out[i] = suffixes_.checkEquality(getSuffixPos(pos), keys[i], level + 1,
+						 key_hashes[i]);
+	    } else {
+		node_nums[i] = getChildNodeNum(pos);
+		louds_bits_.prefetch(node_nums[i] + 1 - node_count_dense_);
+		active[num_next_active++] = i;
+	    }
+	}
+	num_active = num_next_active;
+	level++;
+    }
+}
+
+RangeProbe LoudsSparse::probeRange(const Slice& left_key, const Slice& right_key,
+				   const level_t prefix_len, const position_t in_node_num) const {
+    if (start_level_ >= height_)
+	return kRangeUnknown;
+    position_t pos = getFirstLabelPos(in_node_num);
+    for (level_t level = start_level_; level < height_; level++) {
+	position_t node_size = nodeSize(pos);
+	if (level == prefix_len) {
+	    if (level >= right_key.length())
+		return kRangeUnknown;
+	    // the smallest label greater than the left bound's
+	    if (level < left_key.length()) {
+		if (!labels_.searchGreaterThan((label_t)left_key[level], pos, node_size))
+		    return kRangeUnknown;
+	    } else if ((node_size > 1) && (labels_.read(pos) == kTerminator)) {
+		pos++;
+	    }
+	    if (labels_.read(pos) < (label_t)right_key[level])
+		return kRangeNonEmpty;
+	    return kRangeUnknown;
+	}
+	if (!labels_.search((label_t)left_key[level], pos, node_size))
+	    return kRangeEmpty;
+	if (!child_indicator_bits_.readBit(pos)) // a stored key ends on the prefix
+	    return kRangeUnknown;
+	pos = getFirstLabelPos(getChildNodeNum(pos));
+    }
+    return kRangeUnknown;
+}
+
+bool LoudsSparse::moveToKeyGreaterThan(const Slice& key, 
 				       const bool inclusive, LoudsSparse::Iter& iter) const {
+    return moveToKeyGreaterThanFrom(key, inclusive, start_level_,
+				    iter.getStartNodeNum(), iter);
+}
+
+bool LoudsSparse::resumeMoveToKeyGreaterThan(const Slice& key,
+					     const bool inclusive, LoudsSparse::Iter& iter) const {
+    level_t level = start_level_;
     position_t node_num = iter.getStartNodeNum();
+    if (iter.isValid() && (iter.key_len_ > 0)) {
+	// the last position on the path may be a leaf or a terminator
+	level_t max_level = start_level_ + iter.key_len_ - 1;
+	while ((level < max_level) && (level < key.length())
+	       && (iter.key_[level - start_level_] == (label_t)key[level]))
+	    level++;
+	if (level > start_level_)
+	    node_num = getChildNodeNum(iter.pos_in_trie_[level - start_level_ - 1]);
+    }
+    iter.clear();
+    iter.key_len_ = level - start_level_;
+    return moveToKeyGreaterThanFrom(key, inclusive, level, node_num, iter);
+}
+
+bool LoudsSparse::moveToKeyGreaterThanFrom(const Slice& key, const bool inclusive,
+					   const level_t start_level, position_t node_num,
+					   LoudsSparse::Iter& iter) const {
     position_t pos = getFirstLabelPos(node_num);
 
     level_t level;
-    for (level = start_level_; level < key.length(); level++) {
+    for (level = start_level; level < key.length(); level++) {
 	position_t node_size = nodeSize(pos);
+	position_t node_start_pos = pos; // search may skip the terminator
 	// if no exact match
-	if (!labels_->search((label_t)key[level], pos, node_size)) {
-	    moveToLeftInNextSubtrie(pos, node_size, key[level], iter);
+	if (!labels_.search((label_t)key[level], pos, node_size)) {
+	    moveToLeftInNextSubtrie(node_start_pos, node_size, key[level], iter);
 	    return false;
 	}
 
 	iter.append(key[level], pos);
 
 	// if trie branch terminates
-	if (!child_indicator_bits_->readBit(pos))
+	if (!child_indicator_bits_.readBit(pos))
 	    return compareSuffixGreaterThan(pos, key, level+1, inclusive, iter);
 
 	// move to child
@@ -243,8 +572,8 @@ bool LoudsSparse::moveToKeyGreaterThan(const std::string& key,
 	pos = getFirstLabelPos(node_num);
     }
 
-    if ((labels_->read(pos) == kTerminator)
-	&& (!child_indicator_bits_->readBit(pos))
+    if ((labels_.read(pos) == kTerminator)
+	&& (!child_indicator_bits_.readBit(pos))
 	&& !isEndofNode(pos)) {
 	iter.append(kTerminator, pos);
 	iter.is_at_terminator_ = true;
@@ -266,56 +595,94 @@ bool LoudsSparse::moveToKeyGreaterThan(const std::string& key,
 uint64_t LoudsSparse::serializedSize() const {
     uint64_t size = sizeof(height_) + sizeof(start_level_)
 	+ sizeof(node_count_dense_) + sizeof(child_count_dense_)
-	+ labels_->serializedSize()
-	+ child_indicator_bits_->serializedSize()
-	+ louds_bits_->serializedSize()
-	+ suffixes_->serializedSize();
+	+ labels_.serializedSize()
+	+ child_indicator_bits_.serializedSize()
+	+ louds_bits_.serializedSize()
+	+ suffixes_.serializedSize();
     	sizeAlign(size);
 	return size;
 }
 
 uint64_t LoudsSparse::getMemoryUsage() const {
     return (sizeof(this)
-	    + labels_->size()
-	    + child_indicator_bits_->size()
-	    + louds_bits_->size()
-	    + suffixes_->size());
+	    + labels_.size()
+	    + child_indicator_bits_.size()
+	    + louds_bits_.size()
+	    + suffixes_.size());
+}
+
+int64_t LoudsSparse::approxCount(const LoudsSparse::Iter* iter_left, const position_t node_num_left,
+				 const LoudsSparse::Iter* iter_right, const position_t node_num_right) const {
+    const LoudsSparse::Iter* iters[2] = {iter_left, iter_right};
+    position_t node_nums[2] = {node_num_left, node_num_right};
+    position_t num_items = louds_bits_.numBits();
+    int64_t count = 0;
+    for (level_t level = start_level_; level < height_; level++) {
+	position_t cuts[2]; // items before the cut
+	bool is_path_end[2];
+	for (int i = 0; i < 2; i++) {
+	    is_path_end[i] = false;
+	    if (node_nums[i] > 0) {
+		position_t node_id = node_nums[i] - node_count_dense_;
+		if (node_id >= louds_bits_.numOnes())
+		    cuts[i] = num_items;
+		else
+		    cuts[i] = louds_bits_.select(node_id + 1);
+		continue;
+	    }
+	    cuts[i] = iters[i]->pos_in_trie_[level - start_level_];
+	    is_path_end[i] = (level - start_level_ + 1 == iters[i]->key_len_);
+	}
+
+	count += ((int64_t)cuts[1] - (int64_t)cuts[0]);
+	count -= ((int64_t)child_indicator_bits_.rankBefore(cuts[1])
+		  - (int64_t)child_indicator_bits_.rankBefore(cuts[0]));
+
+	for (int i = 0; i < 2; i++) {
+	    if ((node_nums[i] > 0) || is_path_end[i])
+		node_nums[i] = child_indicator_bits_.rankBefore(cuts[i]) + child_count_dense_ + 1;
+	}
+    }
+    return count;
 }
 
 position_t LoudsSparse::getChildNodeNum(const position_t pos) const {
-    return (child_indicator_bits_->rank(pos) + child_count_dense_);
+    return (child_indicator_bits_.rank(pos) + child_count_dense_);
 }
 
 position_t LoudsSparse::getFirstLabelPos(const position_t node_num) const {
-    return louds_bits_->select(node_num + 1 - node_count_dense_);
+    return louds_bits_.select(node_num + 1 - node_count_dense_);
 }
 
 position_t LoudsSparse::getLastLabelPos(const position_t node_num) const {
     position_t next_rank = node_num + 2 - node_count_dense_;
-    if (next_rank > louds_bits_->numOnes())
-	return (louds_bits_->numBits() - 1);
-    return (louds_bits_->select(next_rank) - 1);
+    if (next_rank > louds_bits_.numOnes())
+	return (louds_bits_.numBits() - 1);
+    return (louds_bits_.select(next_rank) - 1);
 }
 
 position_t LoudsSparse::getSuffixPos(const position_t pos) const {
-    return (pos - child_indicator_bits_->rank(pos));
+    return (pos - child_indicator_bits_.rank(pos));
 }
 
 position_t LoudsSparse::nodeSize(const position_t pos) const {
-    assert(louds_bits_->readBit(pos));
-    return louds_bits_->distanceToNextSetBit(pos);
+    assert(louds_bits_.readBit(pos));
+    position_t node_size = louds_bits_.distanceToNextSetBit(pos);
+    SURF_STAT(lookupStats().recordNodeSize(node_size));
+    return node_size;
 }
 
 bool LoudsSparse::isEndofNode(const position_t pos) const {
-    return ((pos == louds_bits_->numBits() - 1)
-	    || louds_bits_->readBit(pos + 1));
+    return ((pos == louds_bits_.numBits() - 1)
+	    || louds_bits_.readBit(pos + 1));
 }
 
 void LoudsSparse::moveToLeftInNextSubtrie(position_t pos, const position_t node_size, 
 					  const label_t label, LoudsSparse::Iter& iter) const {
+    position_t last_pos = pos + node_size - 1;
     // if no label is greater than key[level] in this node
-    if (!labels_->searchGreaterThan(label, pos, node_size)) {
-	iter.append(pos + node_size - 1);
+    if (!labels_.searchGreaterThan(label, pos, node_size)) {
+	iter.append(last_pos);
 	return iter++;
     } else {
 	iter.append(pos);
@@ -323,11 +690,11 @@ void LoudsSparse::moveToLeftInNextSubtrie(position_t pos, const position_t node_
     }
 }
 
-bool LoudsSparse::compareSuffixGreaterThan(const position_t pos, const std::string& key, 
+bool LoudsSparse::compareSuffixGreaterThan(const position_t pos, const Slice& key, 
 					   const level_t level, const bool inclusive, 
 					   LoudsSparse::Iter& iter) const {
     position_t suffix_pos = getSuffixPos(pos);
-    int compare = suffixes_->compare(suffix_pos, key, level);
+    int compare = suffixes_.compare(suffix_pos, key, level);
     if ((compare != kCouldBePositive) && (compare < 0)) {
 	iter++;
 	return false;
@@ -344,33 +711,36 @@ void LoudsSparse::Iter::clear() {
     is_at_terminator_ = false;
 }
 
-int LoudsSparse::Iter::compare(const std::string& key) const {
+int LoudsSparse::Iter::compare(const Slice& key) const {
     if (is_at_terminator_ && (key_len_ - 1) < (key.length() - start_level_))
 	return -1;
-    std::string iter_key = getKey();
-    std::string key_sparse = key.substr(start_level_);
-    std::string key_sparse_same_length = key_sparse.substr(0, iter_key.length());
-    int compare = iter_key.compare(key_sparse_same_length);
+    Slice iter_key = getKeySlice();
+    Slice key_sparse = key.substr(start_level_);
+    int compare = iter_key.compare(key_sparse.substr(0, iter_key.length()));
     if (compare != 0) 
 	return compare;
     position_t suffix_pos = trie_->getSuffixPos(pos_in_trie_[key_len_ - 1]);
-    return trie_->suffixes_->compare(suffix_pos, key_sparse, key_len_);
+    return trie_->suffixes_.compare(suffix_pos, key_sparse, key_len_);
 }
 
 std::string LoudsSparse::Iter::getKey() const {
+    return getKeySlice().toString();
+}
+
+Slice LoudsSparse::Iter::getKeySlice() const {
     if (!is_valid_)
-	return std::string();
+	return Slice();
     level_t len = key_len_;
     if (is_at_terminator_)
 	len--;
-    return std::string((const char*)key_.data(), (size_t)len);
+    return Slice((const char*)key_.data(), (size_t)len);
 }
 
 int LoudsSparse::Iter::getSuffix(word_t* suffix) const {
-    if ((trie_->suffixes_->getType() == kReal) || (trie_->suffixes_->getType() == kMixed)) {
+    if ((trie_->suffixes_.getType() == kReal) || (trie_->suffixes_.getType() == kMixed)) {
 	position_t suffix_pos = trie_->getSuffixPos(pos_in_trie_[key_len_ - 1]);
-	*suffix = trie_->suffixes_->readReal(suffix_pos);
-	return trie_->suffixes_->getRealSuffixLen();
+	*suffix = trie_->suffixes_.readReal(suffix_pos);
+	return trie_->suffixes_.getRealSuffixLen();
     }
     *suffix = 0;
     return 0;
@@ -378,11 +748,11 @@ int LoudsSparse::Iter::getSuffix(word_t* suffix) const {
 
 std::string LoudsSparse::Iter::getKeyWithSuffix(unsigned* bitlen) const {
     std::string iter_key = getKey();
-    if ((trie_->suffixes_->getType() == kReal) || (trie_->suffixes_->getType() == kMixed)) {
+    if ((trie_->suffixes_.getType() == kReal) || (trie_->suffixes_.getType() == kMixed)) {
 	position_t suffix_pos = trie_->getSuffixPos(pos_in_trie_[key_len_ - 1]);
-	word_t suffix = trie_->suffixes_->readReal(suffix_pos);
+	word_t suffix = trie_->suffixes_.readReal(suffix_pos);
 	if (suffix > 0) {
-	    level_t suffix_len = trie_->suffixes_->getRealSuffixLen();
+	    level_t suffix_len = trie_->suffixes_.getRealSuffixLen();
 	    *bitlen = suffix_len % 8;
 	    suffix <<= (64 - suffix_len);
 	    char* suffix_str = reinterpret_cast<char*>(&suffix);
@@ -400,7 +770,7 @@ std::string LoudsSparse::Iter::getKeyWithSuffix(unsigned* bitlen) const {
 
 void LoudsSparse::Iter::append(const position_t pos) {
     assert(key_len_ < key_.size());
-    key_[key_len_] = trie_->labels_->read(pos);
+    key_[key_len_] = trie_->labels_.read(pos);
     pos_in_trie_[key_len_] = pos;
     key_len_++;
 }
@@ -414,34 +784,34 @@ void LoudsSparse::Iter::append(const label_t label, const position_t pos) {
 
 void LoudsSparse::Iter::set(const level_t level, const position_t pos) {
     assert(level < key_.size());
-    key_[level] = trie_->labels_->read(pos);
+    key_[level] = trie_->labels_.read(pos);
     pos_in_trie_[level] = pos;
 }
 
 void LoudsSparse::Iter::setToFirstLabelInRoot() {
     assert(start_level_ == 0);
     pos_in_trie_[0] = 0;
-    key_[0] = trie_->labels_->read(0);
+    key_[0] = trie_->labels_.read(0);
 }
 
 void LoudsSparse::Iter::setToLastLabelInRoot() {
     assert(start_level_ == 0);
     pos_in_trie_[0] = trie_->getLastLabelPos(0);
-    key_[0] = trie_->labels_->read(pos_in_trie_[0]);
+    key_[0] = trie_->labels_.read(pos_in_trie_[0]);
 }
 
 void LoudsSparse::Iter::moveToLeftMostKey() {
     if (key_len_ == 0) {
 	position_t pos = trie_->getFirstLabelPos(start_node_num_);
-	label_t label = trie_->labels_->read(pos);
+	label_t label = trie_->labels_.read(pos);
 	append(label, pos);
     }
 
     level_t level = key_len_ - 1;
     position_t pos = pos_in_trie_[level];
-    label_t label = trie_->labels_->read(pos);
+    label_t label = trie_->labels_.read(pos);
 
-    if (!trie_->child_indicator_bits_->readBit(pos)) {
+    if (!trie_->child_indicator_bits_.readBit(pos)) {
 	if ((label == kTerminator)
 	    && !trie_->isEndofNode(pos))
 	    is_at_terminator_ = true;
@@ -452,9 +822,9 @@ void LoudsSparse::Iter::moveToLeftMostKey() {
     while (level < trie_->getHeight()) {
 	position_t node_num = trie_->getChildNodeNum(pos);
 	pos = trie_->getFirstLabelPos(node_num);
-	label = trie_->labels_->read(pos);
+	label = trie_->labels_.read(pos);
 	// if trie branch terminates
-	if (!trie_->child_indicator_bits_->readBit(pos)) {
+	if (!trie_->child_indicator_bits_.readBit(pos)) {
 	    append(label, pos);
 	    if ((label == kTerminator)
 		&& !trie_->isEndofNode(pos))
@@ -472,15 +842,15 @@ void LoudsSparse::Iter::moveToRightMostKey() {
     if (key_len_ == 0) {
 	position_t pos = trie_->getFirstLabelPos(start_node_num_);
 	pos = trie_->getLastLabelPos(start_node_num_);
-	label_t label = trie_->labels_->read(pos);
+	label_t label = trie_->labels_.read(pos);
 	append(label, pos);
     }
 
     level_t level = key_len_ - 1;
     position_t pos = pos_in_trie_[level];
-    label_t label = trie_->labels_->read(pos);
+    label_t label = trie_->labels_.read(pos);
 
-    if (!trie_->child_indicator_bits_->readBit(pos)) {
+    if (!trie_->child_indicator_bits_.readBit(pos)) {
 	if ((label == kTerminator)
 	    && !trie_->isEndofNode(pos))
 	    is_at_terminator_ = true;
@@ -491,9 +861,9 @@ void LoudsSparse::Iter::moveToRightMostKey() {
     while (level < trie_->getHeight()) {
 	position_t node_num = trie_->getChildNodeNum(pos);
 	pos = trie_->getLastLabelPos(node_num);
-	label = trie_->labels_->read(pos);
+	label = trie_->labels_.read(pos);
 	// if trie branch terminates
-	if (!trie_->child_indicator_bits_->readBit(pos)) {
+	if (!trie_->child_indicator_bits_.readBit(pos)) {
 	    append(label, pos);
 	    if ((label == kTerminator)
 		&& !trie_->isEndofNode(pos))
@@ -512,7 +882,7 @@ void LoudsSparse::Iter::operator ++(int) {
     is_at_terminator_ = false;
     position_t pos = pos_in_trie_[key_len_ - 1];
     pos++;
-    while (pos >= trie_->louds_bits_->numBits() || trie_->louds_bits_->readBit(pos)) {
+    while (pos >= trie_->louds_bits_.numBits() || trie_->louds_bits_.readBit(pos)) {
 	key_len_--;
 	if (key_len_ == 0) {
 	    is_valid_ = false;
@@ -533,7 +903,7 @@ void LoudsSparse::Iter::operator --(int) {
 	is_valid_ = false;
 	return;
     }
-    while (trie_->louds_bits_->readBit(pos)) {
+    while (trie_->louds_bits_.readBit(pos)) {
 	key_len_--;
 	if (key_len_ == 0) {
 	    is_valid_ = false;
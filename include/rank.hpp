@@ -8,30 +8,61 @@
 #include <vector>
 
 #include "popcount.h"
+#include "stats.hpp"
 
 namespace surf {
 
+//******************************************************
+// kRankBasic keeps one cumulative count per basic block;
+// rank pops up to basic_block_size bits after it.
+// kRankTwoLevel is a rank9-style two-level table: one
+// word per 512-bit block holds the cumulative count in
+// the upper 32 bits and the counts of the first 128, 256
+// and 384 bits of the block in 9-bit fields below, so
+// rank reads one table entry and pops at most two words.
+// The table is twice the size of the basic one at 512-bit
+// blocks. Unlike rank9, it is kept apart from the bits,
+// which Bitvector lays out on their own: a rank still
+// touches two cache lines, the table entry's and the bit
+// words', so the one-cache-line goal is not met.
+//******************************************************
 class BitvectorRank : public Bitvector {
 public:
-    BitvectorRank() : basic_block_size_(0), rank_lut_(nullptr) {};
+    BitvectorRank() : basic_block_size_(0), type_(kRankBasic),
+		      rank_lut_(nullptr), block_counts_(nullptr) {};
 
+    // basic_block_size only applies to kRankBasic
     BitvectorRank(const position_t basic_block_size, 
-		  const std::vector<std::vector<word_t> >& bitvector_per_level, 
-		  const std::vector<position_t>& num_bits_per_level,
-		  const level_t start_level = 0,
-		  const level_t end_level = 0/* non-inclusive */) 
-	: Bitvector(bitvector_per_level, num_bits_per_level, start_level, end_level) {
-	basic_block_size_ = basic_block_size;
-	initRankLut();
+		  const LevelBits& bits,
+		  const level_t start_level,
+		  const level_t end_level/* non-inclusive */,
+		  const RankType type = kRankBasic)
+	: Bitvector(bits, start_level, end_level),
+	  type_(type), rank_lut_(nullptr), block_counts_(nullptr) {
+	initRank(basic_block_size);
+    }
+
+    // Takes over bits; see Bitvector
+    BitvectorRank(const position_t basic_block_size,
+		  word_t* bits, const position_t num_bits,
+		  const RankType type = kRankBasic)
+	: Bitvector(bits, num_bits),
+	  type_(type), rank_lut_(nullptr), block_counts_(nullptr) {
+	initRank(basic_block_size);
     }
 
     ~BitvectorRank() {}
 
+    RankType getType() const { return type_; };
+
     // Counts the number of 1's in the bitvector up to position pos.
     // pos is zero-based; count is one-based.
     // E.g., for bitvector: 100101000, rank(3) = 2
     position_t rank(position_t pos) const {
         assert(pos < num_bits_);
+	SURF_STAT(lookupStats().rank_calls++);
+	if (type_ == kRankTwoLevel)
+	    return rankTwoLevel(pos);
         position_t word_per_basic_block = basic_block_size_ / kWordSize;
         position_t block_id = pos / basic_block_size_;
         position_t offset = pos & (basic_block_size_ - 1);
@@ -39,7 +70,16 @@ public:
 		+ popcountLinear(bits_, block_id * word_per_basic_block, offset + 1));
     }
 
+    // Number of ones in [0, pos); pos may be numBits()
+    position_t rankBefore(position_t pos) const {
+	if (pos == 0)
+	    return 0;
+	return rank(pos - 1);
+    }
+
     position_t rankLutSize() const {
+	if (type_ == kRankTwoLevel)
+	    return ((num_bits_ / kTwoLevelBlockSize + 1) * sizeof(word_t));
 	return ((num_bits_ / basic_block_size_ + 1) * sizeof(position_t));
     }
 
@@ -56,41 +96,112 @@ public:
 
     void prefetch(position_t pos) const {
 	__builtin_prefetch(bits_ + (pos / kWordSize));
-	__builtin_prefetch(rank_lut_ + (pos / basic_block_size_));
+	if (type_ == kRankTwoLevel)
+	    __builtin_prefetch(block_counts_ + (pos / kTwoLevelBlockSize));
+	else
+	    __builtin_prefetch(rank_lut_ + (pos / basic_block_size_));
     }
 
+    // The layout is flagged in the block size field, so images
+    // of basic-layout bitvectors are unchanged.
     void serialize(char*& dst) const {
 	memcpy(dst, &num_bits_, sizeof(num_bits_));
 	dst += sizeof(num_bits_);
-	memcpy(dst, &basic_block_size_, sizeof(basic_block_size_));
-	dst += sizeof(basic_block_size_);
+	position_t block_size_field = basic_block_size_;
+	if (type_ == kRankTwoLevel)
+	    block_size_field |= kTwoLevelFlag;
+	memcpy(dst, &block_size_field, sizeof(block_size_field));
+	dst += sizeof(block_size_field);
 	memcpy(dst, bits_, bitsSize());
 	dst += bitsSize();
-	memcpy(dst, rank_lut_, rankLutSize());
+	if (type_ == kRankTwoLevel)
+	    memcpy(dst, block_counts_, rankLutSize());
+	else
+	    memcpy(dst, rank_lut_, rankLutSize());
 	dst += rankLutSize();
 	align(dst);
     }
 
     static BitvectorRank* deSerialize(char*& src) {
 	BitvectorRank* bv_rank = new BitvectorRank();
-	memcpy(&(bv_rank->num_bits_), src, sizeof(bv_rank->num_bits_));
-	src += sizeof(bv_rank->num_bits_);
-	memcpy(&(bv_rank->basic_block_size_), src, sizeof(bv_rank->basic_block_size_));
-	src += sizeof(bv_rank->basic_block_size_);
-	bv_rank->bits_ = const_cast<word_t*>(reinterpret_cast<const word_t*>(src));
-	src += bv_rank->bitsSize();
-	bv_rank->rank_lut_ = const_cast<position_t*>(reinterpret_cast<const position_t*>(src));
-	src += bv_rank->rankLutSize();
-	align(src);
+	const char* cur = src;
+	bv_rank->loadView(cur, nullptr);
+	src = const_cast<char*>(cur);
 	return bv_rank;
     }
 
+    // Points the bitvector and its look-up table at a serialized image
+    // without copying. Returns false if the image is malformed, misaligned
+    // or does not fit before end.
+    bool loadView(const char*& src, const char* end) {
+	if (!isAligned(src)
+	    || !fitsInBuffer(src, end, sizeof(num_bits_) + sizeof(basic_block_size_)))
+	    return false;
+	memcpy(&num_bits_, src, sizeof(num_bits_));
+	memcpy(&basic_block_size_, src + sizeof(num_bits_), sizeof(basic_block_size_));
+	type_ = (basic_block_size_ & kTwoLevelFlag) ? kRankTwoLevel : kRankBasic;
+	basic_block_size_ &= ~kTwoLevelFlag;
+	if ((basic_block_size_ == 0) || (basic_block_size_ % kWordSize != 0)
+	    || ((basic_block_size_ & (basic_block_size_ - 1)) != 0))
+	    return false;
+	if ((type_ == kRankTwoLevel) && (basic_block_size_ != kTwoLevelBlockSize))
+	    return false;
+	if (!fitsInBuffer(src, end, serializedSize()))
+	    return false;
+	src += (sizeof(num_bits_) + sizeof(basic_block_size_));
+	bits_ = const_cast<word_t*>(reinterpret_cast<const word_t*>(src));
+	src += bitsSize();
+	rank_lut_ = nullptr;
+	block_counts_ = nullptr;
+	if (type_ == kRankTwoLevel)
+	    block_counts_ = const_cast<word_t*>(reinterpret_cast<const word_t*>(src));
+	else
+	    rank_lut_ = const_cast<position_t*>(reinterpret_cast<const position_t*>(src));
+	src += rankLutSize();
+	align(src);
+	return true;
+    }
+
     void destroy() {
 	delete[] bits_;
 	delete[] rank_lut_;
+	delete[] block_counts_;
     }
 
+    static const position_t kTwoLevelBlockSize = 512;
+
 private:
+    static const position_t kSubBlockSize = 128;
+    static const position_t kSubBlockCountBits = 9;
+    static const word_t kSubBlockCountMask = (1 << kSubBlockCountBits) - 1;
+    static const position_t kTwoLevelFlag = 0x80000000;
+
+    position_t rankTwoLevel(position_t pos) const {
+	word_t entry = block_counts_[pos / kTwoLevelBlockSize];
+	position_t sub_block = (pos / kSubBlockSize) & 3;
+	position_t sub_block_rank = (entry >> ((3 - sub_block) * kSubBlockCountBits))
+	    & (sub_block ? kSubBlockCountMask : 0);
+	const word_t* words = bits_ + (pos / kSubBlockSize) * (kSubBlockSize / kWordSize);
+	position_t offset = pos & (kSubBlockSize - 1);
+	position_t word_rank;
+	if (offset < kWordSize)
+	    word_rank = popcount(words[0] >> (kWordSize - 1 - offset));
+	else
+	    word_rank = popcount(words[0])
+		+ popcount(words[1] >> (kSubBlockSize - 1 - offset));
+	return (position_t)(entry >> 32) + sub_block_rank + word_rank;
+    }
+
+    void initRank(const position_t basic_block_size) {
+	if (type_ == kRankTwoLevel) {
+	    basic_block_size_ = kTwoLevelBlockSize;
+	    initBlockCounts();
+	} else {
+	    basic_block_size_ = basic_block_size;
+	    initRankLut();
+	}
+    }
+
     void initRankLut() {
         position_t word_per_basic_block = basic_block_size_ / kWordSize;
         position_t num_blocks = num_bits_ / basic_block_size_ + 1;
@@ -104,8 +215,33 @@ private:
 	rank_lut_[num_blocks - 1] = cumu_rank;
     }
 
+    void initBlockCounts() {
+	position_t num_blocks = num_bits_ / kTwoLevelBlockSize + 1;
+	position_t num_words = numWords();
+	block_counts_ = new word_t[num_blocks];
+
+	position_t cumu_rank = 0;
+	for (position_t i = 0; i < num_blocks; i++) {
+	    word_t entry = (word_t)cumu_rank << 32;
+	    position_t block_rank = 0;
+	    for (position_t j = 0; j < kTwoLevelBlockSize / kWordSize; j++) {
+		if ((j > 0) && (j % (kSubBlockSize / kWordSize) == 0)) {
+		    position_t sub_block = j / (kSubBlockSize / kWordSize);
+		    entry |= (word_t)block_rank << ((3 - sub_block) * kSubBlockCountBits);
+		}
+		position_t word_id = i * (kTwoLevelBlockSize / kWordSize) + j;
+		if (word_id < num_words)
+		    block_rank += popcount(bits_[word_id]);
+	    }
+	    block_counts_[i] = entry;
+	    cumu_rank += block_rank;
+	}
+    }
+
     position_t basic_block_size_;
-    position_t* rank_lut_; //rank look-up table
+    RankType type_;
+    position_t* rank_lut_; //rank look-up table (kRankBasic)
+    word_t* block_counts_; // kRankTwoLevel
 };
 
 } // namespace surf
@@ -4,24 +4,36 @@
 #include "bitvector.hpp"
 
 #include <assert.h>
+#include <immintrin.h>
 
 #include <vector>
 
 #include "config.hpp"
 #include "popcount.h"
+#include "stats.hpp"
 
 namespace surf {
 
 class BitvectorSelect : public Bitvector {
 public:
-    BitvectorSelect() : sample_interval_(0), num_ones_(0), select_lut_(nullptr) {};
+    BitvectorSelect() : sample_interval_(0), num_ones_(0), select_lut_(nullptr),
+			use_pdep_(hasFastPdep()), is_copy_(false) {};
 
     BitvectorSelect(const position_t sample_interval, 
-		    const std::vector<std::vector<word_t> >& bitvector_per_level, 
-		    const std::vector<position_t>& num_bits_per_level,
-		    const level_t start_level = 0,
-		    const level_t end_level = 0/* non-inclusive */) 
-	: Bitvector(bitvector_per_level, num_bits_per_level, start_level, end_level) {
+		    const LevelBits& bits,
+		    const level_t start_level,
+		    const level_t end_level/* non-inclusive */) 
+	: Bitvector(bits, start_level, end_level),
+	  use_pdep_(hasFastPdep()), is_copy_(false) {
+	sample_interval_ = sample_interval;
+	initSelectLut();
+    }
+
+    // Takes over bits; see Bitvector
+    BitvectorSelect(const position_t sample_interval,
+		    word_t* bits, const position_t num_bits)
+	: Bitvector(bits, num_bits),
+	  use_pdep_(hasFastPdep()), is_copy_(false) {
 	sample_interval_ = sample_interval;
 	initSelectLut();
     }
@@ -34,6 +46,7 @@ public:
     position_t select(position_t rank) const {
 	assert(rank > 0);
 	assert(rank <= num_ones_);
+	SURF_STAT(lookupStats().select_calls++);
 	position_t lut_idx = rank / sample_interval_;
 	position_t rank_left = rank % sample_interval_;
 	// The first slot in select_lut_ stores the position of the first 1 bit.
@@ -62,7 +75,32 @@ public:
 	    rank_left -= ones_count_in_word;
 	    ones_count_in_word = popcount(word);
 	}
-	return (word_id * kWordSize + select64_popcount_search(word, rank_left));
+	return (word_id * kWordSize + selectInWord(word, rank_left));
+    }
+
+    // Position (counting from the most significant bit) of the
+    // k-th (one-based) 1 bit in word. Uses PDEP if the CPU has BMI2.
+    position_t selectInWord(const word_t word, const position_t k) const {
+	if (use_pdep_)
+	    return selectInWordPdep(word, k);
+	return selectInWordBroadword(word, k);
+    }
+
+    static bool hasFastPdep() {
+	return cpuFeatures().has_fast_pdep;
+    }
+
+    // Bits are numbered from the most significant end, so the k-th 1
+    // bit is the (popcount - k)-th (zero-based) from the least significant.
+    // Requires BMI2.
+    __attribute__((target("bmi2")))
+    static position_t selectInWordPdep(const word_t word, const position_t k) {
+	word_t target = (word_t)1 << (popcount(word) - k);
+	return (kWordSize - 1 - __builtin_ctzll(_pdep_u64(target, word)));
+    }
+
+    static position_t selectInWordBroadword(const word_t word, const position_t k) {
+	return (kWordSize - 1 - select64_broadword(word, popcount(word) - k));
     }
 
     position_t selectLutSize() const {
@@ -70,8 +108,7 @@ public:
     }
 
     position_t serializedSize() const {
-	position_t size = sizeof(num_bits_) + sizeof(sample_interval_) + sizeof(num_ones_)
-	    + bitsSize() + selectLutSize();
+	position_t size = kHeaderSize + bitsSize() + selectLutSize();
 	sizeAlign(size);
 	return size;
     }
@@ -84,13 +121,23 @@ public:
 	return num_ones_;
     }
 
+    // Prefetches the sampled position that select(rank) starts from.
+    void prefetch(position_t rank) const {
+	__builtin_prefetch(select_lut_ + (rank / sample_interval_));
+    }
+
+    // The header is padded to 16 bytes so that bits_ stays 8-byte
+    // aligned; the padding is flagged in the sample interval field.
     void serialize(char*& dst) const {
 	memcpy(dst, &num_bits_, sizeof(num_bits_));
 	dst += sizeof(num_bits_);
-	memcpy(dst, &sample_interval_, sizeof(sample_interval_));
-	dst += sizeof(sample_interval_);
+	position_t interval_field = sample_interval_ | kPaddedHeaderFlag;
+	memcpy(dst, &interval_field, sizeof(interval_field));
+	dst += sizeof(interval_field);
 	memcpy(dst, &num_ones_, sizeof(num_ones_));
 	dst += sizeof(num_ones_);
+	memset(dst, 0, kHeaderSize - 3 * sizeof(position_t));
+	dst += kHeaderSize - 3 * sizeof(position_t);
 	memcpy(dst, bits_, bitsSize());
 	dst += bitsSize();
 	memcpy(dst, select_lut_, selectLutSize());
@@ -100,26 +147,69 @@ public:
 
     static BitvectorSelect* deSerialize(char*& src) {
 	BitvectorSelect* bv_select = new BitvectorSelect();
-	memcpy(&(bv_select->num_bits_), src, sizeof(bv_select->num_bits_));
-	src += sizeof(bv_select->num_bits_);
-	memcpy(&(bv_select->sample_interval_), src, sizeof(bv_select->sample_interval_));
-	src += sizeof(bv_select->sample_interval_);
-	memcpy(&(bv_select->num_ones_), src, sizeof(bv_select->num_ones_));
-	src += sizeof(bv_select->num_ones_);
-	bv_select->bits_ = const_cast<word_t*>(reinterpret_cast<const word_t*>(src));
-	src += bv_select->bitsSize();
-	bv_select->select_lut_ = const_cast<position_t*>(reinterpret_cast<const position_t*>(src));
-	src += bv_select->selectLutSize();
-	align(src);
+	const char* cur = src;
+	bv_select->loadView(cur, nullptr);
+	src = const_cast<char*>(cur);
 	return bv_select;
     }
 
+    // Points the bitvector and its look-up table at a serialized image
+    // without copying. Returns false if the image is malformed, misaligned
+    // or does not fit before end.
+    // Images written before the header was padded have a 12-byte header
+    // that leaves bits_ misaligned; their arrays are copied into buffers
+    // of their own instead, which destroyCopy() frees.
+    bool loadView(const char*& src, const char* end) {
+	is_copy_ = false;
+	if (!isAligned(src) || !fitsInBuffer(src, end, kUnpaddedHeaderSize))
+	    return false;
+	memcpy(&num_bits_, src, sizeof(num_bits_));
+	memcpy(&sample_interval_, src + sizeof(num_bits_), sizeof(sample_interval_));
+	memcpy(&num_ones_, src + sizeof(num_bits_) + sizeof(sample_interval_), sizeof(num_ones_));
+	position_t header_size = kUnpaddedHeaderSize;
+	if (sample_interval_ & kPaddedHeaderFlag)
+	    header_size = kHeaderSize;
+	sample_interval_ &= ~kPaddedHeaderFlag;
+	if ((sample_interval_ == 0) || (num_ones_ > num_bits_))
+	    return false;
+	position_t size = header_size + bitsSize() + selectLutSize();
+	sizeAlign(size);
+	if (!fitsInBuffer(src, end, size))
+	    return false;
+	const char* bits = src + header_size;
+	const char* select_lut = bits + bitsSize();
+	if (header_size == kHeaderSize) {
+	    bits_ = const_cast<word_t*>(reinterpret_cast<const word_t*>(bits));
+	    select_lut_ = const_cast<position_t*>(reinterpret_cast<const position_t*>(select_lut));
+	} else {
+	    bits_ = new word_t[numWords()];
+	    memcpy(bits_, bits, bitsSize());
+	    select_lut_ = new position_t[selectLutSize() / sizeof(position_t)];
+	    memcpy(select_lut_, select_lut, selectLutSize());
+	    is_copy_ = true;
+	}
+	src += size;
+	return true;
+    }
+
     void destroy() {
 	delete[] bits_;
 	delete[] select_lut_;
     }
 
+    // Frees the arrays loadView copied, if any; for views whose
+    // image is owned by the caller.
+    void destroyCopy() {
+	if (is_copy_)
+	    destroy();
+	is_copy_ = false;
+    }
+
 private:
+    static const position_t kHeaderSize = 16;
+    static const position_t kUnpaddedHeaderSize = 12;
+    static const position_t kPaddedHeaderFlag = 0x80000000;
+
     // This function currently assumes that the first bit in the
     // bitvector is one.
     void initSelectLut() {
@@ -135,7 +225,7 @@ private:
 	    position_t num_ones_in_word = popcount(bits_[i]);
 	    while (sampling_ones <= (cumu_ones_upto_word + num_ones_in_word)) {
 		int diff = sampling_ones - cumu_ones_upto_word;
-		position_t result_pos = i * kWordSize + select64_popcount_search(bits_[i], diff);
+		position_t result_pos = i * kWordSize + selectInWord(bits_[i], diff);
 		select_lut_vector.push_back(result_pos);
 		sampling_ones += sample_interval_;
 	    }
@@ -153,6 +243,8 @@ private:
     position_t sample_interval_;
     position_t num_ones_;
     position_t* select_lut_; //select look-up table
+    bool use_pdep_; // checked once per bitvector; not serialized
+    bool is_copy_; // true if loadView copied the arrays of an unpadded image
 };
 
 } // namespace surf
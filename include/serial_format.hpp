@@ -0,0 +1,437 @@
+#ifndef SERIALFORMAT_H_
+#define SERIALFORMAT_H_
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include "config.hpp"
+#include "crc32c.hpp"
+
+namespace surf {
+
+//******************************************************
+// Image layout written by SuRF::serialize():
+//   FormatHeader | SectionEntry[num_sections] | sections
+// Each section (a trie's meta fields, or one bitvector
+// together with its rank/select LUT, or a suffix array)
+// starts at an 8-byte aligned offset and carries its own
+// CRC32C, so readers can map and verify sections
+// independently. header_crc covers the header (with
+// header_crc set to 0) and the section directory.
+//******************************************************
+static const uint32_t kFormatMagic = 0x46527553; // "SuRF"
+static const uint32_t kEndianMarker = 0x01020304;
+static const uint32_t kFormatVersion = 1;
+// Oldest version this reader understands
+static const uint32_t kMinFormatVersion = 1;
+
+enum SectionId {
+    kSectionDenseMeta = 1,
+    kSectionDenseLabelBitmaps = 2,
+    kSectionDenseChildIndicatorBitmaps = 3,
+    kSectionDensePrefixkeyIndicatorBits = 4,
+    kSectionDenseSuffixes = 5,
+    kSectionSparseMeta = 6,
+    kSectionSparseLabels = 7,
+    kSectionSparseChildIndicatorBits = 8,
+    kSectionSparseLoudsBits = 9,
+    kSectionSparseSuffixes = 10
+};
+
+static const uint32_t kNumSections = 10;
+
+// FormatHeader::flags; 0 in images written before they were used
+// every key is kUint64KeyLen bytes long (see SuRFInt64)
+static const uint32_t kFormatFlagUint64Keys = 1;
+
+struct FormatHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t endian_marker;
+    uint32_t num_sections;
+    uint64_t total_size;
+    uint32_t header_crc;
+    uint32_t flags;
+};
+
+struct SectionEntry {
+    uint32_t id;
+    uint32_t crc;
+    uint64_t offset; // from the beginning of the image
+    uint64_t size;
+};
+
+inline uint64_t formatHeaderSize(const uint32_t num_sections) {
+    uint64_t size = sizeof(FormatHeader) + (uint64_t)num_sections * sizeof(SectionEntry);
+    sizeAlign(size);
+    return size;
+}
+
+//******************************************************
+// Destination of a serialized image. Sections are
+// appended one at a time: reserve() hands out room for
+// the next one and commit() appends what was written
+// into it. Write errors are sticky and reported by
+// flush() and patch().
+//******************************************************
+class SerialSink {
+public:
+    SerialSink() : size_(0) {};
+    virtual ~SerialSink() {}
+
+    // Returns an 8-byte aligned region of size bytes that
+    // becomes the image from offset getSize() on.
+    virtual char* reserve(const uint64_t size) = 0;
+    // Appends the first size bytes of the last reserved region.
+    virtual void commit(const uint64_t size) = 0;
+    // Overwrites size committed bytes at offset.
+    virtual bool patch(const uint64_t offset, const char* src, const uint64_t size) = 0;
+    // Writes out anything still buffered.
+    virtual bool flush() { return true; };
+
+    // bytes committed so far
+    uint64_t getSize() const { return size_; };
+
+protected:
+    uint64_t size_;
+};
+
+// Writes into a caller-owned buffer of known capacity.
+class ArraySink : public SerialSink {
+public:
+    ArraySink(char* dst, const uint64_t capacity) : dst_(dst), capacity_(capacity) {};
+
+    char* reserve(const uint64_t size) {
+	assert(size_ + size <= capacity_);
+	(void)size;
+	return dst_ + size_;
+    }
+
+    void commit(const uint64_t size) {
+	size_ += size;
+    }
+
+    bool patch(const uint64_t offset, const char* src, const uint64_t size) {
+	assert(offset + size <= size_);
+	memcpy(dst_ + offset, src, size);
+	return true;
+    }
+
+private:
+    char* dst_;
+    uint64_t capacity_;
+};
+
+// Collects the image in memory, growing as sections arrive.
+// Growth goes through realloc, which can remap large buffers
+// instead of copying them.
+class BufferSink : public SerialSink {
+public:
+    BufferSink() : data_(nullptr), capacity_(0) {};
+    ~BufferSink() { free(data_); }
+
+    char* reserve(const uint64_t size) {
+	if (size_ + size > capacity_) {
+	    uint64_t capacity = std::max(size_ + size, capacity_ * 2);
+	    char* data = static_cast<char*>(realloc(data_, capacity));
+	    if (data == nullptr)
+		throw std::bad_alloc();
+	    data_ = data;
+	    capacity_ = capacity;
+	}
+	return data_ + size_;
+    }
+
+    void commit(const uint64_t size) {
+	size_ += size;
+    }
+
+    bool patch(const uint64_t offset, const char* src, const uint64_t size) {
+	assert(offset + size <= size_);
+	memcpy(data_ + offset, src, size);
+	return true;
+    }
+
+    // The image; malloc-aligned, so it can be passed to SuRF::loadView.
+    // Valid until the next reserve().
+    char* data() { return data_; };
+
+private:
+    BufferSink(const BufferSink&);
+    BufferSink& operator=(const BufferSink&);
+
+    char* data_;
+    uint64_t capacity_;
+};
+
+// Writes the image to a file descriptor from its current offset,
+// batching small sections into writes of at least kBatchSize bytes.
+// A section larger than that gets its own write. The header is
+// written last with pwrite(), so fd must be a seekable file that
+// is not opened with O_APPEND.
+class FdSink : public SerialSink {
+public:
+    static const uint64_t kBatchSize = 1 << 20;
+
+    explicit FdSink(const int fd)
+	: fd_(fd), start_offset_(lseek(fd, 0, SEEK_CUR)),
+	  buffer_(kBatchSize / 8), num_buffered_(0), failed_(start_offset_ < 0) {};
+
+    ~FdSink() { flush(); }
+
+    char* reserve(const uint64_t size) {
+	if (num_buffered_ + size > buffer_.size() * 8) {
+	    flush();
+	    if (size > buffer_.size() * 8)
+		buffer_.resize((size + 7) / 8);
+	}
+	return reinterpret_cast<char*>(buffer_.data()) + num_buffered_;
+    }
+
+    void commit(const uint64_t size) {
+	num_buffered_ += size;
+	size_ += size;
+	// do not hold on to the room of an oversized section
+	if (buffer_.size() * 8 > kBatchSize) {
+	    flush();
+	    std::vector<uint64_t>(kBatchSize / 8).swap(buffer_);
+	}
+    }
+
+    bool patch(const uint64_t offset, const char* src, const uint64_t size) {
+	if (!flush())
+	    return false;
+	failed_ = !writeAll(src, size, start_offset_ + offset);
+	return !failed_;
+    }
+
+    bool flush() {
+	if (num_buffered_ > 0 && !failed_) {
+	    failed_ = !writeAll(reinterpret_cast<const char*>(buffer_.data()), num_buffered_, -1);
+	}
+	num_buffered_ = 0;
+	return !failed_;
+    }
+
+private:
+    // offset < 0: write at the current file offset
+    bool writeAll(const char* src, uint64_t size, const off_t offset) const {
+	uint64_t done = 0;
+	while (done < size) {
+	    ssize_t n = (offset < 0) ? write(fd_, src + done, size - done)
+		: pwrite(fd_, src + done, size - done, offset + done);
+	    if (n < 0 && errno == EINTR)
+		continue;
+	    if (n <= 0)
+		return false;
+	    done += n;
+	}
+	return true;
+    }
+
+    int fd_;
+    off_t start_offset_;
+    std::vector<uint64_t> buffer_;
+    uint64_t num_buffered_;
+    bool failed_;
+};
+
+// Lays out an image in a SerialSink: the header and the section
+// directory are reserved first and filled in by finish().
+class SectionWriter {
+public:
+    SectionWriter(SerialSink& sink, const uint32_t num_sections, const uint32_t flags = 0)
+	: sink_(&sink), base_(sink.getSize()), cur_(nullptr),
+	  entries_(num_sections), num_written_(0), flags_(flags) {
+	uint64_t header_size = formatHeaderSize(num_sections);
+	memset(sink_->reserve(header_size), 0, header_size);
+	sink_->commit(header_size);
+    }
+
+    // Returns where the payload of section id starts; it must
+    // take at most size bytes. The room is zeroed, so the alignment
+    // padding that serialize() skips over is the same in every image.
+    char* beginSection(const uint32_t id, const uint64_t size) {
+	assert(num_written_ < entries_.size());
+	SectionEntry& entry = entries_[num_written_];
+	entry.id = id;
+	entry.crc = 0;
+	entry.offset = sink_->getSize() - base_;
+	entry.size = size;
+	cur_ = sink_->reserve(size);
+	memset(cur_, 0, size);
+	return cur_;
+    }
+
+    // end points right after the (aligned) payload of the current section.
+    void endSection(char* end) {
+	SectionEntry& entry = entries_[num_written_];
+	assert((uint64_t)(end - cur_) <= entry.size);
+	entry.size = end - cur_;
+	entry.crc = crc32c(cur_, entry.size);
+	sink_->commit(entry.size);
+	num_written_++;
+    }
+
+    // Fills in the header and flushes the sink; returns the total
+    // image size, or 0 if the sink failed.
+    uint64_t finish() {
+	assert(num_written_ == entries_.size());
+	uint32_t num_sections = entries_.size();
+	std::vector<uint64_t> words(formatHeaderSize(num_sections) / 8, 0);
+	char* dst = reinterpret_cast<char*>(words.data());
+	FormatHeader header;
+	header.magic = kFormatMagic;
+	header.version = kFormatVersion;
+	header.endian_marker = kEndianMarker;
+	header.num_sections = num_sections;
+	header.total_size = sink_->getSize() - base_;
+	header.header_crc = 0;
+	header.flags = flags_;
+	memcpy(dst, &header, sizeof(header));
+	memcpy(dst + sizeof(header), entries_.data(), num_sections * sizeof(SectionEntry));
+	header.header_crc = crc32c(dst, formatHeaderSize(num_sections));
+	memcpy(dst, &header, sizeof(header));
+	if (!sink_->patch(base_, dst, formatHeaderSize(num_sections)) || !sink_->flush())
+	    return 0;
+	return header.total_size;
+    }
+
+private:
+    SerialSink* sink_;
+    uint64_t base_; // sink offset of the image
+    char* cur_; // payload of the current section
+    std::vector<SectionEntry> entries_;
+    uint32_t num_written_;
+    uint32_t flags_;
+};
+
+// Writes component into its own section.
+template <typename Component>
+void writeSection(SectionWriter& writer, const uint32_t id, const Component& component) {
+    char* dst = writer.beginSection(id, component.serializedSize());
+    component.serialize(dst);
+    writer.endSection(dst);
+}
+
+// Read-only index over a serialized image. It points into the image
+// and never allocates; section payloads are only checksummed on demand.
+class SectionTable {
+public:
+    SectionTable() : base_(nullptr), num_sections_(0), version_(0), flags_(0) {};
+
+    // Returns true if the image starts with the format magic, i.e.,
+    // it is not a headerless image written by older versions.
+    static bool hasMagic(const char* src, const uint64_t size) {
+	uint32_t magic;
+	if (size < sizeof(magic))
+	    return false;
+	memcpy(&magic, src, sizeof(magic));
+	return (magic == kFormatMagic);
+    }
+
+    // Returns the image size recorded in the header, 0 if there is none.
+    static uint64_t imageSize(const char* src) {
+	if (!hasMagic(src, sizeof(FormatHeader)))
+	    return 0;
+	FormatHeader header;
+	memcpy(&header, src, sizeof(header));
+	return header.total_size;
+    }
+
+    // Checks the header, its checksum and the bounds of every section.
+    bool load(const char* src, const uint64_t size) {
+	FormatHeader header;
+	if (!isAligned(src) || (size < sizeof(header)))
+	    return false;
+	memcpy(&header, src, sizeof(header));
+	if ((header.magic != kFormatMagic) || (header.endian_marker != kEndianMarker)
+	    || (header.version < kMinFormatVersion) || (header.version > kFormatVersion)
+	    || (header.total_size > size))
+	    return false;
+	uint64_t header_size = formatHeaderSize(header.num_sections);
+	if ((header.num_sections > header.total_size) || (header_size > header.total_size))
+	    return false;
+
+	uint32_t header_crc = header.header_crc;
+	header.header_crc = 0;
+	uint32_t crc = crc32cExtend(0, reinterpret_cast<const char*>(&header), sizeof(header));
+	crc = crc32cExtend(crc, src + sizeof(header), header_size - sizeof(header));
+	if (crc != header_crc)
+	    return false;
+
+	base_ = src;
+	num_sections_ = header.num_sections;
+	version_ = header.version;
+	flags_ = header.flags;
+	for (uint32_t i = 0; i < num_sections_; i++) {
+	    SectionEntry entry = getEntry(i);
+	    if ((entry.offset % 8 != 0) || (entry.offset < header_size)
+		|| (entry.offset > header.total_size)
+		|| (entry.size > header.total_size - entry.offset))
+		return false;
+	}
+	return true;
+    }
+
+    // Sets [begin, end) to the payload of section id.
+    // Returns false if the image has no such section.
+    bool find(const uint32_t id, const char*& begin, const char*& end) const {
+	SectionEntry entry;
+	if (!findEntry(id, entry))
+	    return false;
+	begin = base_ + entry.offset;
+	end = begin + entry.size;
+	return true;
+    }
+
+    bool verifySection(const uint32_t id) const {
+	SectionEntry entry;
+	if (!findEntry(id, entry))
+	    return false;
+	return (crc32c(base_ + entry.offset, entry.size) == entry.crc);
+    }
+
+    bool verifyAll() const {
+	for (uint32_t i = 0; i < num_sections_; i++) {
+	    SectionEntry entry = getEntry(i);
+	    if (crc32c(base_ + entry.offset, entry.size) != entry.crc)
+		return false;
+	}
+	return true;
+    }
+
+    uint32_t getVersion() const { return version_; };
+    uint32_t getFlags() const { return flags_; };
+
+private:
+    SectionEntry getEntry(const uint32_t i) const {
+	SectionEntry entry;
+	memcpy(&entry, base_ + sizeof(FormatHeader) + i * sizeof(SectionEntry), sizeof(entry));
+	return entry;
+    }
+
+    bool findEntry(const uint32_t id, SectionEntry& entry) const {
+	for (uint32_t i = 0; i < num_sections_; i++) {
+	    entry = getEntry(i);
+	    if (entry.id == id)
+		return true;
+	}
+	return false;
+    }
+
+    const char* base_;
+    uint32_t num_sections_;
+    uint32_t version_;
+    uint32_t flags_;
+};
+
+} // namespace surf
+
+#endif // SERIALFORMAT_H_
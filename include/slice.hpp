@@ -0,0 +1,64 @@
+#ifndef SLICE_H_
+#define SLICE_H_
+
+#include <assert.h>
+#include <string.h>
+
+#include <string>
+
+namespace surf {
+
+//******************************************************
+// A non-owning (pointer, length) view of key bytes, e.g.,
+// a key inside a block buffer. Queries take Slices so
+// that probing does not build a std::string per key.
+// The bytes must stay alive while the Slice is used.
+//******************************************************
+class Slice {
+public:
+    Slice() : data_(""), size_(0) {};
+    Slice(const char* data, const size_t size) : data_(data), size_(size) {};
+    Slice(const std::string& s) : data_(s.data()), size_(s.size()) {};
+
+    const char* data() const { return data_; };
+    size_t size() const { return size_; };
+    size_t length() const { return size_; };
+    bool empty() const { return (size_ == 0); };
+
+    char operator[](const size_t n) const {
+	assert(n < size_);
+	return data_[n];
+    }
+
+    // Same as std::string::substr, without copying
+    Slice substr(size_t pos, size_t n = std::string::npos) const {
+	if (pos > size_)
+	    pos = size_;
+	if (n > size_ - pos)
+	    n = size_ - pos;
+	return Slice(data_ + pos, n);
+    }
+
+    // Same sign convention as std::string::compare
+    int compare(const Slice& b) const {
+	size_t min_len = (size_ < b.size_) ? size_ : b.size_;
+	int r = (min_len == 0) ? 0 : memcmp(data_, b.data_, min_len);
+	if (r == 0) {
+	    if (size_ < b.size_)
+		r = -1;
+	    else if (size_ > b.size_)
+		r = 1;
+	}
+	return r;
+    }
+
+    std::string toString() const { return std::string(data_, size_); };
+
+private:
+    const char* data_;
+    size_t size_;
+};
+
+} // namespace surf
+
+#endif // SLICE_H_
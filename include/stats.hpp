@@ -0,0 +1,144 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <sstream>
+#include <string>
+
+#include "config.hpp"
+
+//******************************************************
+// Hot-path counters of point lookups, compiled in only
+// with -DSURF_STATS (cmake -DSURF_STATS=ON). Otherwise
+// SURF_STAT expands to nothing and lookups are unchanged.
+// Counters are per thread: lookupStats() returns the
+// calling thread's LookupStats; merge() sums them up.
+// Rank, select and label search calls are counted for
+// every caller on the thread, iterators included.
+//******************************************************
+#ifdef SURF_STATS
+#define SURF_STAT(stmt) do { stmt; } while (0)
+#else
+#define SURF_STAT(stmt) do {} while (0)
+#endif
+
+namespace surf {
+
+// Why a lookupKey walk stopped in louds-dense or louds-sparse
+enum LookupExit {
+    kExitNoLabel = 0, // the key byte has no label
+    kExitLeaf = 1, // the branch ends; suffix check
+    kExitPrefixKey = 2, // the key ends at a stored key; suffix check
+    kExitKeyEnd = 3, // the key ends at an inner node without a stored key
+    kExitToSparse = 4, // louds-dense hands the walk to louds-sparse
+    kNumLookupExits = 5
+};
+
+struct LookupStats {
+    // walks deeper than kMaxDepth levels share the last bucket
+    static const level_t kMaxDepth = 64;
+    // bucket i counts nodes of [2^i, 2^(i+1)) labels
+    static const unsigned kNumNodeSizeBuckets = 9;
+
+#ifdef SURF_STATS
+    static const bool kEnabled = true;
+#else
+    static const bool kEnabled = false;
+#endif
+
+    LookupStats() { reset(); }
+
+    void reset() {
+	memset(this, 0, sizeof(LookupStats));
+    }
+
+    void recordExit(const bool is_sparse, const LookupExit reason, const level_t depth) {
+	exits[is_sparse][reason]++;
+	if (reason != kExitToSparse)
+	    depth_hist[(depth < kMaxDepth) ? depth : kMaxDepth]++;
+    }
+
+    void recordNodeSize(const position_t node_size) {
+	unsigned bucket = 0;
+	while ((bucket + 1 < kNumNodeSizeBuckets) && ((node_size >> (bucket + 1)) > 0))
+	    bucket++;
+	node_size_hist[bucket]++;
+    }
+
+    void merge(const LookupStats& other) {
+	dense_lookups += other.dense_lookups;
+	sparse_lookups += other.sparse_lookups;
+	dense_levels += other.dense_levels;
+	sparse_levels += other.sparse_levels;
+	for (int s = 0; s < 2; s++)
+	    for (int r = 0; r < kNumLookupExits; r++)
+		exits[s][r] += other.exits[s][r];
+	for (level_t d = 0; d <= kMaxDepth; d++)
+	    depth_hist[d] += other.depth_hist[d];
+	rank_calls += other.rank_calls;
+	select_calls += other.select_calls;
+	label_searches += other.label_searches;
+	for (unsigned b = 0; b < kNumNodeSizeBuckets; b++)
+	    node_size_hist[b] += other.node_size_hist[b];
+	suffix_checks += other.suffix_checks;
+	suffix_matches += other.suffix_matches;
+    }
+
+    std::string toString() const;
+
+    uint64_t dense_lookups; // walks started in louds-dense
+    uint64_t sparse_lookups; // walks continued in louds-sparse
+    uint64_t dense_levels; // levels traversed in louds-dense
+    uint64_t sparse_levels; // levels traversed in louds-sparse
+    uint64_t exits[2][kNumLookupExits]; // [0]: louds-dense, [1]: louds-sparse
+    uint64_t depth_hist[kMaxDepth + 1]; // levels traversed per finished lookup
+    uint64_t rank_calls;
+    uint64_t select_calls;
+    uint64_t label_searches;
+    uint64_t node_size_hist[kNumNodeSizeBuckets]; // sizes seen by LoudsSparse::nodeSize
+    uint64_t suffix_checks; // BitvectorSuffix::checkEquality calls
+    uint64_t suffix_matches; // checks that returned true
+};
+
+const level_t LookupStats::kMaxDepth;
+const unsigned LookupStats::kNumNodeSizeBuckets;
+const bool LookupStats::kEnabled;
+
+std::string LookupStats::toString() const {
+    static const char* kExitNames[kNumLookupExits]
+	= {"no_label", "leaf", "prefix_key", "key_end", "to_sparse"};
+    std::ostringstream out;
+    out << "lookups dense " << dense_lookups << " sparse " << sparse_lookups << "\n";
+    out << "levels dense " << dense_levels << " sparse " << sparse_levels << "\n";
+    for (int s = 0; s < 2; s++) {
+	out << (s ? "exits sparse" : "exits dense");
+	for (int r = 0; r < kNumLookupExits; r++)
+	    out << " " << kExitNames[r] << " " << exits[s][r];
+	out << "\n";
+    }
+    out << "rank " << rank_calls << " select " << select_calls
+	<< " label_search " << label_searches << "\n";
+    out << "suffix checks " << suffix_checks << " matches " << suffix_matches << "\n";
+    out << "depth";
+    for (level_t d = 0; d <= kMaxDepth; d++)
+	if (depth_hist[d] > 0)
+	    out << " " << d << ":" << depth_hist[d];
+    out << "\n";
+    out << "node_size";
+    for (unsigned b = 0; b < kNumNodeSizeBuckets; b++)
+	out << " " << (1u << b) << "+:" << node_size_hist[b];
+    out << "\n";
+    return out.str();
+}
+
+// The calling thread's counters
+inline LookupStats& lookupStats() {
+    static thread_local LookupStats stats;
+    return stats;
+}
+
+} // namespace surf
+
+#endif // STATS_H_
@@ -9,6 +9,8 @@
 
 #include "config.hpp"
 #include "hash.hpp"
+#include "slice.hpp"
+#include "stats.hpp"
 
 namespace surf {
 
@@ -18,29 +20,46 @@ namespace surf {
 // to indicate that there is no suffix info associated with the key.
 class BitvectorSuffix : public Bitvector {
 public:
-    BitvectorSuffix() : type_(kNone), hash_suffix_len_(0), real_suffix_len_(0) {};
+    BitvectorSuffix() : type_(kNone), hash_type_(kSuffixHashLevelDB),
+			hash_suffix_len_(0), real_suffix_len_(0) {};
 
     BitvectorSuffix(const SuffixType type,
                     const level_t hash_suffix_len, const level_t real_suffix_len,
-                    const std::vector<std::vector<word_t> >& bitvector_per_level,
-                    const std::vector<position_t>& num_bits_per_level,
-                    const level_t start_level = 0,
-                    level_t end_level = 0/* non-inclusive */)
-	: Bitvector(bitvector_per_level, num_bits_per_level, start_level, end_level) {
-	assert((hash_suffix_len + real_suffix_len) <= kWordSize);
-	type_ = type;
-	hash_suffix_len_ = hash_suffix_len;
-        real_suffix_len_ = real_suffix_len;
+                    const LevelBits& bits,
+                    const level_t start_level,
+                    const level_t end_level/* non-inclusive */,
+		    const SuffixHashType hash_type = kSuffixHashLevelDB)
+	: Bitvector(bits, start_level, end_level) {
+	init(type, hash_suffix_len, real_suffix_len, hash_type);
+    }
+
+    // Takes over bits; see Bitvector
+    BitvectorSuffix(const SuffixType type,
+                    const level_t hash_suffix_len, const level_t real_suffix_len,
+                    word_t* bits, const position_t num_bits,
+		    const SuffixHashType hash_type = kSuffixHashLevelDB)
+	: Bitvector(bits, num_bits) {
+	init(type, hash_suffix_len, real_suffix_len, hash_type);
     }
 
-    static word_t constructHashSuffix(const std::string& key, const level_t len) {
-	word_t suffix = suffixHash(key);
-	suffix <<= (kWordSize - len - kHashShift);
+    static word_t constructHashSuffix(const Slice& key, const level_t len,
+				      const SuffixHashType hash_type = kSuffixHashLevelDB) {
+	return constructHashSuffix(suffixHash(key, hash_type), len);
+    }
+
+    // Suffixes longer than kWordSize - kHashShift bits (64-bit hash
+    // only) take the low hash bits as well.
+    static word_t constructHashSuffix(const word_t key_hash, const level_t len) {
+	level_t shift = kHashShift;
+	if (len + shift > kWordSize)
+	    shift = kWordSize - len;
+	word_t suffix = key_hash;
+	suffix <<= (kWordSize - len - shift);
 	suffix >>= (kWordSize - len);
 	return suffix;
     }
 
-    static word_t constructRealSuffix(const std::string& key,
+    static word_t constructRealSuffix(const Slice& key,
 				      const level_t level, const level_t len) {
 	if (key.length() < level || ((key.length() - level) * 8) < len)
 	    return 0;
@@ -64,9 +83,24 @@ public:
 	return suffix;
     }
 
-    static word_t constructMixedSuffix(const std::string& key, const level_t hash_len,
+    // constructRealSuffix of the 8-byte key uint64ToString(key)
+    static word_t constructRealSuffix(const uint64_t key, const level_t level, const level_t len) {
+	if ((len == 0) || ((8 - level) * 8 < len))
+	    return 0;
+	return (key << (8 * level)) >> (kWordSize - len);
+    }
+
+    static word_t constructMixedSuffix(const Slice& key, const level_t hash_len,
+				       const level_t real_level, const level_t real_len,
+				       const SuffixHashType hash_type = kSuffixHashLevelDB) {
+	return constructMixedSuffix(key, suffixHash(key, hash_type), hash_len,
+				    real_level, real_len);
+    }
+
+    static word_t constructMixedSuffix(const Slice& key, const word_t key_hash,
+				       const level_t hash_len,
 				       const level_t real_level, const level_t real_len) {
-        word_t hash_suffix = constructHashSuffix(key, hash_len);
+        word_t hash_suffix = constructHashSuffix(key_hash, hash_len);
         word_t real_suffix = constructRealSuffix(key, real_level, real_len);
         word_t suffix = hash_suffix;
         suffix <<= real_len;
@@ -74,16 +108,27 @@ public:
         return suffix;
     }
 
-    static word_t constructSuffix(const SuffixType type, const std::string& key,
+    static word_t constructSuffix(const SuffixType type, const Slice& key,
                                   const level_t hash_len,
-                                  const level_t real_level, const level_t real_len) {
+                                  const level_t real_level, const level_t real_len,
+				  const SuffixHashType hash_type = kSuffixHashLevelDB) {
+	word_t key_hash = 0;
+	if ((type == kHash) || (type == kMixed))
+	    key_hash = suffixHash(key, hash_type);
+	return constructSuffix(type, key, key_hash, hash_len, real_level, real_len);
+    }
+
+    // key_hash is suffixHash(key, hash_type), computed by the caller
+    static word_t constructSuffix(const SuffixType type, const Slice& key,
+				  const word_t key_hash, const level_t hash_len,
+				  const level_t real_level, const level_t real_len) {
 	switch (type) {
 	case kHash:
-	    return constructHashSuffix(key, hash_len);
+	    return constructHashSuffix(key_hash, hash_len);
 	case kReal:
 	    return constructRealSuffix(key, real_level, real_len);
         case kMixed:
-            return constructMixedSuffix(key, hash_len, real_level, real_len);
+            return constructMixedSuffix(key, key_hash, hash_len, real_level, real_len);
 	default:
 	    return 0;
         }
@@ -104,6 +149,10 @@ public:
 	return type_;
     }
 
+    SuffixHashType getHashType() const {
+	return hash_type_;
+    }
+
     level_t getSuffixLen() const {
 	return hash_suffix_len_ + real_suffix_len_;
     }
@@ -129,16 +178,29 @@ public:
 
     word_t read(const position_t idx) const;
     word_t readReal(const position_t idx) const;
-    bool checkEquality(const position_t idx, const std::string& key, const level_t level) const;
+    bool checkEquality(const position_t idx, const Slice& key, const level_t level) const;
+    // Same, with suffixHash(key, getHashType()) precomputed,
+    // e.g. by suffixHashes
+    bool checkEquality(const position_t idx, const Slice& key, const level_t level,
+		       const word_t key_hash) const;
+
+    // checkEquality for the 8-byte key uint64ToString(key)
+    bool checkEquality(const position_t idx, const uint64_t key, const level_t level) const;
+
+    // Returns false only if the stored key cannot start with prefix,
+    // i.e., its real suffix bits differ from the prefix bits after level.
+    // Hash suffixes cannot tell and always return true.
+    bool checkPrefix(const position_t idx, const Slice& prefix, const level_t level) const;
 
     // Compare stored suffix to querying suffix.
     // kReal suffix type only.
-    int compare(const position_t idx, const std::string& key, const level_t level) const;
+    int compare(const position_t idx, const Slice& key, const level_t level) const;
 
     void serialize(char*& dst) const {
 	memcpy(dst, &num_bits_, sizeof(num_bits_));
 	dst += sizeof(num_bits_);
-	memcpy(dst, &type_, sizeof(type_));
+	uint32_t type_field = type_ | (hash_type_ << kHashTypeShift);
+	memcpy(dst, &type_field, sizeof(type_));
 	dst += sizeof(type_);
 	memcpy(dst, &hash_suffix_len_, sizeof(hash_suffix_len_));
 	dst += sizeof(hash_suffix_len_);
@@ -153,20 +215,45 @@ public:
 
     static BitvectorSuffix* deSerialize(char*& src) {
 	BitvectorSuffix* sv = new BitvectorSuffix();
-	memcpy(&(sv->num_bits_), src, sizeof(sv->num_bits_));
-	src += sizeof(sv->num_bits_);
-	memcpy(&(sv->type_), src, sizeof(sv->type_));
-	src += sizeof(sv->type_);
-	memcpy(&(sv->hash_suffix_len_), src, sizeof(sv->hash_suffix_len_));
-	src += sizeof(sv->hash_suffix_len_);
-        memcpy(&(sv->real_suffix_len_), src, sizeof(sv->real_suffix_len_));
-	src += sizeof(sv->real_suffix_len_);
-	if (sv->type_ != kNone) {
-	    sv->bits_ = const_cast<word_t*>(reinterpret_cast<const word_t*>(src));
-	    src += sv->bitsSize();
+	const char* cur = src;
+	sv->loadView(cur, nullptr);
+	src = const_cast<char*>(cur);
+	return sv;
+    }
+
+    // Points the suffix bits at a serialized image without copying.
+    // Returns false if the image is malformed, misaligned or does not
+    // fit before end.
+    bool loadView(const char*& src, const char* end) {
+	position_t header_size = sizeof(num_bits_) + sizeof(type_)
+	    + sizeof(hash_suffix_len_) + sizeof(real_suffix_len_);
+	if (!isAligned(src) || !fitsInBuffer(src, end, header_size))
+	    return false;
+	const char* cur = src;
+	memcpy(&num_bits_, cur, sizeof(num_bits_));
+	cur += sizeof(num_bits_);
+	uint32_t type_field = 0;
+	memcpy(&type_field, cur, sizeof(type_));
+	cur += sizeof(type_);
+	type_ = (SuffixType)(type_field & ((1 << kHashTypeShift) - 1));
+	hash_type_ = (SuffixHashType)(type_field >> kHashTypeShift);
+	memcpy(&hash_suffix_len_, cur, sizeof(hash_suffix_len_));
+	cur += sizeof(hash_suffix_len_);
+	memcpy(&real_suffix_len_, cur, sizeof(real_suffix_len_));
+	cur += sizeof(real_suffix_len_);
+	if ((type_ < kNone) || (type_ > kMixed) || (hash_type_ > kSuffixHash64)
+	    || (hash_suffix_len_ > kWordSize) || (real_suffix_len_ > kWordSize)
+	    || (hash_suffix_len_ + real_suffix_len_ > kWordSize))
+	    return false;
+	if (type_ != kNone) {
+	    if (!fitsInBuffer(src, end, header_size + bitsSize()))
+		return false;
+	    bits_ = const_cast<word_t*>(reinterpret_cast<const word_t*>(cur));
+	    cur += bitsSize();
 	}
+	src = cur;
 	align(src);
-	return sv;
+	return true;
     }
 
     void destroy() {
@@ -175,7 +262,21 @@ public:
     }
 
 private:
+    void init(const SuffixType type, const level_t hash_suffix_len,
+	      const level_t real_suffix_len, const SuffixHashType hash_type) {
+	assert((hash_suffix_len + real_suffix_len) <= kWordSize);
+	type_ = type;
+	hash_type_ = hash_type;
+	hash_suffix_len_ = hash_suffix_len;
+        real_suffix_len_ = real_suffix_len;
+    }
+
+    // The hash type is kept above the suffix type in the serialized
+    // type field; images from before it existed read as LevelDB.
+    static const unsigned kHashTypeShift = 8;
+
     SuffixType type_;
+    SuffixHashType hash_type_;
     level_t hash_suffix_len_; // in bits
     level_t real_suffix_len_; // in bits
 };
@@ -202,26 +303,87 @@ word_t BitvectorSuffix::readReal(const position_t idx) const {
 }
 
 bool BitvectorSuffix::checkEquality(const position_t idx, 
-				    const std::string& key, const level_t level) const {
-    if (type_ == kNone) 
+				    const Slice& key, const level_t level) const {
+    if ((type_ == kHash) || (type_ == kMixed))
+	return checkEquality(idx, key, level, suffixHash(key, hash_type_));
+    return checkEquality(idx, key, level, 0);
+}
+
+bool BitvectorSuffix::checkEquality(const position_t idx, const Slice& key,
+				    const level_t level, const word_t key_hash) const {
+    SURF_STAT(lookupStats().suffix_checks++);
+    if (type_ == kNone) {
+	SURF_STAT(lookupStats().suffix_matches++);
 	return true;
+    }
     if (idx * getSuffixLen() >= num_bits_) 
 	return false;
 
     word_t stored_suffix = read(idx);
     if (type_ == kReal) {
 	// if no suffix info for the stored key
-	if (stored_suffix == 0) 
+	if (stored_suffix == 0) {
+	    SURF_STAT(lookupStats().suffix_matches++);
 	    return true;
+	}
 	// if the querying key is shorter than the stored key
 	if (key.length() < level || ((key.length() - level) * 8) < real_suffix_len_) 
 	    return false;
     }
     word_t querying_suffix 
-	= constructSuffix(type_, key, hash_suffix_len_, level, real_suffix_len_);
+	= constructSuffix(type_, key, key_hash, hash_suffix_len_, level, real_suffix_len_);
+    SURF_STAT(lookupStats().suffix_matches += (stored_suffix == querying_suffix));
+    return (stored_suffix == querying_suffix);
+}
+
+bool BitvectorSuffix::checkEquality(const position_t idx,
+				    const uint64_t key, const level_t level) const {
+    SURF_STAT(lookupStats().suffix_checks++);
+    if (type_ == kNone) {
+	SURF_STAT(lookupStats().suffix_matches++);
+	return true;
+    }
+    if (idx * getSuffixLen() >= num_bits_)
+	return false;
+
+    word_t stored_suffix = read(idx);
+    if (type_ == kReal) {
+	if (stored_suffix == 0) {
+	    SURF_STAT(lookupStats().suffix_matches++);
+	    return true;
+	}
+	if ((8 - level) * 8 < real_suffix_len_)
+	    return false;
+    }
+    word_t querying_suffix = 0;
+    if ((type_ == kHash) || (type_ == kMixed))
+	querying_suffix = constructHashSuffix(suffixHash(key, hash_type_), hash_suffix_len_);
+    if (type_ == kMixed)
+	querying_suffix <<= real_suffix_len_;
+    if ((type_ == kReal) || (type_ == kMixed))
+	querying_suffix |= constructRealSuffix(key, level, real_suffix_len_);
+    SURF_STAT(lookupStats().suffix_matches += (stored_suffix == querying_suffix));
     return (stored_suffix == querying_suffix);
 }
 
+bool BitvectorSuffix::checkPrefix(const position_t idx,
+				  const Slice& prefix, const level_t level) const {
+    if ((type_ == kNone) || (type_ == kHash) || (idx * getSuffixLen() >= num_bits_))
+	return true;
+    if (prefix.length() <= level)
+	return true;
+    word_t stored_suffix = readReal(idx);
+    level_t len = real_suffix_len_;
+    if ((prefix.length() - level) * 8 < len) {
+	// a stored key with the prefix may be too short to have a suffix
+	if (stored_suffix == 0)
+	    return true;
+	len = (prefix.length() - level) * 8;
+    }
+    word_t querying_suffix = constructRealSuffix(prefix, level, len);
+    return ((stored_suffix >> (real_suffix_len_ - len)) == querying_suffix);
+}
+
 // If no real suffix is stored for the key, compare returns 0.
 // int BitvectorSuffix::compare(const position_t idx, 
 // 			     const std::string& key, const level_t level) const {
@@ -243,7 +405,7 @@ bool BitvectorSuffix::checkEquality(const position_t idx,
 // }
 
 int BitvectorSuffix::compare(const position_t idx, 
-			     const std::string& key, const level_t level) const {
+			     const Slice& key, const level_t level) const {
     if ((idx * getSuffixLen() >= num_bits_) || (type_ == kNone) || (type_ == kHash))
 	return kCouldBePositive;
 
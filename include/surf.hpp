@@ -1,32 +1,73 @@
 #ifndef SURF_H_
 #define SURF_H_
 
+#include <algorithm>
+#include <cmath>
 #include <string>
 #include <vector>
 
 #include "config.hpp"
+#include "huge_pages.hpp"
 #include "louds_dense.hpp"
 #include "louds_sparse.hpp"
+#include "serial_format.hpp"
+#include "slice.hpp"
 #include "surf_builder.hpp"
 
 namespace surf {
 
+class SuRFInt64;
+
+//******************************************************
+// A filter size budget and query mix, from which
+// SuRF::chooseSuffixes picks the suffix configuration.
+//******************************************************
+struct SuffixBudget {
+    SuffixBudget() : max_bytes(0), bits_per_key(10), point_fraction(1.0) {};
+
+    uint64_t max_bytes; // serializedSize limit; 0: bits_per_key per unique key
+    double bits_per_key;
+    double point_fraction; // lookupKey share of the queries, the rest ranges
+};
+
+// The suffixes SuRF::chooseSuffixes picked, and what they lead to
+struct SuffixChoice {
+    SuffixChoice() : suffix_type(kNone), suffix_hash_type(kSuffixHashLevelDB),
+		     hash_suffix_len(0), real_suffix_len(0), sparse_start_level(0),
+		     predicted_bytes(0), predicted_fpr(1.0) {};
+
+    SuffixType suffix_type;
+    SuffixHashType suffix_hash_type;
+    level_t hash_suffix_len;
+    level_t real_suffix_len;
+    level_t sparse_start_level; // of the trie the choice was made for
+    uint64_t predicted_bytes; // serializedSize of the filter
+    // False positive rate of negative queries that reach a stored key's
+    // suffix check, weighted by point_fraction; range queries only
+    // check real suffix bits
+    double predicted_fpr;
+};
+
 class SuRF {
 public:
     class Iter {
     public:
 	Iter() {};
 	Iter(const SuRF* filter) {
-	    dense_iter_ = LoudsDense::Iter(filter->louds_dense_);
-	    sparse_iter_ = LoudsSparse::Iter(filter->louds_sparse_);
+	    dense_iter_ = LoudsDense::Iter(&filter->louds_dense_);
+	    sparse_iter_ = LoudsSparse::Iter(&filter->louds_sparse_);
 	    could_be_fp_ = false;
 	}
 
 	void clear();
 	bool isValid() const;
 	bool getFpFlag() const;
-	int compare(const std::string& key) const;
+	int compare(const Slice& key) const;
+	int compare(const std::string& key) const { return compare(Slice(key)); };
 	std::string getKey() const;
+	// Copies getKey() to dst, which must have room for
+	// getHeight() bytes; returns the key length. Does not allocate.
+	size_t getKey(char* dst) const;
 	int getSuffix(word_t* suffix) const;
 	std::string getKeyWithSuffix(unsigned* bitlen) const;
 
@@ -51,7 +92,7 @@ public:
     };
 
 public:
-    SuRF() {};
+    SuRF() : format_flags_(0) {};
 
     //------------------------------------------------------------------
     // Input keys must be SORTED
@@ -67,26 +108,103 @@ public:
     
     SuRF(const std::vector<std::string>& keys,
 	 const bool include_dense, const uint32_t sparse_dense_ratio,
-	 const SuffixType suffix_type, const level_t hash_suffix_len, const level_t real_suffix_len) {
-	create(keys, include_dense, sparse_dense_ratio, suffix_type, hash_suffix_len, real_suffix_len);
+	 const SuffixType suffix_type, const level_t hash_suffix_len, const level_t real_suffix_len,
+	 const unsigned num_build_threads = 1, const RankType rank_type = kRankBasic,
+	 const position_t select_sample_interval = kSelectSampleInterval,
+	 const SuffixHashType suffix_hash_type = kSuffixHashLevelDB) {
+	create(keys, include_dense, sparse_dense_ratio, suffix_type, hash_suffix_len, real_suffix_len,
+	       num_build_threads, rank_type, select_sample_interval, suffix_hash_type);
     }
 
+    // Builder must be complete, i.e., built with build() or finish()
+    explicit SuRF(const SuRFBuilder* builder)
+	: louds_dense_(builder), louds_sparse_(builder), format_flags_(formatFlags(builder)) {}
+
     ~SuRF() {}
 
+    // num_build_threads > 1 builds partitions of keys concurrently;
+    // rank_type selects the rank look-up table layout (see rank.hpp);
+    // select_sample_interval trades select look-up table size for speed;
+    // suffix_hash_type picks the hash of kHash and kMixed suffixes
     void create(const std::vector<std::string>& keys,
 		const bool include_dense, const uint32_t sparse_dense_ratio,
 		const SuffixType suffix_type,
-                const level_t hash_suffix_len, const level_t real_suffix_len);
-
-    bool lookupKey(const std::string& key) const;
+                const level_t hash_suffix_len, const level_t real_suffix_len,
+		const unsigned num_build_threads = 1, const RankType rank_type = kRankBasic,
+		const position_t select_sample_interval = kSelectSampleInterval,
+		const SuffixHashType suffix_hash_type = kSuffixHashLevelDB);
+    // Builds the filter with the suffixes and sparse start level that
+    // chooseSuffixes picked for the same keys and layout
+    void create(const std::vector<std::string>& keys, const SuffixChoice& choice,
+		const SuRFBuilder& layout = SuRFBuilder(), const unsigned num_build_threads = 1);
+
+    // Queries take keys as Slices (see slice.hpp), so keys that live in
+    // the caller's buffers are probed without a copy. The std::string
+    // overloads only wrap the key.
+    bool lookupKey(const Slice& key) const;
+    bool lookupKey(const std::string& key) const { return lookupKey(Slice(key)); };
+    // Looks up keys[0..n) and stores the results in out[0..n).
+    // Groups of kLookupBatchSize keys walk the trie together, which hides
+    // most of the cache-miss latency of a single lookupKey. Hash suffixes
+    // of a group are computed up front by suffixHashes.
+    void lookupKeys(const Slice* keys, const size_t n, bool* out) const;
+    void lookupKeys(const std::string* keys, const size_t n, bool* out) const;
+    // Returns true if a stored key may start with prefix. The trie is
+    // walked only as deep as the prefix; no upper bound key is needed.
+    // Stored keys whose real suffix bits contradict prefix are ruled out.
+    bool lookupPrefix(const Slice& prefix) const;
+    bool lookupPrefix(const std::string& prefix) const { return lookupPrefix(Slice(prefix)); };
     // This function searches in a conservative way: if inclusive is true
     // and the stored key prefix matches key, iter stays at this key prefix.
-    SuRF::Iter moveToKeyGreaterThan(const std::string& key, const bool inclusive) const;
-    SuRF::Iter moveToKeyLessThan(const std::string& key, const bool inclusive) const;
+    SuRF::Iter moveToKeyGreaterThan(const Slice& key, const bool inclusive) const;
+    SuRF::Iter moveToKeyGreaterThan(const std::string& key, const bool inclusive) const {
+	return moveToKeyGreaterThan(Slice(key), inclusive);
+    }
+    SuRF::Iter moveToKeyLessThan(const Slice& key, const bool inclusive) const;
+    SuRF::Iter moveToKeyLessThan(const std::string& key, const bool inclusive) const {
+	return moveToKeyLessThan(Slice(key), inclusive);
+    }
     SuRF::Iter moveToFirst() const;
     SuRF::Iter moveToLast() const;
+    // Thread-safe: the probe keeps its iterator state on the caller's stack.
+    bool lookupRange(const Slice& left_key, const bool left_inclusive,
+		     const Slice& right_key, const bool right_inclusive) const;
     bool lookupRange(const std::string& left_key, const bool left_inclusive, 
-		     const std::string& right_key, const bool right_inclusive);
+		     const std::string& right_key, const bool right_inclusive) const {
+	return lookupRange(Slice(left_key), left_inclusive, Slice(right_key), right_inclusive);
+    }
+    // Same as above, but reuses iter (created by SuRF::Iter(this)) as scratch
+    // space so that repeated probes do not allocate. Each thread should
+    // own its scratch iterator.
+    bool lookupRange(const Slice& left_key, const bool left_inclusive,
+		     const Slice& right_key, const bool right_inclusive,
+		     SuRF::Iter& iter) const;
+    bool lookupRange(const std::string& left_key, const bool left_inclusive, 
+		     const std::string& right_key, const bool right_inclusive,
+		     SuRF::Iter& iter) const {
+	return lookupRange(Slice(left_key), left_inclusive, Slice(right_key), right_inclusive,
+			   iter);
+    }
+    // Batched lookupRange: out[i] is the result for the range between
+    // left_keys[i] and right_keys[i]. The probes share one iterator and
+    // each descent resumes below the deepest level its left bound shares
+    // with the previous iterator position, so ranges sorted by left bound
+    // walk their common trie paths only once.
+    void lookupRanges(const Slice* left_keys, const bool left_inclusive,
+		      const Slice* right_keys, const bool right_inclusive,
+		      const size_t n, bool* out) const;
+    void lookupRanges(const std::string* left_keys, const bool left_inclusive,
+		      const std::string* right_keys, const bool right_inclusive,
+		      const size_t n, bool* out) const;
+
+    // Returns the number of stored keys in [left_key, right_key) using
+    // O(trie height) rank operations. Since stored keys are truncated,
+    // a key that shares its stored prefix with a bound may be counted
+    // on the wrong side of it.
+    uint64_t approxCount(const Slice& left_key, const Slice& right_key) const;
+    uint64_t approxCount(const std::string& left_key, const std::string& right_key) const {
+	return approxCount(Slice(left_key), Slice(right_key));
+    }
 
     uint64_t serializedSize() const;
     uint64_t getMemoryUsage() const;
@@ -96,58 +214,445 @@ public:
     char* serialize() const {
 	uint64_t size = serializedSize();
 	char* data = new char[size];
-	char* cur_data = data;
-	louds_dense_->serialize(cur_data);
-	louds_sparse_->serialize(cur_data);
-	assert(cur_data - data == (int64_t)size);
+	writeImage(data, size);
 	return data;
     }
 
+    // Writes the image serialize() would produce for SuRF(builder) to
+    // sink without creating the filter: each dense section is built
+    // from the builder, written and freed before the next one, and the
+    // sparse sections are written from the arrays LoudsSparse takes
+    // over from builder, so builder is spent afterwards.
+    // Returns the image size, or 0 if the sink failed.
+    static uint64_t serialize(SuRFBuilder* builder, SerialSink& sink);
+
+    // Builds the filter for keys (see create, which takes the same
+    // trailing options) straight into sink
+    static uint64_t buildSerialized(const std::vector<std::string>& keys,
+				    const bool include_dense, const uint32_t sparse_dense_ratio,
+				    const SuffixType suffix_type,
+				    const level_t hash_suffix_len, const level_t real_suffix_len,
+				    SerialSink& sink,
+				    const unsigned num_build_threads = 1,
+				    const RankType rank_type = kRankBasic,
+				    const position_t select_sample_interval = kSelectSampleInterval,
+				    const SuffixHashType suffix_hash_type = kSuffixHashLevelDB);
+
+    // Picks the suffixes for keys (sorted) that fill what the trie
+    // leaves of budget: the trie is built once without suffixes to
+    // measure it, the largest suffix length that fits is split between
+    // hash and real bits to minimize predicted_fpr. Real-suffix
+    // collisions are estimated from up to kMaxSuffixSamples keys.
+    // If not even the trie fits, the choice has no suffixes. The trie
+    // takes the layout options of layout (dense levels, cutoff ratio,
+    // cost model or fixed start level, rank and select layouts; see
+    // SuRFBuilder::withSuffixes); its suffix options are ignored.
+    static SuffixChoice chooseSuffixes(const std::vector<std::string>& keys,
+				       const SuffixBudget& budget,
+				       const SuRFBuilder& layout = SuRFBuilder(),
+				       const unsigned num_build_threads = 1);
+
+    // Returns a new view over the image at src (see loadView), or
+    // nullptr if the image is malformed. The size is taken from the
+    // image header.
     static SuRF* deSerialize(char* src) {
+	uint64_t size = SectionTable::imageSize(src);
+	if (size == 0)
+	    return nullptr;
+	return deSerialize(src, size);
+    }
+
+    static SuRF* deSerialize(char* src, const uint64_t size) {
+	SuRF* surf = new SuRF();
+	if (!surf->loadView(src, size)) {
+	    delete surf;
+	    return nullptr;
+	}
+	return surf;
+    }
+
+    // Same as deSerialize, but for a headerless image as written
+    // before the versioned format, read unbounded like those builds
+    // did (see loadLegacyView)
+    static SuRF* deSerializeLegacy(char* src) {
 	SuRF* surf = new SuRF();
-	surf->louds_dense_ = LoudsDense::deSerialize(src);
-	surf->louds_sparse_ = LoudsSparse::deSerialize(src);
-	surf->iter_ = SuRF::Iter(surf);
+	if (SectionTable::hasMagic(src, sizeof(uint32_t))
+	    || !surf->loadHeaderless(src, nullptr)) {
+	    delete surf;
+	    return nullptr;
+	}
 	return surf;
     }
 
+    // Turns an empty SuRF into a read-only view over size bytes produced
+    // by serialize() (e.g., an mmap'ed file). Nothing is allocated or
+    // copied; src must be 8-byte aligned and outlive the filter, and
+    // destroy() will not free it. The header and section bounds are
+    // always checked; section checksums only if verify_checksums is set
+    // (see SectionTable for checking them lazily). An image without a
+    // valid header is rejected; headerless images from before the
+    // versioned format load through loadLegacyView only.
+    // Returns false if the image is malformed.
+    bool loadView(const char* src, const uint64_t size,
+		  const bool verify_checksums = false) {
+	SectionTable table;
+	if (!table.load(src, size))
+	    return false;
+	if (verify_checksums && !table.verifyAll())
+	    return false;
+	format_flags_ = table.getFlags();
+	return (louds_dense_.loadView(table)
+		&& louds_sparse_.loadView(table)
+		&& (louds_dense_.getHeight() == louds_sparse_.getStartLevel()));
+    }
+
+    // Loads a headerless image from before the versioned format. It
+    // has no checksums, so only the bounds of its arrays are checked;
+    // its misaligned louds-sparse select arrays are copied, and
+    // destroy() frees the copies. Returns false if the image is
+    // malformed or has a header (see loadView).
+    bool loadLegacyView(const char* src, const uint64_t size) {
+	if (SectionTable::hasMagic(src, size))
+	    return false;
+	return loadHeaderless(src, src + size);
+    }
+
+    // Writes the image into one 2MB-aligned HugePageRegion, backed by
+    // MAP_HUGETLB pages if options ask for them and the system has
+    // them, else madvise'd for transparent huge pages, and bound to
+    // options' NUMA node(s) with mbind if one is set. The filter then
+    // frees its own arrays and becomes a view of the region, which
+    // destroy() unmaps. Returns false, leaving the filter as it was,
+    // if no memory could be mapped.
+    bool moveToHugePages(const HugePageOptions& options = HugePageOptions());
+
+    // The mapping of moveToHugePages; empty if never moved
+    const HugePageRegion& getHugePageRegion() const {
+	return region_;
+    }
+
     void destroy() {
-	louds_dense_->destroy();
-	louds_sparse_->destroy();
+	louds_dense_.destroy();
+	louds_sparse_.destroy();
+	region_.release();
     }
 
 private:
-    LoudsDense* louds_dense_;
-    LoudsSparse* louds_sparse_;
+    static const uint64_t kMaxSuffixSamples = 1 << 16;
+
+    // Writes the serialize() image to dst, which has room for size bytes
+    void writeImage(char* dst, const uint64_t size) const {
+	ArraySink sink(dst, size);
+	SectionWriter writer(sink, kNumSections, format_flags_);
+	louds_dense_.serialize(writer);
+	louds_sparse_.serialize(writer);
+	uint64_t written_size = writer.finish();
+	assert(written_size == size);
+	(void)written_size;
+    }
+
+    // Loads an image without a header (see loadLegacyView); a null
+    // end leaves it unbounded
+    bool loadHeaderless(const char* src, const char* end) {
+	format_flags_ = 0;
+	const char* cur = src;
+	if (!louds_dense_.loadView(cur, end))
+	    return false;
+	if (louds_sparse_.loadView(cur, end)
+	    && (louds_dense_.getHeight() == louds_sparse_.getStartLevel()))
+	    return true;
+	louds_sparse_.destroy(); // frees the select arrays it may have copied
+	return false;
+    }
+
+    // FormatHeader::flags of an image of the keys of builder
+    static uint32_t formatFlags(const SuRFBuilder* builder) {
+	return builder->hasUint64Keys() ? kFormatFlagUint64Keys : 0;
+    }
+
+    // Probability that the len real suffix bits of two sampled keys
+    // are equal, from the unbiased pair count, but at least 2^-len
+    static double realSuffixCollision(std::vector<word_t>& samples, const level_t len);
+    static level_t commonPrefixLen(const std::string& a, const std::string& b) {
+	level_t len = 0;
+	while ((len < a.length()) && (len < b.length()) && (a[len] == b[len]))
+	    len++;
+	return len;
+    }
+
+    // Decides a range probe on the common prefix of its bounds when
+    // possible: without building an iterator if no stored key shares
+    // the prefix or a label at the first differing byte falls strictly
+    // between the bounds; kRangeUnknown otherwise.
+    RangeProbe probeRange(const Slice& left_key, const Slice& right_key) const;
+    // lookupRange that continues from the current position of iter
+    bool resumeLookupRange(const Slice& left_key, const bool left_inclusive,
+			   const Slice& right_key, const bool right_inclusive,
+			   SuRF::Iter& iter) const;
+
+private:
+    LoudsDense louds_dense_;
+    LoudsSparse louds_sparse_;
     SuRFBuilder* builder_;
-    SuRF::Iter iter_;
+    HugePageRegion region_;
+    uint32_t format_flags_; // see FormatHeader
+
+    friend class SuRFInt64;
 };
 
 void SuRF::create(const std::vector<std::string>& keys, 
 		  const bool include_dense, const uint32_t sparse_dense_ratio,
 		  const SuffixType suffix_type,
-                  const level_t hash_suffix_len, const level_t real_suffix_len) {
+                  const level_t hash_suffix_len, const level_t real_suffix_len,
+		  const unsigned num_build_threads, const RankType rank_type,
+		  const position_t select_sample_interval,
+		  const SuffixHashType suffix_hash_type) {
     builder_ = new SuRFBuilder(include_dense, sparse_dense_ratio,
-                              suffix_type, hash_suffix_len, real_suffix_len);
-    builder_->build(keys);
-    louds_dense_ = new LoudsDense(builder_);
-    louds_sparse_ = new LoudsSparse(builder_);
-    iter_ = SuRF::Iter(this);
+                              suffix_type, hash_suffix_len, real_suffix_len,
+			       rank_type, select_sample_interval, suffix_hash_type);
+    if (num_build_threads > 1)
+	builder_->build(keys, num_build_threads);
+    else
+	builder_->build(keys);
+    format_flags_ = formatFlags(builder_);
+    louds_dense_ = LoudsDense(builder_, true);
+    builder_->releaseDenseLevels();
+    louds_sparse_ = LoudsSparse(builder_, true);
+    delete builder_;
+}
+
+void SuRF::create(const std::vector<std::string>& keys, const SuffixChoice& choice,
+		  const SuRFBuilder& layout, const unsigned num_build_threads) {
+    builder_ = new SuRFBuilder(layout.withSuffixes(choice.suffix_type, choice.hash_suffix_len,
+						   choice.real_suffix_len, choice.suffix_hash_type));
+    builder_->setSparseStartLevel(choice.sparse_start_level);
+    if (num_build_threads > 1)
+	builder_->build(keys, num_build_threads);
+    else
+	builder_->build(keys);
+    format_flags_ = formatFlags(builder_);
+    louds_dense_ = LoudsDense(builder_, true);
+    builder_->releaseDenseLevels();
+    louds_sparse_ = LoudsSparse(builder_, true);
     delete builder_;
 }
 
-bool SuRF::lookupKey(const std::string& key) const {
+uint64_t SuRF::serialize(SuRFBuilder* builder, SerialSink& sink) {
+    SectionWriter writer(sink, kNumSections, formatFlags(builder));
+    LoudsDense::serialize(builder, writer);
+    builder->releaseDenseLevels();
+    LoudsSparse::serialize(builder, writer);
+    return writer.finish();
+}
+
+uint64_t SuRF::buildSerialized(const std::vector<std::string>& keys,
+			       const bool include_dense, const uint32_t sparse_dense_ratio,
+			       const SuffixType suffix_type,
+			       const level_t hash_suffix_len, const level_t real_suffix_len,
+			       SerialSink& sink,
+			       const unsigned num_build_threads, const RankType rank_type,
+			       const position_t select_sample_interval,
+			       const SuffixHashType suffix_hash_type) {
+    SuRFBuilder builder(include_dense, sparse_dense_ratio,
+			suffix_type, hash_suffix_len, real_suffix_len,
+			rank_type, select_sample_interval, suffix_hash_type);
+    if (num_build_threads > 1)
+	builder.build(keys, num_build_threads);
+    else
+	builder.build(keys);
+    return serialize(&builder, sink);
+}
+
+bool SuRF::moveToHugePages(const HugePageOptions& options) {
+    uint64_t size = serializedSize();
+    HugePageRegion region;
+    if (!region.allocate(size, options))
+	return false;
+    writeImage(region.data(), size);
+    destroy();
+    region_ = region;
+    bool is_loaded = loadView(region_.data(), size);
+    assert(is_loaded);
+    (void)is_loaded;
+    return true;
+}
+
+SuffixChoice SuRF::chooseSuffixes(const std::vector<std::string>& keys,
+				  const SuffixBudget& budget,
+				  const SuRFBuilder& layout, const unsigned num_build_threads) {
+    SuffixChoice choice;
+    SuRFBuilder builder = layout.withSuffixes(kNone, 0, 0, kSuffixHashLevelDB);
+    if (num_build_threads > 1)
+	builder.build(keys, num_build_threads);
+    else
+	builder.build(keys);
+    choice.sparse_start_level = builder.getSparseStartLevel();
+    SuRF trie(&builder);
+    uint64_t trie_bytes = trie.serializedSize();
+    trie.destroy();
+    choice.predicted_bytes = trie_bytes;
+
+    // suffixes are stored per LOUDS part, each padded to whole words
+    position_t num_dense_keys = 0;
+    position_t num_sparse_keys = 0;
+    const std::vector<position_t>& suffix_counts = builder.getSuffixCounts();
+    for (level_t level = 0; level < suffix_counts.size(); level++) {
+	if (level < choice.sparse_start_level)
+	    num_dense_keys += suffix_counts[level];
+	else
+	    num_sparse_keys += suffix_counts[level];
+    }
+    uint64_t max_bytes = budget.max_bytes;
+    if (max_bytes == 0)
+	max_bytes = (uint64_t)(budget.bits_per_key * (num_dense_keys + num_sparse_keys) / 8);
+    level_t max_len = 0;
+    uint64_t suffix_bytes = 0;
+    for (level_t len = 1; len <= kWordSize; len++) {
+	uint64_t bytes = ((num_dense_keys * len + kWordSize - 1) / kWordSize
+			  + (num_sparse_keys * len + kWordSize - 1) / kWordSize) * (kWordSize / 8);
+	if (trie_bytes + bytes > max_bytes)
+	    break;
+	max_len = len;
+	suffix_bytes = bytes;
+    }
+    if (max_len == 0)
+	return choice;
+
+    // a key's real suffix starts after the byte that makes it unique
+    position_t stride = (keys.size() + kMaxSuffixSamples - 1) / kMaxSuffixSamples;
+    std::vector<position_t> sample_ids;
+    std::vector<level_t> sample_levels;
+    for (position_t i = 0; i < keys.size(); i += stride) {
+	if ((i + 1 < keys.size()) && (keys[i] == keys[i + 1]))
+	    continue;
+	level_t prev_lcp = (i > 0) ? commonPrefixLen(keys[i - 1], keys[i]) : 0;
+	level_t next_lcp = (i + 1 < keys.size()) ? commonPrefixLen(keys[i], keys[i + 1]) : 0;
+	level_t last_level = std::max(prev_lcp, next_lcp);
+	sample_ids.push_back(i);
+	sample_levels.push_back(last_level + 1);
+    }
+    std::vector<double> collision(max_len + 1, 1.0);
+    std::vector<word_t> samples(sample_ids.size());
+    for (level_t len = 1; len <= max_len; len++) {
+	for (position_t i = 0; i < sample_ids.size(); i++)
+	    samples[i] = BitvectorSuffix::constructRealSuffix(keys[sample_ids[i]],
+							      sample_levels[i], len);
+	collision[len] = realSuffixCollision(samples, len);
+    }
+
+    // the LevelDB hash leaves 32 - kHashShift bits to a suffix
+    level_t short_hash_bits = 32 - kHashShift;
+    double point_fraction = std::min(1.0, std::max(0.0, budget.point_fraction));
+    choice.predicted_fpr = 2.0;
+    for (level_t real_len = 0; real_len <= max_len; real_len++) {
+	level_t hash_len = (point_fraction > 0) ? (max_len - real_len) : 0;
+	double fpr = collision[real_len]
+	    * (point_fraction * std::pow(2.0, -(double)hash_len) + (1 - point_fraction));
+	if (fpr < choice.predicted_fpr) {
+	    choice.hash_suffix_len = hash_len;
+	    choice.real_suffix_len = real_len;
+	    choice.predicted_fpr = fpr;
+	}
+    }
+    if (choice.hash_suffix_len > 0 && choice.real_suffix_len > 0)
+	choice.suffix_type = kMixed;
+    else if (choice.hash_suffix_len > 0)
+	choice.suffix_type = kHash;
+    else if (choice.real_suffix_len > 0)
+	choice.suffix_type = kReal;
+    if (choice.hash_suffix_len > short_hash_bits)
+	choice.suffix_hash_type = kSuffixHash64;
+    level_t len = choice.hash_suffix_len + choice.real_suffix_len;
+    if (len == max_len)
+	choice.predicted_bytes = trie_bytes + suffix_bytes;
+    else
+	choice.predicted_bytes = trie_bytes
+	    + ((num_dense_keys * len + kWordSize - 1) / kWordSize
+	       + (num_sparse_keys * len + kWordSize - 1) / kWordSize) * (kWordSize / 8);
+    return choice;
+}
+
+double SuRF::realSuffixCollision(std::vector<word_t>& samples, const level_t len) {
+    double min_collision = std::pow(2.0, -(double)len);
+    if (samples.size() < 2)
+	return min_collision;
+    std::sort(samples.begin(), samples.end());
+    double num_pairs = 0;
+    position_t run_start = 0;
+    for (position_t i = 1; i <= samples.size(); i++) {
+	if ((i == samples.size()) || (samples[i] != samples[run_start])) {
+	    double run_len = (double)(i - run_start);
+	    num_pairs += run_len * (run_len - 1);
+	    run_start = i;
+	}
+    }
+    double n = (double)samples.size();
+    return std::max(min_collision, num_pairs / (n * (n - 1)));
+}
+
+bool SuRF::lookupKey(const Slice& key) const {
+    // without dense levels node 0 is the root of louds-sparse,
+    // not the marker of a walk that ended in louds-dense
+    if (louds_dense_.getHeight() == 0)
+	return louds_sparse_.lookupKey(key, 0);
+    position_t connect_node_num = 0;
+    if (!louds_dense_.lookupKey(key, connect_node_num))
+	return false;
+    else if (connect_node_num != 0)
+	return louds_sparse_.lookupKey(key, connect_node_num);
+    return true;
+}
+
+bool SuRF::lookupPrefix(const Slice& prefix) const {
+    // see lookupKey
+    if (louds_dense_.getHeight() == 0)
+	return louds_sparse_.lookupPrefix(prefix, 0);
     position_t connect_node_num = 0;
-    if (!louds_dense_->lookupKey(key, connect_node_num))
+    if (!louds_dense_.lookupPrefix(prefix, connect_node_num))
 	return false;
     else if (connect_node_num != 0)
-	return louds_sparse_->lookupKey(key, connect_node_num);
+	return louds_sparse_.lookupPrefix(prefix, connect_node_num);
     return true;
 }
 
-SuRF::Iter SuRF::moveToKeyGreaterThan(const std::string& key, const bool inclusive) const {
+void SuRF::lookupKeys(const Slice* keys, const size_t n, bool* out) const {
+    position_t connect_node_nums[kLookupBatchSize];
+    word_t key_hashes[kLookupBatchSize] = {0};
+    SuffixType suffix_type = louds_sparse_.getSuffixType();
+    SuffixHashType hash_type = louds_sparse_.getSuffixHashType();
+    if (suffix_type == kNone) {
+	suffix_type = louds_dense_.getSuffixType();
+	hash_type = louds_dense_.getSuffixHashType();
+    }
+    bool hash_suffix = (suffix_type == kHash) || (suffix_type == kMixed);
+    for (size_t start = 0; start < n; start += kLookupBatchSize) {
+	position_t batch_size = kLookupBatchSize;
+	if (n - start < kLookupBatchSize)
+	    batch_size = n - start;
+	if (hash_suffix)
+	    suffixHashes(keys + start, batch_size, hash_type, key_hashes);
+	louds_dense_.lookupKeys(keys + start, key_hashes, batch_size,
+				out + start, connect_node_nums);
+	louds_sparse_.lookupKeys(keys + start, key_hashes, batch_size,
+				 connect_node_nums, out + start);
+    }
+}
+
+void SuRF::lookupKeys(const std::string* keys, const size_t n, bool* out) const {
+    Slice key_slices[kLookupBatchSize];
+    for (size_t start = 0; start < n; start += kLookupBatchSize) {
+	size_t batch_size = kLookupBatchSize;
+	if (n - start < kLookupBatchSize)
+	    batch_size = n - start;
+	for (size_t i = 0; i < batch_size; i++)
+	    key_slices[i] = Slice(keys[start + i]);
+	lookupKeys(key_slices, batch_size, out + start);
+    }
+}
+
+SuRF::Iter SuRF::moveToKeyGreaterThan(const Slice& key, const bool inclusive) const {
     SuRF::Iter iter(this);
-    iter.could_be_fp_ = louds_dense_->moveToKeyGreaterThan(key, inclusive, iter.dense_iter_);
+    iter.could_be_fp_ = louds_dense_.moveToKeyGreaterThan(key, inclusive, iter.dense_iter_);
 
     if (!iter.dense_iter_.isValid())
 	return iter;
@@ -156,7 +661,7 @@ SuRF::Iter SuRF::moveToKeyGreaterThan(const std::string& key, const bool inclusi
 
     if (!iter.dense_iter_.isSearchComplete()) {
 	iter.passToSparse();
-	iter.could_be_fp_ = louds_sparse_->moveToKeyGreaterThan(key, inclusive, iter.sparse_iter_);
+	iter.could_be_fp_ = louds_sparse_.moveToKeyGreaterThan(key, inclusive, iter.sparse_iter_);
 	if (!iter.sparse_iter_.isValid())
 	    iter.incrementDenseIter();
 	return iter;
@@ -170,7 +675,7 @@ SuRF::Iter SuRF::moveToKeyGreaterThan(const std::string& key, const bool inclusi
     return iter;
 }
 
-SuRF::Iter SuRF::moveToKeyLessThan(const std::string& key, const bool inclusive) const {
+SuRF::Iter SuRF::moveToKeyLessThan(const Slice& key, const bool inclusive) const {
     SuRF::Iter iter = moveToKeyGreaterThan(key, false);
     if (!iter.isValid()) {
 	iter = moveToLast();
@@ -186,55 +691,94 @@ SuRF::Iter SuRF::moveToKeyLessThan(const std::string& key, const bool inclusive)
 
 SuRF::Iter SuRF::moveToFirst() const {
     SuRF::Iter iter(this);
-    if (louds_dense_->getHeight() > 0) {
-	iter.dense_iter_.setToFirstLabelInRoot();
-	iter.dense_iter_.moveToLeftMostKey();
-	if (iter.dense_iter_.isMoveLeftComplete())
-	    return iter;
-	iter.passToSparse();
-	iter.sparse_iter_.moveToLeftMostKey();
-    } else {
-	iter.sparse_iter_.setToFirstLabelInRoot();
-	iter.sparse_iter_.moveToLeftMostKey();
-    }
+    iter.dense_iter_.setToFirstLabelInRoot();
+    iter.dense_iter_.moveToLeftMostKey();
+    if (iter.dense_iter_.isMoveLeftComplete())
+	return iter;
+    iter.passToSparse();
+    iter.sparse_iter_.moveToLeftMostKey();
     return iter;
 }
 
 SuRF::Iter SuRF::moveToLast() const {
     SuRF::Iter iter(this);
-    if (louds_dense_->getHeight() > 0) {
-	iter.dense_iter_.setToLastLabelInRoot();
-	iter.dense_iter_.moveToRightMostKey();
-	if (iter.dense_iter_.isMoveRightComplete())
-	    return iter;
-	iter.passToSparse();
-	iter.sparse_iter_.moveToRightMostKey();
-    } else {
-	iter.sparse_iter_.setToLastLabelInRoot();
-	iter.sparse_iter_.moveToRightMostKey();
-    }
+    iter.dense_iter_.setToLastLabelInRoot();
+    iter.dense_iter_.moveToRightMostKey();
+    if (iter.dense_iter_.isMoveRightComplete())
+	return iter;
+    iter.passToSparse();
+    iter.sparse_iter_.moveToRightMostKey();
     return iter;
 }
 
-bool SuRF::lookupRange(const std::string& left_key, const bool left_inclusive, 
-		       const std::string& right_key, const bool right_inclusive) {
-    iter_.clear();
-    louds_dense_->moveToKeyGreaterThan(left_key, left_inclusive, iter_.dense_iter_);
-    if (!iter_.dense_iter_.isValid()) return false;
-    if (!iter_.dense_iter_.isComplete()) {
-	if (!iter_.dense_iter_.isSearchComplete()) {
-	    iter_.passToSparse();
-	    louds_sparse_->moveToKeyGreaterThan(left_key, left_inclusive, iter_.sparse_iter_);
-	    if (!iter_.sparse_iter_.isValid()) {
-		iter_.incrementDenseIter();
+bool SuRF::lookupRange(const Slice& left_key, const bool left_inclusive,
+		       const Slice& right_key, const bool right_inclusive) const {
+    SuRF::Iter iter(this);
+    return lookupRange(left_key, left_inclusive, right_key, right_inclusive, iter);
+}
+
+bool SuRF::lookupRange(const Slice& left_key, const bool left_inclusive,
+		       const Slice& right_key, const bool right_inclusive,
+		       SuRF::Iter& iter) const {
+    iter.clear();
+    return resumeLookupRange(left_key, left_inclusive, right_key, right_inclusive, iter);
+}
+
+void SuRF::lookupRanges(const Slice* left_keys, const bool left_inclusive,
+			const Slice* right_keys, const bool right_inclusive,
+			const size_t n, bool* out) const {
+    SuRF::Iter iter(this);
+    for (size_t i = 0; i < n; i++)
+	out[i] = resumeLookupRange(left_keys[i], left_inclusive,
+				   right_keys[i], right_inclusive, iter);
+}
+
+void SuRF::lookupRanges(const std::string* left_keys, const bool left_inclusive,
+			const std::string* right_keys, const bool right_inclusive,
+			const size_t n, bool* out) const {
+    SuRF::Iter iter(this);
+    for (size_t i = 0; i < n; i++)
+	out[i] = resumeLookupRange(Slice(left_keys[i]), left_inclusive,
+				   Slice(right_keys[i]), right_inclusive, iter);
+}
+
+RangeProbe SuRF::probeRange(const Slice& left_key, const Slice& right_key) const {
+    level_t prefix_len = 0;
+    while ((prefix_len < left_key.length()) && (prefix_len < right_key.length())
+	   && (left_key[prefix_len] == right_key[prefix_len]))
+	prefix_len++;
+    position_t node_num = 0;
+    RangeProbe result = louds_dense_.probeRange(left_key, right_key, prefix_len, node_num);
+    if (result != kRangeContinue)
+	return result;
+    return louds_sparse_.probeRange(left_key, right_key, prefix_len, node_num);
+}
+
+bool SuRF::resumeLookupRange(const Slice& left_key, const bool left_inclusive,
+			     const Slice& right_key, const bool right_inclusive,
+			     SuRF::Iter& iter) const {
+    RangeProbe probe = probeRange(left_key, right_key);
+    if (probe != kRangeUnknown)
+	return (probe == kRangeNonEmpty);
+    louds_dense_.resumeMoveToKeyGreaterThan(left_key, left_inclusive, iter.dense_iter_);
+    if (!iter.dense_iter_.isValid()) return false;
+    if (!iter.dense_iter_.isComplete()) {
+	// the sparse path can only be reused below the same dense node
+	if (iter.dense_iter_.isSearchComplete()
+	    || (iter.sparse_iter_.getStartNodeNum() != iter.dense_iter_.getSendOutNodeNum()))
+	    iter.sparse_iter_.clear();
+	iter.passToSparse();
+	if (!iter.dense_iter_.isSearchComplete()) {
+	    louds_sparse_.resumeMoveToKeyGreaterThan(left_key, left_inclusive, iter.sparse_iter_);
+	    if (!iter.sparse_iter_.isValid()) {
+		iter.incrementDenseIter();
 	    }
-	} else if (!iter_.dense_iter_.isMoveLeftComplete()) {
-	    iter_.passToSparse();
-	    iter_.sparse_iter_.moveToLeftMostKey();
+	} else if (!iter.dense_iter_.isMoveLeftComplete()) {
+	    iter.sparse_iter_.moveToLeftMostKey();
 	}
     }
-    if (!iter_.isValid()) return false;
-    int compare = iter_.compare(right_key);
+    if (!iter.isValid()) return false;
+    int compare = iter.compare(right_key);
     if (compare == kCouldBePositive)
 	return true;
     if (right_inclusive)
@@ -243,21 +787,43 @@ bool SuRF::lookupRange(const std::string& left_key, const bool left_inclusive,
 	return (compare < 0);
 }
 
+uint64_t SuRF::approxCount(const Slice& left_key, const Slice& right_key) const {
+    SuRF::Iter iter_left = moveToKeyGreaterThan(left_key, true);
+    SuRF::Iter iter_right = moveToKeyGreaterThan(right_key, true);
+    const LoudsDense::Iter* dense_left = nullptr;
+    const LoudsDense::Iter* dense_right = nullptr;
+    if (iter_left.isValid())
+	dense_left = &iter_left.dense_iter_;
+    if (iter_right.isValid())
+	dense_right = &iter_right.dense_iter_;
+
+    position_t node_num_left = 0;
+    position_t node_num_right = 0;
+    int64_t count = louds_dense_.approxCount(dense_left, dense_right,
+					     node_num_left, node_num_right);
+    count += louds_sparse_.approxCount(&iter_left.sparse_iter_, node_num_left,
+				       &iter_right.sparse_iter_, node_num_right);
+    if (count < 0)
+	return 0;
+    return count;
+}
+
 uint64_t SuRF::serializedSize() const {
-    return (louds_dense_->serializedSize()
-	    + louds_sparse_->serializedSize());
+    return (formatHeaderSize(kNumSections)
+	    + louds_dense_.serializedSize()
+	    + louds_sparse_.serializedSize());
 }
 
 uint64_t SuRF::getMemoryUsage() const {
-    return (sizeof(SuRF) + louds_dense_->getMemoryUsage() + louds_sparse_->getMemoryUsage());
+    return (sizeof(SuRF) + louds_dense_.getMemoryUsage() + louds_sparse_.getMemoryUsage());
 }
 
 level_t SuRF::getHeight() const {
-    return louds_sparse_->getHeight();
+    return louds_sparse_.getHeight();
 }
 
 level_t SuRF::getSparseStartLevel() const {
-    return louds_sparse_->getStartLevel();
+    return louds_sparse_.getStartLevel();
 }
 
 //============================================================================
@@ -276,7 +842,7 @@ bool SuRF::Iter::isValid() const {
 	&& (dense_iter_.isComplete() || sparse_iter_.isValid());
 }
 
-int SuRF::Iter::compare(const std::string& key) const {
+int SuRF::Iter::compare(const Slice& key) const {
     assert(isValid());
     int dense_compare = dense_iter_.compare(key);
     if (dense_iter_.isComplete() || dense_compare != 0) 
@@ -289,7 +855,25 @@ std::string SuRF::Iter::getKey() const {
 	return std::string();
     if (dense_iter_.isComplete())
 	return dense_iter_.getKey();
-    return dense_iter_.getKey() + sparse_iter_.getKey();
+    Slice dense_key = dense_iter_.getKeySlice();
+    Slice sparse_key = sparse_iter_.getKeySlice();
+    std::string key;
+    key.reserve(dense_key.size() + sparse_key.size());
+    key.append(dense_key.data(), dense_key.size());
+    key.append(sparse_key.data(), sparse_key.size());
+    return key;
+}
+
+size_t SuRF::Iter::getKey(char* dst) const {
+    if (!isValid())
+	return 0;
+    Slice dense_key = dense_iter_.getKeySlice();
+    memcpy(dst, dense_key.data(), dense_key.size());
+    if (dense_iter_.isComplete())
+	return dense_key.size();
+    Slice sparse_key = sparse_iter_.getKeySlice();
+    memcpy(dst + dense_key.size(), sparse_key.data(), sparse_key.size());
+    return dense_key.size() + sparse_key.size();
 }
 
 int SuRF::Iter::getSuffix(word_t* suffix) const {
@@ -3,70 +3,181 @@
 
 #include <assert.h>
 
+#include <algorithm>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "config.hpp"
 #include "hash.hpp"
+#include "level_vector.hpp"
 #include "suffix.hpp"
 
 namespace surf {
 
+//******************************************************
+// Per-level costs of a lookup walk, in ns, used to pick
+// the LOUDS-Sparse start level by modeled lookup latency
+// (SuRFBuilder::setCutoffCostModel) instead of by the
+// sparse_dense_ratio. The defaults were measured with
+// calibrateCutoffCosts (bench/calibrate_cutoff.hpp) on a
+// 2 MB L2 x86 machine.
+//******************************************************
+struct CutoffCostModel {
+    CutoffCostModel() : dense_level_ns(16.0), sparse_level_ns(37.0), sparse_label_ns(0.3),
+			dense_miss_ns(200.0), sparse_miss_ns(400.0), cache_bytes(2 << 20),
+			memory_budget(0) {};
+
+    double dense_level_ns; // a LOUDS-Dense level in cache
+    double sparse_level_ns; // a LOUDS-Sparse level in cache, label search aside
+    double sparse_label_ns; // label search, per label of the node
+    // Added to a level that is not in cache; a sparse level reads
+    // more vectors than a dense one
+    double dense_miss_ns;
+    double sparse_miss_ns;
+    // A level of b bytes misses the cache in b / (b + cache_bytes)
+    // of the walks that pass it
+    uint64_t cache_bytes;
+    // Upper bound on the modeled filter size in bytes; 0: none
+    uint64_t memory_budget;
+};
+
 class SuRFBuilder {
 public: 
-    SuRFBuilder() : sparse_start_level_(0), suffix_type_(kNone) {};
+    SuRFBuilder() : include_dense_(kIncludeDense), sparse_dense_ratio_(kSparseDenseRatio),
+		    sparse_start_level_(0), suffix_type_(kNone),
+		    hash_suffix_len_(0), real_suffix_len_(0), rank_type_(kRankBasic),
+		    select_sample_interval_(kSelectSampleInterval),
+		    suffix_hash_type_(kSuffixHashLevelDB), use_cost_model_(false),
+		    use_fixed_cutoff_(false), fixed_sparse_start_level_(0),
+		    has_pending_key_(false), has_unsorted_keys_(false), num_inserted_keys_(0),
+		    expected_num_keys_(0), has_uint64_keys_(true) {};
     explicit SuRFBuilder(bool include_dense, uint32_t sparse_dense_ratio,
-			 SuffixType suffix_type, level_t hash_suffix_len, level_t real_suffix_len)
+			 SuffixType suffix_type, level_t hash_suffix_len, level_t real_suffix_len,
+			 RankType rank_type = kRankBasic,
+			 position_t select_sample_interval = kSelectSampleInterval,
+			 SuffixHashType suffix_hash_type = kSuffixHashLevelDB)
 	: include_dense_(include_dense), sparse_dense_ratio_(sparse_dense_ratio),
 	  sparse_start_level_(0), suffix_type_(suffix_type),
-          hash_suffix_len_(hash_suffix_len), real_suffix_len_(real_suffix_len) {};
+          hash_suffix_len_(hash_suffix_len), real_suffix_len_(real_suffix_len),
+	  rank_type_(rank_type), select_sample_interval_(select_sample_interval),
+	  suffix_hash_type_(suffix_hash_type), use_cost_model_(false),
+	  use_fixed_cutoff_(false), fixed_sparse_start_level_(0), has_pending_key_(false),
+	  has_unsorted_keys_(false), num_inserted_keys_(0), expected_num_keys_(0),
+	  has_uint64_keys_(true) {
+	assert(select_sample_interval_ > 0);
+    };
 
     ~SuRFBuilder() {};
 
+    // A builder with nothing built and the layout options of this one
+    // (dense levels, sparse_dense_ratio, cutoff cost model or fixed
+    // start level, rank and select layouts), but the given suffixes
+    SuRFBuilder withSuffixes(const SuffixType suffix_type, const level_t hash_suffix_len,
+			     const level_t real_suffix_len,
+			     const SuffixHashType suffix_hash_type) const {
+	SuRFBuilder builder(include_dense_, sparse_dense_ratio_, suffix_type,
+			    hash_suffix_len, real_suffix_len, rank_type_,
+			    select_sample_interval_, suffix_hash_type);
+	builder.use_cost_model_ = use_cost_model_;
+	builder.cost_model_ = cost_model_;
+	builder.use_fixed_cutoff_ = use_fixed_cutoff_;
+	builder.fixed_sparse_start_level_ = fixed_sparse_start_level_;
+	return builder;
+    }
+
     // Fills in the LOUDS-dense and sparse vectors (members of this class)
     // through a single scan of the sorted key list.
     // After build, the member vectors are used in SuRF constructor.
+    // The sizes of all levels are counted first, so that the
+    // LOUDS-Sparse start level is known up front and each sparse
+    // component is written straight into one array of its final size,
+    // which LoudsSparse then takes over (see LevelBits).
     // REQUIRED: provided key list must be sorted.
     void build(const std::vector<std::string>& keys);
 
-    static bool readBit(const std::vector<word_t>& bits, const position_t pos) {
-	assert(pos < (bits.size() * kWordSize));
-	position_t word_id = pos / kWordSize;
-	position_t offset = pos % kWordSize;
-	return (bits[word_id] & (kMsbMask >> offset));
+    // Same as above, but the key list is cut into up to num_threads
+    // ranges whose LOUDS-Sparse vectors are built concurrently and then
+    // stitched together. The result is bit-identical to build(keys).
+    void build(const std::vector<std::string>& keys, const unsigned num_threads);
+
+    // From the next build on, the LOUDS-Sparse start level is the one
+    // with the lowest modeledLookupCost whose modeledMemory fits
+    // model.memory_budget (the smallest modeledMemory if none does),
+    // at least 1 like with the sparse_dense_ratio. Has no effect
+    // without include_dense.
+    void setCutoffCostModel(const CutoffCostModel& model) {
+	cost_model_ = model;
+	use_cost_model_ = true;
     }
 
-    static void setBit(std::vector<word_t>& bits, const position_t pos) {
-	assert(pos < (bits.size() * kWordSize));
-	position_t word_id = pos / kWordSize;
-	position_t offset = pos % kWordSize;
-	bits[word_id] |= (kMsbMask >> offset);
+    // From the next build on, LOUDS-Sparse starts at level (at most
+    // the trie height), overriding the ratio and the cost model, e.g.,
+    // to rebuild a trie with other suffixes but the same layout.
+    // Has no effect without include_dense.
+    void setSparseStartLevel(const level_t level) {
+	fixed_sparse_start_level_ = level;
+	use_fixed_cutoff_ = true;
+    }
+
+    // Modeled mean cost (ns) of looking up a stored key if LOUDS-Sparse
+    // started at start_level: each level a key's walk passes costs
+    // its dense or sparse per-level cost, the latter growing with the
+    // level's mean node size, plus cache misses that grow with the
+    // level's size. Needs the sparse levels of a build.
+    double modeledLookupCost(const level_t start_level, const CutoffCostModel& model) const;
+    // Estimated filter size in bytes if LOUDS-Sparse started at start_level
+    uint64_t modeledMemory(const level_t start_level) const;
+
+    // Frees the LOUDS-Dense levels once LoudsDense has copied them;
+    // LoudsSparse does not read them.
+    void releaseDenseLevels();
+
+    // Streaming alternative to build: call add for every key in sorted
+    // order (duplicates are allowed), then finish. A key is inserted once
+    // its successor is known, so only the latest key is copied and kept.
+    // add returns false and drops a key that sorts before the previous
+    // one; finish then returns false as well, and the trie holds only
+    // the keys that were added in order.
+    bool add(const char* key, const size_t len);
+    bool finish();
+    // Size hint for a streaming build, whose level sizes are not
+    // known in advance: once kEstimateSampleKeys keys are in, each
+    // level reserves its share extrapolated to num_keys keys instead
+    // of growing by doubling.
+    void setExpectedNumKeys(const position_t num_keys) {
+	expected_num_keys_ = num_keys;
     }
 
     level_t getTreeHeight() const {
-	return labels_.size();
+	return labels_.numLevels();
+    }
+    // Whether every key inserted is kUint64KeyLen bytes long, so that
+    // SuRFInt64 can load the image (see kFormatFlagUint64Keys)
+    bool hasUint64Keys() const {
+	return has_uint64_keys_;
     }
 
     // const accessors
-    const std::vector<std::vector<word_t> >& getBitmapLabels() const {
+    const LevelBits& getBitmapLabels() const {
 	return bitmap_labels_;
     }
-    const std::vector<std::vector<word_t> >& getBitmapChildIndicatorBits() const {
+    const LevelBits& getBitmapChildIndicatorBits() const {
 	return bitmap_child_indicator_bits_;
     }
-    const std::vector<std::vector<word_t> >& getPrefixkeyIndicatorBits() const {
+    const LevelBits& getPrefixkeyIndicatorBits() const {
 	return prefixkey_indicator_bits_;
     }
-    const std::vector<std::vector<label_t> >& getLabels() const {
+    const LevelLabels& getLabels() const {
 	return labels_;
     }
-    const std::vector<std::vector<word_t> >& getChildIndicatorBits() const {
+    const LevelBits& getChildIndicatorBits() const {
 	return child_indicator_bits_;
     }
-    const std::vector<std::vector<word_t> >& getLoudsBits() const {
+    const LevelBits& getLoudsBits() const {
 	return louds_bits_;
     }
-    const std::vector<std::vector<word_t> >& getSuffixes() const {
+    const LevelBits& getSuffixes() const {
 	return suffixes_;
     }
     const std::vector<position_t>& getSuffixCounts() const {
@@ -90,15 +201,50 @@ public:
     level_t getRealSuffixLen() const {
 	return real_suffix_len_;
     }
+    // Rank look-up table layout of the LOUDS-Dense and LOUDS-Sparse bitvectors
+    RankType getRankType() const {
+	return rank_type_;
+    }
+    // Sampling of the LOUDS-Sparse select structure; denser is faster
+    position_t getSelectSampleInterval() const {
+	return select_sample_interval_;
+    }
+    // Hash function of kHash and kMixed suffixes
+    SuffixHashType getSuffixHashType() const {
+	return suffix_hash_type_;
+    }
 
 private:
     static bool isSameKey(const std::string& a, const std::string& b) {
 	return a.compare(b) == 0;
     }
 
+    // Counts the items, nodes and suffixes that buildSparse will store
+    // on each level, from the common prefix lengths of neighbouring keys.
+    void countLevelSizes(const std::vector<std::string>& keys);
+    void clearLevelSizes();
+    // Lays out the LOUDS-Sparse levels of each component in one array
+    // of the counted sizes; before any level is added
+    void reserveLevels();
+    // see setExpectedNumKeys
+    void reserveEstimatedLevels();
+
     // Fill in the LOUDS-Sparse vectors through a single scan
     // of the sorted key list.
     void buildSparse(const std::vector<std::string>& keys);
+    // Same as above, but only inserts keys[begin, end). The successor of
+    // keys[end - 1] is still taken from the full list.
+    void buildSparse(const std::vector<std::string>& keys,
+		     const position_t begin, const position_t end);
+
+    // Appends the LOUDS-Sparse vectors of a partition built by a
+    // parallel build. If has_ghost is set, the partition was started
+    // with the last key of the previous partition (the ghost key) to
+    // recreate the trie state at the cut. The ghost inserted one item
+    // on each level up to ghost_level and one suffix at ghost_level;
+    // these stand for items that already exist here and are dropped.
+    void appendPartition(const SuRFBuilder& part, const bool has_ghost,
+			 const level_t ghost_level);
 
     // Walks down the current partially-filled trie by comparing key to
     // its previous key in the list until their prefixes do not match.
@@ -113,31 +259,50 @@ private:
     // key and next_key do not match.
     // This function is called after skipCommonPrefix. Therefore, it
     // guarantees that the stored prefix of key is unique in the trie.
-    level_t insertKeyBytesToTrieUntilUnique(const std::string& key, const std::string& next_key, const level_t start_level);
+    // next_key_len is 0 if key is the last key.
+    level_t insertKeyBytesToTrieUntilUnique(const std::string& key,
+					    const char* next_key, const size_t next_key_len,
+					    const level_t start_level);
+
+    // Inserts key given its successor in the sorted list
+    // (next_key_len is 0 if there is none).
+    void insertKey(const std::string& key, const char* next_key, const size_t next_key_len);
 
     // Fills in the suffix byte for key
     inline void insertSuffix(const std::string& key, const level_t level);
 
     inline bool isCharCommonPrefix(const label_t c, const level_t level) const;
     inline bool isLevelEmpty(const level_t level) const;
-    inline void moveToNextItemSlot(const level_t level);
     void insertKeyByte(const char c, const level_t level, const bool is_start_of_node, const bool is_term);
     inline void storeSuffix(const level_t level, const word_t suffix);
 
     // Compute sparse_start_level_ according to the pre-defined
     // size ratio between Sparse and Dense levels.
     // Dense size < Sparse size / sparse_dense_ratio_
+    // or with the cost model if one is set.
     inline void determineCutoffLevel();
+    void determineCutoffLevelByCost();
 
     inline uint64_t computeDenseMem(const level_t downto_level) const;
     inline uint64_t computeSparseMem(const level_t start_level) const;
-    
+    // closer size estimates of a level than the above, for the cost model
+    inline uint64_t getDenseLevelBytes(const level_t level) const;
+    inline uint64_t getSparseLevelBytes(const level_t level) const;
+
+    // Level sizes the above are computed from: the counted ones
+    // during a build, so that the cutoff is known before buildSparse,
+    // else the built ones
+    level_t getSizedHeight() const;
+    position_t getSizedNumItems(const level_t level) const;
+    position_t getSizedNumNodes(const level_t level) const;
+    position_t getSizedNumSuffixes(const level_t level) const;
+
     // Fill in the LOUDS-Dense vectors based on the built
     // Sparse vectors.
     // Called after sparse_start_level_ is set.
     void buildDense();
 
-    void initDenseVectors(const level_t level);
+    void initDenseVectors();
     void setLabelAndChildIndicatorBitmap(const level_t level, const position_t node_num, const position_t pos);
 
     position_t getNumItems(const level_t level) const;
@@ -146,6 +311,13 @@ private:
     bool isTerminator(const level_t level, const position_t pos) const;
 
 private:
+    // A parallel build never cuts the key list into smaller ranges
+    static const position_t kMinKeysPerPartition = 4096;
+    // Keys ahead of the current one whose bytes countLevelSizes prefetches
+    static const position_t kCountPrefetchDistance = 16;
+    // Keys of a streaming build the level sizes are extrapolated from
+    static const position_t kEstimateSampleKeys = 4096;
+
     // trie level < sparse_start_level_: LOUDS-Dense
     // trie level >= sparse_start_level_: LOUDS-Sparse
     bool include_dense_;
@@ -153,59 +325,338 @@ private:
     level_t sparse_start_level_;
 
     // LOUDS-Sparse bit/byte vectors
-    std::vector<std::vector<label_t> > labels_;
-    std::vector<std::vector<word_t> > child_indicator_bits_;
-    std::vector<std::vector<word_t> > louds_bits_;
+    LevelLabels labels_;
+    LevelBits child_indicator_bits_;
+    LevelBits louds_bits_;
 
     // LOUDS-Dense bit vectors
-    std::vector<std::vector<word_t> > bitmap_labels_;
-    std::vector<std::vector<word_t> > bitmap_child_indicator_bits_;
-    std::vector<std::vector<word_t> > prefixkey_indicator_bits_;
+    LevelBits bitmap_labels_;
+    LevelBits bitmap_child_indicator_bits_;
+    LevelBits prefixkey_indicator_bits_;
 
     SuffixType suffix_type_;
     level_t hash_suffix_len_;
     level_t real_suffix_len_;
-    std::vector<std::vector<word_t> > suffixes_;
+    LevelBits suffixes_;
     std::vector<position_t> suffix_counts_;
 
+    RankType rank_type_;
+    position_t select_sample_interval_;
+    SuffixHashType suffix_hash_type_;
+
+    bool use_cost_model_;
+    CutoffCostModel cost_model_;
+    bool use_fixed_cutoff_;
+    level_t fixed_sparse_start_level_;
+
     // auxiliary per level bookkeeping vectors
     std::vector<position_t> node_counts_;
     std::vector<bool> is_last_item_terminator_;
+
+    // exact per-level sizes known before the build (see countLevelSizes);
+    // empty if unknown, e.g., in a streaming build
+    std::vector<position_t> level_num_items_;
+    std::vector<position_t> level_num_nodes_;
+    std::vector<position_t> level_num_suffixes_;
+
+    // streaming build: the latest added key, not yet inserted
+    std::string pending_key_;
+    bool has_pending_key_;
+    bool has_unsorted_keys_;
+    position_t num_inserted_keys_;
+    position_t expected_num_keys_;
+
+    bool has_uint64_keys_;
+
+    // take the final arrays over
+    friend class LoudsDense;
+    friend class LoudsSparse;
 };
 
 void SuRFBuilder::build(const std::vector<std::string>& keys) {
     assert(keys.size() > 0);
+    countLevelSizes(keys);
+    if (include_dense_)
+	determineCutoffLevel();
+    reserveLevels();
     buildSparse(keys);
-    if (include_dense_) {
+    clearLevelSizes();
+    if (include_dense_)
+	buildDense();
+}
+
+void SuRFBuilder::build(const std::vector<std::string>& keys, const unsigned num_threads) {
+    assert(keys.size() > 0);
+    position_t num_parts = num_threads;
+    if (keys.size() / kMinKeysPerPartition < num_parts)
+	num_parts = keys.size() / kMinKeysPerPartition;
+
+    // partition p covers keys[boundaries[p], boundaries[p + 1]);
+    // a run of duplicate keys is never cut
+    std::vector<position_t> boundaries;
+    boundaries.push_back(0);
+    for (position_t p = 1; p < num_parts; p++) {
+	position_t boundary = (uint64_t)keys.size() * p / num_parts;
+	if (boundary <= boundaries.back())
+	    continue;
+	while ((boundary < keys.size()) && isSameKey(keys[boundary - 1], keys[boundary]))
+	    boundary++;
+	if (boundary < keys.size())
+	    boundaries.push_back(boundary);
+    }
+    boundaries.push_back(keys.size());
+    num_parts = boundaries.size() - 1;
+    if (num_parts < 2) {
+	build(keys);
+	return;
+    }
+
+    std::vector<SuRFBuilder> parts;
+    for (position_t p = 0; p < num_parts; p++)
+	parts.push_back(SuRFBuilder(include_dense_, sparse_dense_ratio_, suffix_type_,
+				    hash_suffix_len_, real_suffix_len_, rank_type_,
+				    select_sample_interval_, suffix_hash_type_));
+    std::vector<std::thread> threads;
+    for (position_t p = 0; p < num_parts; p++) {
+	threads.push_back(std::thread([&keys, &boundaries, &parts, p]() {
+		    position_t begin = boundaries[p];
+		    if (p > 0)
+			begin--; // ghost key
+		    parts[p].buildSparse(keys, begin, boundaries[p + 1]);
+		}));
+    }
+    for (position_t p = 0; p < num_parts; p++)
+	threads[p].join();
+
+    // the ghost of partition p shares its first ghost_levels[p] bytes
+    // with the first key of p
+    std::vector<level_t> ghost_levels(num_parts, 0);
+    for (position_t p = 1; p < num_parts; p++) {
+	const std::string& ghost = keys[boundaries[p] - 1];
+	const std::string& first = keys[boundaries[p]];
+	level_t ghost_level = 0;
+	while ((ghost_level < ghost.length()) && (ghost_level < first.length())
+	       && (ghost[ghost_level] == first[ghost_level]))
+	    ghost_level++;
+	ghost_levels[p] = ghost_level;
+    }
+
+    // the partitions' sizes add up to the final ones, minus the ghosts
+    for (position_t p = 0; p < num_parts; p++) {
+	for (level_t level = 0; level < parts[p].getTreeHeight(); level++) {
+	    if (level >= level_num_items_.size()) {
+		level_num_items_.push_back(0);
+		level_num_nodes_.push_back(0);
+		level_num_suffixes_.push_back(0);
+	    }
+	    level_num_items_[level] += parts[p].getNumItems(level);
+	    level_num_nodes_[level] += parts[p].node_counts_[level];
+	    level_num_suffixes_[level] += parts[p].suffix_counts_[level];
+	    if ((p > 0) && (level <= ghost_levels[p])) {
+		level_num_items_[level]--;
+		level_num_nodes_[level]--;
+	    }
+	    if ((p > 0) && (level == ghost_levels[p]))
+		level_num_suffixes_[level]--;
+	}
+    }
+    if (include_dense_)
 	determineCutoffLevel();
+    reserveLevels();
+    for (position_t p = 0; p < num_parts; p++) {
+	appendPartition(parts[p], (p > 0), ghost_levels[p]);
+	parts[p] = SuRFBuilder();
+    }
+    clearLevelSizes();
+
+    if (include_dense_)
 	buildDense();
+}
+
+void SuRFBuilder::countLevelSizes(const std::vector<std::string>& keys) {
+    clearLevelSizes();
+    // A key shares levels [0, prev_lcp) with its predecessor and adds
+    // one item on each level from prev_lcp down to where it becomes
+    // unique: next_lcp, the level of its last byte shared with its
+    // successor plus one. Its suffix is stored on that last level.
+    // The items below prev_lcp start new nodes, and so do all items
+    // of the first key.
+    bool is_first_key = true;
+    level_t prev_lcp = 0;
+    for (position_t i = 0; i < keys.size(); i++) {
+	// the key bytes are usually scattered over the heap
+	if (i + kCountPrefetchDistance < keys.size())
+	    __builtin_prefetch(keys[i + kCountPrefetchDistance].data());
+	const std::string& key = keys[i];
+	level_t next_lcp = 0;
+	if (i + 1 < keys.size()) {
+	    const std::string& next_key = keys[i + 1];
+	    level_t max_lcp = (key.length() < next_key.length()) ? key.length() : next_key.length();
+	    while ((next_lcp < max_lcp) && (key[next_lcp] == next_key[next_lcp]))
+		next_lcp++;
+	    // of a run of duplicates, only the last one counts
+	    if ((next_lcp == key.length()) && (next_lcp == next_key.length()))
+		continue;
+	}
+	level_t last_level = (next_lcp > prev_lcp) ? next_lcp : prev_lcp;
+	// plus the level above the last one that insertSuffix adds
+	if (last_level + 1 >= level_num_items_.size()) {
+	    level_num_items_.resize(last_level + 2, 0);
+	    level_num_nodes_.resize(last_level + 2, 0);
+	    level_num_suffixes_.resize(last_level + 2, 0);
+	}
+	for (level_t level = prev_lcp; level <= last_level; level++)
+	    level_num_items_[level]++;
+	level_t first_node_level = is_first_key ? prev_lcp : prev_lcp + 1;
+	for (level_t level = first_node_level; level <= last_level; level++)
+	    level_num_nodes_[level]++;
+	level_num_suffixes_[last_level]++;
+	prev_lcp = next_lcp;
+	is_first_key = false;
     }
 }
 
+void SuRFBuilder::clearLevelSizes() {
+    std::vector<position_t>().swap(level_num_items_);
+    std::vector<position_t>().swap(level_num_nodes_);
+    std::vector<position_t>().swap(level_num_suffixes_);
+}
+
+// The LOUDS-Dense levels grow in vectors of their own, reserved
+// by addLevel, and are freed by releaseDenseLevels.
+void SuRFBuilder::reserveLevels() {
+    std::vector<position_t> num_suffix_bits;
+    for (level_t level = 0; level < level_num_suffixes_.size(); level++)
+	num_suffix_bits.push_back(level_num_suffixes_[level] * getSuffixLen());
+    labels_.reserveExact(level_num_items_, sparse_start_level_);
+    child_indicator_bits_.reserveExact(level_num_items_, sparse_start_level_);
+    louds_bits_.reserveExact(level_num_items_, sparse_start_level_);
+    suffixes_.reserveExact(num_suffix_bits, sparse_start_level_);
+}
+
+void SuRFBuilder::reserveEstimatedLevels() {
+    double scale = (double)expected_num_keys_ / num_inserted_keys_;
+    for (level_t level = 0; level < getTreeHeight(); level++) {
+	position_t num_items = getNumItems(level) * scale;
+	labels_.reserve(level, num_items);
+	child_indicator_bits_.reserve(level, num_items);
+	louds_bits_.reserve(level, num_items);
+	suffixes_.reserve(level, suffixes_.size(level) * scale);
+    }
+}
+
+void SuRFBuilder::releaseDenseLevels() {
+    labels_.releaseLevels(0, sparse_start_level_);
+    child_indicator_bits_.releaseLevels(0, sparse_start_level_);
+    louds_bits_.releaseLevels(0, sparse_start_level_);
+    suffixes_.releaseLevels(0, sparse_start_level_);
+    bitmap_labels_.clear();
+    bitmap_child_indicator_bits_.clear();
+    prefixkey_indicator_bits_.clear();
+}
+
 void SuRFBuilder::buildSparse(const std::vector<std::string>& keys) {
-    for (position_t i = 0; i < keys.size(); i++) {
-	level_t level = skipCommonPrefix(keys[i]);	
+    buildSparse(keys, 0, keys.size());
+}
+
+void SuRFBuilder::buildSparse(const std::vector<std::string>& keys,
+			      const position_t begin, const position_t end) {
+    for (position_t i = begin; i < end; i++) {
 	position_t curpos = i;
-	while ((i + 1 < keys.size()) && isSameKey(keys[curpos], keys[i+1]))
+	while ((i + 1 < end) && isSameKey(keys[curpos], keys[i+1]))
 	    i++;
 	if (i < keys.size() - 1)
-	    level = insertKeyBytesToTrieUntilUnique(keys[curpos], keys[i+1], level);
+	    insertKey(keys[curpos], keys[i+1].data(), keys[i+1].length());
 	else // for last key, there is no successor key in the list
-	    level = insertKeyBytesToTrieUntilUnique(keys[curpos], std::string(), level);
-	insertSuffix(keys[curpos], level);
+	    insertKey(keys[curpos], nullptr, 0);
+    }
+}
+
+bool SuRFBuilder::add(const char* key, const size_t len) {
+    assert(len > 0);
+    if (has_pending_key_) {
+	int compare = pending_key_.compare(0, pending_key_.length(), key, len);
+	if (compare > 0) {
+	    has_unsorted_keys_ = true;
+	    return false;
+	}
+	if (compare == 0)
+	    return true;
+	insertKey(pending_key_, key, len);
+	num_inserted_keys_++;
+	if ((num_inserted_keys_ == kEstimateSampleKeys)
+	    && (expected_num_keys_ > num_inserted_keys_))
+	    reserveEstimatedLevels();
+    }
+    pending_key_.assign(key, len);
+    has_pending_key_ = true;
+    return true;
+}
+
+bool SuRFBuilder::finish() {
+    assert(has_pending_key_);
+    insertKey(pending_key_, nullptr, 0);
+    has_pending_key_ = false;
+    std::string().swap(pending_key_);
+    if (include_dense_) {
+	determineCutoffLevel();
+	buildDense();
+    }
+    return !has_unsorted_keys_;
+}
+
+void SuRFBuilder::insertKey(const std::string& key,
+			    const char* next_key, const size_t next_key_len) {
+    if (key.length() != kUint64KeyLen)
+	has_uint64_keys_ = false;
+    level_t level = skipCommonPrefix(key);
+    level = insertKeyBytesToTrieUntilUnique(key, next_key, next_key_len, level);
+    insertSuffix(key, level);
+}
+
+void SuRFBuilder::appendPartition(const SuRFBuilder& part, const bool has_ghost,
+				  const level_t ghost_level) {
+    while (getTreeHeight() < part.getTreeHeight())
+	addLevel();
+    has_uint64_keys_ = has_uint64_keys_ && part.has_uint64_keys_;
+
+    level_t suffix_len = getSuffixLen();
+    for (level_t level = 0; level < part.getTreeHeight(); level++) {
+	position_t skip = (has_ghost && (level <= ghost_level)) ? 1 : 0;
+	position_t num_items = getNumItems(level);
+	position_t part_num_items = part.getNumItems(level);
+	assert(part_num_items >= skip);
+	// the ghost item's children belong to the last item on this level
+	if ((skip > 0) && part.child_indicator_bits_.readBit(level, 0))
+	    child_indicator_bits_.setBit(level, num_items - 1);
+
+	labels_.append(level, part.labels_, level, skip, part_num_items);
+	child_indicator_bits_.append(level, part.child_indicator_bits_, level,
+				     skip, part_num_items);
+	louds_bits_.append(level, part.louds_bits_, level, skip, part_num_items);
+	node_counts_[level] += (part.node_counts_[level] - skip);
+	if (part_num_items > skip)
+	    is_last_item_terminator_[level] = part.is_last_item_terminator_[level];
+
+	position_t suffix_skip = (has_ghost && (level == ghost_level)) ? 1 : 0;
+	suffixes_.append(level, part.suffixes_, level, suffix_skip * suffix_len,
+			 part.suffix_counts_[level] * suffix_len);
+	suffix_counts_[level] += (part.suffix_counts_[level] - suffix_skip);
     }
 }
 
 level_t SuRFBuilder::skipCommonPrefix(const std::string& key) {
     level_t level = 0;
     while (level < key.length() && isCharCommonPrefix((label_t)key[level], level)) {
-	setBit(child_indicator_bits_[level], getNumItems(level) - 1);
+	child_indicator_bits_.setBit(level, getNumItems(level) - 1);
 	level++;
     }
     return level;
 }
 
-level_t SuRFBuilder::insertKeyBytesToTrieUntilUnique(const std::string& key, const std::string& next_key, const level_t start_level) {
+level_t SuRFBuilder::insertKeyBytesToTrieUntilUnique(const std::string& key,
+						     const char* next_key, const size_t next_key_len,
+						     const level_t start_level) {
     assert(start_level < key.length());
 
     level_t level = start_level;
@@ -219,14 +670,14 @@ level_t SuRFBuilder::insertKeyBytesToTrieUntilUnique(const std::string& key, con
     // shoud be in an the node as the previous key.
     insertKeyByte(key[level], level, is_start_of_node, is_term);
     level++;
-    if (level > next_key.length()
-	|| !isSameKey(key.substr(0, level), next_key.substr(0, level)))
+    if (level > next_key_len
+	|| (memcmp(key.data(), next_key, level) != 0))
 	return level;
 
     // All the following bytes inserted must be the start of a
     // new node.
     is_start_of_node = true;
-    while (level < key.length() && level < next_key.length() && key[level] == next_key[level]) {
+    while (level < key.length() && level < next_key_len && key[level] == next_key[level]) {
 	insertKeyByte(key[level], level, is_start_of_node, is_term);
 	level++;
     }
@@ -246,29 +697,21 @@ level_t SuRFBuilder::insertKeyBytesToTrieUntilUnique(const std::string& key, con
 inline void SuRFBuilder::insertSuffix(const std::string& key, const level_t level) {
     if (level >= getTreeHeight())
 	addLevel();
-    assert(level - 1 < suffixes_.size());
+    assert(level - 1 < suffixes_.numLevels());
     word_t suffix_word = BitvectorSuffix::constructSuffix(suffix_type_, key, hash_suffix_len_,
-                                                          level, real_suffix_len_);
+                                                          level, real_suffix_len_,
+							  suffix_hash_type_);
     storeSuffix(level, suffix_word);
 }
 
 inline bool SuRFBuilder::isCharCommonPrefix(const label_t c, const level_t level) const {
     return (level < getTreeHeight())
 	&& (!is_last_item_terminator_[level])
-	&& (c == labels_[level].back());
+	&& (c == labels_.back(level));
 }
 
 inline bool SuRFBuilder::isLevelEmpty(const level_t level) const {
-    return (level >= getTreeHeight()) || (labels_[level].size() == 0);
-}
-
-inline void SuRFBuilder::moveToNextItemSlot(const level_t level) {
-    assert(level < getTreeHeight());
-    position_t num_items = getNumItems(level);
-    if (num_items % kWordSize == 0) {
-	child_indicator_bits_[level].push_back(0);
-	louds_bits_[level].push_back(0);
-    }
+    return (level >= getTreeHeight()) || (getNumItems(level) == 0);
 }
 
 void SuRFBuilder::insertKeyByte(const char c, const level_t level, const bool is_start_of_node, const bool is_term) {
@@ -280,47 +723,35 @@ void SuRFBuilder::insertKeyByte(const char c, const level_t level, const bool is
 
     // sets parent node's child indicator
     if (level > 0)
-	setBit(child_indicator_bits_[level-1], getNumItems(level-1) - 1);
+	child_indicator_bits_.setBit(level - 1, getNumItems(level - 1) - 1);
 
-    labels_[level].push_back(c);
-    if (is_start_of_node) {
-	setBit(louds_bits_[level], getNumItems(level) - 1);
+    labels_.push(level, c);
+    child_indicator_bits_.push(level, false);
+    louds_bits_.push(level, is_start_of_node);
+    if (is_start_of_node)
 	node_counts_[level]++;
-    }
     is_last_item_terminator_[level] = is_term;
-
-    moveToNextItemSlot(level);
 }
 
 
 inline void SuRFBuilder::storeSuffix(const level_t level, const word_t suffix) {
-    level_t suffix_len = getSuffixLen();
-    position_t pos = suffix_counts_[level-1] * suffix_len;
-    assert(pos <= (suffixes_[level-1].size() * kWordSize));
-    if (pos == (suffixes_[level-1].size() * kWordSize))
-	suffixes_[level-1].push_back(0);
-    position_t word_id = pos / kWordSize;
-    position_t offset = pos % kWordSize;
-    position_t word_remaining_len = kWordSize - offset;
-    if (suffix_len <= word_remaining_len) {
-	word_t shifted_suffix = suffix << (word_remaining_len - suffix_len);
-	suffixes_[level-1][word_id] += shifted_suffix;
-    } else {
-	word_t suffix_left_part = suffix >> (suffix_len - word_remaining_len);
-	suffixes_[level-1][word_id] += suffix_left_part;
-	suffixes_[level-1].push_back(0);
-	word_id++;
-	word_t suffix_right_part = suffix << (kWordSize - (suffix_len - word_remaining_len));
-	suffixes_[level-1][word_id] += suffix_right_part;
-    }
-    suffix_counts_[level-1]++;
+    suffixes_.append(level - 1, suffix, getSuffixLen());
+    suffix_counts_[level - 1]++;
 }
 
 inline void SuRFBuilder::determineCutoffLevel() {
+    if (use_fixed_cutoff_) {
+	sparse_start_level_ = std::min(fixed_sparse_start_level_, getSizedHeight());
+	return;
+    }
+    if (use_cost_model_) {
+	determineCutoffLevelByCost();
+	return;
+    }
     level_t cutoff_level = 0;
     uint64_t dense_mem = computeDenseMem(cutoff_level);
     uint64_t sparse_mem = computeSparseMem(cutoff_level);
-    while ((cutoff_level < getTreeHeight()) && (dense_mem * sparse_dense_ratio_ < sparse_mem)) {
+    while ((cutoff_level < getSizedHeight()) && (dense_mem * sparse_dense_ratio_ < sparse_mem)) {
 	cutoff_level++;
 	dense_mem = computeDenseMem(cutoff_level);
 	sparse_mem = computeSparseMem(cutoff_level);
@@ -328,43 +759,136 @@ inline void SuRFBuilder::determineCutoffLevel() {
     sparse_start_level_ = cutoff_level--;
 }
 
+void SuRFBuilder::determineCutoffLevelByCost() {
+    level_t best_level = 1;
+    double best_cost = modeledLookupCost(best_level, cost_model_);
+    uint64_t best_mem = modeledMemory(best_level);
+    bool best_fits = (cost_model_.memory_budget == 0) || (best_mem <= cost_model_.memory_budget);
+    for (level_t level = 2; level <= getSizedHeight(); level++) {
+	double cost = modeledLookupCost(level, cost_model_);
+	uint64_t mem = modeledMemory(level);
+	bool fits = (cost_model_.memory_budget == 0) || (mem <= cost_model_.memory_budget);
+	bool is_better = fits ? (!best_fits || (cost < best_cost)) : (!best_fits && (mem < best_mem));
+	if (is_better) {
+	    best_level = level;
+	    best_cost = cost;
+	    best_mem = mem;
+	    best_fits = fits;
+	}
+    }
+    sparse_start_level_ = best_level;
+}
+
+double SuRFBuilder::modeledLookupCost(const level_t start_level,
+				      const CutoffCostModel& model) const {
+    position_t num_keys = 0;
+    for (level_t level = 0; level < getSizedHeight(); level++)
+	num_keys += getSizedNumSuffixes(level);
+    if (num_keys == 0)
+	return 0;
+
+    // a key's walk passes level iff its last byte is at level or below
+    position_t num_walks = num_keys;
+    double cost = 0;
+    for (level_t level = 0; level < getSizedHeight(); level++) {
+	double level_cost;
+	double miss_ns;
+	uint64_t level_mem;
+	if (level < start_level) {
+	    level_cost = model.dense_level_ns;
+	    miss_ns = model.dense_miss_ns;
+	    level_mem = getDenseLevelBytes(level);
+	} else {
+	    level_cost = model.sparse_level_ns;
+	    if (getSizedNumNodes(level) > 0)
+		level_cost += model.sparse_label_ns * getSizedNumItems(level) / getSizedNumNodes(level);
+	    miss_ns = model.sparse_miss_ns;
+	    level_mem = getSparseLevelBytes(level);
+	}
+	level_cost += miss_ns * level_mem / (level_mem + model.cache_bytes);
+	cost += level_cost * num_walks;
+	num_walks -= getSizedNumSuffixes(level);
+    }
+    return cost / num_keys;
+}
+
 inline uint64_t SuRFBuilder::computeDenseMem(const level_t downto_level) const {
-    assert(downto_level <= getTreeHeight());
+    assert(downto_level <= getSizedHeight());
     uint64_t mem = 0;
     for (level_t level = 0; level < downto_level; level++) {
-	mem += (2 * kFanout * node_counts_[level]);
+	mem += (2 * kFanout * getSizedNumNodes(level));
 	if (level > 0)
-	    mem += (node_counts_[level - 1] / 8 + 1);
-	mem += (suffix_counts_[level] * getSuffixLen() / 8);
+	    mem += (getSizedNumNodes(level - 1) / 8 + 1);
+	mem += (getSizedNumSuffixes(level) * getSuffixLen() / 8);
     }
     return mem;
 }
 
 inline uint64_t SuRFBuilder::computeSparseMem(const level_t start_level) const {
     uint64_t mem = 0;
-    for (level_t level = start_level; level < getTreeHeight(); level++) {
-	position_t num_items = labels_[level].size();
+    for (level_t level = start_level; level < getSizedHeight(); level++) {
+	position_t num_items = getSizedNumItems(level);
 	mem += (num_items + 2 * num_items / 8 + 1);
-	mem += (suffix_counts_[level] * getSuffixLen() / 8);
+	mem += (getSizedNumSuffixes(level) * getSuffixLen() / 8);
     }
     return mem;
 }
 
+uint64_t SuRFBuilder::modeledMemory(const level_t start_level) const {
+    uint64_t mem = 0;
+    for (level_t level = 0; level < getSizedHeight(); level++)
+	mem += (level < start_level) ? getDenseLevelBytes(level) : getSparseLevelBytes(level);
+    return mem;
+}
+
+// two 256-bit bitmaps and a prefix key bit per node, a 32-bit rank
+// entry per 512 bits, and the suffixes
+inline uint64_t SuRFBuilder::getDenseLevelBytes(const level_t level) const {
+    uint64_t num_bits = (2 * kFanout + 1) * (uint64_t)getSizedNumNodes(level);
+    return (num_bits / 8 + num_bits / 512 * 4
+	    + (uint64_t)getSizedNumSuffixes(level) * getSuffixLen() / 8);
+}
+
+// a label byte and child indicator and LOUDS bits per item, rank and
+// select look-up tables, and the suffixes
+inline uint64_t SuRFBuilder::getSparseLevelBytes(const level_t level) const {
+    uint64_t num_items = getSizedNumItems(level);
+    return (num_items + 2 * num_items / 8 + num_items / 512 * 4
+	    + (uint64_t)getSizedNumNodes(level) / select_sample_interval_ * 4
+	    + (uint64_t)getSizedNumSuffixes(level) * getSuffixLen() / 8);
+}
+
+level_t SuRFBuilder::getSizedHeight() const {
+    return level_num_items_.empty() ? getTreeHeight() : level_num_items_.size();
+}
+
+position_t SuRFBuilder::getSizedNumItems(const level_t level) const {
+    return level_num_items_.empty() ? getNumItems(level) : level_num_items_[level];
+}
+
+position_t SuRFBuilder::getSizedNumNodes(const level_t level) const {
+    return level_num_nodes_.empty() ? node_counts_[level] : level_num_nodes_[level];
+}
+
+position_t SuRFBuilder::getSizedNumSuffixes(const level_t level) const {
+    return level_num_suffixes_.empty() ? suffix_counts_[level] : level_num_suffixes_[level];
+}
+
 void SuRFBuilder::buildDense() {
+    initDenseVectors();
     for (level_t level = 0; level < sparse_start_level_; level++) {
-	initDenseVectors(level);
 	if (getNumItems(level) == 0) continue;
 
 	position_t node_num = 0;
 	if (isTerminator(level, 0))
-	    setBit(prefixkey_indicator_bits_[level], 0);
+	    prefixkey_indicator_bits_.setBit(level, 0);
 	else
 	    setLabelAndChildIndicatorBitmap(level, node_num, 0);
 	for (position_t pos = 1; pos < getNumItems(level); pos++) {
 	    if (isStartOfNode(level, pos)) {
 		node_num++;
 		if (isTerminator(level, pos)) {
-		    setBit(prefixkey_indicator_bits_[level], node_num);
+		    prefixkey_indicator_bits_.setBit(level, node_num);
 		    continue;
 		}
 	    }
@@ -373,54 +897,64 @@ void SuRFBuilder::buildDense() {
     }
 }
 
-void SuRFBuilder::initDenseVectors(const level_t level) {
-    bitmap_labels_.push_back(std::vector<word_t>());
-    bitmap_child_indicator_bits_.push_back(std::vector<word_t>());
-    prefixkey_indicator_bits_.push_back(std::vector<word_t>());
-
-    for (position_t nc = 0; nc < node_counts_[level]; nc++) {
-	for (int i = 0; i < (int)kFanout; i += kWordSize) {
-	    bitmap_labels_[level].push_back(0);
-	    bitmap_child_indicator_bits_[level].push_back(0);
-	}
-	if (nc % kWordSize == 0)
-	    prefixkey_indicator_bits_[level].push_back(0);
+// the node counts are known by now, so the bitmaps of all dense
+// levels are laid out in one array each
+void SuRFBuilder::initDenseVectors() {
+    std::vector<position_t> num_bitmap_bits;
+    std::vector<position_t> num_nodes;
+    for (level_t level = 0; level < sparse_start_level_; level++) {
+	num_bitmap_bits.push_back(node_counts_[level] * kFanout);
+	num_nodes.push_back(node_counts_[level]);
+    }
+    bitmap_labels_.reserveExact(num_bitmap_bits);
+    bitmap_child_indicator_bits_.reserveExact(num_bitmap_bits);
+    prefixkey_indicator_bits_.reserveExact(num_nodes);
+    for (level_t level = 0; level < sparse_start_level_; level++) {
+	bitmap_labels_.addLevel(num_bitmap_bits[level]);
+	bitmap_child_indicator_bits_.addLevel(num_bitmap_bits[level]);
+	prefixkey_indicator_bits_.addLevel(num_nodes[level]);
     }
 }
 
 void SuRFBuilder::setLabelAndChildIndicatorBitmap(const level_t level, 
 						  const position_t node_num, const position_t pos) {
-    label_t label = labels_[level][pos];
-    setBit(bitmap_labels_[level], node_num * kFanout + label);
-    if (readBit(child_indicator_bits_[level], pos))
-	setBit(bitmap_child_indicator_bits_[level], node_num * kFanout + label);
+    label_t label = labels_.read(level, pos);
+    bitmap_labels_.setBit(level, node_num * kFanout + label);
+    if (child_indicator_bits_.readBit(level, pos))
+	bitmap_child_indicator_bits_.setBit(level, node_num * kFanout + label);
 }
 
 void SuRFBuilder::addLevel() {
-    labels_.push_back(std::vector<label_t>());
-    child_indicator_bits_.push_back(std::vector<word_t>());
-    louds_bits_.push_back(std::vector<word_t>());
-    suffixes_.push_back(std::vector<word_t>());
+    labels_.addLevel();
+    child_indicator_bits_.addLevel();
+    louds_bits_.addLevel();
+    suffixes_.addLevel();
     suffix_counts_.push_back(0);
 
     node_counts_.push_back(0);
     is_last_item_terminator_.push_back(false);
 
-    child_indicator_bits_[getTreeHeight() - 1].push_back(0);
-    louds_bits_[getTreeHeight() - 1].push_back(0);
+    // no-ops on the levels laid out by reserveLevels
+    level_t level = getTreeHeight() - 1;
+    if (level < level_num_items_.size()) {
+	labels_.reserve(level, level_num_items_[level]);
+	child_indicator_bits_.reserve(level, level_num_items_[level]);
+	louds_bits_.reserve(level, level_num_items_[level]);
+	suffixes_.reserve(level, level_num_suffixes_[level] * getSuffixLen());
+    }
 }
 
 position_t SuRFBuilder::getNumItems(const level_t level) const {
-    return labels_[level].size();
+    return labels_.size(level);
 }
 
 bool SuRFBuilder::isStartOfNode(const level_t level, const position_t pos) const {
-    return readBit(louds_bits_[level], pos);
+    return louds_bits_.readBit(level, pos);
 }
 
 bool SuRFBuilder::isTerminator(const level_t level, const position_t pos) const {
-    label_t label = labels_[level][pos];
-    return ((label == kTerminator) && !readBit(child_indicator_bits_[level], pos));
+    label_t label = labels_.read(level, pos);
+    return ((label == kTerminator) && !child_indicator_bits_.readBit(level, pos));
 }
 
 } // namespace surf
@@ -0,0 +1,174 @@
+#ifndef SURFINT64_H_
+#define SURFINT64_H_
+
+#include <assert.h>
+
+#include <string>
+#include <vector>
+
+#include "config.hpp"
+#include "surf.hpp"
+
+namespace surf {
+
+//******************************************************
+// SuRF over uint64_t keys. Keys are stored as their
+// 8-byte big-endian strings (uint64ToString), so trie
+// order is integer order. This wraps a regular SuRF:
+// its layout, including the (all zero) dense prefix-key
+// bits, and its image are unchanged, and the height is
+// only known at run time. Since no key is a prefix of
+// another, the trie has at most kKeyLen levels of labels
+// (plus one holding only suffixes) and no terminators or
+// prefix keys, so lookupKey skips their checks and reads
+// key bytes straight from the integer. Loading an image
+// fails unless its header records that every key is
+// kKeyLen bytes long (kFormatFlagUint64Keys); images
+// written before the flag, or headerless ones, are only
+// readable as SuRF.
+//******************************************************
+class SuRFInt64 {
+public:
+    static const level_t kKeyLen = kUint64KeyLen;
+
+    SuRFInt64() {};
+
+    // Input keys must be SORTED
+    SuRFInt64(const std::vector<uint64_t>& keys,
+	      const SuffixType suffix_type = kNone,
+	      const level_t hash_suffix_len = 0, const level_t real_suffix_len = 0,
+	      const SuffixHashType suffix_hash_type = kSuffixHashLevelDB) {
+	create(keys, suffix_type, hash_suffix_len, real_suffix_len, suffix_hash_type);
+    }
+
+    ~SuRFInt64() {}
+
+    // Returns false if keys are not sorted; the filter then holds
+    // only the keys that are (see SuRFBuilder::add)
+    bool create(const std::vector<uint64_t>& keys,
+		const SuffixType suffix_type,
+		const level_t hash_suffix_len, const level_t real_suffix_len,
+		const SuffixHashType suffix_hash_type = kSuffixHashLevelDB) {
+	SuRFBuilder builder(kIncludeDense, kSparseDenseRatio, suffix_type,
+			    hash_suffix_len, real_suffix_len, kRankBasic,
+			    kSelectSampleInterval, suffix_hash_type);
+	builder.setExpectedNumKeys(keys.size());
+	for (size_t i = 0; i < keys.size(); i++) {
+	    uint64_t big_endian_key = __builtin_bswap64(keys[i]);
+	    builder.add(reinterpret_cast<const char*>(&big_endian_key), kKeyLen);
+	}
+	bool is_sorted = builder.finish();
+	surf_.format_flags_ = SuRF::formatFlags(&builder);
+	surf_.louds_dense_ = LoudsDense(&builder, true);
+	builder.releaseDenseLevels();
+	surf_.louds_sparse_ = LoudsSparse(&builder, true);
+	assert(surf_.getHeight() <= kKeyLen + 1);
+	return is_sorted;
+    }
+
+    bool lookupKey(const uint64_t key) const {
+	// see SuRF::lookupKey
+	if (surf_.louds_dense_.getHeight() == 0)
+	    return surf_.louds_sparse_.lookupKey(key, 0);
+	position_t connect_node_num = 0;
+	if (!surf_.louds_dense_.lookupKey(key, connect_node_num))
+	    return false;
+	else if (connect_node_num != 0)
+	    return surf_.louds_sparse_.lookupKey(key, connect_node_num);
+	return true;
+    }
+
+    bool lookupRange(const uint64_t left_key, const bool left_inclusive,
+		     const uint64_t right_key, const bool right_inclusive) const {
+	// the bounds' big-endian bytes, viewed in place
+	uint64_t left_bytes = __builtin_bswap64(left_key);
+	uint64_t right_bytes = __builtin_bswap64(right_key);
+	return surf_.lookupRange(Slice(reinterpret_cast<const char*>(&left_bytes), kKeyLen),
+				 left_inclusive,
+				 Slice(reinterpret_cast<const char*>(&right_bytes), kKeyLen),
+				 right_inclusive);
+    }
+
+    // The underlying filter, e.g. for iterators and approxCount
+    // over uint64ToString keys
+    const SuRF& getSuRF() const {
+	return surf_;
+    }
+
+    uint64_t serializedSize() const {
+	return surf_.serializedSize();
+    }
+
+    uint64_t getMemoryUsage() const {
+	return surf_.getMemoryUsage();
+    }
+
+    char* serialize() const {
+	return surf_.serialize();
+    }
+
+    // See SuRF::deSerialize; nullptr if the image is malformed
+    // or not flagged as one of 8-byte keys (see hasFixedLenKeys)
+    static SuRFInt64* deSerialize(char* src) {
+	return fromSuRF(SuRF::deSerialize(src));
+    }
+
+    static SuRFInt64* deSerialize(char* src, const uint64_t size) {
+	return fromSuRF(SuRF::deSerialize(src, size));
+    }
+
+    // See SuRF::loadView. Also returns false, leaving the filter
+    // empty, if the image is not flagged as one of 8-byte keys
+    // (see hasFixedLenKeys).
+    bool loadView(const char* src, const uint64_t size,
+		  const bool verify_checksums = false) {
+	if (!surf_.loadView(src, size, verify_checksums))
+	    return false;
+	if (hasFixedLenKeys(surf_))
+	    return true;
+	surf_.destroy();
+	surf_ = SuRF();
+	return false;
+    }
+
+    // See SuRF::moveToHugePages
+    bool moveToHugePages(const HugePageOptions& options = HugePageOptions()) {
+	return surf_.moveToHugePages(options);
+    }
+
+    void destroy() {
+	surf_.destroy();
+    }
+
+private:
+    // Returns whether surf can be walked with lookupKey(uint64_t),
+    // i.e., it has no prefix keys, terminators or keys longer than
+    // kKeyLen. Any SuRF of 8-byte keys passes, whoever built it: its
+    // builder set the flag. The height is only checked for sanity.
+    static bool hasFixedLenKeys(const SuRF& surf) {
+	return ((surf.format_flags_ & kFormatFlagUint64Keys)
+		&& (surf.getHeight() <= kKeyLen + 1));
+    }
+
+    // Takes over the view of surf and deletes it; nullptr if surf
+    // is not one of 8-byte keys
+    static SuRFInt64* fromSuRF(SuRF* surf) {
+	if (surf == nullptr)
+	    return nullptr;
+	if (!hasFixedLenKeys(*surf)) {
+	    surf->destroy();
+	    delete surf;
+	    return nullptr;
+	}
+	SuRFInt64* surf_int = new SuRFInt64();
+	surf_int->surf_ = *surf;
+	delete surf;
+	return surf_int;
+    }
+
+    SuRF surf_;
+};
+
+} // namespace surf
+
+#endif // SURFINT64_H_
@@ -46,23 +46,22 @@ public:
     Bitvector* bv5_; // dense: prefixkey indicator bits
     std::vector<position_t> num_items_per_level_; // sparse
     position_t num_items_; // sparse
-    std::vector<position_t> num_bits_per_level_; // dense
 };
 
 void BitvectorUnitTest::setupWordsTest() {
     builder_->build(words);
     for (level_t level = 0; level < builder_->getTreeHeight(); level++)
-	num_items_per_level_.push_back(builder_->getLabels()[level].size());
+	num_items_per_level_.push_back(builder_->getLabels().size(level));
     for (level_t level = 0; level < num_items_per_level_.size(); level++)
 	num_items_ += num_items_per_level_[level];
-    bv_ = new Bitvector(builder_->getChildIndicatorBits(), num_items_per_level_);
-    bv2_ = new Bitvector(builder_->getLoudsBits(), num_items_per_level_);
-
-    for (level_t level = 0; level < builder_->getTreeHeight(); level++)
-	num_bits_per_level_.push_back(builder_->getBitmapLabels()[level].size() * kWordSize);
-    bv3_ = new Bitvector(builder_->getBitmapLabels(), num_bits_per_level_);
-    bv4_ = new Bitvector(builder_->getBitmapChildIndicatorBits(), num_bits_per_level_);
-    bv5_ = new Bitvector(builder_->getPrefixkeyIndicatorBits(), builder_->getNodeCounts());
+    level_t height = builder_->getTreeHeight();
+    bv_ = new Bitvector(builder_->getChildIndicatorBits(), 0, height);
+    bv2_ = new Bitvector(builder_->getLoudsBits(), 0, height);
+
+    level_t dense_height = builder_->getSparseStartLevel();
+    bv3_ = new Bitvector(builder_->getBitmapLabels(), 0, dense_height);
+    bv4_ = new Bitvector(builder_->getBitmapChildIndicatorBits(), 0, dense_height);
+    bv5_ = new Bitvector(builder_->getPrefixkeyIndicatorBits(), 0, dense_height);
 }
 
 TEST_F (BitvectorUnitTest, readBitTest) {
@@ -75,12 +74,12 @@ TEST_F (BitvectorUnitTest, readBitTest) {
     for (level_t level = 0; level < builder_->getTreeHeight(); level++) {
 	for (position_t pos = 0; pos < num_items_per_level_[level]; pos++) {
 	    // bv test
-	    bool has_child = SuRFBuilder::readBit(builder_->getChildIndicatorBits()[level], pos);
+	    bool has_child = builder_->getChildIndicatorBits().readBit(level, pos);
 	    bool bv_bit = bv_->readBit(bv_pos);
 	    ASSERT_EQ(has_child, bv_bit);
 
 	    // bv2 test
-	    bool is_node_start = SuRFBuilder::readBit(builder_->getLoudsBits()[level], pos);
+	    bool is_node_start = builder_->getLoudsBits().readBit(level, pos);
 	    bv_bit = bv2_->readBit(bv_pos);
 	    ASSERT_EQ(is_node_start, bv_bit);
 
@@ -92,8 +91,8 @@ TEST_F (BitvectorUnitTest, readBitTest) {
 	    // bv5 test
 	    bool is_terminator = false;
 	    if (is_node_start) {
-	        is_terminator = (builder_->getLabels()[level][pos] == kTerminator)
-		    && !SuRFBuilder::readBit(builder_->getChildIndicatorBits()[level], pos);
+	        is_terminator = (builder_->getLabels().read(level, pos) == kTerminator)
+		    && !builder_->getChildIndicatorBits().readBit(level, pos);
 		bv_bit = bv5_->readBit(bv5_pos);
 		ASSERT_EQ(is_terminator, bv_bit);
 		bv5_pos++;
@@ -111,7 +110,7 @@ TEST_F (BitvectorUnitTest, readBitTest) {
 	    }
 
 	    // bv3 test
-	    label_t label = builder_->getLabels()[level][pos];
+	    label_t label = builder_->getLabels().read(level, pos);
 	    bool bv3_bit = bv3_->readBit(node_num * kFanout + label);
 	    ASSERT_TRUE(bv3_bit);
 
@@ -176,6 +175,22 @@ TEST_F (BitvectorUnitTest, distanceToNextSetBitTest) {
     }
 }
 
+// the distance from the last set bit must stop at the end of the
+// bitvector, also across empty words and a partial last word
+TEST_F (BitvectorUnitTest, distanceToNextSetBitTailTest) {
+    setupWordsTest();
+    const position_t num_bits_list[4] = {kWordSize, 2 * kWordSize, 3 * kWordSize + 5, 70};
+    for (int i = 0; i < 4; i++) {
+	position_t num_bits = num_bits_list[i];
+	LevelBits bits;
+	bits.addLevel(num_bits);
+	bits.setBit(0, 3);
+	Bitvector bv(bits, 0, 1);
+	for (position_t pos = 3; pos < num_bits; pos++)
+	    ASSERT_EQ(num_bits - pos, bv.distanceToNextSetBit(pos));
+    }
+}
+
 TEST_F (BitvectorUnitTest, distanceToPrevSetBitTest) {
     setupWordsTest();
     std::vector<position_t> distanceVector;
@@ -1,8 +1,12 @@
 #include "gtest/gtest.h"
 
 #include <assert.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <fstream>
+#include <random>
 #include <string>
 #include <vector>
 
@@ -44,7 +48,7 @@ public:
 
 void LabelVectorUnitTest::setupWordsTest() {
     builder_->build(words);
-    labels_ = new LabelVector(builder_->getLabels());
+    labels_ = new LabelVector(builder_->getLabels(), 0, builder_->getTreeHeight());
 }
 
 void LabelVectorUnitTest::testSerialize() {
@@ -73,8 +77,8 @@ void LabelVectorUnitTest::testSearch() {
     position_t start_pos = 0;
     position_t search_len = 0;
     for (level_t level = 0; level < builder_->getTreeHeight(); level++) {
-	for (position_t pos = 0; pos < builder_->getLabels()[level].size(); pos++) {
-	    bool louds_bit = SuRFBuilder::readBit(builder_->getLoudsBits()[level], pos);
+	for (position_t pos = 0; pos < builder_->getLabels().size(level); pos++) {
+	    bool louds_bit = builder_->getLoudsBits().readBit(level, pos);
 	    if (louds_bit) {
 		position_t search_pos;
 		bool search_success;
@@ -108,8 +112,8 @@ TEST_F (LabelVectorUnitTest, readTest) {
     setupWordsTest();
     position_t lv_pos = 0;
     for (level_t level = 0; level < builder_->getTreeHeight(); level++) {
-	for (position_t pos = 0; pos < builder_->getLabels()[level].size(); pos++) {
-	    label_t expected_label = builder_->getLabels()[level][pos];
+	for (position_t pos = 0; pos < builder_->getLabels().size(level); pos++) {
+	    label_t expected_label = builder_->getLabels().read(level, pos);
 	    label_t label = labels_->read(lv_pos);
 	    ASSERT_EQ(expected_label, label);
 	    lv_pos++;
@@ -124,18 +128,12 @@ TEST_F (LabelVectorUnitTest, searchAlgTest) {
     position_t start_pos = 0;
     position_t search_len = 0;
     for (level_t level = 0; level < builder_->getTreeHeight(); level++) {
-	for (position_t pos = 0; pos < builder_->getLabels()[level].size(); pos++) {
-	    bool louds_bit = SuRFBuilder::readBit(builder_->getLoudsBits()[level], pos);
+	for (position_t pos = 0; pos < builder_->getLabels().size(level); pos++) {
+	    bool louds_bit = builder_->getLoudsBits().readBit(level, pos);
 	    if (louds_bit) {
-		position_t binary_search_pos, simd_search_pos, linear_search_pos;
-		bool binary_search_success, simd_search_success, linear_search_success;
+		position_t simd_search_pos, linear_search_pos;
+		bool simd_search_success, linear_search_success;
 		for (position_t i = start_pos; i < start_pos + search_len; i++) {
-		    // binary search success
-		    binary_search_pos = start_pos;
-		    binary_search_success = labels_->binarySearch(labels_->read(i), binary_search_pos, search_len);
-		    ASSERT_TRUE(binary_search_success);
-		    ASSERT_EQ(i, binary_search_pos);
-
 		    // simd search success
 		    simd_search_pos = start_pos;
 		    simd_search_success = labels_->simdSearch(labels_->read(i), simd_search_pos, search_len);
@@ -148,14 +146,6 @@ TEST_F (LabelVectorUnitTest, searchAlgTest) {
 		    ASSERT_TRUE(linear_search_success);
 		    ASSERT_EQ(i, linear_search_pos);
 		}
-		// binary search fail
-		binary_search_pos = start_pos;
-		binary_search_success = labels_->binarySearch('\0', binary_search_pos, search_len);
-		ASSERT_FALSE(binary_search_success);
-		binary_search_pos = start_pos;
-		binary_search_success = labels_->binarySearch('\255', binary_search_pos, search_len);
-		ASSERT_FALSE(binary_search_success);
-
 		// simd search fail
 		simd_search_pos = start_pos;
 		simd_search_success = labels_->simdSearch('\0', simd_search_pos, search_len);
@@ -176,8 +166,8 @@ TEST_F (LabelVectorUnitTest, searchAlgTest) {
 		search_len = 0;
 	    }
 
-	    if (builder_->getLabels()[level][pos] == kTerminator
-		&& !SuRFBuilder::readBit(builder_->getChildIndicatorBits()[level], pos))
+	    if (builder_->getLabels().read(level, pos) == kTerminator
+		&& !builder_->getChildIndicatorBits().readBit(level, pos))
 		start_pos++;
 	    else
 		search_len++;
@@ -205,8 +195,8 @@ TEST_F (LabelVectorUnitTest, searchGreaterThanTest) {
     position_t start_pos = 0;
     position_t search_len = 0;
     for (level_t level = 0; level < builder_->getTreeHeight(); level++) {
-	for (position_t pos = 0; pos < builder_->getLabels()[level].size(); pos++) {
-	    bool louds_bit = SuRFBuilder::readBit(builder_->getLoudsBits()[level], pos);
+	for (position_t pos = 0; pos < builder_->getLabels().size(level); pos++) {
+	    bool louds_bit = builder_->getLoudsBits().readBit(level, pos);
 	    if (louds_bit) {
 		position_t search_pos;
 		position_t terminator_offset = 0;
@@ -248,6 +238,109 @@ TEST_F (LabelVectorUnitTest, searchGreaterThanTest) {
     }
 }
 
+// One node of every size from 1 to 256, then tail_node_size labels
+static void genNodes(const position_t tail_node_size,
+		     LevelLabels& labels,
+		     std::vector<position_t>& node_starts) {
+    std::vector<label_t> all_labels;
+    for (int i = 0; i < 256; i++)
+	all_labels.push_back((label_t)i);
+    std::mt19937 rng(2018);
+    labels.addLevel();
+    for (position_t node_size = 1; node_size <= 256 + 1; node_size++) {
+	position_t size = (node_size > 256) ? tail_node_size : node_size;
+	node_starts.push_back(labels.size(0));
+	std::shuffle(all_labels.begin(), all_labels.end(), rng);
+	std::vector<label_t> node(all_labels.begin(), all_labels.begin() + size);
+	std::sort(node.begin(), node.end());
+	for (position_t i = 0; i < node.size(); i++)
+	    labels.push(0, node[i]);
+    }
+    node_starts.push_back(labels.size(0));
+}
+
+// Every kernel the CPU supports must agree with linear search
+// on every node, for every target label.
+static void testKernels(LabelVector& lv, const std::vector<position_t>& node_starts) {
+    const LabelVector::SimdLevel levels[] = {LabelVector::kSimdSse2,
+					     LabelVector::kSimdAvx2,
+					     LabelVector::kSimdAvx512};
+    for (int l = 0; l < 3; l++) {
+	if (levels[l] > LabelVector::detectSimdLevel())
+	    continue;
+	lv.setSimdLevel(levels[l]);
+	ASSERT_EQ(levels[l], lv.getSimdLevel());
+	for (position_t n = 0; n + 1 < node_starts.size(); n++) {
+	    position_t start_pos = node_starts[n];
+	    position_t search_len = node_starts[n + 1] - start_pos;
+	    for (int target = 0; target < 256; target++) {
+		position_t linear_pos = start_pos;
+		bool linear_success = lv.linearSearch((label_t)target, linear_pos, search_len);
+		position_t simd_pos = start_pos;
+		bool simd_success = lv.simdSearch((label_t)target, simd_pos, search_len);
+		ASSERT_EQ(linear_success, simd_success);
+		if (linear_success) {
+		    ASSERT_EQ(linear_pos, simd_pos);
+		}
+
+		linear_pos = start_pos;
+		linear_success = lv.linearSearchGreaterThan((label_t)target, linear_pos, search_len);
+		simd_pos = start_pos;
+		simd_success = lv.simdSearchGreaterThan((label_t)target, simd_pos, search_len);
+		ASSERT_EQ(linear_success, simd_success);
+		if (linear_success) {
+		    ASSERT_EQ(linear_pos, simd_pos);
+		}
+	    }
+	}
+    }
+}
+
+TEST_F (LabelVectorUnitTest, simdKernelTest) {
+    LevelLabels labels;
+    std::vector<position_t> node_starts;
+    genNodes(7, labels, node_starts);
+    LabelVector lv(labels, 0, 1);
+    testKernels(lv, node_starts);
+    lv.destroy();
+}
+
+// The image is placed so that the last label is the last readable
+// byte before a PROT_NONE page; any load past it faults.
+TEST_F (LabelVectorUnitTest, endOfMappingTest) {
+    const position_t tail_node_sizes[] = {1, 3, 5, 15, 16, 17, 31, 33, 63, 65};
+    for (int t = 0; t < 10; t++) {
+	LevelLabels labels;
+	std::vector<position_t> node_starts;
+	genNodes(tail_node_sizes[t], labels, node_starts);
+	LabelVector ori_lv(labels, 0, 1);
+
+	position_t size = ori_lv.serializedSize();
+	position_t labels_end = sizeof(position_t) + ori_lv.getNumBytes();
+	long page_size = sysconf(_SC_PAGESIZE);
+	size_t map_size = (size / page_size + 2) * page_size;
+	char* map = (char*)mmap(nullptr, map_size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	ASSERT_TRUE(map != MAP_FAILED);
+	char* guard = map + map_size - page_size;
+	ASSERT_EQ(0, mprotect(guard, page_size, PROT_NONE));
+	// drop the alignment padding after the labels
+	char* data = new char[size];
+	char* dst = data;
+	ori_lv.serialize(dst);
+	char* image = guard - labels_end;
+	memcpy(image, data, labels_end);
+	delete[] data;
+
+	LabelVector lv;
+	const char* src = image;
+	ASSERT_TRUE(lv.loadView(src, nullptr));
+	testKernels(lv, node_starts);
+	munmap(map, map_size);
+	ori_lv.destroy();
+    }
+}
+
 void loadWordList() {
     std::ifstream infile(kFilePath);
     std::string key;
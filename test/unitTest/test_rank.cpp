@@ -37,7 +37,7 @@ public:
 	    delete[] data2_;
     }
 
-    void setupWordsTest();
+    void setupWordsTest(const RankType type = kRankBasic);
     void testSerialize();
     void testRank();
 
@@ -52,14 +52,16 @@ public:
     char* data2_;
 };
 
-void RankUnitTest::setupWordsTest() {
+void RankUnitTest::setupWordsTest(const RankType type) {
     builder_->build(words);
     for (level_t level = 0; level < builder_->getTreeHeight(); level++)
-	num_items_per_level_.push_back(builder_->getLabels()[level].size());
+	num_items_per_level_.push_back(builder_->getLabels().size(level));
     for (level_t level = 0; level < num_items_per_level_.size(); level++)
 	num_items_ += num_items_per_level_[level];
-    bv_ = new BitvectorRank(kRankBasicBlockSize, builder_->getChildIndicatorBits(), num_items_per_level_);
-    bv2_ = new BitvectorRank(kRankBasicBlockSize, builder_->getLoudsBits(), num_items_per_level_);
+    bv_ = new BitvectorRank(kRankBasicBlockSize, builder_->getChildIndicatorBits(),
+			    0, builder_->getTreeHeight(), type);
+    bv2_ = new BitvectorRank(kRankBasicBlockSize, builder_->getLoudsBits(),
+			     0, builder_->getTreeHeight(), type);
 }
 
 void RankUnitTest::testSerialize() {
@@ -74,6 +76,7 @@ void RankUnitTest::testSerialize() {
 
     ASSERT_EQ(ori_bv->bitsSize(), bv_->bitsSize());
     ASSERT_EQ(ori_bv->rankLutSize(), bv_->rankLutSize());
+    ASSERT_EQ(ori_bv->getType(), bv_->getType());
     
     ori_bv->destroy();
     delete ori_bv;
@@ -112,11 +115,11 @@ TEST_F (RankUnitTest, readBitTest) {
     position_t bv_pos = 0;
     for (level_t level = 0; level < builder_->getTreeHeight(); level++) {
 	for (position_t pos = 0; pos < num_items_per_level_[level]; pos++) {
-	    bool expected_bit = SuRFBuilder::readBit(builder_->getChildIndicatorBits()[level], pos);
+	    bool expected_bit = builder_->getChildIndicatorBits().readBit(level, pos);
 	    bool bv_bit = bv_->readBit(bv_pos);
 	    ASSERT_EQ(expected_bit, bv_bit);
 
-	    expected_bit = SuRFBuilder::readBit(builder_->getLoudsBits()[level], pos);
+	    expected_bit = builder_->getLoudsBits().readBit(level, pos);
 	    bv_bit = bv2_->readBit(bv_pos);
 	    ASSERT_EQ(expected_bit, bv_bit);
 
@@ -144,6 +147,43 @@ TEST_F (RankUnitTest, serializeTest) {
     testRank();
 }
 
+TEST_F (RankUnitTest, rankTwoLevelTest) {
+    setupWordsTest(kRankTwoLevel);
+    testRank();
+    bv_->destroy();
+    delete bv_;
+    bv2_->destroy();
+    delete bv2_;
+}
+
+TEST_F (RankUnitTest, serializeTwoLevelTest) {
+    setupWordsTest(kRankTwoLevel);
+    testSerialize();
+    testRank();
+}
+
+TEST_F (RankUnitTest, twoLevelBlockBoundaryTest) {
+    // all-ones and alternating words, lengths around block boundaries
+    position_t lens[] = {1, 63, 64, 511, 512, 513, 2047, 2048, 2049, 4096, 5000};
+    for (unsigned t = 0; t < sizeof(lens) / sizeof(lens[0]); t++) {
+	for (int pattern = 0; pattern < 2; pattern++) {
+	    // pattern 1 sets every odd bit, i.e., 0x5555555555555555 words
+	    LevelBits bits;
+	    bits.addLevel(lens[t]);
+	    for (position_t pos = 0; pos < lens[t]; pos++) {
+		if ((pattern == 0) || (pos % 2 == 1))
+		    bits.setBit(0, pos);
+	    }
+	    BitvectorRank basic(kRankBasicBlockSize, bits, 0, 1);
+	    BitvectorRank two_level(kRankBasicBlockSize, bits, 0, 1, kRankTwoLevel);
+	    for (position_t pos = 0; pos < lens[t]; pos++)
+		ASSERT_EQ(basic.rank(pos), two_level.rank(pos));
+	    basic.destroy();
+	    two_level.destroy();
+	}
+    }
+}
+
 void loadWordList() {
     std::ifstream infile(kFilePath);
     std::string key;
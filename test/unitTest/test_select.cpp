@@ -50,10 +50,11 @@ public:
 void SelectUnitTest::setupWordsTest() {
     builder_->build(words);
     for (level_t level = 0; level < builder_->getTreeHeight(); level++)
-	num_items_per_level_.push_back(builder_->getLabels()[level].size());
+	num_items_per_level_.push_back(builder_->getLabels().size(level));
     for (level_t level = 0; level < num_items_per_level_.size(); level++)
 	num_items_ += num_items_per_level_[level];
-    bv_ = new BitvectorSelect(kSelectSampleInterval, builder_->getLoudsBits(), num_items_per_level_);
+    bv_ = new BitvectorSelect(kSelectSampleInterval, builder_->getLoudsBits(),
+			      0, builder_->getTreeHeight());
 }
 
 void SelectUnitTest::testSerialize() {
@@ -89,7 +90,7 @@ TEST_F (SelectUnitTest, readBitTest) {
     position_t bv_pos = 0;
     for (level_t level = 0; level < builder_->getTreeHeight(); level++) {
 	for (position_t pos = 0; pos < num_items_per_level_[level]; pos++) {
-	    bool expected_bit = SuRFBuilder::readBit(builder_->getLoudsBits()[level], pos);
+	    bool expected_bit = builder_->getLoudsBits().readBit(level, pos);
 	    bool bv_bit = bv_->readBit(bv_pos);
 	    ASSERT_EQ(expected_bit, bv_bit);
 	    bv_pos++;
@@ -110,6 +111,84 @@ TEST_F (SelectUnitTest, serializeTest) {
     testSelect();
 }
 
+// the 16-byte header keeps the bits 8-byte aligned in a view
+TEST_F (SelectUnitTest, alignedViewTest) {
+    setupWordsTest();
+    uint64_t size = bv_->serializedSize();
+    std::vector<word_t> buf(size / sizeof(word_t) + 1);
+    char* image = reinterpret_cast<char*>(buf.data());
+    char* dst = image;
+    bv_->serialize(dst);
+    ASSERT_EQ(size, (uint64_t)(dst - image));
+    bv_->destroy();
+    delete bv_;
+
+    BitvectorSelect view;
+    const char* src = image;
+    ASSERT_TRUE(view.loadView(src, image + size));
+    ASSERT_EQ(image + size, src);
+    bv_ = &view;
+    testSelect();
+    bv_ = nullptr;
+
+    src = image + 4;
+    BitvectorSelect misaligned;
+    ASSERT_FALSE(misaligned.loadView(src, image + size));
+
+    // an unpadded 12-byte header as written by older versions: the
+    // misaligned arrays are copied
+    std::vector<word_t> old_buf(size / sizeof(word_t) + 1);
+    char* old_image = reinterpret_cast<char*>(old_buf.data());
+    position_t interval_field;
+    memcpy(&interval_field, image + sizeof(position_t), sizeof(interval_field));
+    interval_field &= 0x7FFFFFFF;
+    memcpy(old_image, image, sizeof(position_t));
+    memcpy(old_image + sizeof(position_t), &interval_field, sizeof(interval_field));
+    memcpy(old_image + 2 * sizeof(position_t), image + 2 * sizeof(position_t),
+	   sizeof(position_t));
+    memcpy(old_image + 3 * sizeof(position_t), image + 16, size - 16);
+    src = old_image;
+    BitvectorSelect unpadded;
+    ASSERT_TRUE(unpadded.loadView(src, old_image + size));
+    ASSERT_TRUE(src <= old_image + size);
+    bv_ = &unpadded;
+    testSelect();
+    bv_ = nullptr;
+    unpadded.destroyCopy();
+}
+
+TEST_F (SelectUnitTest, denseSamplingTest) {
+    setupWordsTest();
+    bv_->destroy();
+    delete bv_;
+    position_t intervals[] = {1, 16, 32, 128};
+    for (unsigned i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++) {
+	bv_ = new BitvectorSelect(intervals[i], builder_->getLoudsBits(),
+				  0, builder_->getTreeHeight());
+	testSelect();
+	bv_->destroy();
+	delete bv_;
+    }
+}
+
+TEST_F (SelectUnitTest, selectInWordTest) {
+    word_t words[] = {kMsbMask, 1, kOneMask, 0x5555555555555555, 0x8000000100000001,
+		      0x0123456789ABCDEF};
+    bool has_pdep = BitvectorSelect::hasFastPdep();
+    for (unsigned i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+	position_t k = 0;
+	for (position_t pos = 0; pos < kWordSize; pos++) {
+	    if (!(words[i] & (kMsbMask >> pos)))
+		continue;
+	    k++;
+	    ASSERT_EQ(pos, BitvectorSelect::selectInWordBroadword(words[i], k));
+	    if (has_pdep) {
+		ASSERT_EQ(pos, BitvectorSelect::selectInWordPdep(words[i], k));
+	    }
+	}
+    }
+}
+
 void loadWordList() {
     std::ifstream infile(kFilePath);
     std::string key;
@@ -0,0 +1,163 @@
+#include "gtest/gtest.h"
+
+// this test binary always counts, whatever the build's SURF_STATS setting
+#ifndef SURF_STATS
+#define SURF_STATS
+#endif
+
+#include <assert.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.hpp"
+#include "stats.hpp"
+#include "surf.hpp"
+#include "surf_int64.hpp"
+
+namespace surf {
+
+namespace statstest {
+
+static const uint64_t kNumKeys = 50000;
+static const uint64_t kNumProbes = 100000;
+
+class StatsUnitTest : public ::testing::Test {
+public:
+    virtual void SetUp () {
+	// short keys over a small alphabet share long prefixes, so
+	// lookups end in both louds-dense and louds-sparse
+	std::mt19937_64 rng(2018);
+	for (uint64_t i = 0; i < kNumKeys; i++) {
+	    std::string key;
+	    uint64_t len = 1 + rng() % 12;
+	    for (uint64_t j = 0; j < len; j++)
+		key.push_back((char)('a' + rng() % 8));
+	    keys_.push_back(key);
+	}
+	std::sort(keys_.begin(), keys_.end());
+	keys_.erase(std::unique(keys_.begin(), keys_.end()), keys_.end());
+	for (uint64_t i = 0; i < kNumProbes; i++) {
+	    if (i % 2 == 0) {
+		probes_.push_back(keys_[rng() % keys_.size()]);
+	    } else {
+		std::string probe;
+		uint64_t len = 1 + rng() % 14;
+		for (uint64_t j = 0; j < len; j++)
+		    probe.push_back((char)('a' + rng() % 9));
+		probes_.push_back(probe);
+	    }
+	}
+    }
+    virtual void TearDown () {}
+
+    std::vector<std::string> keys_;
+    std::vector<std::string> probes_;
+};
+
+static uint64_t sumExits(const LookupStats& stats, const int is_sparse) {
+    uint64_t sum = 0;
+    for (int r = 0; r < kNumLookupExits; r++)
+	sum += stats.exits[is_sparse][r];
+    return sum;
+}
+
+// every lookup ends exactly once, and the histograms add up
+// to the level and search counters
+TEST_F (StatsUnitTest, lookupKeyCountTest) {
+    ASSERT_TRUE(LookupStats::kEnabled);
+    SuRF surf(keys_, kIncludeDense, kSparseDenseRatio, kHash, 8, 0);
+    lookupStats().reset();
+    uint64_t num_positives = 0;
+    for (uint64_t i = 0; i < probes_.size(); i++)
+	num_positives += surf.lookupKey(probes_[i]);
+    const LookupStats& stats = lookupStats();
+
+    ASSERT_EQ(probes_.size(), stats.dense_lookups);
+    ASSERT_EQ(probes_.size(), sumExits(stats, 0));
+    ASSERT_EQ(stats.exits[0][kExitToSparse], stats.sparse_lookups);
+    ASSERT_TRUE(stats.sparse_lookups > 0);
+    ASSERT_EQ(stats.sparse_lookups, sumExits(stats, 1));
+    ASSERT_EQ(0u, stats.exits[1][kExitToSparse]);
+
+    uint64_t num_finished = 0;
+    uint64_t num_levels = 0;
+    for (level_t d = 0; d <= LookupStats::kMaxDepth; d++) {
+	num_finished += stats.depth_hist[d];
+	num_levels += d * stats.depth_hist[d];
+    }
+    ASSERT_EQ(probes_.size(), num_finished);
+    ASSERT_EQ(stats.dense_levels + stats.sparse_levels, num_levels);
+
+    uint64_t num_suffix_exits = stats.exits[0][kExitLeaf] + stats.exits[0][kExitPrefixKey]
+	+ stats.exits[1][kExitLeaf] + stats.exits[1][kExitPrefixKey];
+    ASSERT_EQ(num_suffix_exits, stats.suffix_checks);
+    ASSERT_EQ(num_positives, stats.suffix_matches);
+
+    uint64_t num_node_sizes = 0;
+    for (unsigned b = 0; b < LookupStats::kNumNodeSizeBuckets; b++)
+	num_node_sizes += stats.node_size_hist[b];
+    ASSERT_EQ(stats.label_searches, num_node_sizes);
+    ASSERT_TRUE(stats.label_searches <= stats.sparse_levels);
+    ASSERT_TRUE(stats.rank_calls > 0);
+    ASSERT_TRUE(stats.select_calls >= stats.sparse_lookups);
+    ASSERT_FALSE(stats.toString().empty());
+    surf.destroy();
+}
+
+TEST_F (StatsUnitTest, lookupKeyInt64CountTest) {
+    std::mt19937_64 rng(2018);
+    std::vector<uint64_t> int_keys;
+    for (uint64_t i = 0; i < kNumKeys; i++)
+	int_keys.push_back(rng());
+    std::sort(int_keys.begin(), int_keys.end());
+    int_keys.erase(std::unique(int_keys.begin(), int_keys.end()), int_keys.end());
+    SuRFInt64 surf(int_keys, kReal, 0, 8);
+    lookupStats().reset();
+    for (uint64_t i = 0; i < int_keys.size(); i++)
+	ASSERT_TRUE(surf.lookupKey(int_keys[i]));
+    const LookupStats& stats = lookupStats();
+    ASSERT_EQ(int_keys.size(), stats.dense_lookups);
+    ASSERT_EQ(int_keys.size(), sumExits(stats, 0));
+    ASSERT_EQ(stats.sparse_lookups, sumExits(stats, 1));
+    ASSERT_EQ(int_keys.size(), stats.suffix_checks);
+    ASSERT_EQ(int_keys.size(), stats.suffix_matches);
+    surf.destroy();
+}
+
+// counters are per thread; merge sums them up
+TEST_F (StatsUnitTest, threadLocalTest) {
+    SuRF surf(keys_, kIncludeDense, kSparseDenseRatio, kReal, 0, 8);
+    lookupStats().reset();
+    LookupStats thread_stats;
+    std::thread worker([&]() {
+	    lookupStats().reset();
+	    for (uint64_t i = 0; i < keys_.size(); i++)
+		surf.lookupKey(keys_[i]);
+	    thread_stats = lookupStats();
+	});
+    worker.join();
+    ASSERT_EQ(0u, lookupStats().dense_lookups);
+    ASSERT_EQ(0u, lookupStats().rank_calls);
+    ASSERT_EQ(keys_.size(), thread_stats.dense_lookups);
+
+    for (uint64_t i = 0; i < 10; i++)
+	surf.lookupKey(keys_[i]);
+    LookupStats total = thread_stats;
+    total.merge(lookupStats());
+    ASSERT_EQ(keys_.size() + 10, total.dense_lookups);
+    ASSERT_EQ(thread_stats.rank_calls + lookupStats().rank_calls, total.rank_calls);
+    surf.destroy();
+}
+
+} // namespace statstest
+
+} // namespace surf
+
+int main (int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
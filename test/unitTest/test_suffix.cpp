@@ -187,21 +187,14 @@ TEST_F (SuffixUnitTest, checkEqualityTest) {
                                            suffix_type, suffix_len, suffix_len);
 	    builder_->build(words);
 
-	    level_t height = builder_->getLabels().size();
-	    std::vector<position_t> num_suffix_bits_per_level;
-	    for (level_t level = 0; level < height; level++) {
-                if (suffix_type == kMixed)
-                    num_suffix_bits_per_level.push_back(builder_->getSuffixCounts()[level] * suffix_len * 2);
-                else
-                    num_suffix_bits_per_level.push_back(builder_->getSuffixCounts()[level] * suffix_len);
-            }
+	    level_t height = builder_->getTreeHeight();
 
             if (i == 0)
-                suffixes_ = new BitvectorSuffix(builder_->getSuffixType(), suffix_len, 0, builder_->getSuffixes(), num_suffix_bits_per_level, 0, height);
+                suffixes_ = new BitvectorSuffix(builder_->getSuffixType(), suffix_len, 0, builder_->getSuffixes(), 0, height);
             else if (i == 1)
-                suffixes_ = new BitvectorSuffix(builder_->getSuffixType(), 0, suffix_len, builder_->getSuffixes(), num_suffix_bits_per_level, 0, height);
+                suffixes_ = new BitvectorSuffix(builder_->getSuffixType(), 0, suffix_len, builder_->getSuffixes(), 0, height);
             else
-                suffixes_ = new BitvectorSuffix(builder_->getSuffixType(), suffix_len, suffix_len, builder_->getSuffixes(), num_suffix_bits_per_level, 0, height);
+                suffixes_ = new BitvectorSuffix(builder_->getSuffixType(), suffix_len, suffix_len, builder_->getSuffixes(), 0, height);
 
 	    testCheckEquality();
 	    delete builder_;
@@ -211,6 +204,30 @@ TEST_F (SuffixUnitTest, checkEqualityTest) {
     }
 }
 
+// Batches of every length, so both the vector groups of 8 and the
+// scalar leftovers are covered; key lengths vary inside a group.
+TEST_F (SuffixUnitTest, suffixHashesTest) {
+    std::vector<std::string> keys;
+    for (unsigned i = 0; i < 1000; i++)
+	keys.push_back(words[i].substr(0, i % 7) + words[i * 7] + std::string(i % 61, (char)i));
+    keys.push_back(std::string());
+    std::vector<Slice> key_slices(keys.begin(), keys.end());
+    word_t hashes[kLookupBatchSize];
+    SuffixHashType hash_types[2] = {kSuffixHashLevelDB, kSuffixHash64};
+    for (int t = 0; t < 2; t++) {
+	for (size_t start = 0; start < keys.size(); start += kLookupBatchSize / 2) {
+	    size_t n = (start / 16) % (kLookupBatchSize + 1);
+	    if (start + n > keys.size())
+		n = keys.size() - start;
+	    suffixHashes(key_slices.data() + start, n, hash_types[t], hashes);
+	    for (size_t i = 0; i < n; i++)
+		ASSERT_EQ(suffixHash(keys[start + i], hash_types[t]), hashes[i]);
+	}
+    }
+    for (size_t i = 0; i < keys.size(); i++)
+	ASSERT_EQ(suffixHash(keys[i]), suffixHash(keys[i], kSuffixHashLevelDB));
+}
+
 TEST_F (SuffixUnitTest, serializeTest) {
     bool include_dense = false;
     uint32_t sparse_dense_ratio = 0;
@@ -230,21 +247,14 @@ TEST_F (SuffixUnitTest, serializeTest) {
                                            suffix_type, suffix_len, suffix_len);
 	    builder_->build(words);
 
-	    level_t height = builder_->getLabels().size();
-	    std::vector<position_t> num_suffix_bits_per_level;
-	    for (level_t level = 0; level < height; level++) {
-                if (suffix_type == kMixed)
-                    num_suffix_bits_per_level.push_back(builder_->getSuffixCounts()[level] * suffix_len * 2);
-                else
-                    num_suffix_bits_per_level.push_back(builder_->getSuffixCounts()[level] * suffix_len);
-            }
+	    level_t height = builder_->getTreeHeight();
 
             if (i == 0)
-                suffixes_ = new BitvectorSuffix(builder_->getSuffixType(), suffix_len, 0, builder_->getSuffixes(), num_suffix_bits_per_level, 0, height);
+                suffixes_ = new BitvectorSuffix(builder_->getSuffixType(), suffix_len, 0, builder_->getSuffixes(), 0, height);
             else if (i == 1)
-                suffixes_ = new BitvectorSuffix(builder_->getSuffixType(), 0, suffix_len, builder_->getSuffixes(), num_suffix_bits_per_level, 0, height);
+                suffixes_ = new BitvectorSuffix(builder_->getSuffixType(), 0, suffix_len, builder_->getSuffixes(), 0, height);
             else
-                suffixes_ = new BitvectorSuffix(builder_->getSuffixType(), suffix_len, suffix_len, builder_->getSuffixes(), num_suffix_bits_per_level, 0, height);
+                suffixes_ = new BitvectorSuffix(builder_->getSuffixType(), suffix_len, suffix_len, builder_->getSuffixes(), 0, height);
 
 	    testSerialize();
 	    testCheckEquality();
@@ -1,9 +1,13 @@
 #include "gtest/gtest.h"
 
 #include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <fstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "config.hpp"
@@ -14,6 +18,8 @@ namespace surf {
 namespace surftest {
 
 static const std::string kFilePath = "../../../test/words.txt";
+static const std::string kBaselineImagePath = "../../../test/baseline_mixed.surf";
+static const unsigned kBaselineKeySkip = 64;
 static const int kWordTestSize = 234369;
 static const uint64_t kIntTestStart = 10;
 static const int kIntTestBound = 1000001;
@@ -38,12 +44,16 @@ public:
 
     void newSuRFWords(SuffixType suffix_type, level_t suffix_len);
     void newSuRFInts(SuffixType suffix_type, level_t suffix_len);
+    void newSuRFWordsAllSparse();
+    void newSuRFFruitsAllSparse();
+    void deleteSuRFWordsAllSparse();
     void truncateWordSuffixes();
     void fillinInts();
     void testSerialize();
     void testLookupWord(SuffixType suffix_type);
 
     SuRF* surf_;
+    SuRF* sparse_surf_;
     std::vector<std::string> words_trunc_;
     std::vector<std::string> ints_;
     char* data_;
@@ -102,6 +112,30 @@ void SuRFUnitTest::newSuRFInts(SuffixType suffix_type, level_t suffix_len) {
 	surf_ = new SuRF(ints_);
 }
 
+// surf_ gets the default layout and sparse_surf_ the all-sparse
+// layout (no louds-dense levels) of the same trie of words
+void SuRFUnitTest::newSuRFWordsAllSparse() {
+    surf_ = new SuRF(words, kIncludeDense, kSparseDenseRatio, kReal, 0, 8);
+    sparse_surf_ = new SuRF(words, false, kSparseDenseRatio, kReal, 0, 8);
+    ASSERT_EQ(0u, sparse_surf_->getSparseStartLevel());
+}
+
+void SuRFUnitTest::deleteSuRFWordsAllSparse() {
+    surf_->destroy();
+    delete surf_;
+    sparse_surf_->destroy();
+    delete sparse_surf_;
+}
+
+// sparse_surf_ holds apple, banana and cherry without louds-dense levels
+void SuRFUnitTest::newSuRFFruitsAllSparse() {
+    std::vector<std::string> fruits;
+    fruits.push_back("apple");
+    fruits.push_back("banana");
+    fruits.push_back("cherry");
+    sparse_surf_ = new SuRF(fruits, false, kSparseDenseRatio, kNone, 0, 0);
+}
+
 void SuRFUnitTest::truncateWordSuffixes() {
     assert(words.size() > 1);
     int commonPrefixLen = 0;
@@ -182,6 +216,477 @@ TEST_F (SuRFUnitTest, serializeTest) {
     }
 }
 
+TEST_F (SuRFUnitTest, loadViewTest) {
+    for (int t = 0; t < kNumSuffixType; t++) {
+	newSuRFWords(kSuffixTypeList[t], 8);
+	uint64_t size = surf_->serializedSize();
+	char* data = surf_->serialize();
+	// one extra word so that a misaligned copy still fits
+	uint64_t* buf = new uint64_t[size / 8 + 2];
+	char* image = reinterpret_cast<char*>(buf);
+	memcpy(image, data, size);
+	delete[] data;
+
+	SuRF view;
+	ASSERT_TRUE(view.loadView(image, size));
+	for (unsigned i = 0; i < words.size(); i++) {
+	    ASSERT_TRUE(view.lookupKey(words[i]));
+	    std::string key = words[i] + "A";
+	    ASSERT_EQ(surf_->lookupKey(key), view.lookupKey(key));
+	}
+	SuRF::Iter iter = view.moveToFirst();
+	for (unsigned i = 0; i < words.size(); i++) {
+	    ASSERT_TRUE(iter.isValid());
+	    iter++;
+	}
+	ASSERT_FALSE(iter.isValid());
+	view.destroy(); // must leave the image alone
+	ASSERT_TRUE(view.lookupKey(words[0]));
+
+	SuRF truncated;
+	ASSERT_FALSE(truncated.loadView(image, size - 8));
+	SuRF empty;
+	ASSERT_FALSE(empty.loadView(image, 0));
+	memmove(image + 1, image, size);
+	SuRF misaligned;
+	ASSERT_FALSE(misaligned.loadView(image + 1, size));
+
+	delete[] buf;
+	surf_->destroy();
+	delete surf_;
+    }
+}
+
+TEST_F (SuRFUnitTest, serialFormatTest) {
+    ASSERT_EQ((uint32_t)0xe3069283, crc32c("123456789", 9));
+
+    newSuRFWords(kMixed, 4);
+    uint64_t size = surf_->serializedSize();
+    data_ = surf_->serialize();
+
+    SectionTable table;
+    ASSERT_TRUE(table.load(data_, size));
+    ASSERT_EQ(kFormatVersion, table.getVersion());
+    ASSERT_TRUE(table.verifyAll());
+    const char* begin;
+    const char* end;
+    ASSERT_TRUE(table.find(kSectionSparseSuffixes, begin, end));
+    ASSERT_FALSE(table.find(kNumSections + 1, begin, end));
+
+    // a flipped bit in a section is caught by that section's checksum only
+    ASSERT_TRUE(table.find(kSectionSparseLabels, begin, end));
+    data_[begin - data_ + 8] ^= 0x10;
+    ASSERT_FALSE(table.verifySection(kSectionSparseLabels));
+    ASSERT_TRUE(table.verifySection(kSectionDenseLabelBitmaps));
+    SuRF corrupted;
+    ASSERT_FALSE(corrupted.loadView(data_, size, true));
+    data_[begin - data_ + 8] ^= 0x10;
+    SuRF verified;
+    ASSERT_TRUE(verified.loadView(data_, size, true));
+    for (unsigned i = 0; i < words.size(); i++)
+	ASSERT_TRUE(verified.lookupKey(words[i]));
+
+    // the header is always checked
+    FormatHeader header;
+    memcpy(&header, data_, sizeof(header));
+    header.version = kFormatVersion + 1;
+    memcpy(data_, &header, sizeof(header));
+    SuRF future;
+    ASSERT_FALSE(future.loadView(data_, size));
+    ASSERT_FALSE(table.load(data_, size));
+
+    surf_->destroy();
+    delete surf_;
+}
+
+TEST_F (SuRFUnitTest, deSerializeCorruptTest) {
+    newSuRFWords(kReal, 8);
+    uint64_t size = surf_->serializedSize();
+    data_ = surf_->serialize();
+    surf_->destroy();
+    delete surf_;
+    surf_ = nullptr;
+
+    ASSERT_TRUE(SuRF::deSerialize(data_, size - 8) == nullptr);
+    // every header byte is covered by the header checksum
+    for (uint64_t i = 0; i < sizeof(FormatHeader); i++) {
+	data_[i] ^= 0x01;
+	ASSERT_TRUE(SuRF::deSerialize(data_) == nullptr);
+	ASSERT_TRUE(SuRF::deSerialize(data_, size) == nullptr);
+	data_[i] ^= 0x01;
+    }
+    SuRF* surf = SuRF::deSerialize(data_);
+    ASSERT_TRUE(surf != nullptr);
+    for (unsigned i = 0; i < words.size(); i++)
+	ASSERT_TRUE(surf->lookupKey(words[i]));
+    delete surf;
+}
+
+// A flipped magic byte makes the image headerless, which loadView
+// rejects instead of reading it as a legacy image
+TEST_F (SuRFUnitTest, flipMagicByteTest) {
+    newSuRFWords(kReal, 8);
+    uint64_t size = surf_->serializedSize();
+    data_ = surf_->serialize();
+    for (uint64_t i = 0; i < sizeof(kFormatMagic); i++) {
+	data_[i] ^= 0x01;
+	for (int verify = 0; verify < 2; verify++) {
+	    SuRF view;
+	    ASSERT_FALSE(view.loadView(data_, size, verify));
+	}
+	ASSERT_TRUE(SuRF::deSerialize(data_) == nullptr);
+	ASSERT_TRUE(SuRF::deSerialize(data_, size) == nullptr);
+	data_[i] ^= 0x01;
+    }
+    SuRF view;
+    ASSERT_TRUE(view.loadView(data_, size, true));
+    surf_->destroy();
+    delete surf_;
+}
+
+// building straight into a sink gives the image of serialize()
+TEST_F (SuRFUnitTest, serializeToSinkTest) {
+    for (int t = 0; t < kNumSuffixType; t++) {
+	newSuRFWords(kSuffixTypeList[t], 8);
+	uint64_t size = surf_->serializedSize();
+	data_ = surf_->serialize();
+
+	SuffixType suffix_type = kSuffixTypeList[t];
+	SuRFBuilder builder(kIncludeDense, kSparseDenseRatio, suffix_type,
+			    (suffix_type == kHash || suffix_type == kMixed) ? 8 : 0,
+			    (suffix_type == kReal || suffix_type == kMixed) ? 8 : 0);
+	builder.build(words);
+	BufferSink sink;
+	ASSERT_EQ(size, SuRF::serialize(&builder, sink));
+	ASSERT_EQ(size, sink.getSize());
+	ASSERT_EQ(0, memcmp(data_, sink.data(), size));
+
+	SuRF view;
+	ASSERT_TRUE(view.loadView(sink.data(), size, true));
+	for (unsigned i = 0; i < words.size(); i++)
+	    ASSERT_TRUE(view.lookupKey(words[i]));
+
+	delete[] data_;
+	data_ = nullptr;
+	surf_->destroy();
+	delete surf_;
+    }
+}
+
+// buildSerialized takes every layout option of create
+TEST_F (SuRFUnitTest, buildSerializedOptionsTest) {
+    SuRF surf(words, kIncludeDense, kSparseDenseRatio, kMixed, 4, 4,
+	      4, kRankTwoLevel, 64, kSuffixHash64);
+    uint64_t size = surf.serializedSize();
+    data_ = surf.serialize();
+
+    BufferSink sink;
+    ASSERT_EQ(size, SuRF::buildSerialized(words, kIncludeDense, kSparseDenseRatio,
+					  kMixed, 4, 4, sink,
+					  4, kRankTwoLevel, 64, kSuffixHash64));
+    ASSERT_EQ(0, memcmp(data_, sink.data(), size));
+
+    SuRF view;
+    ASSERT_TRUE(view.loadView(sink.data(), size, true));
+    for (unsigned i = 0; i < words.size(); i++)
+	ASSERT_TRUE(view.lookupKey(words[i]));
+    delete[] data_;
+    data_ = nullptr;
+    surf.destroy();
+}
+
+TEST_F (SuRFUnitTest, serializeToFdTest) {
+    newSuRFWords(kMixed, 4);
+    uint64_t size = surf_->serializedSize();
+    data_ = surf_->serialize();
+
+    char path[] = "/tmp/surf_sink_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_TRUE(fd >= 0);
+    unlink(path);
+    // the image starts at the current offset of fd
+    const char kPrefix[8] = {'p', 'r', 'e', 'f', 'i', 'x', '0', '1'};
+    ASSERT_EQ((ssize_t)sizeof(kPrefix), write(fd, kPrefix, sizeof(kPrefix)));
+    {
+	FdSink sink(fd);
+	ASSERT_EQ(size, SuRF::buildSerialized(words, kIncludeDense, kSparseDenseRatio,
+					      kMixed, 4, 4, sink));
+    }
+    ASSERT_EQ((off_t)(sizeof(kPrefix) + size), lseek(fd, 0, SEEK_END));
+    std::vector<uint64_t> buf(size / 8 + 2);
+    char* image = reinterpret_cast<char*>(buf.data());
+    ASSERT_EQ((ssize_t)(sizeof(kPrefix) + size), pread(fd, image, sizeof(kPrefix) + size, 0));
+    ASSERT_EQ(0, memcmp(kPrefix, image, sizeof(kPrefix)));
+    ASSERT_EQ(0, memcmp(data_, image + sizeof(kPrefix), size));
+
+    // a sink that cannot seek back to the header fails
+    int pipe_fds[2];
+    ASSERT_EQ(0, pipe(pipe_fds));
+    close(pipe_fds[0]);
+    {
+	FdSink sink(pipe_fds[1]);
+	ASSERT_EQ(0u, SuRF::buildSerialized(words, kIncludeDense, kSparseDenseRatio,
+					    kMixed, 4, 4, sink));
+    }
+    close(pipe_fds[1]);
+    close(fd);
+    surf_->destroy();
+    delete surf_;
+}
+
+// a filter built with a hand-set model takes the builder's modeled
+// cheapest layout and finds every key
+TEST_F (SuRFUnitTest, cutoffCostModelFilterTest) {
+    CutoffCostModel model;
+    model.dense_level_ns = 10;
+    model.sparse_level_ns = 40;
+    model.sparse_label_ns = 1;
+    model.dense_miss_ns = 0;
+    model.sparse_miss_ns = 0;
+    SuRFBuilder builder(kIncludeDense, kSparseDenseRatio, kReal, 0, 8);
+    builder.setCutoffCostModel(model);
+    builder.build(words);
+    level_t start_level = builder.getSparseStartLevel();
+    for (level_t level = 1; level <= builder.getTreeHeight(); level++)
+	ASSERT_TRUE(builder.modeledLookupCost(start_level, model)
+		    <= builder.modeledLookupCost(level, model));
+    SuRF filter(&builder);
+    ASSERT_EQ(start_level, filter.getSparseStartLevel());
+    for (unsigned i = 0; i < words.size(); i++)
+	ASSERT_TRUE(filter.lookupKey(words[i]));
+    filter.destroy();
+}
+
+TEST_F (SuRFUnitTest, chooseSuffixesTest) {
+    static const int kNumBudgets = 4;
+    // the trie alone takes about 20 bits per word
+    static const double kBitsPerKey[kNumBudgets] = {10, 24, 30, 40};
+    uint64_t num_keys = words.size();
+    double prev_fpr = 1.0;
+    for (int b = 0; b < kNumBudgets; b++) {
+	SuffixBudget budget;
+	budget.bits_per_key = kBitsPerKey[b];
+	SuffixChoice choice = SuRF::chooseSuffixes(words, budget);
+	level_t len = choice.hash_suffix_len + choice.real_suffix_len;
+	if (b == 0) {
+	    ASSERT_EQ(kNone, choice.suffix_type);
+	    ASSERT_EQ(0u, len);
+	} else {
+	    ASSERT_TRUE(choice.predicted_bytes * 8 <= kBitsPerKey[b] * num_keys);
+	    ASSERT_TRUE(len > 0);
+	    ASSERT_TRUE(choice.hash_suffix_len > 0);
+	}
+	ASSERT_TRUE(choice.predicted_fpr <= prev_fpr);
+	prev_fpr = choice.predicted_fpr;
+
+	SuRF filter;
+	filter.create(words, choice);
+	ASSERT_EQ(choice.predicted_bytes, filter.serializedSize());
+	ASSERT_EQ(choice.sparse_start_level, filter.getSparseStartLevel());
+	for (unsigned i = 0; i < words.size(); i++)
+	    ASSERT_TRUE(filter.lookupKey(words[i]));
+	filter.destroy();
+    }
+
+    // without point queries only real suffix bits help
+    SuffixBudget budget;
+    budget.bits_per_key = 30;
+    budget.point_fraction = 0;
+    SuffixChoice choice = SuRF::chooseSuffixes(words, budget);
+    ASSERT_EQ(kReal, choice.suffix_type);
+    ASSERT_EQ(0u, choice.hash_suffix_len);
+    ASSERT_TRUE(choice.real_suffix_len > 0);
+    SuRF filter;
+    filter.create(words, choice);
+    ASSERT_EQ(choice.predicted_bytes, filter.serializedSize());
+    for (unsigned i = 0; i + 1 < words.size(); i++)
+	ASSERT_TRUE(filter.lookupRange(words[i], true, words[i + 1], false));
+    filter.destroy();
+}
+
+// the trie of a budgeted filter takes the layout of the given builder
+TEST_F (SuRFUnitTest, chooseSuffixesLayoutTest) {
+    static const int kNumLayouts = 3;
+    SuRFBuilder layouts[kNumLayouts] = {
+	SuRFBuilder(false, kSparseDenseRatio, kNone, 0, 0),
+	SuRFBuilder(kIncludeDense, kSparseDenseRatio, kNone, 0, 0, kRankTwoLevel, 16),
+	SuRFBuilder(kIncludeDense, kSparseDenseRatio, kNone, 0, 0)
+    };
+    layouts[2].setCutoffCostModel(CutoffCostModel());
+    for (int l = 0; l < kNumLayouts; l++) {
+	SuffixBudget budget;
+	budget.bits_per_key = 30;
+	SuffixChoice choice = SuRF::chooseSuffixes(words, budget, layouts[l], 2);
+	ASSERT_TRUE(choice.hash_suffix_len + choice.real_suffix_len > 0);
+
+	SuRF filter;
+	filter.create(words, choice, layouts[l], 2);
+	ASSERT_EQ(choice.predicted_bytes, filter.serializedSize());
+	ASSERT_TRUE(choice.predicted_bytes * 8 <= budget.bits_per_key * words.size());
+	ASSERT_EQ(choice.sparse_start_level, filter.getSparseStartLevel());
+	if (l == 0) {
+	    ASSERT_EQ(0u, filter.getSparseStartLevel());
+	}
+	for (unsigned i = 0; i < words.size(); i++)
+	    ASSERT_TRUE(filter.lookupKey(words[i]));
+	filter.destroy();
+    }
+}
+
+TEST_F (SuRFUnitTest, moveToHugePagesTest) {
+    static const int kNumOptions = 4;
+    HugePageOptions options[kNumOptions];
+    options[1].use_hugetlb = true;
+    options[2].numa_node = 0;
+    options[3].interleave = true;
+    for (int o = 0; o < kNumOptions; o++) {
+	SuRF filter(words, kIncludeDense, kSparseDenseRatio, kMixed, 4, 4);
+	uint64_t size = filter.serializedSize();
+	char* image = filter.serialize();
+	ASSERT_TRUE(filter.moveToHugePages(options[o]));
+
+	const HugePageRegion& region = filter.getHugePageRegion();
+	ASSERT_EQ(size, region.size());
+	ASSERT_EQ(0u, (uintptr_t)region.data() % HugePageRegion::kHugePageSize);
+	ASSERT_EQ(0, memcmp(image, region.data(), size));
+	char* moved_image = filter.serialize();
+	ASSERT_EQ(0, memcmp(image, moved_image, size));
+	delete[] moved_image;
+	delete[] image;
+
+	for (unsigned i = 0; i < words.size(); i++)
+	    ASSERT_TRUE(filter.lookupKey(words[i]));
+	SuRF::Iter iter = filter.moveToFirst();
+	for (unsigned i = 0; i < words.size(); i++) {
+	    ASSERT_TRUE(iter.isValid());
+	    iter++;
+	}
+	ASSERT_FALSE(iter.isValid());
+	filter.destroy();
+    }
+}
+
+// baseline_mixed.surf was written by SuRF::serialize() of the release
+// before the versioned format: SuRF(keys, kMixed, 4, 4) over every
+// kBaselineKeySkip-th word. Its select header is 12 bytes, so the
+// louds-sparse select arrays are misaligned in the image.
+TEST_F (SuRFUnitTest, loadBaselineImageTest) {
+    std::vector<std::string> keys;
+    for (unsigned i = 0; i < words.size(); i += kBaselineKeySkip)
+	keys.push_back(words[i]);
+    std::ifstream infile(kBaselineImagePath, std::ios::binary | std::ios::ate);
+    ASSERT_TRUE(infile.good());
+    uint64_t size = infile.tellg();
+    std::vector<uint64_t> buf(size / 8 + 1);
+    char* image = reinterpret_cast<char*>(buf.data());
+    infile.seekg(0);
+    infile.read(image, size);
+    ASSERT_TRUE(infile.good());
+
+    SuRF filter(keys, kMixed, 4, 4);
+    SuRF view;
+    // no header: only loaded on request
+    ASSERT_FALSE(view.loadView(image, size));
+    ASSERT_TRUE(view.loadLegacyView(image, size));
+    ASSERT_EQ(filter.getHeight(), view.getHeight());
+    ASSERT_EQ(filter.getSparseStartLevel(), view.getSparseStartLevel());
+    ASSERT_TRUE(view.getSparseStartLevel() > 0);
+    for (unsigned i = 0; i < words.size(); i++)
+	ASSERT_EQ(filter.lookupKey(words[i]), view.lookupKey(words[i]));
+    SuRF::Iter iter = view.moveToFirst();
+    for (unsigned i = 0; i < keys.size(); i++) {
+	ASSERT_TRUE(iter.isValid());
+	iter++;
+    }
+    ASSERT_FALSE(iter.isValid());
+    for (unsigned i = 0; i + 1 < keys.size(); i += 7)
+	ASSERT_TRUE(view.lookupRange(keys[i], true, keys[i + 1], false));
+    // the image is left as it was; only the copies are freed
+    view.destroy();
+
+    ASSERT_FALSE(view.loadLegacyView(image, size / 2));
+    view.destroy();
+
+    ASSERT_TRUE(SuRF::deSerialize(image, size) == nullptr);
+    ASSERT_TRUE(SuRF::deSerialize(image) == nullptr);
+    // read unbounded, as before
+    SuRF* surf = SuRF::deSerializeLegacy(image);
+    ASSERT_TRUE(surf != nullptr);
+    for (unsigned i = 0; i < keys.size(); i++)
+	ASSERT_TRUE(surf->lookupKey(keys[i]));
+    surf->destroy();
+    delete surf;
+
+    // images with a header are not legacy ones
+    char* data = filter.serialize();
+    ASSERT_FALSE(view.loadLegacyView(data, filter.serializedSize()));
+    ASSERT_TRUE(SuRF::deSerializeLegacy(data) == nullptr);
+    delete[] data;
+    filter.destroy();
+}
+
+TEST_F (SuRFUnitTest, rankTwoLevelTest) {
+    for (int t = 0; t < kNumSuffixType; t++) {
+	SuffixType suffix_type = kSuffixTypeList[t];
+	level_t hash_len = (suffix_type == kHash || suffix_type == kMixed) ? 4 : 0;
+	level_t real_len = (suffix_type == kReal || suffix_type == kMixed) ? 4 : 0;
+	surf_ = new SuRF(words, kIncludeDense, kSparseDenseRatio, suffix_type, hash_len, real_len,
+			 1, kRankTwoLevel);
+	SuRF* basic = new SuRF(words, kIncludeDense, kSparseDenseRatio, suffix_type,
+			       hash_len, real_len);
+	testSerialize();
+	testLookupWord(kSuffixTypeList[t]);
+	for (unsigned i = 0; i + 1 < words.size(); i += 7) {
+	    ASSERT_EQ(basic->lookupRange(words[i], false, words[i + 1], false),
+		      surf_->lookupRange(words[i], false, words[i + 1], false));
+	    ASSERT_EQ(basic->approxCount(words[i / 2], words[i]),
+		      surf_->approxCount(words[i / 2], words[i]));
+	}
+	basic->destroy();
+	delete basic;
+	surf_->destroy();
+	delete surf_;
+	delete[] data_;
+	data_ = nullptr;
+    }
+}
+
+// The hash type travels with the image: if it were lost, the lookups
+// after testSerialize would hash with LevelDB and miss stored keys.
+TEST_F (SuRFUnitTest, suffixHash64Test) {
+    std::vector<std::string> probes;
+    for (unsigned i = 0; i < words.size(); i++)
+	probes.push_back(words[i] + "A");
+    bool* results = new bool[probes.size()];
+    SuffixType suffix_types[2] = {kHash, kMixed};
+    level_t hash_lens[3] = {8, 40, 56};
+    for (int t = 0; t < 2; t++) {
+	for (int k = 0; k < 3; k++) {
+	    level_t real_len = (suffix_types[t] == kMixed) ? 8 : 0;
+	    surf_ = new SuRF(words, kIncludeDense, kSparseDenseRatio, suffix_types[t],
+			     hash_lens[k], real_len, 1, kRankBasic, kSelectSampleInterval,
+			     kSuffixHash64);
+	    testSerialize();
+	    testLookupWord(suffix_types[t]);
+	    surf_->lookupKeys(probes.data(), probes.size(), results);
+	    uint64_t num_fp = 0;
+	    for (unsigned i = 0; i < probes.size(); i++) {
+		ASSERT_EQ(surf_->lookupKey(probes[i]), results[i]);
+		if (results[i])
+		    num_fp++;
+	    }
+	    if (hash_lens[k] >= 40) {
+		ASSERT_EQ(0u, num_fp);
+	    }
+	    surf_->destroy();
+	    delete surf_;
+	    delete[] data_;
+	    data_ = nullptr;
+	}
+    }
+    delete[] results;
+}
+
 TEST_F (SuRFUnitTest, lookupIntTest) {
     for (int t = 0; t < kNumSuffixType; t++) {
 	for (int k = 0; k < kNumSuffixLen; k++) {
@@ -199,6 +704,101 @@ TEST_F (SuRFUnitTest, lookupIntTest) {
     }
 }
 
+TEST_F (SuRFUnitTest, lookupKeysTest) {
+    std::vector<std::string> keys;
+    for (unsigned i = 0; i < words.size(); i++) {
+	keys.push_back(words[i]);
+	std::string key = words[i];
+	key[key.length() - 1] = 'A';
+	keys.push_back(key);
+	keys.push_back(key.substr(0, key.length() / 2));
+    }
+    for (uint64_t i = 0; i < kIntTestBound; i += kIntTestSkip / 2)
+	keys.push_back(uint64ToString(i));
+
+    bool* results = new bool[keys.size()];
+    for (int t = 0; t < kNumSuffixType; t++) {
+	newSuRFWords(kSuffixTypeList[t], 8);
+	surf_->lookupKeys(keys.data(), keys.size(), results);
+	for (unsigned i = 0; i < keys.size(); i++)
+	    ASSERT_EQ(surf_->lookupKey(keys[i]), results[i]);
+	surf_->destroy();
+	delete surf_;
+
+	newSuRFInts(kSuffixTypeList[t], 8);
+	surf_->lookupKeys(keys.data(), keys.size(), results);
+	for (unsigned i = 0; i < keys.size(); i++)
+	    ASSERT_EQ(surf_->lookupKey(keys[i]), results[i]);
+	surf_->destroy();
+	delete surf_;
+    }
+
+    // without dense levels the walks start at the louds-sparse root
+    newSuRFFruitsAllSparse();
+    std::string fruit_probes[] = {"apple", "banana", "cherry", "zzz", "dog", "eel"};
+    bool fruit_results[6];
+    sparse_surf_->lookupKeys(fruit_probes, 6, fruit_results);
+    for (unsigned i = 0; i < 6; i++) {
+	ASSERT_EQ(i < 3, sparse_surf_->lookupKey(fruit_probes[i]));
+	ASSERT_EQ(i < 3, fruit_results[i]);
+    }
+    sparse_surf_->destroy();
+    delete sparse_surf_;
+
+    // an all-sparse filter answers like the default layout of the same trie
+    newSuRFWordsAllSparse();
+    sparse_surf_->lookupKeys(keys.data(), keys.size(), results);
+    for (unsigned i = 0; i < keys.size(); i++) {
+	ASSERT_EQ(surf_->lookupKey(keys[i]), sparse_surf_->lookupKey(keys[i]));
+	ASSERT_EQ(surf_->lookupKey(keys[i]), results[i]);
+    }
+    deleteSuRFWordsAllSparse();
+    delete[] results;
+}
+
+// Slices into one buffer holding the probes back to back (so no slice
+// is followed by a terminating 0) must answer like the strings
+TEST_F (SuRFUnitTest, lookupSliceTest) {
+    std::vector<std::string> keys;
+    for (unsigned i = 0; i < words.size(); i += 3) {
+	keys.push_back(words[i]);
+	keys.push_back(words[i].substr(0, words[i].length() / 2));
+	keys.push_back(words[i] + "A");
+    }
+    std::string buffer;
+    for (unsigned i = 0; i < keys.size(); i++)
+	buffer += keys[i];
+    std::vector<Slice> slices;
+    size_t offset = 0;
+    for (unsigned i = 0; i < keys.size(); i++) {
+	slices.push_back(Slice(buffer.data() + offset, keys[i].length()));
+	offset += keys[i].length();
+    }
+
+    bool* results = new bool[keys.size()];
+    for (int t = 0; t < kNumSuffixType; t++) {
+	newSuRFWords(kSuffixTypeList[t], 8);
+	surf_->lookupKeys(slices.data(), slices.size(), results);
+	for (unsigned i = 0; i < keys.size(); i++) {
+	    ASSERT_EQ(surf_->lookupKey(keys[i]), surf_->lookupKey(slices[i]));
+	    ASSERT_EQ(surf_->lookupKey(keys[i]), results[i]);
+	    SuRF::Iter iter = surf_->moveToKeyGreaterThan(slices[i], true);
+	    SuRF::Iter iter_str = surf_->moveToKeyGreaterThan(keys[i], true);
+	    ASSERT_EQ(iter_str.isValid(), iter.isValid());
+	    if (iter.isValid()) {
+		ASSERT_EQ(iter_str.getKey(), iter.getKey());
+	    }
+	}
+	for (unsigned i = 0; i + 1 < keys.size(); i++) {
+	    ASSERT_EQ(surf_->lookupRange(keys[i], true, keys[i + 1], false),
+		      surf_->lookupRange(slices[i], true, slices[i + 1], false));
+	}
+	surf_->destroy();
+	delete surf_;
+    }
+    delete[] results;
+}
+
 TEST_F (SuRFUnitTest, moveToKeyGreaterThanWordTest) {
     for (int t = 2; t < kNumSuffixType; t++) {
 	for (int k = 0; k < kNumSuffixLen; k++) {
@@ -335,6 +935,21 @@ TEST_F (SuRFUnitTest, moveToKeyGreaterThanIntTest) {
     }
 }
 
+TEST_F (SuRFUnitTest, moveToKeyGreaterThanPastTerminatorTest) {
+    std::vector<std::string> keys;
+    keys.push_back(std::string("abc"));
+    keys.push_back(std::string("abcd"));
+    keys.push_back(std::string("abce"));
+    keys.push_back(std::string("abz"));
+    surf_ = new SuRF(keys, false, 16, kNone, 0, 0);
+    // node "abc" holds a terminator; no label in it is greater than 'f'
+    SuRF::Iter iter = surf_->moveToKeyGreaterThan(std::string("abcf"), true);
+    ASSERT_TRUE(iter.isValid());
+    ASSERT_EQ(std::string("abz"), iter.getKey());
+    surf_->destroy();
+    delete surf_;
+}
+
 TEST_F (SuRFUnitTest, moveToKeyLessThanWordTest) {
     for (int k = 0; k < kNumSuffixLen; k++) {
 	newSuRFWords(kMixed, kSuffixLenList[k]);
@@ -538,6 +1153,153 @@ TEST_F (SuRFUnitTest, lookupRangeWordTest) {
     }
 }
 
+// Bounds cut from stored words, so the probes end inside the trie and
+// most of them are decided on the bounds' common prefix. The result
+// must match positioning an iterator and comparing its key, and a
+// stored word in the range must always be found.
+TEST_F (SuRFUnitTest, lookupRangePrefixBoundTest) {
+    for (int t = 0; t < kNumSuffixType; t++) {
+	newSuRFWords(kSuffixTypeList[t], 8);
+	for (unsigned i = 0; i + 4 < words.size(); i += 7) {
+	    if (words[i].empty() || words[i + 1 + i % 3].empty())
+		continue;
+	    std::string left_key = words[i].substr(0, 1 + i % words[i].length());
+	    const std::string& right_key = words[i + 1 + i % 3];
+	    bool exist = surf_->lookupRange(left_key, true, right_key, true);
+	    ASSERT_TRUE(exist);
+	    std::string right_short = right_key.substr(0, 1 + i % right_key.length());
+	    exist = surf_->lookupRange(left_key, false, right_short, false);
+	    SuRF::Iter iter = surf_->moveToKeyGreaterThan(left_key, false);
+	    bool iter_exist = false;
+	    if (iter.isValid()) {
+		int compare = iter.compare(right_short);
+		iter_exist = (compare == kCouldBePositive) || (compare < 0);
+	    }
+	    ASSERT_EQ(iter_exist, exist);
+	}
+	surf_->destroy();
+	delete surf_;
+    }
+}
+
+TEST_F (SuRFUnitTest, lookupPrefixTest) {
+    uint64_t num_fp[kNumSuffixType] = {0};
+    for (int t = 0; t < kNumSuffixType; t++) {
+	newSuRFWords(kSuffixTypeList[t], 8);
+	ASSERT_TRUE(surf_->lookupPrefix(std::string()));
+	for (unsigned i = 0; i < words.size(); i += 3) {
+	    for (unsigned len = 1; len <= words[i].length(); len++)
+		ASSERT_TRUE(surf_->lookupPrefix(words[i].substr(0, len)));
+	}
+	// prefixes that branch off the stored keys
+	for (unsigned i = 0; i < words.size(); i += 5) {
+	    if (words[i].empty())
+		continue;
+	    std::string prefix = words[i].substr(0, 1 + i % words[i].length());
+	    prefix[prefix.length() - 1] += (char)(1 + i % 7);
+	    std::vector<std::string>::const_iterator it
+		= std::lower_bound(words.begin(), words.end(), prefix);
+	    bool exist = (it != words.end()) && (it->compare(0, prefix.length(), prefix) == 0);
+	    bool found = surf_->lookupPrefix(prefix);
+	    if (exist) {
+		ASSERT_TRUE(found);
+	    } else if (found) {
+		num_fp[t]++;
+	    }
+	}
+	surf_->destroy();
+	delete surf_;
+    }
+    // real suffix bits only rule out more prefixes
+    ASSERT_EQ(num_fp[0], num_fp[1]);
+    ASSERT_TRUE(num_fp[2] < num_fp[0]);
+    ASSERT_TRUE(num_fp[3] <= num_fp[0]);
+
+    // without dense levels the walk starts at the louds-sparse root
+    newSuRFFruitsAllSparse();
+    ASSERT_TRUE(sparse_surf_->lookupPrefix(std::string("ban")));
+    ASSERT_TRUE(sparse_surf_->lookupPrefix(std::string("c")));
+    ASSERT_FALSE(sparse_surf_->lookupPrefix(std::string("d")));
+    ASSERT_FALSE(sparse_surf_->lookupPrefix(std::string("zzz")));
+    sparse_surf_->destroy();
+    delete sparse_surf_;
+
+    // an all-sparse filter answers like the default layout of the same trie
+    newSuRFWordsAllSparse();
+    for (unsigned i = 0; i < words.size(); i += 5) {
+	if (words[i].empty())
+	    continue;
+	std::string prefix = words[i].substr(0, 1 + i % words[i].length());
+	ASSERT_TRUE(sparse_surf_->lookupPrefix(prefix));
+	prefix[prefix.length() - 1] += (char)(1 + i % 7);
+	ASSERT_EQ(surf_->lookupPrefix(prefix), sparse_surf_->lookupPrefix(prefix));
+    }
+    deleteSuRFWordsAllSparse();
+}
+
+// Without dense levels the iterators start at the louds-sparse root:
+// scans and counts match the default layout of the same trie, and
+// seeks and ranges answer like a filter of the words
+TEST_F (SuRFUnitTest, allSparseIterTest) {
+    newSuRFWordsAllSparse();
+    const SuRF& dense = *surf_;
+    const SuRF& sparse = *sparse_surf_;
+
+    SuRF::Iter dense_iter = dense.moveToFirst();
+    SuRF::Iter sparse_iter = sparse.moveToFirst();
+    unsigned num_keys = 0;
+    while (dense_iter.isValid()) {
+	ASSERT_TRUE(sparse_iter.isValid());
+	ASSERT_EQ(dense_iter.getKey(), sparse_iter.getKey());
+	dense_iter++;
+	sparse_iter++;
+	num_keys++;
+    }
+    ASSERT_FALSE(sparse_iter.isValid());
+    ASSERT_EQ(words.size(), num_keys);
+    dense_iter = dense.moveToLast();
+    sparse_iter = sparse.moveToLast();
+    while (dense_iter.isValid()) {
+	ASSERT_TRUE(sparse_iter.isValid());
+	ASSERT_EQ(dense_iter.getKey(), sparse_iter.getKey());
+	dense_iter--;
+	sparse_iter--;
+    }
+    ASSERT_FALSE(sparse_iter.isValid());
+
+    for (unsigned i = 0; i + 1 < words.size(); i += 7) {
+	std::string key = words[i];
+	key[key.length() - 1] += 1;
+	// the iterators stop on the trie prefix of the neighbouring word,
+	// or, if it could be a false positive, on the one of the other word
+	std::vector<std::string>::const_iterator next
+	    = std::lower_bound(words.begin(), words.end(), key);
+	ASSERT_TRUE((next != words.begin()) && (next != words.end()));
+	sparse_iter = sparse.moveToKeyGreaterThan(key, true);
+	ASSERT_TRUE(sparse_iter.isValid());
+	std::string prefix = sparse_iter.getKey();
+	bool is_next = (next->compare(0, prefix.length(), prefix) == 0);
+	bool is_prev = ((next - 1)->compare(0, prefix.length(), prefix) == 0);
+	ASSERT_TRUE(is_next || (sparse_iter.getFpFlag() && is_prev));
+	sparse_iter = sparse.moveToKeyLessThan(key, false);
+	ASSERT_TRUE(sparse_iter.isValid());
+	prefix = sparse_iter.getKey();
+	is_next = (next->compare(0, prefix.length(), prefix) == 0);
+	is_prev = ((next - 1)->compare(0, prefix.length(), prefix) == 0);
+	ASSERT_TRUE(is_prev || (sparse_iter.getFpFlag() && is_next));
+	ASSERT_TRUE(sparse.lookupRange(words[i], true, words[i + 1], false));
+	if (*next < words[i + 1]) {
+	    ASSERT_TRUE(sparse.lookupRange(key, true, words[i + 1], false));
+	}
+	ASSERT_EQ(dense.approxCount(words[i / 2], key), sparse.approxCount(words[i / 2], key));
+    }
+    std::string past_last = "~"; // after every first byte of the words
+    ASSERT_FALSE(sparse.lookupRange(past_last, true, past_last + "z", true));
+    ASSERT_FALSE(sparse.moveToKeyGreaterThan(past_last, true).isValid());
+    ASSERT_EQ(dense.approxCount(words[0], past_last), sparse.approxCount(words[0], past_last));
+    deleteSuRFWordsAllSparse();
+}
+
 TEST_F (SuRFUnitTest, lookupRangeIntTest) {
     for (int k = 0; k < kNumSuffixLen; k++) {
 	newSuRFInts(kMixed, kSuffixLenList[k]);
@@ -567,6 +1329,133 @@ TEST_F (SuRFUnitTest, lookupRangeIntTest) {
 }
 
 
+TEST_F (SuRFUnitTest, lookupRangesTest) {
+    std::vector<std::string> left_keys;
+    for (unsigned i = 0; i < words.size(); i++) {
+	left_keys.push_back(words[i]);
+	std::string key = words[i];
+	key[key.length() - 1] = 'A';
+	left_keys.push_back(key);
+	if (key.length() > 1)
+	    left_keys.push_back(key.substr(0, key.length() / 2));
+    }
+    for (uint64_t i = 0; i < kIntTestBound; i += kIntTestSkip / 2)
+	left_keys.push_back(uint64ToString(i));
+    std::sort(left_keys.begin(), left_keys.end());
+    std::vector<std::string> right_keys;
+    for (unsigned i = 0; i < left_keys.size(); i++) {
+	std::string key = left_keys[i];
+	key[key.length() - 1]++;
+	right_keys.push_back(key);
+    }
+
+    bool* results = new bool[left_keys.size()];
+    for (int t = 0; t < kNumSuffixType; t++) {
+	for (int f = 0; f < 2; f++) {
+	    if (f == 0)
+		newSuRFWords(kSuffixTypeList[t], 8);
+	    else
+		newSuRFInts(kSuffixTypeList[t], 8);
+	    for (int inclusive = 0; inclusive < 4; inclusive++) {
+		bool left_inclusive = (inclusive & 1);
+		bool right_inclusive = (inclusive & 2);
+		surf_->lookupRanges(left_keys.data(), left_inclusive,
+				    right_keys.data(), right_inclusive,
+				    left_keys.size(), results);
+		for (unsigned i = 0; i < left_keys.size(); i++)
+		    ASSERT_EQ(surf_->lookupRange(left_keys[i], left_inclusive,
+						 right_keys[i], right_inclusive), results[i]);
+	    }
+	    // correct in any order, only slower
+	    std::vector<std::string> reversed_left(left_keys.rbegin(), left_keys.rend());
+	    std::vector<std::string> reversed_right(right_keys.rbegin(), right_keys.rend());
+	    surf_->lookupRanges(reversed_left.data(), true, reversed_right.data(), false,
+				reversed_left.size(), results);
+	    for (unsigned i = 0; i < reversed_left.size(); i++)
+		ASSERT_EQ(surf_->lookupRange(reversed_left[i], true, reversed_right[i], false),
+			  results[i]);
+	    surf_->destroy();
+	    delete surf_;
+	}
+    }
+    delete[] results;
+}
+
+
+TEST_F (SuRFUnitTest, approxCountTest) {
+    static const int kNumPairs = 2000;
+    for (int t = 0; t < kNumSuffixType; t++) {
+	newSuRFWords(kSuffixTypeList[t], 8);
+	srand(t);
+	for (int p = 0; p < kNumPairs; p++) {
+	    int i = rand() % words.size();
+	    int j = rand() % words.size();
+	    if (i > j)
+		std::swap(i, j);
+	    ASSERT_EQ((uint64_t)(j - i), surf_->approxCount(words[i], words[j]));
+	    if (i < j) {
+		ASSERT_EQ((uint64_t)0, surf_->approxCount(words[j], words[i]));
+	    }
+	}
+	ASSERT_EQ((uint64_t)(words.size() - 1), surf_->approxCount(words[0], words.back()));
+	surf_->destroy();
+	delete surf_;
+
+	newSuRFInts(kSuffixTypeList[t], 8);
+	for (int p = 0; p < kNumPairs; p++) {
+	    uint64_t i = rand() % kIntTestBound;
+	    uint64_t j = rand() % kIntTestBound;
+	    if (i > j)
+		std::swap(i, j);
+	    uint64_t count = surf_->approxCount(uint64ToString(i), uint64ToString(j));
+	    uint64_t expected = (j + kIntTestSkip - 1) / kIntTestSkip
+		- (i + kIntTestSkip - 1) / kIntTestSkip;
+	    if ((i % kIntTestSkip == 0) && (j % kIntTestSkip == 0)) {
+		ASSERT_EQ(expected, count);
+	    } else {
+		ASSERT_LE(count, expected + 1);
+	    }
+	}
+	uint64_t num_ints = (kIntTestBound + kIntTestSkip - 1) / kIntTestSkip;
+	ASSERT_EQ(num_ints, surf_->approxCount(uint64ToString(0), uint64ToString(kIntTestBound)));
+	surf_->destroy();
+	delete surf_;
+    }
+}
+
+TEST_F (SuRFUnitTest, lookupRangeSharedAcrossThreadsTest) {
+    static const int kNumThreads = 4;
+    newSuRFInts(kMixed, 8);
+    const SuRF* filter = surf_;
+    std::vector<std::vector<bool> > results(kNumThreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kNumThreads; t++) {
+	threads.push_back(std::thread([filter, t, &results] {
+		    SuRF::Iter scratch(filter);
+		    for (uint64_t i = t; i < kIntTestBound; i += kNumThreads) {
+			std::string left_key = uint64ToString(i);
+			std::string right_key = uint64ToString(i + kIntTestSkip / 2);
+			results[t].push_back(filter->lookupRange(left_key, true,
+								 right_key, false, scratch));
+		    }
+		}));
+    }
+    for (int t = 0; t < kNumThreads; t++)
+	threads[t].join();
+
+    for (int t = 0; t < kNumThreads; t++) {
+	position_t idx = 0;
+	for (uint64_t i = t; i < kIntTestBound; i += kNumThreads) {
+	    bool exist = surf_->lookupRange(uint64ToString(i), true,
+					    uint64ToString(i + kIntTestSkip / 2), false);
+	    ASSERT_EQ(exist, results[t][idx]);
+	    idx++;
+	}
+    }
+    surf_->destroy();
+    delete surf_;
+}
+
 void loadWordList() {
     std::ifstream infile(kFilePath);
     std::string key;
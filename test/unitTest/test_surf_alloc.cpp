@@ -0,0 +1,121 @@
+#include "gtest/gtest.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "config.hpp"
+#include "surf.hpp"
+
+// Counts the heap allocations of the calling thread, and their bytes.
+// The replacement is global, so it lives in this binary alone.
+static thread_local uint64_t num_allocs = 0;
+static thread_local uint64_t num_alloc_bytes = 0;
+
+void* operator new(size_t size) {
+    num_allocs++;
+    num_alloc_bytes += size;
+    void* ptr = malloc(size);
+    if (ptr == nullptr)
+	throw std::bad_alloc();
+    return ptr;
+}
+
+// gcc pairs the inlined free() with the new-expressions it came from
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+#pragma GCC diagnostic pop
+
+namespace surf {
+
+namespace surfalloctest {
+
+static const int kIntTestBound = 1000001;
+static const uint64_t kIntTestSkip = 10;
+
+class SuRFAllocUnitTest : public ::testing::Test {
+public:
+    virtual void SetUp () {
+	for (uint64_t i = 0; i < kIntTestBound; i += kIntTestSkip)
+	    ints_.push_back(uint64ToString(i));
+	surf_ = new SuRF(ints_, kMixed, 8, 8);
+    }
+    virtual void TearDown () {
+	surf_->destroy();
+	delete surf_;
+    }
+
+    SuRF* surf_;
+    std::vector<std::string> ints_;
+};
+
+// Seeks, increments and compares of an iterator must not allocate
+// while the trie fits in the iterator's inline path
+TEST_F (SuRFAllocUnitTest, iteratorNoAllocationTest) {
+    ASSERT_TRUE(surf_->getHeight() <= InlineVector<label_t>::kInlineSize);
+    std::vector<std::string> probes;
+    for (uint64_t i = 0; i < kIntTestBound; i += kIntTestSkip * 7 + 3)
+	probes.push_back(uint64ToString(i));
+    char key_buf[InlineVector<label_t>::kInlineSize];
+    SuRF::Iter scratch(surf_);
+    uint64_t checksum = 0;
+    uint64_t start_num_allocs = num_allocs;
+    for (unsigned i = 0; i + 1 < probes.size(); i++) {
+	SuRF::Iter iter = surf_->moveToKeyGreaterThan(Slice(probes[i]), true);
+	if (iter.isValid()) {
+	    checksum += iter.compare(Slice(probes[i + 1]));
+	    iter++;
+	    iter--;
+	    checksum += iter.getKey(key_buf);
+	}
+	checksum += surf_->lookupRange(Slice(probes[i]), true, Slice(probes[i + 1]), false,
+				       scratch);
+    }
+    ASSERT_EQ(start_num_allocs, num_allocs);
+    ASSERT_TRUE(checksum > 0);
+
+    SuRF::Iter iter = surf_->moveToFirst();
+    for (uint64_t i = 0; i < ints_.size(); i++) {
+	size_t len = iter.getKey(key_buf);
+	ASSERT_EQ(iter.getKey(), std::string(key_buf, len));
+	iter++;
+    }
+}
+
+// LoudsSparse takes the arrays of a counted build over; it only
+// allocates its look-up tables, whereas copying the labels alone
+// would take a byte per item
+TEST_F (SuRFAllocUnitTest, sparseTakesBuilderArraysTest) {
+    bool include_dense[2] = {false, true};
+    for (int d = 0; d < 2; d++) {
+	// with dense levels, the sparse arrays start past them
+	SuRFBuilder builder(include_dense[d], kSparseDenseRatio, kReal, 0, 8);
+	builder.setSparseStartLevel(3);
+	builder.build(ints_);
+	ASSERT_EQ(include_dense[d] ? 3 : 0, builder.getSparseStartLevel());
+	position_t num_items = 0;
+	for (level_t level = builder.getSparseStartLevel(); level < builder.getTreeHeight(); level++)
+	    num_items += builder.getLabels().size(level);
+	LoudsDense louds_dense(&builder, true);
+	uint64_t start_num_alloc_bytes = num_alloc_bytes;
+	LoudsSparse louds_sparse(&builder, true);
+	ASSERT_TRUE(num_alloc_bytes - start_num_alloc_bytes < num_items / 2);
+	ASSERT_EQ(0, builder.getTreeHeight());
+	louds_dense.destroy();
+	louds_sparse.destroy();
+    }
+}
+
+} // namespace surfalloctest
+
+} // namespace surf
+
+int main (int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
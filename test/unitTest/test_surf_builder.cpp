@@ -16,6 +16,11 @@ namespace buildertest {
 static const std::string kFilePath = "../../../test/words.txt";
 static const int kTestSize = 234369;
 static const int kIntTestSize = 1000000;
+// suffix configurations that whole-build comparisons run through
+static const int kNumSuffixConfigs = 4;
+static const SuffixType kSuffixTypes[kNumSuffixConfigs] = {kNone, kHash, kReal, kMixed};
+static const level_t kHashSuffixLens[kNumSuffixConfigs] = {0, 4, 0, 3};
+static const level_t kRealSuffixLens[kNumSuffixConfigs] = {0, 0, 7, 5};
 static std::vector<std::string> words;
 static std::vector<std::string> words_dup;
 
@@ -103,7 +108,7 @@ void SuRFBuilderUnitTest::printDenseNode(level_t level, position_t node_num) {
     // print labels
     printIndent(level);
     for (position_t i = 0; i < kFanout; i++) {
-	if (SuRFBuilder::readBit(builder_->getBitmapLabels()[level], node_num * kFanout + i)) {
+	if (builder_->getBitmapLabels().readBit(level, node_num * kFanout + i)) {
 	    if ((i >= 65 && i <= 90) || (i >= 97 && i <= 122))
 		std::cout << (char)i << " ";
 	    else
@@ -115,8 +120,8 @@ void SuRFBuilderUnitTest::printDenseNode(level_t level, position_t node_num) {
     // print child indicator bitmap
     printIndent(level);
     for (position_t i = 0; i < kFanout; i++) {
-	if (SuRFBuilder::readBit(builder_->getBitmapLabels()[level], node_num * kFanout + i)) {
-	    if (SuRFBuilder::readBit(builder_->getBitmapChildIndicatorBits()[level], node_num * kFanout + i))
+	if (builder_->getBitmapLabels().readBit(level, node_num * kFanout + i)) {
+	    if (builder_->getBitmapChildIndicatorBits().readBit(level, node_num * kFanout + i))
 		std::cout << "1 ";
 	    else
 		std::cout << "0 ";
@@ -126,7 +131,7 @@ void SuRFBuilderUnitTest::printDenseNode(level_t level, position_t node_num) {
 
     // print prefixkey indicator
     printIndent(level);
-    if (SuRFBuilder::readBit(builder_->getPrefixkeyIndicatorBits()[level], node_num))
+    if (builder_->getPrefixkeyIndicatorBits().readBit(level, node_num))
 	std::cout << "1 ";
     else
 	std::cout << "0 ";
@@ -142,14 +147,14 @@ void SuRFBuilderUnitTest::printSparseNode(level_t level, position_t pos) {
     // print labels
     printIndent(level);
     bool is_end_of_node = false;
-    while (!is_end_of_node && pos < builder_->getLabels()[level].size()) {
-	label_t label = builder_->getLabels()[level][pos];
+    while (!is_end_of_node && pos < builder_->getLabels().size(level)) {
+	label_t label = builder_->getLabels().read(level, pos);
 	if ((label >= 65 && label <= 90) || (label >= 97 && label <= 122))
 	    std::cout << (char)label << " ";
 	else
 	    std::cout << (int16_t)label << " ";
 	pos++;
-	is_end_of_node = SuRFBuilder::readBit(builder_->getLoudsBits()[level], pos);
+	is_end_of_node = builder_->getLoudsBits().readBit(level, pos);
     }
     std::cout << "\n";
 
@@ -157,14 +162,14 @@ void SuRFBuilderUnitTest::printSparseNode(level_t level, position_t pos) {
     printIndent(level);
     is_end_of_node = false;
     pos = start_pos;
-    while (!is_end_of_node && pos < builder_->getLabels()[level].size()) {
-	bool has_child = SuRFBuilder::readBit(builder_->getChildIndicatorBits()[level], pos);
+    while (!is_end_of_node && pos < builder_->getLabels().size(level)) {
+	bool has_child = builder_->getChildIndicatorBits().readBit(level, pos);
 	if (has_child)
 	    std::cout << "1 ";
 	else
 	    std::cout << "0 ";
 	pos++;
-	is_end_of_node = SuRFBuilder::readBit(builder_->getLoudsBits()[level], pos);
+	is_end_of_node = builder_->getLoudsBits().readBit(level, pos);
     }
     std::cout << "\n";
 
@@ -172,14 +177,14 @@ void SuRFBuilderUnitTest::printSparseNode(level_t level, position_t pos) {
     printIndent(level);
     is_end_of_node = false;
     pos = start_pos;
-    while (!is_end_of_node && pos < builder_->getLabels()[level].size()) {
-	bool louds_bit = SuRFBuilder::readBit(builder_->getLoudsBits()[level], pos);
+    while (!is_end_of_node && pos < builder_->getLabels().size(level)) {
+	bool louds_bit = builder_->getLoudsBits().readBit(level, pos);
 	if (louds_bit)
 	    std::cout << "1 ";
 	else
 	    std::cout << "0 ";
 	pos++;
-	is_end_of_node = SuRFBuilder::readBit(builder_->getLoudsBits()[level], pos);
+	is_end_of_node = builder_->getLoudsBits().readBit(level, pos);
     }
     std::cout << "\n";
 }
@@ -209,18 +214,18 @@ void SuRFBuilderUnitTest::testSparse(const std::vector<std::string> &keys,
 
 	    // label test
 	    label_t label = (label_t)keys_trunc[i][level];
-	    bool exist_in_node = (builder_->getLabels()[level][pos] == label);
+	    bool exist_in_node = (builder_->getLabels().read(level, pos) == label);
 	    ASSERT_TRUE(exist_in_node);
 
 	    // child indicator test
-	    bool has_child = SuRFBuilder::readBit(builder_->getChildIndicatorBits()[level], pos);
+	    bool has_child = builder_->getChildIndicatorBits().readBit(level, pos);
 	    bool same_prefix_in_prev_key = DoesPrefixMatchInTrunc(keys_trunc, i-1, i, level+1);
 	    bool same_prefix_in_next_key = DoesPrefixMatchInTrunc(keys_trunc, i, i+1, level+1);
 	    bool expected_has_child = same_prefix_in_prev_key || same_prefix_in_next_key;
 	    ASSERT_EQ(expected_has_child, has_child);
 
 	    // LOUDS bit test
-	    bool louds_bit = SuRFBuilder::readBit(builder_->getLoudsBits()[level], pos);
+	    bool louds_bit = builder_->getLoudsBits().readBit(level, pos);
 	    bool expected_louds_bit = !DoesPrefixMatchInTrunc(keys_trunc, i-1, i, level);
 	    if (pos == 0)
 		ASSERT_TRUE(louds_bit);
@@ -239,13 +244,13 @@ void SuRFBuilderUnitTest::testSparse(const std::vector<std::string> &keys,
 			bool expected_suffix_bit = false;
 			if (level + 1 + byte_id < keys[i].size())
 			    expected_suffix_bit = (bool)(keys[i][level + 1 + byte_id] & byte_mask);
-			bool stored_suffix_bit = SuRFBuilder::readBit(builder_->getSuffixes()[level], suffix_bitpos);
+			bool stored_suffix_bit = builder_->getSuffixes().readBit(level, suffix_bitpos);
 			ASSERT_EQ(expected_suffix_bit, stored_suffix_bit);
 			suffix_bitpos++;
 		    }
 		} else {
 		    for (position_t bitpos = 0; bitpos < suffix_len; bitpos++) {
-			bool stored_suffix_bit = SuRFBuilder::readBit(builder_->getSuffixes()[level], suffix_bitpos);
+			bool stored_suffix_bit = builder_->getSuffixes().readBit(level, suffix_bitpos);
 			ASSERT_FALSE(stored_suffix_bit);
 			suffix_bitpos++;
 		    }
@@ -260,19 +265,19 @@ void SuRFBuilderUnitTest::testDense() {
 	int node_num = -1;
 
 	label_t prev_label = 0;
-	for (unsigned i = 0; i < builder_->getLabels()[level].size(); i++) {
-	    bool is_node_start = SuRFBuilder::readBit(builder_->getLoudsBits()[level], i);
+	for (unsigned i = 0; i < builder_->getLabels().size(level); i++) {
+	    bool is_node_start = builder_->getLoudsBits().readBit(level, i);
 	    if (is_node_start) 
 		node_num++;
 
-	    label_t label = builder_->getLabels()[level][i];
-	    bool exist_in_node = SuRFBuilder::readBit(builder_->getBitmapLabels()[level], node_num * kFanout + label);
-	    bool has_child_sparse = SuRFBuilder::readBit(builder_->getChildIndicatorBits()[level], i);
-	    bool has_child_dense = SuRFBuilder::readBit(builder_->getBitmapChildIndicatorBits()[level], node_num * kFanout + label);
+	    label_t label = builder_->getLabels().read(level, i);
+	    bool exist_in_node = builder_->getBitmapLabels().readBit(level, node_num * kFanout + label);
+	    bool has_child_sparse = builder_->getChildIndicatorBits().readBit(level, i);
+	    bool has_child_dense = builder_->getBitmapChildIndicatorBits().readBit(level, node_num * kFanout + label);
 
 	    // prefixkey indicator test
 	    if (is_node_start) {
-		bool prefixkey_indicator = SuRFBuilder::readBit(builder_->getPrefixkeyIndicatorBits()[level], node_num);
+		bool prefixkey_indicator = builder_->getPrefixkeyIndicatorBits().readBit(level, node_num);
 		if ((label == kTerminator) && !has_child_sparse)
 		    ASSERT_TRUE(prefixkey_indicator);
 		else
@@ -291,23 +296,23 @@ void SuRFBuilderUnitTest::testDense() {
 	    if (is_node_start) {
 		if (node_num > 0) {
 		    for (unsigned c = prev_label + 1; c < kFanout; c++) {
-			exist_in_node = SuRFBuilder::readBit(builder_->getBitmapLabels()[level], (node_num - 1) * kFanout + c);
+			exist_in_node = builder_->getBitmapLabels().readBit(level, (node_num - 1) * kFanout + c);
 			ASSERT_FALSE(exist_in_node);
-			has_child_dense = SuRFBuilder::readBit(builder_->getBitmapChildIndicatorBits()[level], (node_num - 1) * kFanout + c);
+			has_child_dense = builder_->getBitmapChildIndicatorBits().readBit(level, (node_num - 1) * kFanout + c);
 			ASSERT_FALSE(has_child_dense);
 		    }
 		}
 		for (unsigned c = 0; c < (unsigned)label; c++) {
-		    exist_in_node = SuRFBuilder::readBit(builder_->getBitmapLabels()[level], node_num * kFanout + c);
+		    exist_in_node = builder_->getBitmapLabels().readBit(level, node_num * kFanout + c);
 		    ASSERT_FALSE(exist_in_node);
-		    has_child_dense = SuRFBuilder::readBit(builder_->getBitmapChildIndicatorBits()[level], node_num * kFanout + c);
+		    has_child_dense = builder_->getBitmapChildIndicatorBits().readBit(level, node_num * kFanout + c);
 		    ASSERT_FALSE(has_child_dense);
 		}
 	    } else {
 		for (unsigned c = prev_label + 1; c < (unsigned)label; c++) {
-		    exist_in_node = SuRFBuilder::readBit(builder_->getBitmapLabels()[level], node_num * kFanout + c);
+		    exist_in_node = builder_->getBitmapLabels().readBit(level, node_num * kFanout + c);
 		    ASSERT_FALSE(exist_in_node);
-		    has_child_dense = SuRFBuilder::readBit(builder_->getBitmapChildIndicatorBits()[level], node_num * kFanout + c);
+		    has_child_dense = builder_->getBitmapChildIndicatorBits().readBit(level, node_num * kFanout + c);
 		    ASSERT_FALSE(has_child_dense);
 		}
 	    }
@@ -381,6 +386,166 @@ TEST_F (SuRFBuilderUnitTest, buildDenseIntTest) {
     }
 }
 
+static void testSameBuild(const SuRFBuilder& expected, const SuRFBuilder& actual) {
+    ASSERT_EQ(expected.getSparseStartLevel(), actual.getSparseStartLevel());
+    ASSERT_TRUE(expected.getBitmapLabels() == actual.getBitmapLabels());
+    ASSERT_TRUE(expected.getBitmapChildIndicatorBits() == actual.getBitmapChildIndicatorBits());
+    ASSERT_TRUE(expected.getPrefixkeyIndicatorBits() == actual.getPrefixkeyIndicatorBits());
+    ASSERT_TRUE(expected.getLabels() == actual.getLabels());
+    ASSERT_TRUE(expected.getChildIndicatorBits() == actual.getChildIndicatorBits());
+    ASSERT_TRUE(expected.getLoudsBits() == actual.getLoudsBits());
+    ASSERT_TRUE(expected.getSuffixes() == actual.getSuffixes());
+    ASSERT_TRUE(expected.getSuffixCounts() == actual.getSuffixCounts());
+    ASSERT_TRUE(expected.getNodeCounts() == actual.getNodeCounts());
+}
+
+TEST_F (SuRFBuilderUnitTest, buildParallelTest) {
+    const std::vector<std::string>* key_lists[3] = {&words, &words_dup, &ints_};
+    unsigned thread_counts[3] = {2, 3, 8};
+    for (int k = 0; k < 3; k++) {
+	for (int t = 0; t < kNumSuffixConfigs; t++) {
+	    SuRFBuilder serial(kIncludeDense, kSparseDenseRatio, kSuffixTypes[t],
+			       kHashSuffixLens[t], kRealSuffixLens[t]);
+	    serial.build(*key_lists[k]);
+	    for (int n = 0; n < 3; n++) {
+		SuRFBuilder parallel(kIncludeDense, kSparseDenseRatio, kSuffixTypes[t],
+				     kHashSuffixLens[t], kRealSuffixLens[t]);
+		parallel.build(*key_lists[k], thread_counts[n]);
+		testSameBuild(serial, parallel);
+	    }
+	}
+    }
+}
+
+TEST_F (SuRFBuilderUnitTest, buildStreamingTest) {
+    const std::vector<std::string>* key_lists[3] = {&words, &words_dup, &ints_};
+    for (int k = 0; k < 3; k++) {
+	const std::vector<std::string>& keys = *key_lists[k];
+	for (int t = 0; t < kNumSuffixConfigs; t++) {
+	    SuRFBuilder batch(kIncludeDense, kSparseDenseRatio, kSuffixTypes[t],
+			      kHashSuffixLens[t], kRealSuffixLens[t]);
+	    batch.build(keys);
+	    SuRFBuilder streaming(kIncludeDense, kSparseDenseRatio, kSuffixTypes[t],
+				  kHashSuffixLens[t], kRealSuffixLens[t]);
+	    for (unsigned i = 0; i < keys.size(); i++)
+		ASSERT_TRUE(streaming.add(keys[i].data(), keys[i].length()));
+	    ASSERT_TRUE(streaming.finish());
+	    testSameBuild(batch, streaming);
+
+	    // a size hint only changes the reserved room
+	    SuRFBuilder hinted(kIncludeDense, kSparseDenseRatio, kSuffixTypes[t],
+			       kHashSuffixLens[t], kRealSuffixLens[t]);
+	    hinted.setExpectedNumKeys(keys.size());
+	    for (unsigned i = 0; i < keys.size(); i++)
+		hinted.add(keys[i].data(), keys[i].length());
+	    hinted.finish();
+	    testSameBuild(batch, hinted);
+	}
+    }
+}
+
+// A key that sorts before its predecessor is dropped, and finish
+// reports it
+TEST_F (SuRFBuilderUnitTest, buildUnsortedStreamTest) {
+    const std::vector<std::string>* key_lists[2] = {&words, &ints_};
+    for (int k = 0; k < 2; k++) {
+	const std::vector<std::string>& keys = *key_lists[k];
+	SuRFBuilder batch(kIncludeDense, kSparseDenseRatio, kReal, 0, 8);
+	batch.build(keys);
+	SuRFBuilder streaming(kIncludeDense, kSparseDenseRatio, kReal, 0, 8);
+	for (unsigned i = 0; i < keys.size(); i++) {
+	    ASSERT_TRUE(streaming.add(keys[i].data(), keys[i].length()));
+	    if (i == keys.size() / 2) {
+		const std::string& earlier = keys[i / 2];
+		ASSERT_FALSE(streaming.add(earlier.data(), earlier.length()));
+	    }
+	}
+	ASSERT_FALSE(streaming.finish());
+	testSameBuild(batch, streaming);
+    }
+}
+
+// build picks the cutoff from the counted level sizes, lays the
+// LOUDS-Sparse levels of every component out in one array of their
+// final size up front, and fills each level exactly; so does a
+// parallel build
+TEST_F (SuRFBuilderUnitTest, buildExactSizeTest) {
+    const std::vector<std::string>* key_lists[3] = {&words, &words_dup, &ints_};
+    for (int k = 0; k < 3; k++) {
+	for (int t = 0; t < kNumSuffixConfigs; t++) {
+	    for (unsigned num_threads = 1; num_threads <= 4; num_threads += 3) {
+		SuRFBuilder builder(kIncludeDense, kSparseDenseRatio, kSuffixTypes[t],
+				    kHashSuffixLens[t], kRealSuffixLens[t]);
+		builder.build(*key_lists[k], num_threads);
+		ASSERT_TRUE(builder.getLabels().isFull());
+		ASSERT_TRUE(builder.getChildIndicatorBits().isFull());
+		ASSERT_TRUE(builder.getLoudsBits().isFull());
+		ASSERT_TRUE(builder.getSuffixes().isFull());
+		ASSERT_TRUE(builder.getBitmapLabels().isFull());
+		ASSERT_TRUE(builder.getBitmapChildIndicatorBits().isFull());
+		ASSERT_TRUE(builder.getPrefixkeyIndicatorBits().isFull());
+	    }
+	}
+    }
+}
+
+TEST_F (SuRFBuilderUnitTest, cutoffCostModelTest) {
+    const std::vector<std::string>* key_lists[2] = {&words, &ints_};
+    for (int k = 0; k < 2; k++) {
+	SuRFBuilder ratio_builder(kIncludeDense, kSparseDenseRatio, kReal, 0, 8);
+	ratio_builder.build(*key_lists[k]);
+	level_t height = ratio_builder.getTreeHeight();
+
+	// a free layout takes every level it may; the root stays dense
+	CutoffCostModel model;
+	model.dense_miss_ns = 0;
+	model.sparse_miss_ns = 0;
+	model.dense_level_ns = 0;
+	SuRFBuilder dense_builder(kIncludeDense, kSparseDenseRatio, kReal, 0, 8);
+	dense_builder.setCutoffCostModel(model);
+	dense_builder.build(*key_lists[k]);
+	ASSERT_EQ(dense_builder.modeledLookupCost(height, model),
+		  dense_builder.modeledLookupCost(dense_builder.getSparseStartLevel(), model));
+	model.dense_level_ns = 100;
+	SuRFBuilder sparse_builder(kIncludeDense, kSparseDenseRatio, kReal, 0, 8);
+	sparse_builder.setCutoffCostModel(model);
+	sparse_builder.build(*key_lists[k]);
+	ASSERT_EQ(1u, sparse_builder.getSparseStartLevel());
+
+	// the cheapest level that fits the budget
+	model = CutoffCostModel();
+	level_t budget_level = ratio_builder.getSparseStartLevel();
+	model.memory_budget = ratio_builder.modeledMemory(budget_level);
+	SuRFBuilder builder(kIncludeDense, kSparseDenseRatio, kReal, 0, 8);
+	builder.setCutoffCostModel(model);
+	builder.build(*key_lists[k]);
+	level_t start_level = builder.getSparseStartLevel();
+	ASSERT_TRUE(builder.modeledMemory(start_level) <= model.memory_budget);
+	// the counted level sizes pick the same level as the built ones
+	SuRFBuilder streaming(kIncludeDense, kSparseDenseRatio, kReal, 0, 8);
+	streaming.setCutoffCostModel(model);
+	for (unsigned i = 0; i < key_lists[k]->size(); i++)
+	    streaming.add((*key_lists[k])[i].data(), (*key_lists[k])[i].length());
+	streaming.finish();
+	ASSERT_EQ(start_level, streaming.getSparseStartLevel());
+	for (level_t level = 1; level <= height; level++) {
+	    if (builder.modeledMemory(level) <= model.memory_budget) {
+		ASSERT_TRUE(builder.modeledLookupCost(start_level, model)
+			    <= builder.modeledLookupCost(level, model));
+	    }
+	}
+	// nothing fits: the smallest
+	model.memory_budget = 1;
+	SuRFBuilder small_builder(kIncludeDense, kSparseDenseRatio, kReal, 0, 8);
+	small_builder.setCutoffCostModel(model);
+	small_builder.build(*key_lists[k]);
+	start_level = small_builder.getSparseStartLevel();
+	for (level_t level = 1; level <= height; level++)
+	    ASSERT_TRUE(small_builder.modeledMemory(start_level)
+			<= small_builder.modeledMemory(level));
+    }
+}
+
 void loadWordList() {
     std::ifstream infile(kFilePath);
     std::string key;
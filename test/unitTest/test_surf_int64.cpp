@@ -0,0 +1,189 @@
+#include "gtest/gtest.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "config.hpp"
+#include "surf.hpp"
+#include "surf_int64.hpp"
+
+namespace surf {
+
+namespace surfint64test {
+
+static const uint64_t kNumKeys = 100000;
+static const uint64_t kNumProbes = 200000;
+static const int kNumSuffixType = 4;
+static const SuffixType kSuffixTypeList[kNumSuffixType] = {kNone, kHash, kReal, kMixed};
+static const int kNumSuffixLen = 3;
+static const level_t kSuffixLenList[kNumSuffixLen] = {3, 8, 13};
+
+class SuRFInt64UnitTest : public ::testing::Test {
+public:
+    virtual void SetUp () {
+	// random keys plus a dense run, so the trie has both
+	// 256-fanout and sparse nodes
+	std::mt19937_64 rng(2018);
+	for (uint64_t i = 0; i < kNumKeys; i++)
+	    keys_.push_back(rng());
+	for (uint64_t i = 0; i < kNumKeys; i += 3)
+	    keys_.push_back(0x1000000 + i);
+	std::sort(keys_.begin(), keys_.end());
+	keys_.erase(std::unique(keys_.begin(), keys_.end()), keys_.end());
+	for (uint64_t i = 0; i < keys_.size(); i++)
+	    str_keys_.push_back(uint64ToString(keys_[i]));
+
+	for (uint64_t i = 0; i < kNumProbes; i++) {
+	    if (i % 2 == 0)
+		probes_.push_back(rng());
+	    else
+		probes_.push_back(0x1000000 + (rng() % kNumKeys));
+	}
+    }
+    virtual void TearDown () {}
+
+    std::vector<uint64_t> keys_;
+    std::vector<std::string> str_keys_;
+    std::vector<uint64_t> probes_;
+};
+
+// SuRFInt64 must answer exactly like a SuRF built from uint64ToString keys
+TEST_F (SuRFInt64UnitTest, lookupKeyTest) {
+    SuffixHashType hash_types[2] = {kSuffixHashLevelDB, kSuffixHash64};
+    for (int t = 0; t < kNumSuffixType; t++) {
+	for (int k = 0; k < kNumSuffixLen; k++) {
+	    for (int h = 0; h < 2; h++) {
+		level_t hash_len = (kSuffixTypeList[t] == kHash || kSuffixTypeList[t] == kMixed)
+		    ? kSuffixLenList[k] : 0;
+		level_t real_len = (kSuffixTypeList[t] == kReal || kSuffixTypeList[t] == kMixed)
+		    ? kSuffixLenList[k] : 0;
+		SuRFInt64 surf_int(keys_, kSuffixTypeList[t], hash_len, real_len, hash_types[h]);
+		SuRF surf(str_keys_, kIncludeDense, kSparseDenseRatio, kSuffixTypeList[t],
+			  hash_len, real_len, 1, kRankBasic, kSelectSampleInterval, hash_types[h]);
+		ASSERT_TRUE(surf_int.getSuRF().getHeight() <= SuRFInt64::kKeyLen + 1);
+		for (uint64_t i = 0; i < keys_.size(); i++)
+		    ASSERT_TRUE(surf_int.lookupKey(keys_[i]));
+		for (uint64_t i = 0; i < probes_.size(); i++)
+		    ASSERT_EQ(surf.lookupKey(uint64ToString(probes_[i])),
+			      surf_int.lookupKey(probes_[i]));
+		surf_int.destroy();
+		surf.destroy();
+	    }
+	}
+    }
+}
+
+TEST_F (SuRFInt64UnitTest, lookupRangeTest) {
+    SuRFInt64 surf_int(keys_, kReal, 0, 8);
+    SuRF surf(str_keys_, kIncludeDense, kSparseDenseRatio, kReal, 0, 8);
+    for (uint64_t i = 0; i + 1 < probes_.size(); i += 2) {
+	uint64_t left = std::min(probes_[i], probes_[i + 1]);
+	uint64_t right = std::max(probes_[i], probes_[i + 1]);
+	if (i % 4 == 0)
+	    right = left + (right - left) / 1000000;
+	ASSERT_EQ(surf.lookupRange(uint64ToString(left), true, uint64ToString(right), false),
+		  surf_int.lookupRange(left, true, right, false));
+    }
+    for (uint64_t i = 0; i < keys_.size(); i++)
+	ASSERT_TRUE(surf_int.lookupRange(keys_[i], true, keys_[i], true));
+    surf_int.destroy();
+    surf.destroy();
+}
+
+TEST_F (SuRFInt64UnitTest, serializeTest) {
+    SuRFInt64 ori_surf_int(keys_, kMixed, 4, 4);
+    char* data = ori_surf_int.serialize();
+    SuRFInt64* surf_int = SuRFInt64::deSerialize(data);
+    ASSERT_TRUE(surf_int != nullptr);
+    ASSERT_TRUE(SuRFInt64::deSerialize(data, ori_surf_int.serializedSize() - 8) == nullptr);
+    for (uint64_t i = 0; i < probes_.size(); i++)
+	ASSERT_EQ(ori_surf_int.lookupKey(probes_[i]), surf_int->lookupKey(probes_[i]));
+
+    SuRFInt64 view;
+    ASSERT_TRUE(view.loadView(data, ori_surf_int.serializedSize(), true));
+    for (uint64_t i = 0; i < keys_.size(); i++)
+	ASSERT_TRUE(view.lookupKey(keys_[i]));
+
+    ori_surf_int.destroy();
+    delete surf_int;
+    delete[] data;
+
+    // an all-sparse image: the walk starts at the louds-sparse root
+    SuRF sparse(str_keys_, false, kSparseDenseRatio, kReal, 0, 8);
+    ASSERT_EQ(0u, sparse.getSparseStartLevel());
+    data = sparse.serialize();
+    surf_int = SuRFInt64::deSerialize(data);
+    ASSERT_TRUE(surf_int != nullptr);
+    for (uint64_t i = 0; i < keys_.size(); i++)
+	ASSERT_TRUE(surf_int->lookupKey(keys_[i]));
+    for (uint64_t i = 0; i < probes_.size(); i++)
+	ASSERT_EQ(sparse.lookupKey(uint64ToString(probes_[i])), surf_int->lookupKey(probes_[i]));
+    sparse.destroy();
+    delete surf_int;
+    delete[] data;
+}
+
+// Images where a 7-byte key is a prefix of 8-byte keys hold a dense
+// prefix key or a sparse terminator; lookupKey(uint64_t) would miss
+// the 8-byte keys, so loading them must fail.
+TEST_F (SuRFInt64UnitTest, rejectPrefixKeyImageTest) {
+    std::vector<std::string> keys;
+    keys.push_back(str_keys_[0].substr(0, SuRFInt64::kKeyLen - 1));
+    for (uint64_t i = 0; i < 2000; i++)
+	keys.push_back(str_keys_[i]);
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    bool include_dense_list[2] = {true, false};
+    for (int d = 0; d < 2; d++) {
+	SuRF surf(keys, include_dense_list[d], 0, kHash, 8, 0);
+	char* data = surf.serialize();
+	SuRFInt64 view;
+	ASSERT_FALSE(view.loadView(data, surf.serializedSize()));
+	ASSERT_TRUE(SuRFInt64::deSerialize(data) == nullptr);
+	ASSERT_TRUE(SuRFInt64::deSerialize(data, surf.serializedSize()) == nullptr);
+	surf.destroy();
+	delete[] data;
+    }
+}
+
+// The image header records that every key is 8 bytes long; an image
+// without the flag, e.g. from before it was written, is only a SuRF.
+TEST_F (SuRFInt64UnitTest, uint64KeysFlagTest) {
+    SuRFInt64 surf_int(keys_, kReal, 0, 8);
+    char* data = surf_int.serialize();
+    SectionTable table;
+    ASSERT_TRUE(table.load(data, surf_int.serializedSize()));
+    ASSERT_EQ(kFormatFlagUint64Keys, table.getFlags());
+
+    FormatHeader header;
+    memcpy(&header, data, sizeof(header));
+    header.flags = 0;
+    header.header_crc = 0;
+    memcpy(data, &header, sizeof(header));
+    header.header_crc = crc32c(data, formatHeaderSize(header.num_sections));
+    memcpy(data, &header, sizeof(header));
+    SuRF* surf = SuRF::deSerialize(data, surf_int.serializedSize());
+    ASSERT_TRUE(surf != nullptr);
+    ASSERT_TRUE(surf->lookupKey(str_keys_[0]));
+    delete surf;
+    SuRFInt64 view;
+    ASSERT_FALSE(view.loadView(data, surf_int.serializedSize()));
+    ASSERT_TRUE(SuRFInt64::deSerialize(data, surf_int.serializedSize()) == nullptr);
+
+    surf_int.destroy();
+    delete[] data;
+}
+
+} // namespace surfint64test
+
+} // namespace surf
+
+int main (int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}